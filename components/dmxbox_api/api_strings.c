@@ -1,5 +1,6 @@
 #include "api_strings.h"
 #include "cJSON.h"
+#include "serializer.h"
 #include <esp_log.h>
 #include <esp_mac.h>
 #include <esp_wifi_types.h>
@@ -103,3 +104,29 @@ bool dmxbox_api_optional_channel_from_json(
 
   return dmxbox_api_channel_from_json(json, c);
 }
+
+cJSON *dmxbox_api_show_time_to_json(const dmxbox_show_time_t *t) {
+  if (!t->set) {
+    return cJSON_CreateNull();
+  }
+
+  return cJSON_CreateNumber(t->ms);
+}
+
+bool dmxbox_api_show_time_from_json(const cJSON *json, dmxbox_show_time_t *t) {
+  if (cJSON_IsNull(json)) {
+    t->set = 0;
+    t->ms = 0;
+    return true;
+  }
+
+  uint32_t ms;
+  if (!dmxbox_u32_from_json(json, &ms)) {
+    ESP_LOGE(TAG, "show time is not a number of ms");
+    return false;
+  }
+
+  t->set = 1;
+  t->ms = ms;
+  return true;
+}
@@ -1,5 +1,6 @@
 #pragma once
 #include "dmxbox_storage.h"
+#include "show_time.h"
 #include <cJSON.h>
 #include <esp_wifi.h>
 #include <stdbool.h>
@@ -15,3 +16,6 @@ bool dmxbox_api_optional_channel_from_json(
     const cJSON *json,
     dmxbox_channel_t *c
 );
+
+cJSON *dmxbox_api_show_time_to_json(const dmxbox_show_time_t *t);
+bool dmxbox_api_show_time_from_json(const cJSON *json, dmxbox_show_time_t *t);
@@ -0,0 +1,323 @@
+#include "cues.h"
+#include "api_strings.h"
+#include "cJSON.h"
+#include "cue_storage.h"
+#include "dmxbox_cues.h"
+#include "dmxbox_httpd.h"
+#include "dmxbox_rest.h"
+#include "effects_steps.h"
+#include "esp_check.h"
+#include "esp_err.h"
+#include "serializer.h"
+#include <esp_log.h>
+#include <string.h>
+
+static const char TAG[] = "dmxbox_api_cue";
+
+static cJSON *cue_name_to_json(const char *name) {
+  return cJSON_CreateString(name);
+}
+
+static bool cue_name_from_json(const cJSON *json, char *name) {
+  const char *str = cJSON_GetStringValue(json);
+  if (!str) {
+    ESP_LOGE(TAG, "name is not a string");
+    return false;
+  }
+  size_t size = sizeof(((dmxbox_cue_t *)NULL)->name);
+  if (strlcpy(name, str, size) >= size) {
+    ESP_LOGE(TAG, "name is too long");
+    return false;
+  }
+  return true;
+}
+
+BEGIN_DMXBOX_API_SERIALIZER(dmxbox_cue_t, cue)
+DMXBOX_API_SERIALIZE_OPTIONAL_ITEM(
+    dmxbox_cue_t,
+    name,
+    cue_name_to_json,
+    cue_name_from_json
+)
+DMXBOX_API_SERIALIZE_U32(dmxbox_cue_t, fade_in)
+DMXBOX_API_SERIALIZE_U32(dmxbox_cue_t, fade_out)
+DMXBOX_API_SERIALIZE_U32(dmxbox_cue_t, delay)
+DMXBOX_API_SERIALIZE_U32(dmxbox_cue_t, follow)
+DMXBOX_API_SERIALIZE_OPTIONAL_ITEM(
+    dmxbox_cue_t,
+    time,
+    dmxbox_api_show_time_to_json,
+    dmxbox_api_show_time_from_json
+)
+DMXBOX_API_SERIALIZE_TRAILING_ARRAY(
+    dmxbox_cue_t,
+    channels,
+    channel_count,
+    dmxbox_channel_level_to_json,
+    dmxbox_channel_level_from_json
+)
+END_DMXBOX_API_SERIALIZER(dmxbox_cue_t, cue)
+
+static void reload_cues() {
+  // the edit is already saved, playback picks it up on the next reload
+  if (dmxbox_cues_reload() != ESP_OK) {
+    ESP_LOGE(TAG, "failed to reload cues");
+  }
+}
+
+static dmxbox_rest_result_t
+dmxbox_api_cue_post(httpd_req_t *req, uint16_t unused_parent_id, cJSON *json) {
+  ESP_LOGI(TAG, "POST cue");
+
+  dmxbox_cue_t *parsed = dmxbox_cue_from_json_alloc(json);
+  if (!parsed) {
+    ESP_LOGE(TAG, "failed to parse cue");
+    return dmxbox_rest_400_bad_request("failed to parse cue");
+  }
+
+  uint16_t id;
+  esp_err_t err = dmxbox_cue_create(parsed, &id);
+  free(parsed);
+
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "failed to create cue");
+    return dmxbox_rest_500_internal_server_error("failed to create cue");
+  }
+
+  reload_cues();
+  return dmxbox_rest_201_created("/api/cues/%u", id);
+}
+
+static dmxbox_rest_result_t dmxbox_api_cue_put(
+    httpd_req_t *req,
+    uint16_t unused_parent_id,
+    uint16_t cue_id,
+    cJSON *json
+) {
+  ESP_LOGI(TAG, "PUT cue=%u", cue_id);
+
+  dmxbox_cue_t *parsed = dmxbox_cue_from_json_alloc(json);
+  if (!parsed) {
+    ESP_LOGE(TAG, "failed to parse cue");
+    return dmxbox_rest_400_bad_request("failed to parse cue");
+  }
+
+  esp_err_t ret = dmxbox_cue_set(cue_id, parsed);
+  free(parsed);
+
+  if (ret != ESP_OK) {
+    ESP_LOGE(TAG, "failed to save cue");
+    return dmxbox_rest_500_internal_server_error("failed to save cue");
+  }
+
+  reload_cues();
+  return dmxbox_rest_204_no_content;
+}
+
+static dmxbox_rest_result_t
+dmxbox_api_cue_get(httpd_req_t *req, uint16_t unused, uint16_t cue_id) {
+  ESP_LOGI(TAG, "GET cue=%u", cue_id);
+
+  dmxbox_cue_t *cue = NULL;
+  esp_err_t ret = dmxbox_cue_get(cue_id, &cue);
+  switch (ret) {
+  case ESP_OK:
+    break;
+  case ESP_ERR_NOT_FOUND:
+    return dmxbox_rest_404_not_found("cue not found");
+  default:
+    return dmxbox_rest_500_internal_server_error(
+        "failed to get the cue from storage"
+    );
+  }
+
+  cJSON *json = dmxbox_cue_to_json(cue);
+  free(cue);
+
+  if (!json) {
+    ESP_LOGE(TAG, "failed to serialize json");
+    return dmxbox_rest_500_internal_server_error("failed to serialize json");
+  }
+
+  return dmxbox_rest_result_json(json);
+}
+
+static dmxbox_rest_result_t
+dmxbox_api_cue_delete(httpd_req_t *req, uint16_t unused, uint16_t cue_id) {
+  ESP_LOGI(TAG, "DELETE cue=%u", cue_id);
+
+  esp_err_t ret = dmxbox_cue_delete(cue_id);
+  switch (ret) {
+  case ESP_OK:
+    reload_cues();
+    return dmxbox_rest_200_ok;
+  case ESP_ERR_NOT_FOUND:
+    return dmxbox_rest_404_not_found("cue not found");
+  default:
+    return dmxbox_rest_500_internal_server_error(
+        "failed to delete the cue from storage"
+    );
+  }
+}
+
+static dmxbox_rest_result_t
+dmxbox_api_cue_list(httpd_req_t *req, uint16_t unused_parent_id) {
+  ESP_LOGI(TAG, "GET cues");
+
+  cJSON *array = cJSON_CreateArray();
+  if (!array) {
+    ESP_LOGE(TAG, "failed to allocate array");
+    return dmxbox_rest_500_internal_server_error("failed to allocate array");
+  }
+
+  dmxbox_storage_entry_t cues[30];
+  uint16_t count = sizeof(cues) / sizeof(cues[0]);
+  if (dmxbox_cue_list(0, &count, cues) != ESP_OK) {
+    ESP_LOGE(TAG, "failed to list cues");
+    cJSON_free(array);
+    return dmxbox_rest_500_internal_server_error("failed to list cues");
+  }
+
+  dmxbox_rest_result_t result;
+  for (size_t i = 0; i < count; i++) {
+    cJSON *json = dmxbox_cue_to_json(cues[i].data);
+    if (!json) {
+      ESP_LOGE(TAG, "failed to serialize cue %u", cues[i].id);
+      cJSON_free(array);
+      result = dmxbox_rest_500_internal_server_error("failed to serialize cue");
+      goto exit;
+    }
+    if (!cJSON_AddNumberToObject(json, "id", cues[i].id)) {
+      ESP_LOGE(TAG, "failed to add id for %u", cues[i].id);
+      cJSON_free(json);
+      cJSON_free(array);
+      result = dmxbox_rest_500_internal_server_error(
+          "failed to add id to cue object"
+      );
+      goto exit;
+    }
+    if (!cJSON_AddItemToArray(array, json)) {
+      ESP_LOGE(TAG, "failed to add cue %u to array", cues[i].id);
+      cJSON_free(json);
+      cJSON_free(array);
+      result =
+          dmxbox_rest_500_internal_server_error("failed to add cue to array");
+      goto exit;
+    }
+  }
+
+  result = dmxbox_rest_result_json(array);
+
+exit:
+  while (count--) {
+    free(cues[count].data);
+  }
+  return result;
+}
+
+const dmxbox_rest_container_t cues_router = {
+    .slug = "cues",
+    .get = dmxbox_api_cue_get,
+    .post = dmxbox_api_cue_post,
+    .put = dmxbox_api_cue_put,
+    .delete = dmxbox_api_cue_delete,
+    .list = dmxbox_api_cue_list,
+};
+
+static esp_err_t dmxbox_api_cue_stack_get(httpd_req_t *req) {
+  ESP_LOGI(TAG, "GET request for %s", req->uri);
+
+  dmxbox_httpd_cors_allow_origin(req);
+
+  dmxbox_cues_state_t state;
+  dmxbox_cues_get_state(&state);
+
+  esp_err_t ret = ESP_ERR_NO_MEM;
+  cJSON *json = cJSON_CreateObject();
+  if (!json) {
+    goto exit;
+  }
+
+  if (!cJSON_AddNumberToObject(json, "cue_id", state.cue_id)) {
+    goto exit;
+  }
+  if (!cJSON_AddNumberToObject(json, "cue_count", state.cue_count)) {
+    goto exit;
+  }
+  if (!cJSON_AddBoolToObject(json, "fading", state.fading)) {
+    goto exit;
+  }
+  if (!cJSON_AddNumberToObject(json, "fade_progress", state.fade_progress)) {
+    goto exit;
+  }
+  ret = dmxbox_httpd_send_json(req, json);
+exit:
+  if (json) {
+    cJSON_free(json);
+  }
+  return ret;
+}
+
+static esp_err_t send_no_content(httpd_req_t *req) {
+  ESP_RETURN_ON_ERROR(
+      httpd_resp_set_status(req, HTTPD_204),
+      TAG,
+      "failed to set status"
+  );
+  ESP_RETURN_ON_ERROR(
+      httpd_resp_send_chunk(req, NULL, 0),
+      TAG,
+      "failed to send empty chunk"
+  );
+  return ESP_OK;
+}
+
+static esp_err_t dmxbox_api_cue_stack_go(httpd_req_t *req) {
+  ESP_LOGI(TAG, "POST request for %s", req->uri);
+
+  dmxbox_httpd_cors_allow_origin(req);
+  dmxbox_cues_go();
+  return send_no_content(req);
+}
+
+static esp_err_t dmxbox_api_cue_stack_back(httpd_req_t *req) {
+  ESP_LOGI(TAG, "POST request for %s", req->uri);
+
+  dmxbox_httpd_cors_allow_origin(req);
+  dmxbox_cues_back();
+  return send_no_content(req);
+}
+
+esp_err_t dmxbox_api_cue_stack_register(httpd_handle_t server) {
+  static const httpd_uri_t state = {
+      .uri = "/api/cue-stack",
+      .method = HTTP_GET,
+      .handler = dmxbox_api_cue_stack_get,
+  };
+  static const httpd_uri_t go = {
+      .uri = "/api/cue-stack/go",
+      .method = HTTP_POST,
+      .handler = dmxbox_api_cue_stack_go,
+  };
+  static const httpd_uri_t back = {
+      .uri = "/api/cue-stack/back",
+      .method = HTTP_POST,
+      .handler = dmxbox_api_cue_stack_back,
+  };
+  ESP_RETURN_ON_ERROR(
+      httpd_register_uri_handler(server, &state),
+      TAG,
+      "cue-stack register failed"
+  );
+  ESP_RETURN_ON_ERROR(
+      httpd_register_uri_handler(server, &go),
+      TAG,
+      "cue-stack/go register failed"
+  );
+  ESP_RETURN_ON_ERROR(
+      httpd_register_uri_handler(server, &back),
+      TAG,
+      "cue-stack/back register failed"
+  );
+  return ESP_OK;
+}
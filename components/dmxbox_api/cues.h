@@ -0,0 +1,13 @@
+#pragma once
+#include <esp_err.h>
+#include <esp_http_server.h>
+
+#include "cue_storage.h"
+#include "dmxbox_rest.h"
+#include "serializer.h"
+
+DMXBOX_API_SERIALIZER_HEADERS(dmxbox_cue_t, cue);
+
+extern const dmxbox_rest_container_t cues_router;
+
+esp_err_t dmxbox_api_cue_stack_register(httpd_handle_t server);
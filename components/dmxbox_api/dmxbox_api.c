@@ -3,14 +3,19 @@
 
 #include "api_config.h"
 #include "artnet.h"
+#include "cues.h"
 #include "dmx.h"
 #include "dmxbox_api.h"
 #include "dmxbox_httpd.h"
 #include "dmxbox_rest.h"
 #include "effects.h"
+#include "metrics.h"
 #include "settings_artnet.h"
 #include "settings_sta.h"
+#include "show_transfer.h"
 #include "system.h"
+#include "tempo.h"
+#include "timecode.h"
 #include "ws.h"
 
 static const char TAG[] = "dmxbox_api";
@@ -53,6 +58,36 @@ esp_err_t dmxbox_api_register(httpd_handle_t server) {
       TAG,
       "effects register failed"
   );
+  ESP_RETURN_ON_ERROR(
+      dmxbox_rest_register(server, &cues_router),
+      TAG,
+      "cues register failed"
+  );
+  ESP_RETURN_ON_ERROR(
+      dmxbox_api_cue_stack_register(server),
+      TAG,
+      "cue-stack register failed"
+  );
+  ESP_RETURN_ON_ERROR(
+      dmxbox_api_tempo_register(server),
+      TAG,
+      "tempo register failed"
+  );
+  ESP_RETURN_ON_ERROR(
+      dmxbox_api_timecode_register(server),
+      TAG,
+      "timecode register failed"
+  );
+  ESP_RETURN_ON_ERROR(
+      dmxbox_api_metrics_register(server),
+      TAG,
+      "metrics register failed"
+  );
+  ESP_RETURN_ON_ERROR(
+      dmxbox_api_show_transfer_register(server),
+      TAG,
+      "show transfer register failed"
+  );
   ESP_RETURN_ON_ERROR(
       dmxbox_httpd_cors_register_options(server, "/api/*"),
       TAG,
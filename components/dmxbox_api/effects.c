@@ -11,9 +11,115 @@
 #include "serializer.h"
 #include <esp_log.h>
 #include <stdio.h>
+#include <string.h>
 
 static const char TAG[] = "dmxbox_api_effect";
 
+static const char *const effect_types[] = {
+    [dmxbox_effect_type_chase] = "chase",
+    [dmxbox_effect_type_waveform] = "waveform",
+};
+
+static const char *const effect_blends[dmxbox_effect_blend_count] = {
+    [dmxbox_effect_blend_htp] = "htp",
+    [dmxbox_effect_blend_ltp] = "ltp",
+    [dmxbox_effect_blend_add] = "add",
+    [dmxbox_effect_blend_multiply] = "multiply",
+};
+
+static const char *const waveform_shapes[dmxbox_waveform_shape_count] = {
+    [dmxbox_waveform_sine] = "sine",
+    [dmxbox_waveform_triangle] = "triangle",
+    [dmxbox_waveform_square] = "square",
+    [dmxbox_waveform_saw] = "saw",
+    [dmxbox_waveform_random] = "random",
+};
+
+static cJSON *
+enum_to_json(const char *const *names, size_t count, const uint8_t *value) {
+  if (*value >= count || !names[*value]) {
+    ESP_LOGE(TAG, "unknown enum value %u", *value);
+    return NULL;
+  }
+  return cJSON_CreateString(names[*value]);
+}
+
+static bool enum_from_json(
+    const char *const *names,
+    size_t count,
+    const cJSON *json,
+    uint8_t *value
+) {
+  const char *str = cJSON_GetStringValue(json);
+  if (!str) {
+    ESP_LOGE(TAG, "enum value is not a string");
+    return false;
+  }
+  for (size_t i = 0; i < count; i++) {
+    if (names[i] && !strcmp(names[i], str)) {
+      *value = i;
+      return true;
+    }
+  }
+  ESP_LOGE(TAG, "unknown enum value '%s'", str);
+  return false;
+}
+
+static cJSON *effect_type_to_json(const uint8_t *type) {
+  return enum_to_json(
+      effect_types,
+      sizeof(effect_types) / sizeof(effect_types[0]),
+      type
+  );
+}
+
+static bool effect_type_from_json(const cJSON *json, uint8_t *type) {
+  return enum_from_json(
+      effect_types,
+      sizeof(effect_types) / sizeof(effect_types[0]),
+      json,
+      type
+  );
+}
+
+static cJSON *effect_blend_to_json(const uint8_t *blend) {
+  return enum_to_json(effect_blends, dmxbox_effect_blend_count, blend);
+}
+
+static bool effect_blend_from_json(const cJSON *json, uint8_t *blend) {
+  return enum_from_json(effect_blends, dmxbox_effect_blend_count, json, blend);
+}
+
+static cJSON *effect_priority_to_json(const uint8_t *priority) {
+  return dmxbox_u8_to_json(*priority);
+}
+
+static cJSON *waveform_shape_to_json(const uint8_t *shape) {
+  return enum_to_json(waveform_shapes, dmxbox_waveform_shape_count, shape);
+}
+
+static bool waveform_shape_from_json(const cJSON *json, uint8_t *shape) {
+  return enum_from_json(
+      waveform_shapes,
+      dmxbox_waveform_shape_count,
+      json,
+      shape
+  );
+}
+
+BEGIN_DMXBOX_API_SERIALIZER(dmxbox_effect_waveform_t, effect_waveform)
+DMXBOX_API_SERIALIZE_ITEM(
+    dmxbox_effect_waveform_t,
+    shape,
+    waveform_shape_to_json,
+    waveform_shape_from_json
+)
+DMXBOX_API_SERIALIZE_U8(dmxbox_effect_waveform_t, size)
+DMXBOX_API_SERIALIZE_U8(dmxbox_effect_waveform_t, offset)
+DMXBOX_API_SERIALIZE_U16(dmxbox_effect_waveform_t, spread)
+DMXBOX_API_SERIALIZE_U32(dmxbox_effect_waveform_t, period)
+END_DMXBOX_API_SERIALIZER(dmxbox_effect_waveform_t, effect_waveform)
+
 BEGIN_DMXBOX_API_SERIALIZER(dmxbox_effect_t, effect)
 DMXBOX_API_SERIALIZE_ITEM(
     dmxbox_effect_t,
@@ -28,6 +134,48 @@ DMXBOX_API_SERIALIZE_ITEM(
     dmxbox_api_optional_channel_from_json
 )
 DMXBOX_API_SERIALIZE_U16(dmxbox_effect_t, distributed_id)
+DMXBOX_API_SERIALIZE_OPTIONAL_ITEM(
+    dmxbox_effect_t,
+    type,
+    effect_type_to_json,
+    effect_type_from_json
+)
+DMXBOX_API_SERIALIZE_OPTIONAL_ITEM(
+    dmxbox_effect_t,
+    waveform,
+    dmxbox_effect_waveform_to_json,
+    dmxbox_effect_waveform_from_json
+)
+DMXBOX_API_SERIALIZE_OPTIONAL_ITEM(
+    dmxbox_effect_t,
+    priority,
+    effect_priority_to_json,
+    dmxbox_u8_from_json
+)
+DMXBOX_API_SERIALIZE_OPTIONAL_ITEM(
+    dmxbox_effect_t,
+    blend,
+    effect_blend_to_json,
+    effect_blend_from_json
+)
+DMXBOX_API_SERIALIZE_OPTIONAL_ITEM(
+    dmxbox_effect_t,
+    beats,
+    dmxbox_u16_ptr_to_json,
+    dmxbox_u16_from_json
+)
+DMXBOX_API_SERIALIZE_OPTIONAL_ITEM(
+    dmxbox_effect_t,
+    start,
+    dmxbox_api_show_time_to_json,
+    dmxbox_api_show_time_from_json
+)
+DMXBOX_API_SERIALIZE_OPTIONAL_ITEM(
+    dmxbox_effect_t,
+    end,
+    dmxbox_api_show_time_to_json,
+    dmxbox_api_show_time_from_json
+)
 DMXBOX_API_SERIALIZE_TRAILING_ARRAY(
     dmxbox_effect_t,
     steps,
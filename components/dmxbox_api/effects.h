@@ -1,4 +1,8 @@
 #pragma once
 #include "dmxbox_rest.h"
+#include "effect_storage.h"
+#include "serializer.h"
+
+DMXBOX_API_SERIALIZER_HEADERS(dmxbox_effect_t, effect);
 
 extern const dmxbox_rest_container_t effects_router;
@@ -120,19 +120,25 @@ dmxbox_rest_result_t dmxbox_api_effect_step_batch_put(
 
   ESP_LOGI(TAG, "got %u steps", cJSON_GetArraySize(json));
 
+  // one transaction, so the show is only invalidated once for all steps
+  dmxbox_storage_begin();
+
+  dmxbox_rest_result_t result;
   cJSON *step_json;
   int i = 0;
   cJSON_ArrayForEach(step_json, json) {
     cJSON *step_id_json = cJSON_GetObjectItem(step_json, "id");
     if (!step_id_json) {
       ESP_LOGE(TAG, "step id is missing at position %d", i);
-      return dmxbox_rest_400_bad_request("step id is missing");
+      result = dmxbox_rest_400_bad_request("step id is missing");
+      goto exit;
     }
 
     uint16_t step_id;
     if (!dmxbox_u16_from_json(step_id_json, &step_id)) {
       ESP_LOGE(TAG, "failed parse step id at position %d", i);
-      return dmxbox_rest_400_bad_request("failed to parse step id");
+      result = dmxbox_rest_400_bad_request("failed to parse step id");
+      goto exit;
     }
 
     dmxbox_effect_step_t *parsed =
@@ -144,7 +150,8 @@ dmxbox_rest_result_t dmxbox_api_effect_step_batch_put(
           step_id,
           i
       );
-      return dmxbox_rest_400_bad_request("failed to parse effect step");
+      result = dmxbox_rest_400_bad_request("failed to parse effect step");
+      goto exit;
     }
 
     esp_err_t ret = dmxbox_effect_step_set(effect_id, step_id, parsed);
@@ -152,15 +159,25 @@ dmxbox_rest_result_t dmxbox_api_effect_step_batch_put(
 
     if (ret != ESP_OK) {
       ESP_LOGE(TAG, "failed to save effect step %u", step_id);
-      return dmxbox_rest_500_internal_server_error(
+      result = dmxbox_rest_500_internal_server_error(
           "failed to save effect step to storage"
       );
+      goto exit;
     }
 
     i++;
   }
 
+  if (dmxbox_storage_commit() != ESP_OK) {
+    return dmxbox_rest_500_internal_server_error(
+        "failed to commit effect steps to storage"
+    );
+  }
   return dmxbox_rest_204_no_content;
+
+exit:
+  dmxbox_storage_commit();
+  return result;
 }
 
 static dmxbox_rest_result_t dmxbox_api_effect_step_delete(
@@ -6,4 +6,5 @@
 #include "serializer.h"
 
 DMXBOX_API_SERIALIZER_HEADERS(dmxbox_channel_level_t, channel_level);
+DMXBOX_API_SERIALIZER_HEADERS(dmxbox_effect_step_t, effect_step);
 extern const dmxbox_rest_container_t effects_steps_router;
@@ -0,0 +1,352 @@
+#include <cJSON.h>
+#include <esp_check.h>
+#include <esp_err.h>
+#include <esp_http_server.h>
+
+#include "api_strings.h"
+#include "dmxbox_espnow.h"
+#include "dmxbox_httpd.h"
+#include "dmxbox_storage.h"
+#include "esp_log.h"
+#include "metrics.h"
+
+static const char TAG[] = "dmxbox_api_metrics";
+
+typedef struct counter {
+  const char *name;
+  double value;
+} counter_t;
+
+static bool
+add_counters(cJSON *json, const counter_t *counters, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    if (!cJSON_AddNumberToObject(json, counters[i].name, counters[i].value)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool add_buckets(
+    cJSON *json,
+    const char *name,
+    const uint32_t *buckets,
+    size_t count
+) {
+  cJSON *array = cJSON_AddArrayToObject(json, name);
+  if (!array) {
+    return false;
+  }
+  for (size_t i = 0; i < count; i++) {
+    cJSON *bucket = cJSON_CreateNumber(buckets[i]);
+    if (!bucket) {
+      return false;
+    }
+    if (!cJSON_AddItemToArray(array, bucket)) {
+      cJSON_Delete(bucket);
+      return false;
+    }
+  }
+  return true;
+}
+
+static cJSON *peer_to_json(const dmxbox_espnow_peer_stats_t *peer) {
+  cJSON *json = cJSON_CreateObject();
+  if (!json) {
+    goto fail;
+  }
+
+  cJSON *mac = dmxbox_mac_to_json(peer->mac);
+  if (!mac) {
+    goto fail;
+  }
+  if (!cJSON_AddItemToObject(json, "mac", mac)) {
+    cJSON_Delete(mac);
+    goto fail;
+  }
+
+  const counter_t counters[] = {
+      {"received", peer->received},
+      {"crc_failures", peer->crc_failures},
+      {"duplicates", peer->duplicates},
+      {"gaps", peer->gaps},
+  };
+  if (!add_counters(json, counters, sizeof(counters) / sizeof(counters[0]))) {
+    goto fail;
+  }
+
+  if (!add_buckets(
+          json,
+          "jitter",
+          peer->jitter,
+          DMXBOX_ESPNOW_JITTER_BUCKETS
+      )) {
+    goto fail;
+  }
+  return json;
+
+fail:
+  cJSON_Delete(json);
+  return NULL;
+}
+
+cJSON *dmxbox_api_espnow_metrics_to_json() {
+  dmxbox_espnow_stats_t *stats = malloc(sizeof(dmxbox_espnow_stats_t));
+  cJSON *json = NULL;
+  if (!stats) {
+    goto fail;
+  }
+  dmxbox_espnow_get_stats(stats);
+
+  json = cJSON_CreateObject();
+  if (!json) {
+    goto fail;
+  }
+
+  const counter_t counters[] = {
+      {"sent", stats->sent},
+      {"send_errors", stats->send_errors},
+      {"send_failures", stats->send_failures},
+      {"rejected", stats->rejected},
+      {"dropped", stats->dropped},
+  };
+  if (!add_counters(json, counters, sizeof(counters) / sizeof(counters[0]))) {
+    goto fail;
+  }
+
+  // in microseconds
+  cJSON *phase_error = cJSON_AddObjectToObject(json, "phase_error");
+  if (!phase_error) {
+    goto fail;
+  }
+  const counter_t phase_counters[] = {
+      {"samples", stats->phase_samples},
+      {"last", stats->phase_error_last_us},
+      {"average", stats->phase_error_average_us},
+      {"max", stats->phase_error_max_us},
+  };
+  if (!add_counters(
+          phase_error,
+          phase_counters,
+          sizeof(phase_counters) / sizeof(phase_counters[0])
+      )) {
+    goto fail;
+  }
+
+  cJSON *peers = cJSON_AddArrayToObject(json, "peers");
+  if (!peers) {
+    goto fail;
+  }
+  for (size_t i = 0; i < stats->peer_count; i++) {
+    cJSON *peer = peer_to_json(&stats->peers[i]);
+    if (!peer) {
+      goto fail;
+    }
+    if (!cJSON_AddItemToArray(peers, peer)) {
+      cJSON_Delete(peer);
+      goto fail;
+    }
+  }
+
+  free(stats);
+  return json;
+
+fail:
+  free(stats);
+  cJSON_Delete(json);
+  return NULL;
+}
+
+static const char *const storage_op_names[dmxbox_storage_op_count] = {
+    [dmxbox_storage_op_open] = "open",
+    [dmxbox_storage_op_get] = "get",
+    [dmxbox_storage_op_set] = "set",
+    [dmxbox_storage_op_commit] = "commit",
+    [dmxbox_storage_op_erase] = "erase",
+    [dmxbox_storage_op_iterate] = "iterate",
+};
+
+static bool add_storage_op(
+    cJSON *ops,
+    const char *name,
+    const dmxbox_storage_op_stats_t *op
+) {
+  cJSON *json = cJSON_AddObjectToObject(ops, name);
+  if (!json) {
+    return false;
+  }
+  // in microseconds
+  const counter_t counters[] = {
+      {"count", op->count},
+      {"errors", op->errors},
+      {"total_us", op->total_us},
+      {"max_us", op->max_us},
+  };
+  return add_counters(json, counters, sizeof(counters) / sizeof(counters[0])) &&
+         add_buckets(
+             json,
+             "latency",
+             op->latency,
+             DMXBOX_STORAGE_LATENCY_BUCKETS
+         );
+}
+
+cJSON *dmxbox_api_storage_metrics_to_json() {
+  dmxbox_storage_stats_t *stats = malloc(sizeof(dmxbox_storage_stats_t));
+  cJSON *json = NULL;
+  if (!stats) {
+    goto fail;
+  }
+  dmxbox_storage_get_stats(stats);
+  dmxbox_storage_cache_stats_t cache_stats;
+  dmxbox_storage_get_cache_stats(&cache_stats);
+
+  json = cJSON_CreateObject();
+  if (!json) {
+    goto fail;
+  }
+
+  const counter_t counters[] = {
+      {"uptime_s", stats->uptime_s},
+      {"bytes_read", stats->bytes_read},
+      {"bytes_written", stats->bytes_written},
+      {"entries_written", stats->entries_written},
+  };
+  if (!add_counters(json, counters, sizeof(counters) / sizeof(counters[0]))) {
+    goto fail;
+  }
+
+  cJSON *ops = cJSON_AddObjectToObject(json, "ops");
+  if (!ops) {
+    goto fail;
+  }
+  for (size_t i = 0; i < dmxbox_storage_op_count; i++) {
+    if (!add_storage_op(ops, storage_op_names[i], &stats->ops[i])) {
+      goto fail;
+    }
+  }
+
+  cJSON *nvs = cJSON_AddObjectToObject(json, "nvs");
+  if (!nvs) {
+    goto fail;
+  }
+  const counter_t nvs_counters[] = {
+      {"used_entries", stats->used_entries},
+      {"free_entries", stats->free_entries},
+      {"total_entries", stats->total_entries},
+      {"namespace_count", stats->namespace_count},
+  };
+  if (!add_counters(
+          nvs,
+          nvs_counters,
+          sizeof(nvs_counters) / sizeof(nvs_counters[0])
+      )) {
+    goto fail;
+  }
+
+  cJSON *wear = cJSON_AddObjectToObject(json, "wear");
+  if (!wear) {
+    goto fail;
+  }
+  const counter_t wear_counters[] = {
+      {"estimated_page_erases", stats->estimated_page_erases},
+      {"erases_per_page_per_year", stats->erases_per_page_per_year},
+  };
+  if (!add_counters(
+          wear,
+          wear_counters,
+          sizeof(wear_counters) / sizeof(wear_counters[0])
+      )) {
+    goto fail;
+  }
+  // null until there's something to extrapolate from
+  if (!(stats->projected_lifetime_years < 0
+            ? cJSON_AddNullToObject(wear, "projected_lifetime_years")
+            : cJSON_AddNumberToObject(
+                  wear,
+                  "projected_lifetime_years",
+                  stats->projected_lifetime_years
+              ))) {
+    goto fail;
+  }
+
+  cJSON *cache = cJSON_AddObjectToObject(json, "cache");
+  if (!cache) {
+    goto fail;
+  }
+  const counter_t cache_counters[] = {
+      {"hits", cache_stats.hits},
+      {"misses", cache_stats.misses},
+      {"evictions", cache_stats.evictions},
+      {"entries", cache_stats.entries},
+      {"bytes", cache_stats.bytes},
+      {"capacity_bytes", cache_stats.capacity_bytes},
+  };
+  if (!add_counters(
+          cache,
+          cache_counters,
+          sizeof(cache_counters) / sizeof(cache_counters[0])
+      )) {
+    goto fail;
+  }
+
+  free(stats);
+  return json;
+
+fail:
+  free(stats);
+  cJSON_Delete(json);
+  return NULL;
+}
+
+static esp_err_t dmxbox_api_metrics_espnow_get(httpd_req_t *req) {
+  ESP_LOGI(TAG, "GET request for %s", req->uri);
+
+  dmxbox_httpd_cors_allow_origin(req);
+
+  cJSON *json = dmxbox_api_espnow_metrics_to_json();
+  if (!json) {
+    return ESP_ERR_NO_MEM;
+  }
+  esp_err_t ret = dmxbox_httpd_send_json(req, json);
+  cJSON_Delete(json);
+  return ret;
+}
+
+static esp_err_t dmxbox_api_metrics_storage_get(httpd_req_t *req) {
+  ESP_LOGI(TAG, "GET request for %s", req->uri);
+
+  dmxbox_httpd_cors_allow_origin(req);
+
+  cJSON *json = dmxbox_api_storage_metrics_to_json();
+  if (!json) {
+    return ESP_ERR_NO_MEM;
+  }
+  esp_err_t ret = dmxbox_httpd_send_json(req, json);
+  cJSON_Delete(json);
+  return ret;
+}
+
+esp_err_t dmxbox_api_metrics_register(httpd_handle_t server) {
+  static const httpd_uri_t get = {
+      .uri = "/api/metrics/espnow",
+      .method = HTTP_GET,
+      .handler = dmxbox_api_metrics_espnow_get,
+  };
+  static const httpd_uri_t get_storage = {
+      .uri = "/api/metrics/storage",
+      .method = HTTP_GET,
+      .handler = dmxbox_api_metrics_storage_get,
+  };
+  ESP_RETURN_ON_ERROR(
+      httpd_register_uri_handler(server, &get),
+      TAG,
+      "metrics register failed"
+  );
+  ESP_RETURN_ON_ERROR(
+      httpd_register_uri_handler(server, &get_storage),
+      TAG,
+      "storage metrics register failed"
+  );
+  return ESP_OK;
+}
@@ -0,0 +1,12 @@
+#pragma once
+#include <cJSON.h>
+#include <esp_err.h>
+#include <esp_http_server.h>
+
+// ESP-NOW sync statistics, also streamed over the websocket
+cJSON *dmxbox_api_espnow_metrics_to_json();
+
+// NVS latencies, bytes, usage and projected wear, plus the blob cache
+cJSON *dmxbox_api_storage_metrics_to_json();
+
+esp_err_t dmxbox_api_metrics_register(httpd_handle_t server);
@@ -233,6 +233,18 @@ bool dmxbox_deserialize_item(
   return func(item, ptr);
 }
 
+bool dmxbox_deserialize_optional_item(
+    const dmxbox_serializer_entry_t *entry,
+    const cJSON *json,
+    void *object
+) {
+  if (!cJSON_GetObjectItemCaseSensitive(json, entry->json_name)) {
+    DESERIALIZE_LOGI(entry, "optional item missing");
+    return true;
+  }
+  return dmxbox_deserialize_item(entry, json, object);
+}
+
 cJSON *dmxbox_serialize_trailing_array(
     const dmxbox_serializer_entry_t *entry,
     const void *object
@@ -102,6 +102,12 @@ bool dmxbox_deserialize_item(
     void *object
 );
 
+bool dmxbox_deserialize_optional_item(
+    const dmxbox_serializer_entry_t *entry,
+    const cJSON *json,
+    void *object
+);
+
 bool dmxbox_deserialize_trailing_array(
     const dmxbox_serializer_entry_t *entry,
     const cJSON *json,
@@ -143,6 +149,21 @@ bool dmxbox_deserialize_trailing_array(
    .parent_size = sizeof(type),                                                \
    .offset = offsetof(type, name)},
 
+// like DMXBOX_API_SERIALIZE_ITEM, but the field keeps its current value when
+// it's missing from the json
+#define DMXBOX_API_SERIALIZE_OPTIONAL_ITEM(                                    \
+    type,                                                                      \
+    name,                                                                      \
+    to_json_fn,                                                                \
+    from_json_fn                                                               \
+)                                                                              \
+  {.serialize = dmxbox_serialize_item,                                         \
+   .deserialize = dmxbox_deserialize_optional_item,                            \
+   .context = {to_json_fn, from_json_fn},                                      \
+   .json_name = #name,                                                         \
+   .parent_size = sizeof(type),                                                \
+   .offset = offsetof(type, name)},
+
 // count field must be a size_t
 #define DMXBOX_API_SERIALIZE_TRAILING_ARRAY(                                   \
     type,                                                                      \
@@ -4,6 +4,7 @@
 #include <esp_http_server.h>
 
 #include "api_strings.h"
+#include "dmxbox_const.h"
 #include "dmxbox_httpd.h"
 #include "settings_artnet.h"
 
@@ -11,73 +12,135 @@ static const char TAG[] = "dmxbox_api_settings_artnet";
 
 static const char field_native_universe[] = "native_universe";
 static const char field_effect_control_universe[] = "effect_control_universe";
+static const char field_cue_go_channel[] = "cue_go_channel";
+static const char field_cue_back_channel[] = "cue_back_channel";
+static const char field_tempo_tap_channel[] = "tempo_tap_channel";
 
-static esp_err_t dmxbox_api_settings_artnet_get(httpd_req_t *req) {
-  ESP_LOGI(TAG, "GET request for %s", req->uri);
-
-  dmxbox_httpd_cors_allow_origin(req);
-
-  esp_err_t ret = ESP_ERR_NO_MEM;
+cJSON *dmxbox_api_settings_artnet_to_json() {
   cJSON *json = cJSON_CreateObject();
   if (!json) {
-    goto exit;
+    return NULL;
   }
 
-  uint16_t native_universe = dmxbox_get_native_universe();
-  uint16_t effect_control_universe = dmxbox_get_effect_control_universe();
-  if (!cJSON_AddNumberToObject(json, field_native_universe, native_universe)) {
-    goto exit;
-  }
   if (!cJSON_AddNumberToObject(
+          json,
+          field_native_universe,
+          dmxbox_get_native_universe()
+      ) ||
+      !cJSON_AddNumberToObject(
           json,
           field_effect_control_universe,
-          effect_control_universe
+          dmxbox_get_effect_control_universe()
+      ) ||
+      !cJSON_AddNumberToObject(
+          json,
+          field_cue_go_channel,
+          dmxbox_get_cue_go_channel()
+      ) ||
+      !cJSON_AddNumberToObject(
+          json,
+          field_cue_back_channel,
+          dmxbox_get_cue_back_channel()
+      ) ||
+      !cJSON_AddNumberToObject(
+          json,
+          field_tempo_tap_channel,
+          dmxbox_get_tempo_tap_channel()
       )) {
-    goto exit;
+    cJSON_Delete(json);
+    return NULL;
   }
-  ret = dmxbox_httpd_send_json(req, json);
-exit:
-  if (json) {
-    cJSON_free(json);
-  }
-  return ret;
+  return json;
 }
 
-static esp_err_t dmxbox_api_settings_artnet_put(httpd_req_t *req) {
-  ESP_LOGI(TAG, "PUT request for %s", req->uri);
+static esp_err_t dmxbox_api_settings_artnet_get(httpd_req_t *req) {
+  ESP_LOGI(TAG, "GET request for %s", req->uri);
 
   dmxbox_httpd_cors_allow_origin(req);
 
-  esp_err_t ret = ESP_OK;
-  const char *http_status = HTTPD_400;
-  cJSON *json = NULL;
+  cJSON *json = dmxbox_api_settings_artnet_to_json();
+  if (!json) {
+    return ESP_ERR_NO_MEM;
+  }
+  esp_err_t ret = dmxbox_httpd_send_json(req, json);
+  cJSON_free(json);
+  return ret;
+}
 
-  ESP_RETURN_ON_ERROR(
-      dmxbox_httpd_receive_json(req, &json),
-      TAG,
-      "failed to receive json"
-  );
+static bool is_valid_channel(const cJSON *json) {
+  return cJSON_IsNumber(json) && json->valueint >= 0 &&
+         json->valueint <= DMX_CHANNEL_COUNT;
+}
 
+bool dmxbox_api_settings_artnet_from_json(const cJSON *json) {
   cJSON *native_universe =
       cJSON_GetObjectItemCaseSensitive(json, field_native_universe);
   if (!native_universe || !cJSON_IsNumber(native_universe)) {
     ESP_LOGE(TAG, "native_universe missing or not a number");
-    goto send;
+    return false;
   }
 
   cJSON *effect_control_universe =
       cJSON_GetObjectItemCaseSensitive(json, field_effect_control_universe);
   if (!effect_control_universe || !cJSON_IsNumber(effect_control_universe)) {
     ESP_LOGE(TAG, "effect_control_universe missing or not a number");
-    goto send;
+    return false;
+  }
+
+  // cue and tempo controls are optional, 0 disables them
+  cJSON *cue_go_channel =
+      cJSON_GetObjectItemCaseSensitive(json, field_cue_go_channel);
+  if (cue_go_channel && !is_valid_channel(cue_go_channel)) {
+    ESP_LOGE(TAG, "cue_go_channel is not a valid channel");
+    return false;
+  }
+
+  cJSON *cue_back_channel =
+      cJSON_GetObjectItemCaseSensitive(json, field_cue_back_channel);
+  if (cue_back_channel && !is_valid_channel(cue_back_channel)) {
+    ESP_LOGE(TAG, "cue_back_channel is not a valid channel");
+    return false;
+  }
+
+  cJSON *tempo_tap_channel =
+      cJSON_GetObjectItemCaseSensitive(json, field_tempo_tap_channel);
+  if (tempo_tap_channel && !is_valid_channel(tempo_tap_channel)) {
+    ESP_LOGE(TAG, "tempo_tap_channel is not a valid channel");
+    return false;
   }
 
   dmxbox_set_native_universe(native_universe->valueint);
   dmxbox_set_effect_control_universe(effect_control_universe->valueint);
+  if (cue_go_channel) {
+    dmxbox_set_cue_go_channel(cue_go_channel->valueint);
+  }
+  if (cue_back_channel) {
+    dmxbox_set_cue_back_channel(cue_back_channel->valueint);
+  }
+  if (tempo_tap_channel) {
+    dmxbox_set_tempo_tap_channel(tempo_tap_channel->valueint);
+  }
+  return true;
+}
+
+static esp_err_t dmxbox_api_settings_artnet_put(httpd_req_t *req) {
+  ESP_LOGI(TAG, "PUT request for %s", req->uri);
+
+  dmxbox_httpd_cors_allow_origin(req);
+
+  esp_err_t ret = ESP_OK;
+  const char *http_status = HTTPD_400;
+  cJSON *json = NULL;
 
-  http_status = HTTPD_204;
+  ESP_RETURN_ON_ERROR(
+      dmxbox_httpd_receive_json(req, &json),
+      TAG,
+      "failed to receive json"
+  );
 
-send:
+  if (dmxbox_api_settings_artnet_from_json(json)) {
+    http_status = HTTPD_204;
+  }
 
   ESP_GOTO_ON_ERROR(
       httpd_resp_set_status(req, http_status),
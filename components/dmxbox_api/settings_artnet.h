@@ -1,5 +1,12 @@
 #pragma once
+#include <cJSON.h>
 #include <esp_err.h>
+#include <stdbool.h>
 #include <esp_http_server.h>
 
 esp_err_t dmxbox_api_settings_artnet_register(httpd_handle_t server);
+
+// also used by the show export and import
+cJSON *dmxbox_api_settings_artnet_to_json();
+// validates and applies the settings
+bool dmxbox_api_settings_artnet_from_json(const cJSON *json);
@@ -0,0 +1,690 @@
+#include "show_transfer.h"
+#include "cJSON.h"
+#include "cues.h"
+#include "dmxbox_cues.h"
+#include "dmxbox_httpd.h"
+#include "dmxbox_storage.h"
+#include "effects.h"
+#include "effects_steps.h"
+#include "serializer.h"
+#include "settings_artnet.h"
+#include <esp_check.h>
+#include <esp_err.h>
+#include <esp_http_server.h>
+#include <esp_log.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char TAG[] = "dmxbox_api_show_transfer";
+
+// Everything is streamed one record at a time, so neither side ever holds
+// more than a page of records. Storage is only locked while a page is read or
+// written, never while waiting on the client. The document is a flat object:
+//   {"version": 1, "settings": {...}, "effects": [{"id": 1, ...}, ...],
+//    "steps": [{"effect_id": 1, "id": 1, ...}, ...], "cues": [...]}
+// Records have the same fields as in the REST API, plus their ids.
+
+#define SHOW_FORMAT_VERSION 1
+#define EXPORT_PAGE_SIZE 8
+#define IMPORT_BATCH_SIZE 8
+
+static const char field_version[] = "version";
+static const char field_settings[] = "settings";
+static const char field_effects[] = "effects";
+static const char field_steps[] = "steps";
+static const char field_cues[] = "cues";
+static const char field_effect_id[] = "effect_id";
+static const char field_id[] = "id";
+
+typedef cJSON *(*record_to_json_t)(const void *record);
+
+static cJSON *effect_to_json(const void *record) {
+  return dmxbox_effect_to_json(record);
+}
+
+static cJSON *effect_step_to_json(const void *record) {
+  return dmxbox_effect_step_to_json(record);
+}
+
+static cJSON *cue_to_json(const void *record) {
+  return dmxbox_cue_to_json(record);
+}
+
+static void free_page(dmxbox_storage_entry_t *page, uint16_t count) {
+  while (count--) {
+    free(page[count].data);
+  }
+}
+
+// sends the records of a page as array elements, effect_id is -1 for records
+// without a parent
+static esp_err_t send_page(
+    httpd_req_t *req,
+    const dmxbox_storage_entry_t *page,
+    uint16_t count,
+    record_to_json_t to_json,
+    int effect_id,
+    bool *first
+) {
+  for (uint16_t i = 0; i < count; i++) {
+    cJSON *json = to_json(page[i].data);
+    if (!json) {
+      ESP_LOGE(TAG, "failed to serialize record %u", page[i].id);
+      return ESP_ERR_NO_MEM;
+    }
+    bool added = (effect_id < 0 ||
+                  cJSON_AddNumberToObject(json, field_effect_id, effect_id)) &&
+                 cJSON_AddNumberToObject(json, field_id, page[i].id);
+    esp_err_t ret = ESP_ERR_NO_MEM;
+    if (added) {
+      ret = *first ? ESP_OK : httpd_resp_sendstr_chunk(req, ",");
+      if (ret == ESP_OK) {
+        ret = dmxbox_httpd_send_json_chunk(req, json);
+      }
+    }
+    cJSON_Delete(json);
+    ESP_RETURN_ON_ERROR(ret, TAG, "failed to send record %u", page[i].id);
+    *first = false;
+  }
+  return ESP_OK;
+}
+
+// Records are paged over by id and read one by one. Listing them in pages
+// of records would quietly leave out the ones that can't be read, and a
+// backup missing records replaces the whole show when it's imported.
+typedef esp_err_t (*list_ids_t)(
+    uint16_t parent_id,
+    uint16_t skip,
+    uint16_t *count,
+    dmxbox_storage_entry_t *page
+);
+typedef esp_err_t (*get_t)(uint16_t parent_id, uint16_t id, void **record);
+
+static esp_err_t list_effect_ids(
+    uint16_t parent_id,
+    uint16_t skip,
+    uint16_t *count,
+    dmxbox_storage_entry_t *page
+) {
+  return dmxbox_effect_list_ids(skip, count, page);
+}
+
+static esp_err_t list_cue_ids(
+    uint16_t parent_id,
+    uint16_t skip,
+    uint16_t *count,
+    dmxbox_storage_entry_t *page
+) {
+  return dmxbox_cue_list_ids(skip, count, page);
+}
+
+static esp_err_t get_effect(uint16_t parent_id, uint16_t id, void **record) {
+  return dmxbox_effect_get(id, (dmxbox_effect_t **)record);
+}
+
+static esp_err_t
+get_effect_step(uint16_t effect_id, uint16_t id, void **record) {
+  return dmxbox_effect_step_get(effect_id, id, (dmxbox_effect_step_t **)record);
+}
+
+static esp_err_t get_cue(uint16_t parent_id, uint16_t id, void **record) {
+  return dmxbox_cue_get(id, (dmxbox_cue_t **)record);
+}
+
+// reads a page in its own transaction, so that it's consistent with batched
+// REST writes without holding storage over the sends; a record that can't be
+// read fails the page
+static esp_err_t read_page(
+    list_ids_t list_ids,
+    get_t get,
+    uint16_t parent_id,
+    uint16_t skip,
+    uint16_t *count,
+    dmxbox_storage_entry_t *page
+) {
+  dmxbox_storage_begin();
+  esp_err_t ret = list_ids(parent_id, skip, count, page);
+  uint16_t read = 0;
+  while (ret == ESP_OK && read < *count) {
+    ret = get(parent_id, page[read].id, &page[read].data);
+    if (ret != ESP_OK) {
+      ESP_LOGE(
+          TAG,
+          "failed to read record %u (parent %u): %s",
+          page[read].id,
+          parent_id,
+          esp_err_to_name(ret)
+      );
+      break;
+    }
+    read++;
+  }
+  dmxbox_storage_commit();
+
+  if (ret != ESP_OK) {
+    free_page(page, read);
+    *count = 0;
+  }
+  return ret;
+}
+
+// sends all records of a parent (0 for records without one) as array
+// elements, effect_id is -1 for records without a parent
+static esp_err_t send_records(
+    httpd_req_t *req,
+    list_ids_t list_ids,
+    get_t get,
+    uint16_t parent_id,
+    record_to_json_t to_json,
+    int effect_id,
+    bool *first
+) {
+  dmxbox_storage_entry_t page[EXPORT_PAGE_SIZE];
+  uint16_t skip = 0;
+  uint16_t count;
+  do {
+    count = EXPORT_PAGE_SIZE;
+    ESP_RETURN_ON_ERROR(
+        read_page(list_ids, get, parent_id, skip, &count, page),
+        TAG,
+        "failed to read page at %u",
+        skip
+    );
+    esp_err_t ret = send_page(req, page, count, to_json, effect_id, first);
+    free_page(page, count);
+    ESP_RETURN_ON_ERROR(ret, TAG, "failed to send page at %u", skip);
+    skip += EXPORT_PAGE_SIZE;
+  } while (count == EXPORT_PAGE_SIZE);
+  return ESP_OK;
+}
+
+static esp_err_t send_steps(httpd_req_t *req) {
+  dmxbox_storage_entry_t effects[EXPORT_PAGE_SIZE];
+  bool first = true;
+  uint16_t effect_skip = 0;
+  uint16_t effect_count;
+  do {
+    effect_count = EXPORT_PAGE_SIZE;
+    dmxbox_storage_begin();
+    esp_err_t ret = dmxbox_effect_list_ids(effect_skip, &effect_count, effects);
+    dmxbox_storage_commit();
+    ESP_RETURN_ON_ERROR(ret, TAG, "failed to list effects");
+    for (uint16_t i = 0; i < effect_count; i++) {
+      uint16_t effect_id = effects[i].id;
+      ESP_RETURN_ON_ERROR(
+          send_records(
+              req,
+              dmxbox_effect_step_list_ids,
+              get_effect_step,
+              effect_id,
+              effect_step_to_json,
+              effect_id,
+              &first
+          ),
+          TAG,
+          "failed to send steps of effect %u",
+          effect_id
+      );
+    }
+    effect_skip += EXPORT_PAGE_SIZE;
+  } while (effect_count == EXPORT_PAGE_SIZE);
+  return ESP_OK;
+}
+
+static esp_err_t send_show(httpd_req_t *req) {
+  // Edits aren't held off while the client downloads. If effects or steps
+  // change halfway through, the records may not match up, so the document is
+  // left unfinished for the client to fail on.
+  uint32_t generation = dmxbox_show_generation();
+
+  char header[32];
+  snprintf(
+      header,
+      sizeof(header),
+      "{\"%s\":%d,\"%s\":",
+      field_version,
+      SHOW_FORMAT_VERSION,
+      field_settings
+  );
+  ESP_RETURN_ON_ERROR(
+      httpd_resp_sendstr_chunk(req, header),
+      TAG,
+      "failed to send header"
+  );
+
+  cJSON *settings = dmxbox_api_settings_artnet_to_json();
+  if (!settings) {
+    return ESP_ERR_NO_MEM;
+  }
+  esp_err_t ret = dmxbox_httpd_send_json_chunk(req, settings);
+  cJSON_Delete(settings);
+  ESP_RETURN_ON_ERROR(ret, TAG, "failed to send settings");
+
+  ESP_RETURN_ON_ERROR(
+      httpd_resp_sendstr_chunk(req, ",\"effects\":["),
+      TAG,
+      "failed to send effects"
+  );
+  bool first = true;
+  ESP_RETURN_ON_ERROR(
+      send_records(
+          req,
+          list_effect_ids,
+          get_effect,
+          0,
+          effect_to_json,
+          -1,
+          &first
+      ),
+      TAG,
+      "failed to send effects"
+  );
+  ESP_RETURN_ON_ERROR(
+      httpd_resp_sendstr_chunk(req, "],\"steps\":["),
+      TAG,
+      "failed to send steps"
+  );
+  ESP_RETURN_ON_ERROR(send_steps(req), TAG, "failed to send steps");
+  ESP_RETURN_ON_ERROR(
+      httpd_resp_sendstr_chunk(req, "],\"cues\":["),
+      TAG,
+      "failed to send cues"
+  );
+  first = true;
+  ESP_RETURN_ON_ERROR(
+      send_records(req, list_cue_ids, get_cue, 0, cue_to_json, -1, &first),
+      TAG,
+      "failed to send cues"
+  );
+  if (dmxbox_show_generation() != generation) {
+    ESP_LOGW(TAG, "show changed during the export");
+    return ESP_ERR_INVALID_STATE;
+  }
+  ESP_RETURN_ON_ERROR(
+      httpd_resp_sendstr_chunk(req, "]}"),
+      TAG,
+      "failed to send footer"
+  );
+  return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+static esp_err_t dmxbox_api_show_export(httpd_req_t *req) {
+  ESP_LOGI(TAG, "GET request for %s", req->uri);
+
+  dmxbox_httpd_cors_allow_origin(req);
+  ESP_RETURN_ON_ERROR(
+      httpd_resp_set_type(req, HTTPD_TYPE_JSON),
+      TAG,
+      "failed to set content type"
+  );
+  ESP_RETURN_ON_ERROR(
+      httpd_resp_set_hdr(
+          req,
+          "Content-Disposition",
+          "attachment; filename=\"show.json\""
+      ),
+      TAG,
+      "failed to set content disposition"
+  );
+
+  // once the first chunk is out, all that's left is to drop the connection
+  return send_show(req);
+}
+
+typedef enum import_type {
+  import_type_effect,
+  import_type_step,
+  import_type_cue,
+} import_type_t;
+
+// parsed, waiting to be written with the rest of its batch
+typedef struct import_record {
+  import_type_t type;
+  uint16_t effect_id; // steps
+  uint16_t id;
+  void *data;
+} import_record_t;
+
+typedef struct import_state {
+  bool version_seen;
+  uint16_t records;
+  const char *status;
+  const char *error;
+
+  import_record_t batch[IMPORT_BATCH_SIZE];
+  size_t batch_count;
+
+  // highest imported ids, the id counters were erased with the old show
+  uint16_t last_effect_id;
+  uint16_t last_cue_id;
+  uint16_t step_effect_id; // steps come grouped by effect
+  uint16_t last_step_id;
+} import_state_t;
+
+static bool import_failed(
+    import_state_t *state,
+    const char *status,
+    const char *error
+) {
+  state->status = status;
+  state->error = error;
+  return false;
+}
+
+static bool clear_show() {
+  dmxbox_storage_begin();
+  esp_err_t ret = dmxbox_effect_delete_all();
+  if (ret == ESP_OK) {
+    ret = dmxbox_effect_step_delete_all();
+  }
+  if (ret == ESP_OK) {
+    ret = dmxbox_cue_delete_all();
+  }
+  esp_err_t commit_ret = dmxbox_storage_commit();
+  if (ret == ESP_OK) {
+    ret = commit_ret;
+  }
+  if (ret != ESP_OK) {
+    ESP_LOGE(TAG, "failed to clear the show: %s", esp_err_to_name(ret));
+    return false;
+  }
+  return true;
+}
+
+static bool import_version(import_state_t *state, const cJSON *item) {
+  if (!cJSON_IsNumber(item) || item->valueint != SHOW_FORMAT_VERSION) {
+    return import_failed(state, HTTPD_400, "unsupported version");
+  }
+  state->version_seen = true;
+
+  // the import replaces the whole show
+  if (!clear_show()) {
+    return import_failed(state, HTTPD_500, "failed to clear the show");
+  }
+  return true;
+}
+
+static bool record_id(const cJSON *item, const char *field, uint16_t *id) {
+  return dmxbox_u16_from_json(
+      cJSON_GetObjectItemCaseSensitive(item, field),
+      id
+  );
+}
+
+static esp_err_t reserve_step_ids(import_state_t *state) {
+  if (!state->last_step_id) {
+    return ESP_OK;
+  }
+  esp_err_t ret = dmxbox_effect_step_reserve_ids(
+      state->step_effect_id,
+      state->last_step_id
+  );
+  state->last_step_id = 0;
+  return ret;
+}
+
+// so that creating a record after the import doesn't overwrite one
+static esp_err_t reserve_ids(import_state_t *state) {
+  ESP_RETURN_ON_ERROR(
+      dmxbox_effect_reserve_ids(state->last_effect_id),
+      TAG,
+      "failed to reserve effect ids"
+  );
+  ESP_RETURN_ON_ERROR(
+      reserve_step_ids(state),
+      TAG,
+      "failed to reserve step ids"
+  );
+  ESP_RETURN_ON_ERROR(
+      dmxbox_cue_reserve_ids(state->last_cue_id),
+      TAG,
+      "failed to reserve cue ids"
+  );
+  return ESP_OK;
+}
+
+static bool save_record(import_state_t *state, const import_record_t *record) {
+  esp_err_t ret;
+  switch (record->type) {
+  case import_type_effect:
+    if (dmxbox_effect_set(record->id, record->data) != ESP_OK) {
+      return import_failed(state, HTTPD_500, "failed to save effect");
+    }
+    if (record->id > state->last_effect_id) {
+      state->last_effect_id = record->id;
+    }
+    return true;
+  case import_type_step:
+    ret = dmxbox_effect_step_set(record->effect_id, record->id, record->data);
+    if (ret != ESP_OK) {
+      return import_failed(state, HTTPD_500, "failed to save effect step");
+    }
+    if (record->effect_id != state->step_effect_id) {
+      if (reserve_step_ids(state) != ESP_OK) {
+        return import_failed(state, HTTPD_500, "failed to reserve step ids");
+      }
+      state->step_effect_id = record->effect_id;
+    }
+    if (record->id > state->last_step_id) {
+      state->last_step_id = record->id;
+    }
+    return true;
+  default:
+    if (dmxbox_cue_set(record->id, record->data) != ESP_OK) {
+      return import_failed(state, HTTPD_500, "failed to save cue");
+    }
+    if (record->id > state->last_cue_id) {
+      state->last_cue_id = record->id;
+    }
+    return true;
+  }
+}
+
+// Writes the batched records in one transaction. Storage is only locked for
+// the writes themselves, not while the next records are received.
+static bool flush_batch(import_state_t *state) {
+  bool saved = true;
+  dmxbox_storage_begin();
+  for (size_t i = 0; i < state->batch_count; i++) {
+    if (saved) {
+      saved = save_record(state, &state->batch[i]);
+    }
+    free(state->batch[i].data);
+  }
+  state->batch_count = 0;
+  if (dmxbox_storage_commit() != ESP_OK && saved) {
+    saved = import_failed(state, HTTPD_500, "failed to commit the show");
+  }
+  return saved;
+}
+
+// takes ownership of data
+static bool add_record(
+    import_state_t *state,
+    import_type_t type,
+    uint16_t effect_id,
+    uint16_t id,
+    void *data
+) {
+  state->batch[state->batch_count++] = (import_record_t){
+      .type = type,
+      .effect_id = effect_id,
+      .id = id,
+      .data = data,
+  };
+  if (state->batch_count < IMPORT_BATCH_SIZE) {
+    return true;
+  }
+  return flush_batch(state);
+}
+
+static bool import_effect(import_state_t *state, const cJSON *item) {
+  uint16_t id;
+  if (!record_id(item, field_id, &id)) {
+    return import_failed(state, HTTPD_400, "effect id is missing");
+  }
+  dmxbox_effect_t *effect = dmxbox_effect_from_json_alloc(item);
+  if (!effect) {
+    return import_failed(state, HTTPD_400, "failed to parse effect");
+  }
+  return add_record(state, import_type_effect, 0, id, effect);
+}
+
+static bool import_step(import_state_t *state, const cJSON *item) {
+  uint16_t effect_id;
+  uint16_t id;
+  if (!record_id(item, field_effect_id, &effect_id) ||
+      !record_id(item, field_id, &id)) {
+    return import_failed(state, HTTPD_400, "effect step id is missing");
+  }
+  dmxbox_effect_step_t *step = dmxbox_effect_step_from_json_alloc(item);
+  if (!step) {
+    return import_failed(state, HTTPD_400, "failed to parse effect step");
+  }
+  return add_record(state, import_type_step, effect_id, id, step);
+}
+
+static bool import_cue(import_state_t *state, const cJSON *item) {
+  uint16_t id;
+  if (!record_id(item, field_id, &id)) {
+    return import_failed(state, HTTPD_400, "cue id is missing");
+  }
+  dmxbox_cue_t *cue = dmxbox_cue_from_json_alloc(item);
+  if (!cue) {
+    return import_failed(state, HTTPD_400, "failed to parse cue");
+  }
+  return add_record(state, import_type_cue, 0, id, cue);
+}
+
+// writes what's left of the batch and the id counters
+static bool finish_import(import_state_t *state) {
+  if (!flush_batch(state)) {
+    return false;
+  }
+  dmxbox_storage_begin();
+  esp_err_t ret = reserve_ids(state);
+  esp_err_t commit_ret = dmxbox_storage_commit();
+  if (ret != ESP_OK || commit_ret != ESP_OK) {
+    return import_failed(state, HTTPD_500, "failed to reserve ids");
+  }
+  return true;
+}
+
+static bool
+import_item(const char *key, int index, const cJSON *item, void *ctx) {
+  import_state_t *state = ctx;
+  if (!strcmp(key, field_version)) {
+    return import_version(state, item);
+  }
+  if (!state->version_seen) {
+    // checked before anything is overwritten
+    return import_failed(state, HTTPD_400, "version must come first");
+  }
+
+  if (!strcmp(key, field_settings)) {
+    if (!dmxbox_api_settings_artnet_from_json(item)) {
+      return import_failed(state, HTTPD_400, "failed to parse settings");
+    }
+    return true;
+  }
+
+  bool (*import_record)(import_state_t *, const cJSON *);
+  if (!strcmp(key, field_effects)) {
+    import_record = import_effect;
+  } else if (!strcmp(key, field_steps)) {
+    import_record = import_step;
+  } else if (!strcmp(key, field_cues)) {
+    import_record = import_cue;
+  } else {
+    ESP_LOGW(TAG, "ignoring unknown field '%s'", key);
+    return true;
+  }
+
+  if (index < 0) {
+    return import_failed(state, HTTPD_400, "records must be in an array");
+  }
+  if (!import_record(state, item)) {
+    ESP_LOGE(TAG, "failed to import %s[%d]", key, index);
+    return false;
+  }
+  state->records++;
+  return true;
+}
+
+static esp_err_t dmxbox_api_show_import(httpd_req_t *req) {
+  ESP_LOGI(TAG, "POST request for %s, %u bytes", req->uri, req->content_len);
+
+  dmxbox_httpd_cors_allow_origin(req);
+
+  import_state_t state = {0};
+
+  // NVS has no rollback, a failed import leaves part of the new show behind
+  esp_err_t ret = dmxbox_httpd_receive_json_stream(req, import_item, &state);
+  bool finished = true;
+  if (state.version_seen) {
+    // also after a failure, for the records received before it
+    const char *status = state.status;
+    const char *error = state.error;
+    finished = finish_import(&state);
+    if (ret != ESP_OK) {
+      state.status = status;
+      state.error = error;
+    }
+    dmxbox_cues_reload();
+  }
+
+  switch (ret) {
+  case ESP_OK:
+    break;
+  case ESP_FAIL:
+    if (state.status) {
+      httpd_resp_set_status(req, state.status);
+      return httpd_resp_sendstr(req, state.error);
+    }
+    return ESP_FAIL; // the socket failed
+  case ESP_ERR_INVALID_ARG:
+    return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Malformed JSON");
+  case ESP_ERR_INVALID_SIZE:
+    return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Record too long");
+  case ESP_ERR_TIMEOUT:
+    return httpd_resp_send_err(req, HTTPD_408_REQ_TIMEOUT, NULL);
+  default:
+    return ret;
+  }
+
+  if (!state.version_seen) {
+    return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Missing version");
+  }
+  if (!finished) {
+    httpd_resp_set_status(req, state.status);
+    return httpd_resp_sendstr(req, state.error);
+  }
+
+  ESP_LOGI(TAG, "imported %u records", state.records);
+  return dmxbox_httpd_send_204_no_content(req);
+}
+
+esp_err_t dmxbox_api_show_transfer_register(httpd_handle_t server) {
+  static const httpd_uri_t export = {
+      .uri = "/api/show/export",
+      .method = HTTP_GET,
+      .handler = dmxbox_api_show_export,
+  };
+  static const httpd_uri_t import = {
+      .uri = "/api/show/import",
+      .method = HTTP_POST,
+      .handler = dmxbox_api_show_import,
+  };
+  ESP_RETURN_ON_ERROR(
+      httpd_register_uri_handler(server, &export),
+      TAG,
+      "show export register failed"
+  );
+  ESP_RETURN_ON_ERROR(
+      httpd_register_uri_handler(server, &import),
+      TAG,
+      "show import register failed"
+  );
+  return ESP_OK;
+}
@@ -2,16 +2,22 @@
 #include <esp_check.h>
 #include <esp_err.h>
 #include <esp_http_server.h>
+#include <stdlib.h>
 
 #include "api_strings.h"
 #include "dmxbox_artnet.h"
+#include "dmxbox_boot.h"
+#include "dmxbox_dmx_send.h"
 #include "dmxbox_httpd.h"
+#include "dmxbox_storage.h"
 #include "esp_log.h"
 #include "esp_timer.h"
 #include "settings_artnet.h"
 
 static const char TAG[] = "dmxbox_api_system";
 
+#define REBOOT_FLUSH_TIMEOUT_MS 2000
+
 static esp_err_t dmxbox_api_system_uptime(httpd_req_t *req) {
   ESP_LOGI(TAG, "GET request for %s", req->uri);
 
@@ -28,6 +34,25 @@ static esp_err_t dmxbox_api_system_uptime(httpd_req_t *req) {
   if (!cJSON_AddNumberToObject(json, "uptime", uptime)) {
     goto exit;
   }
+
+  // how long the output was dark while booting
+  int64_t first_frame_us = dmxbox_dmx_send_get_first_frame_time();
+  if (!(first_frame_us < 0
+            ? cJSON_AddNullToObject(json, "first_frame_ms")
+            : cJSON_AddNumberToObject(
+                  json,
+                  "first_frame_ms",
+                  first_frame_us / 1000
+              ))) {
+    goto exit;
+  }
+  if (!cJSON_AddBoolToObject(
+          json,
+          "output_resumed",
+          dmxbox_dmx_send_resumed()
+      )) {
+    goto exit;
+  }
   ret = dmxbox_httpd_send_json(req, json);
 exit:
   if (json) {
@@ -36,6 +61,96 @@ exit:
   return ret;
 }
 
+// null for times that haven't happened yet
+static bool add_time(cJSON *json, const char *name, int64_t time_us) {
+  return time_us < 0 ? cJSON_AddNullToObject(json, name)
+                     : cJSON_AddNumberToObject(json, name, time_us);
+}
+
+static cJSON *boot_stage_to_json(const dmxbox_boot_timing_t *timing) {
+  cJSON *json = cJSON_CreateObject();
+  if (!json) {
+    return NULL;
+  }
+  int64_t duration_us = timing->end_us < 0
+                            ? -1
+                            : timing->end_us - timing->start_us;
+  if (!cJSON_AddStringToObject(json, "name", timing->name) ||
+      !cJSON_AddBoolToObject(json, "background", timing->background) ||
+      !add_time(json, "start_us", timing->start_us) ||
+      !add_time(json, "end_us", timing->end_us) ||
+      !add_time(json, "duration_us", duration_us)) {
+    cJSON_Delete(json);
+    return NULL;
+  }
+  return json;
+}
+
+static cJSON *boot_profile_to_json() {
+  dmxbox_boot_profile_t *profile = malloc(sizeof(dmxbox_boot_profile_t));
+  cJSON *json = NULL;
+  if (!profile) {
+    goto fail;
+  }
+  dmxbox_boot_get_profile(profile);
+
+  json = cJSON_CreateObject();
+  if (!json) {
+    goto fail;
+  }
+  if (!add_time(json, "start_us", profile->start_us) ||
+      !add_time(json, "end_us", profile->end_us) ||
+      !add_time(
+          json,
+          "first_frame_us",
+          dmxbox_dmx_send_get_first_frame_time()
+      ) ||
+      !cJSON_AddBoolToObject(
+          json,
+          "output_resumed",
+          dmxbox_dmx_send_resumed()
+      )) {
+    goto fail;
+  }
+
+  cJSON *stages = cJSON_AddArrayToObject(json, "stages");
+  if (!stages) {
+    goto fail;
+  }
+  for (size_t i = 0; i < profile->stage_count; i++) {
+    cJSON *stage = boot_stage_to_json(&profile->stages[i]);
+    if (!stage) {
+      goto fail;
+    }
+    if (!cJSON_AddItemToArray(stages, stage)) {
+      cJSON_Delete(stage);
+      goto fail;
+    }
+  }
+
+  free(profile);
+  return json;
+
+fail:
+  free(profile);
+  cJSON_Delete(json);
+  return NULL;
+}
+
+static esp_err_t dmxbox_api_system_boot(httpd_req_t *req) {
+  ESP_LOGI(TAG, "GET request for %s", req->uri);
+
+  dmxbox_httpd_cors_allow_origin(req);
+
+  cJSON *json = boot_profile_to_json();
+  if (!json) {
+    return ESP_ERR_NO_MEM;
+  }
+  esp_err_t ret = dmxbox_httpd_send_json(req, json);
+  cJSON_Delete(json);
+  return ret;
+}
+
 static esp_err_t dmxbox_api_system_reboot(httpd_req_t *req) {
   ESP_LOGI(TAG, "POST request for %s", req->uri);
 
@@ -44,6 +159,11 @@ static esp_err_t dmxbox_api_system_reboot(httpd_req_t *req) {
   ESP_LOGI(TAG, "saving artnet state");
   dmxbox_artnet_save_universe_snapshots();
 
+  esp_err_t ret = dmxbox_storage_flush(REBOOT_FLUSH_TIMEOUT_MS);
+  if (ret != ESP_OK) {
+    ESP_LOGW(TAG, "storage flush failed: %s", esp_err_to_name(ret));
+  }
+
   ESP_LOGI(TAG, "rebooting");
   esp_restart();
   // TODO reboot more gracefully - artnet is logging some errors
@@ -55,6 +175,11 @@ esp_err_t dmxbox_api_system_register(httpd_handle_t server) {
       .method = HTTP_GET,
       .handler = dmxbox_api_system_uptime,
   };
+  static const httpd_uri_t boot = {
+      .uri = "/api/system/boot",
+      .method = HTTP_GET,
+      .handler = dmxbox_api_system_boot,
+  };
   static const httpd_uri_t reboot = {
       .uri = "/api/system/reboot",
       .method = HTTP_POST,
@@ -65,6 +190,11 @@ esp_err_t dmxbox_api_system_register(httpd_handle_t server) {
       TAG,
       "system/uptime register failed"
   );
+  ESP_RETURN_ON_ERROR(
+      httpd_register_uri_handler(server, &boot),
+      TAG,
+      "system/boot register failed"
+  );
   ESP_RETURN_ON_ERROR(
       httpd_register_uri_handler(server, &reboot),
       TAG,
@@ -0,0 +1,149 @@
+#include <cJSON.h>
+#include <esp_check.h>
+#include <esp_err.h>
+#include <esp_http_server.h>
+
+#include "dmxbox_httpd.h"
+#include "dmxbox_tempo.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "tempo.h"
+
+static const char TAG[] = "dmxbox_api_tempo";
+
+static const char field_bpm[] = "bpm";
+static const char field_beats[] = "beats";
+static const char field_leader[] = "leader";
+
+static esp_err_t dmxbox_api_tempo_get(httpd_req_t *req) {
+  ESP_LOGI(TAG, "GET request for %s", req->uri);
+
+  dmxbox_httpd_cors_allow_origin(req);
+
+  dmxbox_tempo_state_t state;
+  dmxbox_tempo_get_state(esp_timer_get_time(), &state);
+
+  esp_err_t ret = ESP_ERR_NO_MEM;
+  cJSON *json = cJSON_CreateObject();
+  if (!json) {
+    goto exit;
+  }
+
+  if (!cJSON_AddNumberToObject(json, field_bpm, state.bpm)) {
+    goto exit;
+  }
+  if (!cJSON_AddNumberToObject(json, field_beats, state.beats)) {
+    goto exit;
+  }
+  if (!cJSON_AddBoolToObject(json, field_leader, state.leader)) {
+    goto exit;
+  }
+  ret = dmxbox_httpd_send_json(req, json);
+exit:
+  if (json) {
+    cJSON_free(json);
+  }
+  return ret;
+}
+
+static esp_err_t dmxbox_api_tempo_put(httpd_req_t *req) {
+  ESP_LOGI(TAG, "PUT request for %s", req->uri);
+
+  dmxbox_httpd_cors_allow_origin(req);
+
+  esp_err_t ret = ESP_OK;
+  const char *http_status = HTTPD_400;
+  cJSON *json = NULL;
+
+  ESP_RETURN_ON_ERROR(
+      dmxbox_httpd_receive_json(req, &json),
+      TAG,
+      "failed to receive json"
+  );
+
+  cJSON *bpm = cJSON_GetObjectItemCaseSensitive(json, field_bpm);
+  if (!bpm || !cJSON_IsNumber(bpm)) {
+    ESP_LOGE(TAG, "bpm missing or not a number");
+    goto send;
+  }
+
+  if (!dmxbox_tempo_set_bpm(esp_timer_get_time(), bpm->valuedouble)) {
+    ESP_LOGE(TAG, "bpm out of range");
+    goto send;
+  }
+
+  http_status = HTTPD_204;
+
+send:
+
+  ESP_GOTO_ON_ERROR(
+      httpd_resp_set_status(req, http_status),
+      exit,
+      TAG,
+      "failed to set status"
+  );
+
+  ESP_GOTO_ON_ERROR(
+      httpd_resp_send_chunk(req, NULL, 0),
+      exit,
+      TAG,
+      "failed to send empty chunk"
+  );
+exit:
+  cJSON_free(json);
+  return ret;
+}
+
+static esp_err_t dmxbox_api_tempo_tap(httpd_req_t *req) {
+  ESP_LOGI(TAG, "POST request for %s", req->uri);
+
+  // taken as early as possible, the rest of the request doesn't matter
+  dmxbox_tempo_tap(esp_timer_get_time());
+
+  dmxbox_httpd_cors_allow_origin(req);
+  ESP_RETURN_ON_ERROR(
+      httpd_resp_set_status(req, HTTPD_204),
+      TAG,
+      "failed to set status"
+  );
+  ESP_RETURN_ON_ERROR(
+      httpd_resp_send_chunk(req, NULL, 0),
+      TAG,
+      "failed to send empty chunk"
+  );
+  return ESP_OK;
+}
+
+esp_err_t dmxbox_api_tempo_register(httpd_handle_t server) {
+  static const httpd_uri_t get = {
+      .uri = "/api/tempo",
+      .method = HTTP_GET,
+      .handler = dmxbox_api_tempo_get,
+  };
+  static const httpd_uri_t put = {
+      .uri = "/api/tempo",
+      .method = HTTP_PUT,
+      .handler = dmxbox_api_tempo_put,
+  };
+  static const httpd_uri_t tap = {
+      .uri = "/api/tempo/tap",
+      .method = HTTP_POST,
+      .handler = dmxbox_api_tempo_tap,
+  };
+  ESP_RETURN_ON_ERROR(
+      httpd_register_uri_handler(server, &get),
+      TAG,
+      "tempo get register failed"
+  );
+  ESP_RETURN_ON_ERROR(
+      httpd_register_uri_handler(server, &put),
+      TAG,
+      "tempo put register failed"
+  );
+  ESP_RETURN_ON_ERROR(
+      httpd_register_uri_handler(server, &tap),
+      TAG,
+      "tempo/tap register failed"
+  );
+  return ESP_OK;
+}
@@ -0,0 +1,70 @@
+#include <cJSON.h>
+#include <esp_check.h>
+#include <esp_err.h>
+#include <esp_http_server.h>
+
+#include "dmxbox_httpd.h"
+#include "dmxbox_timecode.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "timecode.h"
+
+static const char TAG[] = "dmxbox_api_timecode";
+
+static const char *const states[] = {
+    [dmxbox_timecode_none] = "none",
+    [dmxbox_timecode_locked] = "locked",
+    [dmxbox_timecode_freewheel] = "freewheel",
+    [dmxbox_timecode_stopped] = "stopped",
+};
+
+static esp_err_t dmxbox_api_timecode_get(httpd_req_t *req) {
+  ESP_LOGI(TAG, "GET request for %s", req->uri);
+
+  dmxbox_httpd_cors_allow_origin(req);
+
+  int64_t show_time_us = 0;
+  dmxbox_timecode_state_t state =
+      dmxbox_timecode_get(esp_timer_get_time(), &show_time_us);
+  uint16_t frame_rate = dmxbox_timecode_get_frame_rate();
+
+  esp_err_t ret = ESP_ERR_NO_MEM;
+  cJSON *json = cJSON_CreateObject();
+  if (!json) {
+    goto exit;
+  }
+
+  if (!cJSON_AddStringToObject(json, "state", states[state])) {
+    goto exit;
+  }
+  if (state == dmxbox_timecode_none) {
+    if (!cJSON_AddNullToObject(json, "time")) {
+      goto exit;
+    }
+  } else if (!cJSON_AddNumberToObject(json, "time", show_time_us / 1000)) {
+    goto exit;
+  }
+  if (!cJSON_AddNumberToObject(json, "fps", frame_rate / 100.0)) {
+    goto exit;
+  }
+  ret = dmxbox_httpd_send_json(req, json);
+exit:
+  if (json) {
+    cJSON_free(json);
+  }
+  return ret;
+}
+
+esp_err_t dmxbox_api_timecode_register(httpd_handle_t server) {
+  static const httpd_uri_t get = {
+      .uri = "/api/timecode",
+      .method = HTTP_GET,
+      .handler = dmxbox_api_timecode_get,
+  };
+  ESP_RETURN_ON_ERROR(
+      httpd_register_uri_handler(server, &get),
+      TAG,
+      "timecode register failed"
+  );
+  return ESP_OK;
+}
@@ -0,0 +1,5 @@
+#pragma once
+#include <esp_err.h>
+#include <esp_http_server.h>
+
+esp_err_t dmxbox_api_timecode_register(httpd_handle_t server);
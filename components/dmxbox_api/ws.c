@@ -1,10 +1,12 @@
 #include "ws.h"
 #include "dmxbox_httpd.h"
+#include "metrics.h"
 #include "wifi_scan.h"
 #include "ws_ap_found.h"
 #include <cJSON.h>
 #include <esp_check.h>
 #include <esp_err.h>
+#include <esp_timer.h>
 #include <esp_wifi.h>
 #include <stdbool.h>
 #include <strings.h>
@@ -12,8 +14,11 @@
 static const char TAG[] = "dmxbox_ws";
 static httpd_handle_t dmxbox_ws_server;
 
+#define ESPNOW_METRICS_PERIOD_US (1000 * 1000)
+
 typedef struct dmxbox_ws_session {
   bool scan_aps;
+  bool espnow_metrics;
 } dmxbox_ws_session_t;
 
 static void dmxbox_ws_session_free(dmxbox_ws_session_t *session) {
@@ -93,6 +98,55 @@ exit:
   (void)ret;
 }
 
+// runs on the httpd task
+static void dmxbox_ws_send_espnow_metrics(void *arg) {
+  int client_fds[CONFIG_DMXBOX_WEBSEVER_MAX_SOCKETS];
+  size_t clients = CONFIG_DMXBOX_WEBSEVER_MAX_SOCKETS;
+  if (httpd_get_client_list(dmxbox_ws_server, &clients, client_fds) !=
+      ESP_OK) {
+    ESP_LOGE(TAG, "failed to get client list");
+    return;
+  }
+
+  char *text = NULL;
+  for (int c = 0; c < clients; c++) {
+    httpd_ws_client_info_t client_info =
+        httpd_ws_get_fd_info(dmxbox_ws_server, client_fds[c]);
+    if (client_info != HTTPD_WS_CLIENT_WEBSOCKET) {
+      continue;
+    }
+    dmxbox_ws_session_t *session =
+        httpd_sess_get_ctx(dmxbox_ws_server, client_fds[c]);
+    if (!session || !session->espnow_metrics) {
+      continue;
+    }
+
+    // only built once someone wants it
+    if (!text) {
+      cJSON *json = dmxbox_api_espnow_metrics_to_json();
+      if (json && cJSON_AddStringToObject(json, "type", "metrics/espnow")) {
+        text = cJSON_PrintUnformatted(json);
+      }
+      cJSON_Delete(json);
+      if (!text) {
+        ESP_LOGE(TAG, "failed to create metrics/espnow");
+        return;
+      }
+    }
+    httpd_ws_frame_t ws_frame = dmxbox_ws_frame_from_json(text);
+    httpd_ws_send_frame_async(dmxbox_ws_server, client_fds[c], &ws_frame);
+  }
+  free(text);
+}
+
+// runs on the esp_timer task
+static void dmxbox_ws_metrics_timer_callback(void *arg) {
+  if (httpd_queue_work(dmxbox_ws_server, dmxbox_ws_send_espnow_metrics, NULL) !=
+      ESP_OK) {
+    ESP_LOGW(TAG, "failed to queue metrics work");
+  }
+}
+
 // runs on the wifi event task
 static void dmxbox_ws_wifi_scan_callback(dmxbox_wifi_scan_result_t *result) {
   ESP_LOGI(
@@ -141,6 +195,10 @@ static esp_err_t dmxbox_ws_handle_request(
   } else if (!strcmp(type, "settings/stopApScan")) {
     ESP_LOGI(TAG, "stopping AP scan");
     session->scan_aps = false;
+  } else if (!strcmp(type, "metrics/startEspnow")) {
+    session->espnow_metrics = true;
+  } else if (!strcmp(type, "metrics/stopEspnow")) {
+    session->espnow_metrics = false;
   } else {
     ESP_LOGE(TAG, "unknown message type %s", type);
   }
@@ -198,5 +256,21 @@ esp_err_t dmxbox_ws_register(httpd_handle_t server) {
   );
 
   dmxbox_ws_server = server;
+
+  static const esp_timer_create_args_t metrics_timer_args = {
+      .callback = dmxbox_ws_metrics_timer_callback,
+      .name = "ws_metrics",
+  };
+  esp_timer_handle_t metrics_timer;
+  ESP_RETURN_ON_ERROR(
+      esp_timer_create(&metrics_timer_args, &metrics_timer),
+      TAG,
+      "failed to create metrics timer"
+  );
+  ESP_RETURN_ON_ERROR(
+      esp_timer_start_periodic(metrics_timer, ESPNOW_METRICS_PERIOD_US),
+      TAG,
+      "failed to start metrics timer"
+  );
   return ESP_OK;
 }
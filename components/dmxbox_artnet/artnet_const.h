@@ -9,6 +9,7 @@
 #define OP_POLL 0x2000
 #define OP_POLL_REPLY 0x2100
 #define OP_DMX 0x5000
+#define OP_TIMECODE 0x9700
 
 #define PORT_TYPE_OUTPUT 0x80
 #define OEM_UNKNOWN                                                            \
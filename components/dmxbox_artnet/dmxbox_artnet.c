@@ -6,12 +6,14 @@
 #include <freertos/task.h>
 #include <lwip/sockets.h>
 #include <sdkconfig.h>
+#include <stdatomic.h>
 #include <stdint.h>
 
 #include "artnet_client_tracking.h"
 #include "artnet_const.h"
 #include "button.h"
 #include "dmxbox_artnet.h"
+#include "dmxbox_dmx_rtc.h"
 #include "dmxbox_led.h"
 #include "dmxbox_storage.h"
 #include "hashmap.h"
@@ -38,11 +40,25 @@ typedef struct dmxbox_artnet_listener_context {
   uint8_t packet_buffer[MAX_PACKET_SIZE];
 } dmxbox_artnet_listener_context_t;
 
+struct dmxbox_artnet_subscription {
+  struct dmxbox_artnet_subscription *next;
+  size_t channel_count;
+  uint16_t *channels;
+  uint8_t *values;
+
+  // odd while the values are being written
+  atomic_uint sequence;
+
+  // reader side
+  unsigned last_read_sequence;
+};
+
 typedef struct dmxbox_artnet_universe {
   struct dmxbox_artnet_universe *next;
   uint16_t address;
   uint8_t data[DMX_CHANNEL_COUNT];
   uint8_t last_snapshot[DMX_CHANNEL_COUNT];
+  dmxbox_artnet_subscription_t *subscriptions_head;
 } dmxbox_artnet_universe_t;
 
 static dmxbox_artnet_universe_t *dmxbox_artnet_universe_alloc() {
@@ -172,13 +188,76 @@ static void initialize_universe_advertisements() {
   universe_advertisements_head = head;
 }
 
+static void subscription_free(dmxbox_artnet_subscription_t *subscription) {
+  if (subscription) {
+    free(subscription->channels);
+    free(subscription->values);
+  }
+  free(subscription);
+}
+
+// Must be called inside dmxbox_artnet_spinlock, which serializes the writers.
+static void publish_subscriptions(dmxbox_artnet_universe_t *universe) {
+  for (dmxbox_artnet_subscription_t *subscription =
+           universe->subscriptions_head;
+       subscription;
+       subscription = subscription->next) {
+
+    bool changed = false;
+    for (size_t i = 0; i < subscription->channel_count; i++) {
+      if (subscription->values[i] !=
+          universe->data[subscription->channels[i] - 1]) {
+        changed = true;
+        break;
+      }
+    }
+
+    if (!changed) {
+      continue;
+    }
+
+    unsigned sequence =
+        atomic_load_explicit(&subscription->sequence, memory_order_relaxed);
+    atomic_store_explicit(
+        &subscription->sequence,
+        sequence + 1,
+        memory_order_relaxed
+    );
+    atomic_thread_fence(memory_order_release);
+
+    for (size_t i = 0; i < subscription->channel_count; i++) {
+      subscription->values[i] = universe->data[subscription->channels[i] - 1];
+    }
+
+    atomic_store_explicit(
+        &subscription->sequence,
+        sequence + 2,
+        memory_order_release
+    );
+  }
+}
+
 static void load_stored_snapshots() {
   for (dmxbox_artnet_universe_t *universe = universes_head; universe;
        universe = universe->next) {
 
+    bool loaded = false;
     if (dmxbox_get_artnet_snapshot(universe->address, universe->data)) {
       memcpy(universe->last_snapshot, universe->data, DMX_CHANNEL_COUNT);
       ESP_LOGI(TAG, "Loaded snapshot for universe %d", universe->address);
+      loaded = true;
+    }
+
+    // newer than the snapshot, which is left to be updated by the autosave
+    if (dmxbox_dmx_rtc_restore_universe(universe->address, universe->data)) {
+      ESP_LOGI(TAG, "Restored universe %d after reset", universe->address);
+      loaded = true;
+    }
+
+    if (loaded) {
+      taskENTER_CRITICAL(&dmxbox_artnet_spinlock);
+      publish_subscriptions(universe);
+      taskEXIT_CRITICAL(&dmxbox_artnet_spinlock);
     }
   }
 }
@@ -196,7 +275,7 @@ static void store_universe_snapshot(dmxbox_artnet_universe_t *universe) {
   taskEXIT_CRITICAL(&dmxbox_artnet_spinlock);
 
   if (should_save) {
-    dmxbox_set_artnet_snapshot(universe->address, universe->data);
+    dmxbox_set_artnet_snapshot(universe->address, snapshot_data);
     ESP_LOGI(TAG, "Stored universe %d snapshot", universe->address);
   }
 }
@@ -401,14 +480,25 @@ static void apply_changes(
     const uint8_t *current_data,
     uint16_t data_length
 ) {
+  bool changed = false;
+  uint8_t data[DMX_CHANNEL_COUNT];
   taskENTER_CRITICAL(&dmxbox_artnet_spinlock);
   for (uint16_t i = 0; i < data_length; i++) {
     if (current_data[i] != last_data[i]) {
       universe->data[i] = current_data[i];
+      changed = true;
     }
   }
+  publish_subscriptions(universe);
+  if (changed) {
+    memcpy(data, universe->data, DMX_CHANNEL_COUNT);
+  }
   taskEXIT_CRITICAL(&dmxbox_artnet_spinlock);
 
+  if (changed) {
+    dmxbox_dmx_rtc_save_universe(universe->address, data);
+  }
+
   if (LOG_DMX_DATA) {
     ESP_LOG_BUFFER_HEX(TAG, universe->data, 16);
   }
@@ -529,6 +619,54 @@ static void handle_op_dmx(
   }
 }
 
+static dmxbox_artnet_timecode_handler_t timecode_handler = NULL;
+
+void dmxbox_artnet_set_timecode_handler(
+    dmxbox_artnet_timecode_handler_t handler
+) {
+  timecode_handler = handler;
+}
+
+static void handle_op_timecode(
+    const char *addr_str,
+    const uint8_t *packet,
+    int len
+) {
+  if (len < 19) {
+    ESP_LOGE(TAG, "Timecode packet too short: %d", len);
+    return;
+  }
+
+  dmxbox_artnet_timecode_t timecode = {
+      .frames = packet[14],
+      .seconds = packet[15],
+      .minutes = packet[16],
+      .hours = packet[17],
+      .type = packet[18],
+  };
+
+  if (timecode.type >= dmxbox_artnet_timecode_type_count ||
+      timecode.hours > 23 || timecode.minutes > 59 ||
+      timecode.seconds > 59 || timecode.frames > 29) {
+    ESP_LOGE(
+        TAG,
+        "Invalid timecode %02u:%02u:%02u:%02u type %u from %s",
+        timecode.hours,
+        timecode.minutes,
+        timecode.seconds,
+        timecode.frames,
+        timecode.type,
+        addr_str
+    );
+    return;
+  }
+
+  dmxbox_artnet_timecode_handler_t handler = timecode_handler;
+  if (handler) {
+    handler(&timecode);
+  }
+}
+
 static void handle_packet(
     int sock,
     esp_netif_t *interface,
@@ -582,6 +720,10 @@ static void handle_packet(
     handle_op_dmx(sock, source_addr, addr_str, packet, len);
     break;
 
+  case OP_TIMECODE:
+    handle_op_timecode(addr_str, packet, len);
+    break;
+
   default:
     ESP_LOGI(TAG, "Received unsupported opcode: %d", opcode);
     break;
@@ -593,25 +735,97 @@ void dmxbox_artnet_reset_state() {
        universe = universe->next) {
     taskENTER_CRITICAL(&dmxbox_artnet_spinlock);
     memset(universe->data, 0, DMX_CHANNEL_COUNT);
+    publish_subscriptions(universe);
     taskEXIT_CRITICAL(&dmxbox_artnet_spinlock);
 
+    static const uint8_t blackout[DMX_CHANNEL_COUNT];
+    dmxbox_dmx_rtc_save_universe(universe->address, blackout);
     store_universe_snapshot(universe);
   }
 
   dmxbox_artnet_client_tracking_reset();
 }
 
+#define BUTTON_HANDLER_COUNT 4
+
+typedef struct button_handler {
+  dmxbox_artnet_button_wanted_t wanted;
+  dmxbox_artnet_button_handler_t handler;
+} button_handler_t;
+
+static button_handler_t button_handlers[BUTTON_HANDLER_COUNT];
+static size_t button_handler_count = 0;
+
+void dmxbox_artnet_add_button_handler(
+    dmxbox_artnet_button_wanted_t wanted,
+    dmxbox_artnet_button_handler_t handler
+) {
+  if (button_handler_count == BUTTON_HANDLER_COUNT) {
+    ESP_LOGE(TAG, "Too many button handlers");
+    return;
+  }
+  button_handlers[button_handler_count++] = (button_handler_t){
+      .wanted = wanted,
+      .handler = handler,
+  };
+}
+
+static bool button_wanted() {
+  for (size_t i = 0; i < button_handler_count; i++) {
+    if (button_handlers[i].wanted()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool handle_button_press() {
+  for (size_t i = 0; i < button_handler_count; i++) {
+    if (button_handlers[i].handler()) {
+      return true;
+    }
+  }
+  return false;
+}
+
 static void reset_button_loop(void *parameter) {
   button_event_t ev;
   QueueHandle_t button_events =
       pulled_button_init(PIN_BIT(dmxbox_button_reset), GPIO_PULLUP_ONLY);
 
+  bool held = false;
+  bool wanted = false; // by a handler, decided when the button went down
   while (1) {
-    if (xQueueReceive(button_events, &ev, 1000 / portTICK_PERIOD_MS)) {
-      if ((ev.pin == dmxbox_button_reset) && (ev.event == BUTTON_DOWN)) {
+    if (!xQueueReceive(button_events, &ev, 1000 / portTICK_PERIOD_MS) ||
+        ev.pin != dmxbox_button_reset) {
+      continue;
+    }
+
+    switch (ev.event) {
+    case BUTTON_DOWN:
+      held = false;
+      wanted = button_wanted();
+      if (!wanted) {
+        ESP_LOGI(TAG, "Reset button pressed");
+        dmxbox_artnet_reset_state();
+      }
+      break;
+
+    case BUTTON_HELD:
+      if (wanted && !held) {
+        ESP_LOGI(TAG, "Reset button held");
+        dmxbox_artnet_reset_state();
+      }
+      held = true;
+      break;
+
+    case BUTTON_UP:
+      if (wanted && !held && !handle_button_press()) {
         ESP_LOGI(TAG, "Reset button pressed");
         dmxbox_artnet_reset_state();
       }
+      wanted = false;
+      break;
     }
   }
 }
@@ -812,3 +1026,100 @@ bool dmxbox_artnet_get_universe_data(
   taskEXIT_CRITICAL(&dmxbox_artnet_spinlock);
   return !!universe;
 }
+
+esp_err_t dmxbox_artnet_subscribe(
+    uint16_t address,
+    const uint16_t *channels,
+    size_t channel_count,
+    dmxbox_artnet_subscription_t **result
+) {
+  for (size_t i = 0; i < channel_count; i++) {
+    if (channels[i] < 1 || channels[i] > DMX_CHANNEL_COUNT) {
+      ESP_LOGE(TAG, "Can't subscribe to channel %d", channels[i]);
+      return ESP_ERR_INVALID_ARG;
+    }
+  }
+
+  dmxbox_artnet_universe_t *universe = find_universe(address);
+  if (!universe) {
+    ESP_LOGE(TAG, "Can't subscribe to unknown universe %d", address);
+    return ESP_ERR_NOT_FOUND;
+  }
+
+  dmxbox_artnet_subscription_t *subscription =
+      calloc(1, sizeof(dmxbox_artnet_subscription_t));
+  if (!subscription) {
+    return ESP_ERR_NO_MEM;
+  }
+
+  subscription->channel_count = channel_count;
+  subscription->channels = calloc(channel_count, sizeof(uint16_t));
+  subscription->values = calloc(channel_count, sizeof(uint8_t));
+  if (!subscription->channels || !subscription->values) {
+    subscription_free(subscription);
+    return ESP_ERR_NO_MEM;
+  }
+  memcpy(subscription->channels, channels, channel_count * sizeof(uint16_t));
+
+  taskENTER_CRITICAL(&dmxbox_artnet_spinlock);
+  for (size_t i = 0; i < channel_count; i++) {
+    subscription->values[i] = universe->data[channels[i] - 1];
+  }
+  // the first poll always reports a change
+  atomic_init(&subscription->sequence, 2);
+  subscription->last_read_sequence = 0;
+
+  subscription->next = universe->subscriptions_head;
+  universe->subscriptions_head = subscription;
+  taskEXIT_CRITICAL(&dmxbox_artnet_spinlock);
+
+  *result = subscription;
+  return ESP_OK;
+}
+
+void dmxbox_artnet_unsubscribe(dmxbox_artnet_subscription_t *subscription) {
+  if (!subscription) {
+    return;
+  }
+
+  taskENTER_CRITICAL(&dmxbox_artnet_spinlock);
+  for (dmxbox_artnet_universe_t *universe = universes_head; universe;
+       universe = universe->next) {
+    for (dmxbox_artnet_subscription_t **link = &universe->subscriptions_head;
+         *link;
+         link = &(*link)->next) {
+      if (*link == subscription) {
+        *link = subscription->next;
+        break;
+      }
+    }
+  }
+  taskEXIT_CRITICAL(&dmxbox_artnet_spinlock);
+
+  subscription_free(subscription);
+}
+
+bool dmxbox_artnet_subscription_poll(
+    dmxbox_artnet_subscription_t *subscription,
+    uint8_t *values
+) {
+  while (true) {
+    unsigned sequence =
+        atomic_load_explicit(&subscription->sequence, memory_order_acquire);
+    if (sequence == subscription->last_read_sequence) {
+      return false;
+    }
+    if (sequence & 1) {
+      continue; // a write is in progress
+    }
+
+    memcpy(values, subscription->values, subscription->channel_count);
+
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&subscription->sequence, memory_order_relaxed) ==
+        sequence) {
+      subscription->last_read_sequence = sequence;
+      return true;
+    }
+  }
+}
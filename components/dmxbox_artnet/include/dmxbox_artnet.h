@@ -1,4 +1,5 @@
 #pragma once
+#include <esp_err.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 
@@ -11,6 +12,52 @@ bool dmxbox_artnet_get_universe_data(
     uint8_t data[DMX_CHANNEL_COUNT]
 );
 
+// A set of channels of one universe, published to a single reader without
+// locking. Values are updated whenever Art-Net data, a reset or a snapshot
+// changes any of the subscribed channels.
+typedef struct dmxbox_artnet_subscription dmxbox_artnet_subscription_t;
+
+// channels are 1-based
+esp_err_t dmxbox_artnet_subscribe(
+    uint16_t address,
+    const uint16_t *channels,
+    size_t channel_count,
+    dmxbox_artnet_subscription_t **result
+);
+void dmxbox_artnet_unsubscribe(dmxbox_artnet_subscription_t *subscription);
+
+// Copies the current values of the subscribed channels (in the order they were
+// subscribed) into values, unless they haven't changed since the last poll.
+// Returns true if they did.
+bool dmxbox_artnet_subscription_poll(
+    dmxbox_artnet_subscription_t *subscription,
+    uint8_t *values
+);
+
+typedef enum dmxbox_artnet_timecode_type {
+  dmxbox_artnet_timecode_film = 0,  // 24 fps
+  dmxbox_artnet_timecode_ebu = 1,   // 25 fps
+  dmxbox_artnet_timecode_df = 2,    // 29.97 fps drop frame
+  dmxbox_artnet_timecode_smpte = 3, // 30 fps
+  dmxbox_artnet_timecode_type_count,
+} dmxbox_artnet_timecode_type_t;
+
+typedef struct dmxbox_artnet_timecode {
+  uint8_t hours;
+  uint8_t minutes;
+  uint8_t seconds;
+  uint8_t frames;
+  uint8_t type; // dmxbox_artnet_timecode_type_t
+} dmxbox_artnet_timecode_t;
+
+// Called from the Art-Net task for every valid ArtTimeCode packet
+typedef void (*dmxbox_artnet_timecode_handler_t)(
+    const dmxbox_artnet_timecode_t *timecode
+);
+void dmxbox_artnet_set_timecode_handler(
+    dmxbox_artnet_timecode_handler_t handler
+);
+
 void dmxbox_artnet_init();
 
 void dmxbox_artnet_receive_task(void *parameter);
@@ -18,3 +65,18 @@ void dmxbox_set_artnet_active(bool state);
 
 void dmxbox_artnet_save_universe_snapshots();
 void dmxbox_artnet_reset_state();
+
+// Asked when the reset button goes down. While no handler wants the press,
+// the button resets the state right away, as if there were no handlers.
+typedef bool (*dmxbox_artnet_button_wanted_t)();
+
+// Called when the reset button is released without having been held, if a
+// handler wanted the press. Returns false if it didn't use the press, in which
+// case the next handler (in the order they were added) gets it, and the state
+// is reset if none of them use it. Holding the button resets the state.
+// Handlers must be added before the Art-Net tasks start.
+typedef bool (*dmxbox_artnet_button_handler_t)();
+void dmxbox_artnet_add_button_handler(
+    dmxbox_artnet_button_wanted_t wanted,
+    dmxbox_artnet_button_handler_t handler
+);
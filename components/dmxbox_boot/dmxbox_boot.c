@@ -0,0 +1,129 @@
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+#include <freertos/task.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "dmxbox_boot.h"
+
+static const char TAG[] = "dmxbox_boot";
+
+// for the background stages, which are as deep as the foreground ones
+#ifndef CONFIG_DMXBOX_BOOT_STACK_SIZE
+#define CONFIG_DMXBOX_BOOT_STACK_SIZE 8192
+#endif
+
+static const dmxbox_boot_stage_t *stages;
+static EventGroupHandle_t done_events;
+
+static portMUX_TYPE profile_spinlock = portMUX_INITIALIZER_UNLOCKED;
+static dmxbox_boot_profile_t profile = {
+    .start_us = -1,
+    .end_us = -1,
+};
+
+static void run_stage(size_t index) {
+  const dmxbox_boot_stage_t *stage = &stages[index];
+  if (stage->depends_on) {
+    xEventGroupWaitBits(
+        done_events,
+        stage->depends_on,
+        pdFALSE,
+        pdTRUE,
+        portMAX_DELAY
+    );
+  }
+
+  int64_t start_us = esp_timer_get_time();
+  taskENTER_CRITICAL(&profile_spinlock);
+  profile.stages[index].start_us = start_us;
+  taskEXIT_CRITICAL(&profile_spinlock);
+
+  stage->run();
+
+  int64_t end_us = esp_timer_get_time();
+  taskENTER_CRITICAL(&profile_spinlock);
+  profile.stages[index].end_us = end_us;
+  taskEXIT_CRITICAL(&profile_spinlock);
+
+  ESP_LOGI(TAG, "%s took %lld ms", stage->name, (end_us - start_us) / 1000);
+  xEventGroupSetBits(done_events, DMXBOX_BOOT_STAGE(index));
+}
+
+static void background_task(void *parameter) {
+  run_stage((uintptr_t)parameter);
+  vTaskDelete(NULL);
+}
+
+void dmxbox_boot_run(const dmxbox_boot_stage_t *boot_stages, size_t count) {
+  if (count > DMXBOX_BOOT_MAX_STAGES) {
+    ESP_LOGE(TAG, "too many stages: %u", count);
+    abort();
+  }
+  for (size_t i = 0; i < count; i++) {
+    // also rules out cycles
+    if (boot_stages[i].depends_on & ~(DMXBOX_BOOT_STAGE(i) - 1)) {
+      ESP_LOGE(TAG, "%s depends on a later stage", boot_stages[i].name);
+      abort();
+    }
+  }
+
+  done_events = xEventGroupCreate();
+  if (!done_events) {
+    ESP_LOGE(TAG, "failed to create event group");
+    abort();
+  }
+  stages = boot_stages;
+
+  taskENTER_CRITICAL(&profile_spinlock);
+  profile.start_us = esp_timer_get_time();
+  profile.stage_count = count;
+  for (size_t i = 0; i < count; i++) {
+    profile.stages[i] = (dmxbox_boot_timing_t){
+        .name = stages[i].name,
+        .background = stages[i].background,
+        .start_us = -1,
+        .end_us = -1,
+    };
+  }
+  taskEXIT_CRITICAL(&profile_spinlock);
+
+  for (size_t i = 0; i < count; i++) {
+    if (stages[i].background) {
+      if (xTaskCreate(
+              background_task,
+              stages[i].name,
+              CONFIG_DMXBOX_BOOT_STACK_SIZE,
+              (void *)(uintptr_t)i,
+              uxTaskPriorityGet(NULL),
+              NULL
+          ) == pdPASS) {
+        continue;
+      }
+      ESP_LOGW(TAG, "failed to create task, running %s here", stages[i].name);
+    }
+    run_stage(i);
+  }
+
+  xEventGroupWaitBits(
+      done_events,
+      DMXBOX_BOOT_STAGE(count) - 1,
+      pdFALSE,
+      pdTRUE,
+      portMAX_DELAY
+  );
+
+  taskENTER_CRITICAL(&profile_spinlock);
+  profile.end_us = esp_timer_get_time();
+  int64_t duration_us = profile.end_us - profile.start_us;
+  taskEXIT_CRITICAL(&profile_spinlock);
+  ESP_LOGI(TAG, "%u stages took %lld ms", count, duration_us / 1000);
+}
+
+void dmxbox_boot_get_profile(dmxbox_boot_profile_t *result) {
+  taskENTER_CRITICAL(&profile_spinlock);
+  *result = profile;
+  taskEXIT_CRITICAL(&profile_spinlock);
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Runs the init stages of app_main in dependency order and records how long
+// each one took. A stage waits for all the stages in its depends_on, which
+// must come before it. Foreground stages run on the calling task in order,
+// background ones each get a task of their own, so that slow stages that
+// don't depend on each other run at the same time.
+
+// one event group bit per stage
+#define DMXBOX_BOOT_MAX_STAGES 24
+
+#define DMXBOX_BOOT_STAGE(index) (1UL << (index))
+
+typedef struct dmxbox_boot_stage {
+  const char *name;
+  void (*run)();
+  uint32_t depends_on; // DMXBOX_BOOT_STAGE() bits
+  bool background;
+} dmxbox_boot_stage_t;
+
+// returns once every stage has finished, stages must outlive the boot
+void dmxbox_boot_run(const dmxbox_boot_stage_t *stages, size_t count);
+
+// esp_timer times, -1 until the stage or the boot has started or finished
+typedef struct dmxbox_boot_timing {
+  const char *name;
+  bool background;
+  int64_t start_us;
+  int64_t end_us;
+} dmxbox_boot_timing_t;
+
+typedef struct dmxbox_boot_profile {
+  int64_t start_us;
+  int64_t end_us;
+  size_t stage_count;
+  dmxbox_boot_timing_t stages[DMXBOX_BOOT_MAX_STAGES];
+} dmxbox_boot_profile_t;
+
+void dmxbox_boot_get_profile(dmxbox_boot_profile_t *profile);
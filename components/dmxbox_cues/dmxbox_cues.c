@@ -0,0 +1,549 @@
+#include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dmxbox_artnet.h"
+#include "dmxbox_const.h"
+#include "dmxbox_cues.h"
+#include "dmxbox_storage.h"
+#include "dmxbox_timecode.h"
+#include "esp_err.h"
+
+static const char TAG[] = "dmxbox_cues";
+
+// control channel levels at or above this trigger GO / BACK
+#define CONTROL_THRESHOLD 128
+
+#ifndef MAX
+#define MAX(x, y) ((x) > (y) ? (x) : (y))
+#endif
+
+static const uint32_t us_per_ms = 1000;
+
+typedef struct cue {
+  uint16_t id;
+  dmxbox_cue_t *data;
+} cue_t;
+
+typedef struct timed_cue {
+  uint32_t ms;
+  uint16_t index; // into cue_list_t.cues
+} timed_cue_t;
+
+typedef struct cue_list {
+  size_t count;
+  cue_t *cues;
+
+  // cues on the timecode timeline, by time
+  size_t timed_count;
+  timed_cue_t *timed;
+} cue_list_t;
+
+typedef struct fade_channel {
+  uint16_t index;
+  uint8_t from;
+  uint8_t to;
+} fade_channel_t;
+
+typedef enum control {
+  control_go,
+  control_back,
+  control_count,
+} control_t;
+
+// Synchronizes the requests and the published state below
+static portMUX_TYPE cues_spinlock = portMUX_INITIALIZER_UNLOCKED;
+static cue_list_t *pending_list = NULL;
+static int pending_go = 0;
+static int pending_back = 0;
+static dmxbox_cues_state_t published_state;
+
+// owned by the task calling dmxbox_cues_evaluate
+static cue_list_t *cue_list = NULL;
+static int current_cue = -1;
+static uint8_t levels[DMX_CHANNEL_COUNT];
+
+// channels that differ between the outgoing and the incoming look
+static fade_channel_t fade_channels[DMX_CHANNEL_COUNT];
+static size_t fade_channel_count = 0;
+static bool fading = false;
+static int64_t fade_start_us = 0;
+static uint32_t fade_in_us = 0;
+static uint32_t fade_out_us = 0;
+static int64_t follow_at_us = 0;
+
+// index into cue_list->timed the timeline last went to, -1 before the first
+// timed cue, TIMELINE_UNKNOWN when timecode isn't running
+#define TIMELINE_UNKNOWN -2
+static int timeline_cue = TIMELINE_UNKNOWN;
+
+static dmxbox_artnet_subscription_t *control_subscription = NULL;
+static int control_index[control_count] = {-1, -1};
+static uint8_t control_values[control_count];
+static bool control_pressed[control_count];
+
+static uint32_t ms_to_us(uint32_t value) { return value * us_per_ms; }
+
+static void cue_list_free(cue_list_t *list) {
+  if (!list) {
+    return;
+  }
+  for (size_t i = 0; i < list->count; i++) {
+    free(list->cues[i].data);
+  }
+  free(list->cues);
+  free(list->timed);
+  free(list);
+}
+
+static int compare_cues(const void *a, const void *b) {
+  return (int)((const cue_t *)a)->id - (int)((const cue_t *)b)->id;
+}
+
+static int compare_timed_cues(const void *a, const void *b) {
+  const timed_cue_t *cue_a = a;
+  const timed_cue_t *cue_b = b;
+  if (cue_a->ms != cue_b->ms) {
+    return cue_a->ms < cue_b->ms ? -1 : 1;
+  }
+  return (int)cue_a->index - (int)cue_b->index;
+}
+
+static bool index_timed_cues(cue_list_t *list) {
+  for (size_t i = 0; i < list->count; i++) {
+    if (list->cues[i].data->time.set) {
+      list->timed_count++;
+    }
+  }
+  if (!list->timed_count) {
+    return true;
+  }
+
+  list->timed = calloc(list->timed_count, sizeof(timed_cue_t));
+  if (!list->timed) {
+    return false;
+  }
+
+  size_t timed_count = 0;
+  for (size_t i = 0; i < list->count; i++) {
+    if (list->cues[i].data->time.set) {
+      list->timed[timed_count++] = (timed_cue_t){
+          .ms = list->cues[i].data->time.ms,
+          .index = i,
+      };
+    }
+  }
+  qsort(
+      list->timed,
+      list->timed_count,
+      sizeof(timed_cue_t),
+      compare_timed_cues
+  );
+  return true;
+}
+
+static esp_err_t load_cue_list(cue_list_t **result) {
+  cue_list_t *list = calloc(1, sizeof(cue_list_t));
+  if (!list) {
+    return ESP_ERR_NO_MEM;
+  }
+
+  dmxbox_storage_entry_t page[10];
+  const uint16_t page_length = sizeof(page) / sizeof(page[0]);
+  size_t capacity = 0;
+
+  uint16_t count;
+  uint16_t skip = 0;
+  do {
+    count = page_length;
+    esp_err_t ret = dmxbox_cue_list(skip, &count, page);
+    if (ret != ESP_OK) {
+      cue_list_free(list);
+      return ret;
+    }
+    skip += count;
+
+    if (list->count + count > capacity) {
+      capacity = MAX(capacity * 2, list->count + count);
+      cue_t *cues = realloc(list->cues, capacity * sizeof(cue_t));
+      if (!cues) {
+        while (count--) {
+          free(page[count].data);
+        }
+        cue_list_free(list);
+        return ESP_ERR_NO_MEM;
+      }
+      list->cues = cues;
+    }
+
+    for (uint16_t i = 0; i < count; i++) {
+      list->cues[list->count].id = page[i].id;
+      list->cues[list->count].data = page[i].data;
+      list->count++;
+    }
+  } while (count == page_length);
+
+  // cues play in id order, storage lists them in no particular order
+  qsort(list->cues, list->count, sizeof(cue_t), compare_cues);
+
+  if (!index_timed_cues(list)) {
+    cue_list_free(list);
+    return ESP_ERR_NO_MEM;
+  }
+
+  *result = list;
+  return ESP_OK;
+}
+
+// fades from wherever the output is now, which may be mid-fade
+static void fade_to(const uint8_t target[DMX_CHANNEL_COUNT]) {
+  fade_channel_count = 0;
+  for (uint16_t i = 0; i < DMX_CHANNEL_COUNT; i++) {
+    if (levels[i] != target[i]) {
+      fade_channels[fade_channel_count++] = (fade_channel_t){
+          .index = i,
+          .from = levels[i],
+          .to = target[i],
+      };
+    }
+  }
+  fading = true;
+  follow_at_us = 0;
+}
+
+// go_time_us is when GO happened, which is in the past for timed cues that
+// were seeked into
+static void start_fade(int64_t go_time_us, int cue_index) {
+  const dmxbox_cue_t *cue = cue_list->cues[cue_index].data;
+  ESP_LOGI(TAG, "Cue %u", cue_list->cues[cue_index].id);
+
+  static uint8_t target[DMX_CHANNEL_COUNT];
+  memset(target, 0, sizeof(target));
+  for (size_t i = 0; i < cue->channel_count; i++) {
+    uint16_t channel = cue->channels[i].channel.index;
+    if (channel >= 1 && channel <= DMX_CHANNEL_COUNT) {
+      target[channel - 1] = MAX(target[channel - 1], cue->channels[i].level);
+    }
+  }
+
+  fade_to(target);
+  current_cue = cue_index;
+  fade_start_us = go_time_us + ms_to_us(cue->delay);
+  fade_in_us = ms_to_us(cue->fade_in);
+  fade_out_us = ms_to_us(cue->fade_out);
+}
+
+// The cue that was playing got deleted, so its look fades out the way it
+// would have for the next cue
+static void fade_out_deleted(int64_t time_us, uint32_t fade_out_ms) {
+  ESP_LOGI(TAG, "Current cue deleted, fading out");
+  static const uint8_t dark[DMX_CHANNEL_COUNT];
+  fade_to(dark);
+  current_cue = -1;
+  fade_start_us = time_us;
+  fade_in_us = 0;
+  fade_out_us = ms_to_us(fade_out_ms);
+}
+
+static uint8_t advance_fade(int64_t time_us) {
+  if (!fading) {
+    return 255;
+  }
+  if (time_us < fade_start_us) {
+    return 0;
+  }
+
+  int64_t elapsed_us = time_us - fade_start_us;
+  bool done = true;
+  for (size_t i = 0; i < fade_channel_count; i++) {
+    const fade_channel_t *channel = &fade_channels[i];
+    uint32_t duration_us =
+        channel->to > channel->from ? fade_in_us : fade_out_us;
+
+    if (elapsed_us >= duration_us) {
+      levels[channel->index] = channel->to;
+      continue;
+    }
+
+    done = false;
+    levels[channel->index] =
+        channel->from +
+        (int)(((int64_t)channel->to - channel->from) * elapsed_us /
+              duration_us);
+  }
+
+  if (done) {
+    fading = false;
+    const dmxbox_cue_t *cue =
+        current_cue >= 0 ? cue_list->cues[current_cue].data : NULL;
+    if (cue && cue->follow) {
+      follow_at_us = time_us + ms_to_us(cue->follow);
+    }
+    return 255;
+  }
+
+  uint32_t duration_us = MAX(fade_in_us, fade_out_us);
+  return (uint8_t)(255 * elapsed_us / duration_us);
+}
+
+static void go(int64_t time_us) {
+  if (current_cue + 1 >= (int)cue_list->count) {
+    ESP_LOGI(TAG, "GO: already at the last cue");
+    return;
+  }
+  start_fade(time_us, current_cue + 1);
+}
+
+static void back(int64_t time_us) {
+  if (current_cue <= 0) {
+    ESP_LOGI(TAG, "BACK: already at the first cue");
+    return;
+  }
+  start_fade(time_us, current_cue - 1);
+}
+
+static void release() {
+  ESP_LOGI(TAG, "Released");
+  memset(levels, 0, sizeof(levels));
+  current_cue = -1;
+  fading = false;
+  follow_at_us = 0;
+}
+
+// Last timed cue at or before show_ms, -1 if none
+static int find_timed_cue(uint32_t show_ms) {
+  int low = 0;
+  int high = (int)cue_list->timed_count;
+  while (low < high) {
+    int middle = (low + high) / 2;
+    if (cue_list->timed[middle].ms <= show_ms) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  return low - 1;
+}
+
+// Puts the cue list where the timecode says. Only reacts when the timeline
+// moves to another cue, so manual GO/BACK still work in between.
+static void follow_timeline(int64_t time_us) {
+  int64_t show_time_us;
+  if (!cue_list->timed_count ||
+      dmxbox_timecode_get(time_us, &show_time_us) == dmxbox_timecode_none) {
+    timeline_cue = TIMELINE_UNKNOWN;
+    return;
+  }
+
+  uint32_t show_ms = show_time_us < 0 ? 0 : (uint32_t)(show_time_us / 1000);
+  int target = find_timed_cue(show_ms);
+  if (target == timeline_cue) {
+    return;
+  }
+
+  timeline_cue = target;
+  if (target < 0) {
+    release();
+    return;
+  }
+
+  // fade as if GO happened right at the cue's time, wherever that was
+  const timed_cue_t *timed = &cue_list->timed[target];
+  int64_t since_cue_us = show_time_us - ms_to_us(timed->ms);
+  start_fade(time_us - since_cue_us, timed->index);
+}
+
+static void use_cue_list(int64_t time_us, cue_list_t *list) {
+  uint16_t current_id = 0;
+  uint32_t fade_out_ms = 0;
+  if (current_cue >= 0) {
+    current_id = cue_list->cues[current_cue].id;
+    fade_out_ms = cue_list->cues[current_cue].data->fade_out;
+  }
+
+  cue_list_free(cue_list);
+  cue_list = list;
+
+  // stay on the same cue, wherever it is now
+  current_cue = -1;
+  for (size_t i = 0; i < cue_list->count && current_id; i++) {
+    if (cue_list->cues[i].id == current_id) {
+      current_cue = i;
+    }
+  }
+
+  if (current_id && current_cue < 0) {
+    fade_out_deleted(time_us, fade_out_ms);
+  }
+  timeline_cue = TIMELINE_UNKNOWN;
+}
+
+static void poll_controls(int *go_count, int *back_count) {
+  if (!control_subscription ||
+      !dmxbox_artnet_subscription_poll(control_subscription, control_values)) {
+    return;
+  }
+
+  for (int i = 0; i < control_count; i++) {
+    if (control_index[i] < 0) {
+      continue;
+    }
+
+    bool pressed = control_values[control_index[i]] >= CONTROL_THRESHOLD;
+    if (pressed && !control_pressed[i]) {
+      *(i == control_go ? go_count : back_count) += 1;
+    }
+    control_pressed[i] = pressed;
+  }
+}
+
+void dmxbox_cues_evaluate(int64_t time_us, uint8_t data[DMX_CHANNEL_COUNT]) {
+  taskENTER_CRITICAL(&cues_spinlock);
+  cue_list_t *list = pending_list;
+  pending_list = NULL;
+  int go_count = pending_go;
+  int back_count = pending_back;
+  pending_go = pending_back = 0;
+  taskEXIT_CRITICAL(&cues_spinlock);
+
+  if (list) {
+    use_cue_list(time_us, list);
+  }
+  if (!cue_list) {
+    return;
+  }
+
+  poll_controls(&go_count, &back_count);
+  follow_timeline(time_us);
+
+  if (follow_at_us && follow_at_us <= time_us) {
+    follow_at_us = 0;
+    go_count++;
+  }
+
+  while (go_count--) {
+    go(time_us);
+  }
+  while (back_count--) {
+    back(time_us);
+  }
+
+  uint8_t fade_progress = advance_fade(time_us);
+
+  for (uint16_t i = 0; i < DMX_CHANNEL_COUNT; i++) {
+    data[i] = MAX(data[i], levels[i]);
+  }
+
+  taskENTER_CRITICAL(&cues_spinlock);
+  published_state.cue_id =
+      current_cue >= 0 ? cue_list->cues[current_cue].id : 0;
+  published_state.cue_count = cue_list->count;
+  published_state.fading = fading;
+  published_state.fade_progress = fade_progress;
+  taskEXIT_CRITICAL(&cues_spinlock);
+}
+
+void dmxbox_cues_go() {
+  taskENTER_CRITICAL(&cues_spinlock);
+  pending_go++;
+  taskEXIT_CRITICAL(&cues_spinlock);
+}
+
+void dmxbox_cues_back() {
+  taskENTER_CRITICAL(&cues_spinlock);
+  pending_back++;
+  taskEXIT_CRITICAL(&cues_spinlock);
+}
+
+void dmxbox_cues_get_state(dmxbox_cues_state_t *state) {
+  taskENTER_CRITICAL(&cues_spinlock);
+  *state = published_state;
+  taskEXIT_CRITICAL(&cues_spinlock);
+}
+
+esp_err_t dmxbox_cues_reload() {
+  cue_list_t *list;
+  esp_err_t ret = load_cue_list(&list);
+  if (ret != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to load cues: %s", esp_err_to_name(ret));
+    return ret;
+  }
+  ESP_LOGI(TAG, "Loaded %u cues", list->count);
+
+  taskENTER_CRITICAL(&cues_spinlock);
+  cue_list_t *unused_list = pending_list;
+  pending_list = list;
+  published_state.cue_count = list->count;
+  taskEXIT_CRITICAL(&cues_spinlock);
+
+  cue_list_free(unused_list);
+  return ESP_OK;
+}
+
+// the button only steps through cues when there are any, otherwise it keeps
+// resetting the state on press
+static bool wants_button() {
+  dmxbox_cues_state_t state;
+  dmxbox_cues_get_state(&state);
+  return state.cue_count;
+}
+
+static bool handle_button() {
+  if (!wants_button()) {
+    return false;
+  }
+
+  ESP_LOGI(TAG, "GO from the button");
+  dmxbox_cues_go();
+  return true;
+}
+
+static void subscribe_to_controls() {
+  uint16_t channels[control_count];
+  size_t channel_count = 0;
+
+  uint16_t go_channel = dmxbox_get_cue_go_channel();
+  if (go_channel) {
+    control_index[control_go] = channel_count;
+    channels[channel_count++] = go_channel;
+  }
+
+  uint16_t back_channel = dmxbox_get_cue_back_channel();
+  if (back_channel) {
+    control_index[control_back] = channel_count;
+    channels[channel_count++] = back_channel;
+  }
+
+  if (!channel_count) {
+    return;
+  }
+
+  esp_err_t ret = dmxbox_artnet_subscribe(
+      dmxbox_get_effect_control_universe(),
+      channels,
+      channel_count,
+      &control_subscription
+  );
+  if (ret != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to subscribe to GO/BACK: %s", esp_err_to_name(ret));
+    control_subscription = NULL;
+    return;
+  }
+
+  // don't fire for levels that were already up at boot
+  if (dmxbox_artnet_subscription_poll(control_subscription, control_values)) {
+    for (int i = 0; i < control_count; i++) {
+      control_pressed[i] = control_index[i] >= 0 &&
+                           control_values[control_index[i]] >=
+                               CONTROL_THRESHOLD;
+    }
+  }
+}
+
+void dmxbox_cues_init() {
+  dmxbox_cues_reload();
+  subscribe_to_controls();
+  dmxbox_artnet_add_button_handler(wants_button, handle_button);
+}
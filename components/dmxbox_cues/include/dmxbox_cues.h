@@ -0,0 +1,27 @@
+#pragma once
+#include <esp_err.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "dmxbox_const.h"
+
+typedef struct dmxbox_cues_state {
+  uint16_t cue_id; // 0 before the first GO
+  uint16_t cue_count;
+  bool fading;
+  uint8_t fade_progress; // 0-255
+} dmxbox_cues_state_t;
+
+void dmxbox_cues_init();
+
+// Reloads the cue list from storage after it has been edited. The playing cue
+// keeps playing.
+esp_err_t dmxbox_cues_reload();
+
+void dmxbox_cues_go();
+void dmxbox_cues_back();
+void dmxbox_cues_get_state(dmxbox_cues_state_t *state);
+
+// Advances cue playback to time_us and merges the cue output into data (HTP).
+// Must always be called from the same task.
+void dmxbox_cues_evaluate(int64_t time_us, uint8_t data[DMX_CHANNEL_COUNT]);
@@ -0,0 +1,175 @@
+#include <esp_attr.h>
+#include <esp_crc.h>
+#include <esp_log.h>
+#include <esp_system.h>
+#include <freertos/FreeRTOS.h>
+#include <string.h>
+
+#include "dmxbox_dmx_rtc.h"
+
+static const char *TAG = "dmx_rtc";
+
+#define RTC_MAGIC 0x43545244 // "DRTC"
+
+// the native universe and the effect control universe
+#define RTC_UNIVERSES 2
+
+typedef struct rtc_frame {
+  uint32_t magic;
+  uint32_t crc;
+  uint8_t data[DMX_PACKET_SIZE_MAX];
+} rtc_frame_t;
+
+typedef struct rtc_universe {
+  uint32_t magic;
+  uint32_t crc; // of the address and the data
+  uint16_t address;
+  uint8_t data[DMX_CHANNEL_COUNT];
+} rtc_universe_t;
+
+RTC_NOINIT_ATTR static rtc_frame_t rtc_frame;
+RTC_NOINIT_ATTR static rtc_universe_t rtc_universes[RTC_UNIVERSES];
+
+// the Art-Net receive tasks of both interfaces save universes
+static portMUX_TYPE universes_spinlock = portMUX_INITIALIZER_UNLOCKED;
+static bool universe_saved[RTC_UNIVERSES]; // since this boot
+
+// validating the frame and clearing it don't race
+static portMUX_TYPE frame_spinlock = portMUX_INITIALIZER_UNLOCKED;
+
+// set by dmxbox_dmx_rtc_clear, under both spinlocks
+static bool cleared = false;
+
+bool dmxbox_dmx_rtc_warm_reset() {
+  switch (esp_reset_reason()) {
+  case ESP_RST_SW:
+  case ESP_RST_PANIC:
+  case ESP_RST_INT_WDT:
+  case ESP_RST_TASK_WDT:
+  case ESP_RST_WDT:
+    return true;
+  default:
+    return false;
+  }
+}
+
+static uint32_t universe_crc(const rtc_universe_t *universe) {
+  uint32_t crc =
+      esp_crc32_le(0, (const uint8_t *)&universe->address, sizeof(uint16_t));
+  return esp_crc32_le(crc, universe->data, DMX_CHANNEL_COUNT);
+}
+
+void dmxbox_dmx_rtc_save_frame(const uint8_t data[DMX_PACKET_SIZE_MAX]) {
+  if (rtc_frame.magic == RTC_MAGIC &&
+      !memcmp(rtc_frame.data, data, DMX_PACKET_SIZE_MAX)) {
+    return;
+  }
+  // invalid until the checksum is in place
+  rtc_frame.magic = 0;
+  memcpy(rtc_frame.data, data, DMX_PACKET_SIZE_MAX);
+  rtc_frame.crc = esp_crc32_le(0, rtc_frame.data, DMX_PACKET_SIZE_MAX);
+  taskENTER_CRITICAL(&frame_spinlock);
+  if (!cleared) {
+    rtc_frame.magic = RTC_MAGIC;
+  }
+  taskEXIT_CRITICAL(&frame_spinlock);
+}
+
+bool dmxbox_dmx_rtc_restore_frame(uint8_t data[DMX_PACKET_SIZE_MAX]) {
+  if (!dmxbox_dmx_rtc_warm_reset() || rtc_frame.magic != RTC_MAGIC) {
+    return false;
+  }
+  if (esp_crc32_le(0, rtc_frame.data, DMX_PACKET_SIZE_MAX) != rtc_frame.crc) {
+    ESP_LOGW(TAG, "saved frame is corrupted");
+    return false;
+  }
+  memcpy(data, rtc_frame.data, DMX_PACKET_SIZE_MAX);
+  return true;
+}
+
+static rtc_universe_t *find_universe(uint16_t address) {
+  for (size_t i = 0; i < RTC_UNIVERSES; i++) {
+    if (rtc_universes[i].magic == RTC_MAGIC &&
+        rtc_universes[i].address == address) {
+      return &rtc_universes[i];
+    }
+  }
+  return NULL;
+}
+
+void dmxbox_dmx_rtc_save_universe(
+    uint16_t address,
+    const uint8_t data[DMX_CHANNEL_COUNT]
+) {
+  taskENTER_CRITICAL(&universes_spinlock);
+  rtc_universe_t *universe = NULL;
+  for (size_t i = 0; i < RTC_UNIVERSES; i++) {
+    if ((universe_saved[i] || rtc_universes[i].magic == RTC_MAGIC) &&
+        rtc_universes[i].address == address) {
+      universe = &rtc_universes[i];
+      break;
+    }
+  }
+  if (!universe) {
+    // slots not saved since this boot belong to universes that are gone
+    for (size_t i = 0; i < RTC_UNIVERSES; i++) {
+      if (!universe_saved[i]) {
+        universe = &rtc_universes[i];
+        break;
+      }
+    }
+  }
+  if (universe) {
+    universe_saved[universe - rtc_universes] = true;
+    universe->magic = 0;
+    universe->address = address;
+    memcpy(universe->data, data, DMX_CHANNEL_COUNT);
+  }
+  taskEXIT_CRITICAL(&universes_spinlock);
+
+  if (!universe) {
+    ESP_LOGW(TAG, "no room to save universe %u", address);
+    return;
+  }
+
+  // the checksum is left out of the critical section, a concurrent save of
+  // the same universe at worst leaves a mismatch that isn't restored
+  uint32_t crc = universe_crc(universe);
+  taskENTER_CRITICAL(&universes_spinlock);
+  if (universe->address == address && !cleared) {
+    universe->crc = crc;
+    universe->magic = RTC_MAGIC;
+  }
+  taskEXIT_CRITICAL(&universes_spinlock);
+}
+
+bool dmxbox_dmx_rtc_restore_universe(
+    uint16_t address,
+    uint8_t data[DMX_CHANNEL_COUNT]
+) {
+  if (!dmxbox_dmx_rtc_warm_reset()) {
+    return false;
+  }
+  rtc_universe_t *universe = find_universe(address);
+  if (!universe) {
+    return false;
+  }
+  if (universe_crc(universe) != universe->crc) {
+    ESP_LOGW(TAG, "saved universe %u is corrupted", address);
+    return false;
+  }
+  memcpy(data, universe->data, DMX_CHANNEL_COUNT);
+  return true;
+}
+
+void dmxbox_dmx_rtc_clear() {
+  taskENTER_CRITICAL(&frame_spinlock);
+  taskENTER_CRITICAL(&universes_spinlock);
+  cleared = true;
+  rtc_frame.magic = 0;
+  for (size_t i = 0; i < RTC_UNIVERSES; i++) {
+    rtc_universes[i].magic = 0;
+  }
+  taskEXIT_CRITICAL(&universes_spinlock);
+  taskEXIT_CRITICAL(&frame_spinlock);
+}
@@ -1,15 +1,16 @@
 #include <esp_log.h>
+#include <esp_timer.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <string.h>
 
 #include "const.h"
 #include "dmxbox_const.h"
+#include "dmxbox_dmx_rtc.h"
 #include "dmxbox_dmx_send.h"
 #include "dmxbox_led.h"
 #include "esp_dmx.h"
 
-#define DMX_SEND_PERIOD 30
 #define DMX_SEND_BACKOFF 200
 
 static const char *TAG = "dmx_send";
@@ -17,6 +18,16 @@ static const char *TAG = "dmx_send";
 portMUX_TYPE dmxbox_dmx_out_spinlock = portMUX_INITIALIZER_UNLOCKED;
 uint8_t dmxbox_dmx_out_data[DMX_PACKET_SIZE_MAX] = {0};
 
+static const int64_t frame_period_us = 1000000 / CONFIG_DMXBOX_DMX_FRAME_RATE;
+
+static portMUX_TYPE frame_spinlock = portMUX_INITIALIZER_UNLOCKED;
+static int64_t next_frame_time_us = 0;
+static TaskHandle_t frame_listener = NULL;
+static int64_t first_frame_time_us = -1;
+
+static TaskHandle_t send_task = NULL;
+static bool resumed = false;
+
 static esp_err_t configure_dmx_out() {
   ESP_LOGI(TAG, "Configuring DMX OUT");
 
@@ -37,19 +48,60 @@ static esp_err_t configure_dmx_out() {
   return ESP_OK;
 }
 
-void dmxbox_dmx_send_task(void *parameter) {
+static void frame_timer_callback(void *arg) {
+  xTaskNotifyGive((TaskHandle_t)arg);
+}
+
+static void frame_sent(int64_t frame_time_us) {
+  taskENTER_CRITICAL(&frame_spinlock);
+  next_frame_time_us = frame_time_us + frame_period_us;
+  TaskHandle_t listener = frame_listener;
+  bool first = first_frame_time_us < 0;
+  if (first) {
+    first_frame_time_us = frame_time_us;
+  }
+  taskEXIT_CRITICAL(&frame_spinlock);
+
+  if (listener) {
+    xTaskNotifyGive(listener);
+  }
+  if (first) {
+    ESP_LOGI(
+        TAG,
+        "First frame sent %lld ms after boot%s",
+        frame_time_us / 1000,
+        resumed ? ", resumed from before the reset" : ""
+    );
+  }
+}
+
+static void dmxbox_dmx_send_task(void *parameter) {
   ESP_LOGI(TAG, "DMX send task started");
 
   ESP_ERROR_CHECK(configure_dmx_out());
 
-  TickType_t xLastWakeTime = xTaskGetTickCount();
+  // the tick rate is too coarse for frame rates like 44 Hz
+  const esp_timer_create_args_t frame_timer_args = {
+      .callback = frame_timer_callback,
+      .arg = xTaskGetCurrentTaskHandle(),
+      .name = "DMX frame",
+  };
+  esp_timer_handle_t frame_timer;
+  ESP_ERROR_CHECK(esp_timer_create(&frame_timer_args, &frame_timer));
+  ESP_ERROR_CHECK(esp_timer_start_periodic(frame_timer, frame_period_us));
+
+  uint8_t frame[DMX_PACKET_SIZE_MAX];
   while (1) {
-    // write the packet to the DMX driver
     taskENTER_CRITICAL(&dmxbox_dmx_out_spinlock);
-    size_t bytes_written =
-        dmx_write(DMX_OUT_NUM, dmxbox_dmx_out_data, DMX_PACKET_SIZE_MAX);
+    memcpy(frame, dmxbox_dmx_out_data, DMX_PACKET_SIZE_MAX);
     taskEXIT_CRITICAL(&dmxbox_dmx_out_spinlock);
 
+    // kept so that a warm reset can carry on from here
+    dmxbox_dmx_rtc_save_frame(frame);
+
+    // write the packet to the DMX driver
+    size_t bytes_written = dmx_write(DMX_OUT_NUM, frame, DMX_PACKET_SIZE_MAX);
+
     if (bytes_written == 0) {
       ESP_LOGE(TAG, "Unable to write DMX data");
       vTaskDelay(DMX_SEND_BACKOFF / portTICK_PERIOD_MS);
@@ -64,7 +116,9 @@ void dmxbox_dmx_send_task(void *parameter) {
       continue;
     }
 
-    vTaskDelayUntil(&xLastWakeTime, DMX_SEND_PERIOD / portTICK_PERIOD_MS);
+    frame_sent(esp_timer_get_time());
+
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
 
     // block until the packet is done being sent
     if (!dmx_wait_sent(DMX_OUT_NUM, DMX_TIMEOUT_TICK)) {
@@ -75,6 +129,45 @@ void dmxbox_dmx_send_task(void *parameter) {
   }
 }
 
+void dmxbox_dmx_send_start() {
+  if (send_task) {
+    return;
+  }
+  xTaskCreate(dmxbox_dmx_send_task, "DMX send", 10000, NULL, 5, &send_task);
+}
+
+bool dmxbox_dmx_send_resume() {
+  if (!dmxbox_dmx_rtc_restore_frame(dmxbox_dmx_out_data)) {
+    return false;
+  }
+  ESP_LOGI(TAG, "Resuming output after a warm reset");
+  resumed = true;
+  dmxbox_dmx_send_start();
+  return true;
+}
+
+bool dmxbox_dmx_send_resumed() { return resumed; }
+
+int64_t dmxbox_dmx_send_get_first_frame_time() {
+  taskENTER_CRITICAL(&frame_spinlock);
+  int64_t result = first_frame_time_us;
+  taskEXIT_CRITICAL(&frame_spinlock);
+  return result;
+}
+
+int64_t dmxbox_dmx_send_get_next_frame_time() {
+  taskENTER_CRITICAL(&frame_spinlock);
+  int64_t result = next_frame_time_us;
+  taskEXIT_CRITICAL(&frame_spinlock);
+  return result;
+}
+
+void dmxbox_dmx_send_set_frame_listener(TaskHandle_t task) {
+  taskENTER_CRITICAL(&frame_spinlock);
+  frame_listener = task;
+  taskEXIT_CRITICAL(&frame_spinlock);
+}
+
 static bool dmx_out_active = false;
 
 void dmxbox_set_dmx_out_active(bool state) {
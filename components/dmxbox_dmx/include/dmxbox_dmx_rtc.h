@@ -0,0 +1,30 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "dmxbox_const.h"
+#include "esp_dmx.h"
+
+// Copies of the last output frame and the Art-Net universes in RTC memory,
+// which keeps its contents through a crash, watchdog or software reset. They
+// are only restored after one of those, and only if their checksum matches,
+// so a reset in the middle of a save just loses that copy.
+
+bool dmxbox_dmx_rtc_warm_reset();
+
+void dmxbox_dmx_rtc_save_frame(const uint8_t data[DMX_PACKET_SIZE_MAX]);
+bool dmxbox_dmx_rtc_restore_frame(uint8_t data[DMX_PACKET_SIZE_MAX]);
+
+void dmxbox_dmx_rtc_save_universe(
+    uint16_t address,
+    const uint8_t data[DMX_CHANNEL_COUNT]
+);
+bool dmxbox_dmx_rtc_restore_universe(
+    uint16_t address,
+    uint8_t data[DMX_CHANNEL_COUNT]
+);
+
+// Invalidates the copies and stops saving new ones for the rest of this boot,
+// so that the next boot starts dark even after a software reset. For a
+// factory reset.
+void dmxbox_dmx_rtc_clear();
@@ -1,10 +1,38 @@
 #pragma once
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <stdint.h>
+
 #include "dmxbox_const.h"
 #include "esp_dmx.h"
 
+// DMX output frames per second. A full 512-slot frame allows at most 44.
+#ifndef CONFIG_DMXBOX_DMX_FRAME_RATE
+#define CONFIG_DMXBOX_DMX_FRAME_RATE 33
+#endif
+
 extern portMUX_TYPE dmxbox_dmx_out_spinlock;
 extern uint8_t dmxbox_dmx_out_data[DMX_PACKET_SIZE_MAX];
 
-void dmxbox_dmx_send_task(void *parameter);
+// starts the send task, unless dmxbox_dmx_send_resume already did
+void dmxbox_dmx_send_start();
+
+// After a warm reset, starts sending the frame that was last sent before it,
+// so the output doesn't black out while the rest of the system boots. Must be
+// called before anything else writes dmxbox_dmx_out_data. Returns false if
+// there's no intact frame to resume from.
+bool dmxbox_dmx_send_resume();
+bool dmxbox_dmx_send_resumed();
+
+// esp_timer time at which the first frame since boot was sent, -1 until then
+int64_t dmxbox_dmx_send_get_first_frame_time();
+
 void dmxbox_set_dmx_out_active(bool state);
 void dmxbox_dmx_send_get_data(uint8_t data[DMX_CHANNEL_COUNT]);
+
+// esp_timer time at which the next frame will start being sent
+int64_t dmxbox_dmx_send_get_next_frame_time();
+
+// The task gets a notification (xTaskNotifyGive) right after each frame is
+// handed to the driver, leaving a full frame period to prepare the next one.
+void dmxbox_dmx_send_set_frame_listener(TaskHandle_t task);
@@ -1,4 +1,5 @@
 #include <esp_log.h>
+#include <esp_mac.h>
 #include <esp_timer.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/event_groups.h>
@@ -10,18 +11,25 @@
 
 #include "dmxbox_artnet.h"
 #include "dmxbox_const.h"
+#include "dmxbox_dmx_send.h"
 #include "dmxbox_effects.h"
 #include "dmxbox_espnow.h"
 #include "dmxbox_storage.h"
+#include "dmxbox_tempo.h"
+#include "dmxbox_timecode.h"
 #include "effect_storage.h"
+#include "election.h"
+#include "engine.h"
 #include "esp_err.h"
+#include "show.h"
 
 static const char *TAG = "effects";
 
-#define EFFECTS_PERIOD 30
-// #define EFFECTS_PERIOD 300
 #define LOG_DMX_DATA false
 
+// how long a frame aligned tick waits for a frame before running anyway
+#define FRAME_WAIT_TIMEOUT 100
+
 #define SYNC_QUEUE_SIZE 50
 #define SYNC_QUEUE_MAX_DELAY 15
 
@@ -29,175 +37,84 @@ static const char *TAG = "effects";
 #define MAX(x, y) ((x) > (y) ? (x) : (y))
 #endif
 
-static const uint32_t us_per_ms = 1000;
-
-static const uint8_t default_effect_rate_raw = 127;
-
 static uint16_t effect_control_universe_address = 0;
 
-static const uint32_t distributed_sync_period_us = 10000 * us_per_ms;
+_Static_assert(
+    ELECTION_MAC_LEN == DMXBOX_ESPNOW_MAC_LEN,
+    "elections identify boxes by their ESP-NOW MAC"
+);
 
 typedef struct effect_state_sync_event {
+  uint8_t mac[DMXBOX_ESPNOW_MAC_LEN];
+  uint8_t priority;
   uint16_t effect_id;
   uint8_t level;
   uint8_t rate_raw;
-  double progress;
+  double phase; // position in the cycle, from 0 to 1
   bool first_pass;
+  int64_t leader_time_us; // shared clock, 0 if unknown
   int64_t receive_time_us;
 } effect_state_sync_event_t;
 
-typedef struct step_channel {
-  struct step_channel *next;
-
-  uint16_t channel;
-  uint8_t level;
-} step_channel_t;
-
-typedef struct step {
-  struct step *next;
-
-  uint32_t time;
-  uint32_t in;
-  uint32_t dwell;
-  uint32_t out;
-
-  struct step_channel *channels_head;
-
-  // precalculated values
-  uint32_t offset_us;
-} step_t;
-
-typedef struct effect_distributed_state {
-  bool is_leader;
-
-  uint8_t last_level;
-  uint8_t last_rate_raw;
-  uint64_t last_sync_us;
-} effect_distributed_state_t;
-
-typedef struct effect {
-  struct effect *next;
-
-  uint16_t id;
-  uint16_t level_channel;
-  uint16_t rate_channel;
-  bool distributed;
-  bool distributed_id;
+static engine_t engine;
 
-  step_t *steps_head;
-
-  // precalculated values
-  uint32_t effect_length_us;
-
-  // internal state
-  bool active;
-  double progress;
-  bool first_pass;
-
-  effect_distributed_state_t distributed_state;
-} effect_t;
-
-static step_channel_t *step_channel_alloc() {
-  return calloc(1, sizeof(step_channel_t));
-}
-
-static void step_channel_free(step_channel_t *data) { free(data); }
-
-static step_t *step_alloc() { return calloc(1, sizeof(step_t)); }
-
-static void step_free(step_t *step) {
-  step_channel_t *channel = step->channels_head;
-  while (channel) {
-    step_channel_t *current_channel = channel;
-    channel = channel->next;
-    step_channel_free(current_channel);
-  }
-
-  free(step);
-}
+static portMUX_TYPE tick_listener_spinlock = portMUX_INITIALIZER_UNLOCKED;
+static TaskHandle_t tick_listener = NULL;
 
-static effect_t *effect_alloc() { return calloc(1, sizeof(effect_t)); }
-
-static void effect_free(effect_t *effect) {
-  step_t *step = effect->steps_head;
-  while (step) {
-    step_t *current_step = step;
-    step = step->next;
-    step_free(current_step);
-  }
-  free(effect);
-}
-
-static effect_t *effects_head = NULL;
+static dmxbox_artnet_subscription_t *control_subscription = NULL;
+static uint8_t *control_values = NULL;
 
 // Synchronizes module output
 portMUX_TYPE dmxbox_effects_spinlock = portMUX_INITIALIZER_UNLOCKED;
 
 uint8_t dmxbox_effects_data[DMX_CHANNEL_COUNT] = {0};
 
-double rate_from_fader_level[UINT8_MAX + 1];
-
 static QueueHandle_t effect_state_sync_queue;
 
-static uint32_t ms_to_us(uint32_t value) { return value * us_per_ms; }
-
-static uint32_t get_step_in_end_us(step_t *step) { return ms_to_us(step->in); }
-
-static uint32_t get_step_dwell_end_us(step_t *step) {
-  return ms_to_us(step->in + step->dwell);
-}
-
-static uint32_t get_step_out_end_us(step_t *step) {
-  return ms_to_us(step->in + step->dwell + step->out);
-}
-
-static double get_rate_from_fader_level(uint8_t level) {
-  if (level == 0) {
-    return 0;
-  }
-
-  // 2^((x - 127) / 30.035) * 104.5 - 4.5 works out to:
-  // around 1 at x=1
-  // 100 at x=127
-  // around 2000 at x=255
-  return (pow(2, ((double)level - 127) / 30.035) * 1.045 - .045);
-}
-
 static void distributed_follower_callback(
-    uint16_t effect_id,
-    uint8_t level,
-    uint8_t rate_raw,
-    double progress,
-    bool first_pass
+    const uint8_t mac[DMXBOX_ESPNOW_MAC_LEN],
+    const dmxbox_espnow_effect_state_t *states,
+    size_t count,
+    int64_t leader_time_us,
+    int64_t receive_time_us
 ) {
-  effect_state_sync_event_t event = {
-      .effect_id = effect_id,
-      .level = level,
-      .rate_raw = rate_raw,
-      .progress = progress,
-      .first_pass = first_pass,
-      .receive_time_us = esp_timer_get_time(),
-  };
-
-  if (xQueueSend(
-          effect_state_sync_queue,
-          &event,
-          SYNC_QUEUE_MAX_DELAY / portTICK_PERIOD_MS
-      ) != pdTRUE) {
-    ESP_LOGW(TAG, "Failed to enqueue sync event for effect %d", effect_id);
+  for (size_t i = 0; i < count; i++) {
+    const dmxbox_espnow_effect_state_t *state = &states[i];
+    effect_state_sync_event_t event = {
+        .priority = state->priority,
+        .effect_id = state->effect_id,
+        .level = state->level,
+        .rate_raw = state->rate_raw,
+        .phase = state->phase,
+        .first_pass = state->first_pass,
+        .leader_time_us = leader_time_us,
+        .receive_time_us = receive_time_us,
+    };
+    memcpy(event.mac, mac, DMXBOX_ESPNOW_MAC_LEN);
+
+    if (xQueueSend(
+            effect_state_sync_queue,
+            &event,
+            SYNC_QUEUE_MAX_DELAY / portTICK_PERIOD_MS
+        ) != pdTRUE) {
+      ESP_LOGW(
+          TAG,
+          "Failed to enqueue sync event for effect %d",
+          state->effect_id
+      );
+    }
   }
 }
 
 void create_sample_effect_if_needed() {
   dmxbox_storage_entry_t effects[1];
   uint16_t count = sizeof(effects) / sizeof(effects[0]);
-  if (dmxbox_effect_list(0, &count, effects) != ESP_OK) {
+  if (dmxbox_effect_list_ids(0, &count, effects) != ESP_OK) {
     ESP_LOGE(TAG, "Failed to list effects");
     return;
   }
 
   if (count) {
-    free(effects[0].data);
     return;
   }
 
@@ -298,254 +215,101 @@ void create_sample_effect_if_needed() {
   free(step3);
 }
 
-void prepare_loaded_effect(effect_t *effect) {
-  effect->active = false;
-  effect->distributed_state.is_leader = false;
-  effect->distributed_state.last_sync_us = 0;
+static void subscribe_to_control_channels() {
+  // every effect has at most two control channels
+  size_t max_channel_count = engine.show.effect_count * 2;
+  if (!max_channel_count) {
+    return;
+  }
 
-  uint32_t current_offset_us = 0;
+  uint16_t *channels = calloc(max_channel_count, sizeof(uint16_t));
+  if (!channels) {
+    ESP_LOGE(TAG, "Failed to allocate control channels");
+    return;
+  }
 
-  int step_number = 1;
-  for (step_t *step = effect->steps_head; step;
-       step = step->next, step_number++) {
-    if ((step->in == 0) && (step->dwell == 0) && (step->out == 0)) {
-      step->dwell = step->time;
-    }
+  size_t channel_count = engine_assign_controls(&engine, channels);
+  control_values = calloc(channel_count, sizeof(uint8_t));
+  if (!control_values) {
+    ESP_LOGE(TAG, "Failed to allocate control values");
+    free(channels);
+    return;
+  }
 
-    step->offset_us = current_offset_us;
-    current_offset_us += ms_to_us(step->time);
+  esp_err_t ret = dmxbox_artnet_subscribe(
+      effect_control_universe_address,
+      channels,
+      channel_count,
+      &control_subscription
+  );
+  if (ret != ESP_OK) {
+    ESP_LOGE(
+        TAG,
+        "Failed to subscribe to control universe %d: %s",
+        effect_control_universe_address,
+        esp_err_to_name(ret)
+    );
+    control_subscription = NULL;
+  } else {
+    ESP_LOGI(TAG, "Subscribed to %d control channels", channel_count);
   }
 
-  effect->effect_length_us = current_offset_us;
+  free(channels);
 }
 
-effect_t *load_effect(uint16_t effect_id, dmxbox_effect_t *effect_data) {
-  ESP_LOGI(TAG, "Loading effect %d (%s)", effect_id, effect_data->name);
-
-  effect_t *effect = effect_alloc();
-  effect->id = effect_id;
-  effect->level_channel = effect_data->level_channel.index;
-  effect->rate_channel = effect_data->rate_channel.index;
-  effect->distributed = effect_data->distributed_id != 0;
-  effect->distributed_id = effect_data->distributed_id;
-
-  step_t *steps_tail = NULL;
-  for (int i = 0; i < effect_data->step_count; i++) {
-    uint16_t step_id = effect_data->steps[i];
-
-    ESP_LOGI(TAG, "step %d", step_id);
-
-    dmxbox_effect_step_t *step_data;
-    esp_err_t ret = (dmxbox_effect_step_get(effect_id, step_id, &step_data));
-    if (ret == ESP_ERR_NOT_FOUND) {
-      ESP_LOGW(
-          TAG,
-          "step %d not found, skipping effect %d",
-          step_id,
-          effect_id
-      );
-      effect_free(effect);
-      return NULL;
-    }
-    ESP_ERROR_CHECK(ret);
-
-    step_t *step = step_alloc();
-    step->time = step_data->time;
-    step->in = step_data->in;
-    step->dwell = step_data->dwell;
-    step->out = step_data->out;
-
-    ESP_LOGI(TAG, "step %d time = %d", step_id, (int)step->time);
-    ESP_LOGI(TAG, "step %d in = %d", step_id, (int)step->in);
-    ESP_LOGI(TAG, "step %d dwell = %d", step_id, (int)step->dwell);
-    ESP_LOGI(TAG, "step %d out = %d", step_id, (int)step->out);
-
-    step_channel_t *channels_tail = NULL;
-    for (size_t i = 0; i < step_data->channel_count; i++) {
-      step_channel_t *channel = step_channel_alloc();
-      channel->channel = step_data->channels[i].channel.index;
-      channel->level = step_data->channels[i].level;
-
-      ESP_LOGI(
-          TAG,
-          "step %d channel %d: %d @ %d",
-          step_id,
-          i,
-          channel->channel,
-          channel->level
-      );
-
-      if (channels_tail) {
-        channels_tail->next = channel;
-        channels_tail = channel;
-      } else {
-        step->channels_head = channels_tail = channel;
-      }
-    }
-
-    if (steps_tail) {
-      steps_tail->next = step;
-      steps_tail = step;
-    } else {
-      effect->steps_head = steps_tail = step;
+// the button taps the tempo while any effect follows it
+static bool wants_button() {
+  for (size_t i = 0; i < engine.show.effect_count; i++) {
+    if (engine.show.effects[i].beats) {
+      return true;
     }
-
-    free(step_data);
   }
-
-  prepare_loaded_effect(effect);
-
-  return effect;
+  return false;
 }
 
-effect_t *load_effects_from_storage() {
-  effect_t *head = NULL;
-  effect_t *tail = NULL;
-
-  dmxbox_storage_entry_t effects[10];
-  const uint16_t buffer_length = sizeof(effects) / sizeof(effects[0]);
-
-  uint16_t count;
-  uint16_t skip = 0;
-
-  do {
-    count = buffer_length;
-    if (dmxbox_effect_list(skip, &count, effects) != ESP_OK) {
-      ESP_LOGE(TAG, "Failed to list effects");
-      return head;
-    }
-
-    ESP_LOGI(TAG, "Loading %d effects", count);
-
-    skip += count;
-
-    for (size_t i = 0; i < count; i++) {
-      uint16_t effect_id = effects[i].id;
-      dmxbox_effect_t *effect_data = effects[i].data;
-
-      effect_t *effect = load_effect(effect_id, effect_data);
-      free(effect_data);
-
-      if (tail) {
-        tail->next = effect;
-        tail = effect;
-      } else {
-        head = tail = effect;
-      }
-    }
-  } while (count == buffer_length);
-
-  return head;
+static bool handle_button() {
+  if (!wants_button()) {
+    return false;
+  }
+  ESP_LOGI(TAG, "Tempo tap from the button");
+  dmxbox_tempo_tap(esp_timer_get_time());
+  return true;
 }
 
 void dmxbox_effects_init() {
-  for (int i = 0; i <= UINT8_MAX; i++) {
-    rate_from_fader_level[i] = get_rate_from_fader_level(i);
-  }
+  engine_init_tables();
 
   create_sample_effect_if_needed();
 
   effect_control_universe_address = dmxbox_get_effect_control_universe();
-  effects_head = load_effects_from_storage();
+  show_load(&engine.show);
+  if (!engine_start(&engine)) {
+    ESP_LOGE(TAG, "Running without effects");
+    engine_stop(&engine);
+  }
+  subscribe_to_control_channels();
+  dmxbox_artnet_add_button_handler(wants_button, handle_button);
 
   effect_state_sync_queue =
       xQueueCreate(SYNC_QUEUE_SIZE, sizeof(effect_state_sync_event_t));
   dmxbox_espnow_register_effect_state_callback(distributed_follower_callback);
 }
 
-static uint8_t multiply_levels(uint8_t level1, uint8_t level2) {
-  if (level1 == 255)
-    return level2;
-  if (level2 == 255)
-    return level1;
-  if (level1 == 0)
-    return 0;
-  if (level2 == 0)
-    return 0;
-
-  return (uint8_t)(level1 * level2 / 255);
-}
-
-static void advance_chase_effect_progress(
-    effect_t *effect,
-    uint8_t rate_raw,
-    int64_t time_increment_us
-) {
-  effect->progress += (time_increment_us * rate_from_fader_level[rate_raw]);
-
-  if (effect->effect_length_us <= effect->progress) {
-    effect->first_pass = false;
-    effect->progress -= (int)(effect->progress / effect->effect_length_us) *
-                        effect->effect_length_us;
-  }
-}
-
-static void process_chase_effect(
-    uint8_t tick_data[DMX_CHANNEL_COUNT],
-    effect_t *effect,
-    uint8_t effect_level,
-    uint8_t rate_raw,
-    int64_t time_increment_us
-) {
-  advance_chase_effect_progress(effect, rate_raw, time_increment_us);
-
-  int step_number = 1;
-  for (step_t *step = effect->steps_head; step;
-       step = step->next, step_number++) {
-
-    double progress_in_step = effect->progress - step->offset_us;
-
-    if (progress_in_step < 0 && !effect->first_pass) {
-      // There might be overlapping steps from the previous pass
-      progress_in_step += effect->effect_length_us;
-    }
-
-    if (progress_in_step <= 0) {
-      continue; // too early
-    }
-
-    if (get_step_out_end_us(step) <= progress_in_step) {
-      continue; // too late
-    }
-
-    uint8_t step_fade_level = 0;
-    if (progress_in_step < get_step_in_end_us(step)) {
-      step_fade_level = (uint8_t)(255 * progress_in_step / ms_to_us(step->in));
-    } else if (progress_in_step < get_step_dwell_end_us(step)) {
-      step_fade_level = 255;
-    } else if (progress_in_step < get_step_out_end_us(step)) {
-      step_fade_level =
-          (uint8_t)(255 -
-                    (255 * (progress_in_step - get_step_dwell_end_us(step)) /
-                     ms_to_us(step->out)));
-    }
-
-    uint8_t step_fade_level_adjusted =
-        multiply_levels(effect_level, step_fade_level);
-
-    for (step_channel_t *channel = step->channels_head; channel;
-         channel = channel->next) {
-      uint16_t channel_index = channel->channel - 1;
-
-      uint8_t level = multiply_levels(step_fade_level_adjusted, channel->level);
-      tick_data[channel_index] = MAX(tick_data[channel_index], level);
-    }
-  }
-}
-
 static bool should_send_sync(
     effect_distributed_state_t *state,
     uint8_t level,
     uint8_t rate_raw,
+    uint8_t priority,
     int64_t current_time_us
 ) {
   // Sync on parameter change
-  if (state->last_level != level || state->last_rate_raw != rate_raw) {
+  if (state->last_level != level || state->last_rate_raw != rate_raw ||
+      state->last_priority != priority) {
     return true;
   }
 
-  // Sync periodicallyj
-  if ((state->last_sync_us + distributed_sync_period_us) < current_time_us) {
+  // Heartbeat
+  if ((state->last_sync_us + ELECTION_HEARTBEAT_US) < current_time_us) {
     return true;
   }
 
@@ -556,23 +320,31 @@ static void handle_distributed_leader(
     effect_t *effect,
     uint8_t level,
     uint8_t rate_raw,
-    int64_t current_time_us
+    uint8_t priority,
+    const engine_input_t *input
 ) {
   effect_distributed_state_t *state = &effect->distributed_state;
-
-  if (should_send_sync(state, level, rate_raw, current_time_us)) {
-    dmxbox_espnow_send_effect_state(
-        effect->distributed_id,
-        level,
-        rate_raw,
-        effect->progress,
-        effect->first_pass
-    );
+  int64_t current_time_us = input->current_time_us;
+
+  if (should_send_sync(state, level, rate_raw, priority, current_time_us)) {
+    // sent along with the other effects' states at the end of the tick
+    dmxbox_espnow_effect_state_t effect_state = {
+        .effect_id = effect->distributed_id,
+        .level = level,
+        .rate_raw = rate_raw,
+        .phase = effect->effect_length_us
+                     ? effect->progress / effect->effect_length_us
+                     : 0,
+        .first_pass = effect->first_pass,
+        .priority = priority,
+    };
+    dmxbox_espnow_add_effect_state(&effect_state);
     state->last_sync_us = current_time_us;
   }
 
   state->last_level = level;
   state->last_rate_raw = rate_raw;
+  state->last_priority = priority;
 }
 
 static void handle_distributed_follower(
@@ -589,67 +361,53 @@ static void handle_distributed_effect(
     effect_t *effect,
     uint8_t *level,
     uint8_t *rate_raw,
-    int64_t current_time_us
+    const engine_input_t *input
 ) {
   effect_distributed_state_t *state = &effect->distributed_state;
-
-  if (*level != 0) {
-    if (!state->is_leader) {
-      ESP_LOGI(
-          TAG,
-          "Switching to leader role for effect %d",
-          effect->distributed_id
-      );
-    }
-    state->is_leader = true;
-  }
-  if (state->is_leader) {
-    handle_distributed_leader(effect, *level, *rate_raw, current_time_us);
-  } else {
-    handle_distributed_follower(effect, level, rate_raw);
+  election_t *election = &state->election;
+
+  switch (election_tick(
+      election,
+      dmxbox_espnow_get_mac(),
+      *level != 0,
+      input->current_time_us
+  )) {
+  case election_leader_lost:
+    ESP_LOGW(
+        TAG,
+        "Leader of effect %d timed out, going by local faders",
+        effect->distributed_id
+    );
+    break;
+  case election_elected:
+    ESP_LOGI(
+        TAG,
+        "Switching to leader role for effect %d",
+        effect->distributed_id
+    );
+    // the progress carries on from following, and is sent right away
+    state->last_sync_us = 0;
+    break;
+  default:
+    break;
   }
-}
 
-static void process_effect(
-    uint8_t tick_data[DMX_CHANNEL_COUNT],
-    effect_t *effect,
-    uint8_t effect_level,
-    uint8_t rate_raw,
-    int64_t current_time_us,
-    int64_t time_increment_us
-) {
-  if (effect->distributed) {
-    handle_distributed_effect(
+  if (election->is_leader) {
+    handle_distributed_leader(
         effect,
-        &effect_level,
-        &rate_raw,
-        current_time_us
+        *level,
+        *rate_raw,
+        election->priority,
+        input
     );
+  } else if (election->has_leader) {
+    handle_distributed_follower(effect, level, rate_raw);
   }
-
-  if (effect_level == 0) {
-    effect->active = false;
-    return;
-  }
-
-  if (!effect->active) {
-    effect->active = true;
-    effect->progress = 0;
-    effect->first_pass = true;
-    time_increment_us = 0; // Start from beginning
-  }
-
-  process_chase_effect(
-      tick_data,
-      effect,
-      effect_level,
-      rate_raw,
-      time_increment_us
-  );
 }
 
 static effect_t *find_effect_by_distributed_id(uint16_t distributed_id) {
-  for (effect_t *effect = effects_head; effect; effect = effect->next) {
+  for (size_t i = 0; i < engine.show.effect_count; i++) {
+    effect_t *effect = &engine.show.effects[i];
     if (effect->distributed_id == distributed_id) {
       return effect;
     }
@@ -663,8 +421,8 @@ void handle_sync_queue(int64_t current_time_us, int64_t time_increment_us) {
   while (xQueueReceive(effect_state_sync_queue, &event, 0) == pdTRUE) {
     effect_t *effect = find_effect_by_distributed_id(event.effect_id);
 
-    if (!effect->distributed) {
-      ESP_LOGW(
+    if (!effect || !effect->distributed) {
+      ESP_LOGD(
           TAG,
           "Got sync info for non-distributed effect %d",
           event.effect_id
@@ -672,56 +430,105 @@ void handle_sync_queue(int64_t current_time_us, int64_t time_increment_us) {
       continue;
     }
 
-    if (effect->distributed_state.is_leader) {
-      ESP_LOGW(TAG, "Got sync info for a leader (effect %d)", event.effect_id);
+    effect_distributed_state_t *state = &effect->distributed_state;
+    election_t *election = &state->election;
+
+    // how far off we were from the leader we've been following
+    bool measure =
+        election->has_leader && effect->active &&
+        !memcmp(event.mac, election->leader_mac, DMXBOX_ESPNOW_MAC_LEN);
+    double previous_progress = effect->progress;
+
+    bool yielded;
+    if (!election_hear(
+            election,
+            dmxbox_espnow_get_mac(),
+            event.mac,
+            event.priority,
+            event.receive_time_us,
+            &yielded
+        )) {
       continue;
     }
+    if (yielded) {
+      ESP_LOGI(
+          TAG,
+          "Handing effect %d over to " MACSTR,
+          event.effect_id,
+          MAC2STR(event.mac)
+      );
+    }
 
-    effect->distributed_state.last_level = event.level;
-    effect->distributed_state.last_rate_raw = event.rate_raw;
-    effect->progress = event.progress;
+    state->last_level = event.level;
+    state->last_rate_raw = event.rate_raw;
+    effect->progress = event.phase * effect->effect_length_us;
     effect->first_pass = event.first_pass;
 
-    // Account for time elapsed since we got the event
-    if (event.receive_time_us < current_time_us) {
-      advance_chase_effect_progress(
-          effect,
-          event.rate_raw,
-          current_time_us - event.receive_time_us
-      );
+    // When the leader's progress was current, as far as we can tell. Going
+    // by when it arrived leaves the radio latency (and its jitter) in.
+    int64_t leader_time_us = event.receive_time_us;
+    if (event.leader_time_us && dmxbox_espnow_time_synced()) {
+      leader_time_us = dmxbox_espnow_to_local_time(event.leader_time_us);
+    }
+
+    // Catch up to where the leader is at the frame just computed
+    int64_t elapsed_us = current_time_us - leader_time_us;
+    if (elapsed_us > 0) {
+      engine_advance_progress(effect, event.rate_raw, elapsed_us);
+    } else if (elapsed_us < 0 && effect->effect_length_us) {
+      // the leader is running a bit ahead of us
+      effect->progress += elapsed_us * rate_from_fader_level[event.rate_raw];
+      effect->progress = fmod(effect->progress, effect->effect_length_us);
+      if (effect->progress < 0) {
+        effect->progress += effect->effect_length_us;
+      }
+    }
+
+    double rate = rate_from_fader_level[event.rate_raw];
+    if (measure && effect->effect_length_us && rate > 0) {
+      // the shorter way around the cycle
+      double length = effect->effect_length_us;
+      double error = fmod(previous_progress - effect->progress, length);
+      if (error >= length / 2) {
+        error -= length;
+      } else if (error < -length / 2) {
+        error += length;
+      }
+      dmxbox_espnow_record_phase_error((int32_t)(error / rate));
     }
   }
 }
 
 static void
 dmxbox_effects_tick(int64_t current_time_us, int64_t time_increment_us) {
-  uint8_t control_data[DMX_CHANNEL_COUNT] = {0};
-  dmxbox_artnet_get_universe_data(
-      effect_control_universe_address,
-      control_data
-  );
+  dmxbox_tempo_update();
 
-  uint8_t tick_data[DMX_CHANNEL_COUNT] = {0};
-  for (effect_t *effect = effects_head; effect; effect = effect->next) {
-    uint8_t effect_level = 0;
-    uint8_t rate_raw = default_effect_rate_raw;
+  if (control_subscription) {
+    dmxbox_artnet_subscription_poll(control_subscription, control_values);
+  }
 
-    if (effect->level_channel) {
-      effect_level = control_data[effect->level_channel - 1];
-    }
-    if (effect->rate_channel) {
-      rate_raw = control_data[effect->rate_channel - 1];
-    }
+  engine_input_t input = {
+      .current_time_us = current_time_us,
+      .time_increment_us = time_increment_us,
+      .control_values = control_subscription ? control_values : NULL,
+      .beats = dmxbox_tempo_get_beats(current_time_us),
+      .distribute = handle_distributed_effect,
+  };
+  input.timecode = dmxbox_timecode_get(current_time_us, &input.show_time_us) !=
+                   dmxbox_timecode_none;
+
+  // The progress of the effects is still that of the previous frame while
+  // their states are collected, this one hasn't been advanced to yet
+  int64_t progress_time_us = current_time_us - time_increment_us;
+  dmxbox_espnow_begin_effect_states(
+      dmxbox_espnow_time_synced()
+          ? dmxbox_espnow_get_shared_time(progress_time_us)
+          : 0
+  );
 
-    process_effect(
-        tick_data,
-        effect,
-        effect_level,
-        rate_raw,
-        current_time_us,
-        time_increment_us
-    );
-  }
+  uint8_t tick_data[DMX_CHANNEL_COUNT];
+  engine_tick(&engine, &input, tick_data);
+  dmxbox_espnow_flush_effect_states();
 
   if (LOG_DMX_DATA) {
     ESP_LOG_BUFFER_HEX(TAG, tick_data, 16);
@@ -734,18 +541,73 @@ dmxbox_effects_tick(int64_t current_time_us, int64_t time_increment_us) {
   handle_sync_queue(current_time_us, time_increment_us);
 }
 
+static void tick_timer_callback(void *arg) {
+  xTaskNotifyGive((TaskHandle_t)arg);
+}
+
+static void start_tick_source() {
+  if (CONFIG_DMXBOX_EFFECTS_FRAME_ALIGNED) {
+    ESP_LOGI(TAG, "Evaluating effects at DMX frame times");
+    dmxbox_dmx_send_set_frame_listener(xTaskGetCurrentTaskHandle());
+    return;
+  }
+
+  ESP_LOGI(TAG, "Evaluating effects at %d Hz", CONFIG_DMXBOX_EFFECTS_RATE);
+  const esp_timer_create_args_t tick_timer_args = {
+      .callback = tick_timer_callback,
+      .arg = xTaskGetCurrentTaskHandle(),
+      .name = "Effect tick",
+  };
+  esp_timer_handle_t tick_timer;
+  ESP_ERROR_CHECK(esp_timer_create(&tick_timer_args, &tick_timer));
+  ESP_ERROR_CHECK(
+      esp_timer_start_periodic(tick_timer, 1000000 / CONFIG_DMXBOX_EFFECTS_RATE)
+  );
+}
+
+// Returns the time the tick should be evaluated for
+static int64_t wait_for_tick() {
+  if (!CONFIG_DMXBOX_EFFECTS_FRAME_ALIGNED) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    return esp_timer_get_time();
+  }
+
+  // evaluate for the instant the next frame starts going out
+  if (ulTaskNotifyTake(pdTRUE, FRAME_WAIT_TIMEOUT / portTICK_PERIOD_MS)) {
+    int64_t next_frame_time_us = dmxbox_dmx_send_get_next_frame_time();
+    if (next_frame_time_us) {
+      return next_frame_time_us;
+    }
+  }
+  return esp_timer_get_time();
+}
+
 void dmxbox_effects_task(void *parameter) {
-  TickType_t xLastWakeTime = xTaskGetTickCount();
+  start_tick_source();
+
   int64_t last_time_us = esp_timer_get_time();
-  int64_t current_time_us = last_time_us;
 
   while (1) {
-    dmxbox_effects_tick(current_time_us, current_time_us - last_time_us);
-    vTaskDelayUntil(&xLastWakeTime, EFFECTS_PERIOD / portTICK_PERIOD_MS);
-
-    last_time_us = current_time_us;
-    current_time_us = esp_timer_get_time();
+    int64_t current_time_us = wait_for_tick();
+
+    // a timed out wait can fall behind a previously predicted frame time
+    int64_t time_increment_us = MAX(current_time_us - last_time_us, 0);
+    dmxbox_effects_tick(current_time_us, time_increment_us);
+    last_time_us = MAX(current_time_us, last_time_us);
+
+    taskENTER_CRITICAL(&tick_listener_spinlock);
+    TaskHandle_t listener = tick_listener;
+    taskEXIT_CRITICAL(&tick_listener_spinlock);
+    if (listener) {
+      xTaskNotifyGive(listener);
+    }
   }
 
   // vTaskDelete(NULL);
 }
+
+void dmxbox_effects_set_tick_listener(TaskHandle_t task) {
+  taskENTER_CRITICAL(&tick_listener_spinlock);
+  tick_listener = task;
+  taskEXIT_CRITICAL(&tick_listener_spinlock);
+}
@@ -0,0 +1,105 @@
+#include <string.h>
+
+#include "election.h"
+
+static bool is_better_candidate(
+    uint8_t priority,
+    const uint8_t mac[ELECTION_MAC_LEN],
+    uint8_t other_priority,
+    const uint8_t other_mac[ELECTION_MAC_LEN]
+) {
+  if (priority != other_priority) {
+    return priority > other_priority;
+  }
+  return memcmp(mac, other_mac, ELECTION_MAC_LEN) < 0;
+}
+
+election_change_t election_tick(
+    election_t *election,
+    const uint8_t mac[ELECTION_MAC_LEN],
+    bool fader_up,
+    int64_t time_us
+) {
+  if (!election->listen_until_us) {
+    election->listen_until_us = time_us + ELECTION_LISTEN_US;
+  }
+
+  election_change_t change = election_unchanged;
+  if (election->has_leader &&
+      election->leader_heard_us + ELECTION_TIMEOUT_US < time_us) {
+    election->has_leader = false;
+    change = election_leader_lost;
+  }
+
+  uint8_t priority = PRIORITY_NONE;
+  if (fader_up && !election->is_leader) {
+    priority = PRIORITY_FADER;
+  } else if (fader_up) {
+    int64_t terms =
+        (time_us - election->leading_since_us) / ELECTION_TIMEOUT_US;
+    priority = terms < PRIORITY_MAX - PRIORITY_LEADING
+                   ? PRIORITY_LEADING + terms
+                   : PRIORITY_MAX;
+  }
+
+  // A leader keeps leading (even with its fader down, so that it takes the
+  // effect down everywhere) until a better candidate shows up. Leaders
+  // yield when they hear one, see election_hear.
+  if (!election->is_leader && priority != PRIORITY_NONE) {
+    bool claim = election->has_leader ? is_better_candidate(
+                                            priority,
+                                            mac,
+                                            election->leader_priority,
+                                            election->leader_mac
+                                        )
+                                      : time_us >= election->listen_until_us;
+    if (claim) {
+      election->is_leader = true;
+      election->leading_since_us = time_us;
+      election->has_leader = false;
+      priority = PRIORITY_LEADING;
+      change = election_elected;
+    }
+  }
+
+  election->priority = priority;
+  return change;
+}
+
+bool election_hear(
+    election_t *election,
+    const uint8_t mac[ELECTION_MAC_LEN],
+    const uint8_t sender_mac[ELECTION_MAC_LEN],
+    uint8_t sender_priority,
+    int64_t receive_time_us,
+    bool *yielded
+) {
+  *yielded = false;
+  if (election->is_leader) {
+    if (!is_better_candidate(
+            sender_priority,
+            sender_mac,
+            election->priority,
+            mac
+        )) {
+      return false; // they yield once they hear our heartbeat
+    }
+    election->is_leader = false;
+    *yielded = true;
+  } else if (election->has_leader &&
+             memcmp(sender_mac, election->leader_mac, ELECTION_MAC_LEN) &&
+             !is_better_candidate(
+                 sender_priority,
+                 sender_mac,
+                 election->leader_priority,
+                 election->leader_mac
+             )) {
+    return false; // a worse candidate, about to yield to our leader
+  }
+
+  election->has_leader = true;
+  memcpy(election->leader_mac, sender_mac, ELECTION_MAC_LEN);
+  election->leader_priority = sender_priority;
+  election->leader_heard_us = receive_time_us;
+  return true;
+}
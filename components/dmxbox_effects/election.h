@@ -0,0 +1,69 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+// Picks the box that leads a distributed effect. Every box runs one election
+// per effect: the leader broadcasts the effect's state along with its
+// priority, and the others follow the best candidate they've heard. Nothing
+// in here touches ESP-IDF, so that it can be simulated on the host.
+
+#define ELECTION_MAC_LEN 6
+
+// A leader sends the state of its effects at least this often, and a
+// follower gives up on one it hasn't heard from for a while
+#define ELECTION_HEARTBEAT_US (1000 * 1000)
+#define ELECTION_TIMEOUT_US (3500 * 1000)
+
+// After the first tick, a box listens this long before it claims an effect
+// nobody seems to lead, so that it hears an existing leader first. Two
+// heartbeats, so that one can get lost.
+#define ELECTION_LISTEN_US (2 * ELECTION_HEARTBEAT_US)
+
+// Election priorities. A box leading with its fader up isn't taken over by
+// one whose fader comes up later. Between two leaders, which happens when one
+// missed the other's heartbeats, the one that has led longer wins, so that it
+// isn't the established progress that jumps. Ties go to the lower MAC.
+#define PRIORITY_NONE 0    // fader down
+#define PRIORITY_FADER 1   // fader up
+#define PRIORITY_LEADING 2 // fader up and leading, +1 per timeout led so far
+#define PRIORITY_MAX UINT8_MAX
+
+// All zeroes is a box that hasn't ticked yet
+typedef struct election {
+  bool is_leader;
+  int64_t leading_since_us;
+  uint8_t priority; // as sent while leading
+
+  // the box followed while not leading, until it times out
+  bool has_leader;
+  uint8_t leader_mac[ELECTION_MAC_LEN];
+  uint8_t leader_priority;
+  int64_t leader_heard_us;
+
+  int64_t listen_until_us; // 0 until the first tick
+} election_t;
+
+typedef enum election_change {
+  election_unchanged,
+  election_leader_lost, // the leader timed out, going by local faders
+  election_elected,     // started leading, the progress carries on
+} election_change_t;
+
+// Updates the role of this box for a tick and election->priority.
+election_change_t election_tick(
+    election_t *election,
+    const uint8_t mac[ELECTION_MAC_LEN],
+    bool fader_up,
+    int64_t time_us
+);
+
+// Handles a state another box sent. Returns whether to follow it, and sets
+// *yielded if this box stopped leading because of it.
+bool election_hear(
+    election_t *election,
+    const uint8_t mac[ELECTION_MAC_LEN],
+    const uint8_t sender_mac[ELECTION_MAC_LEN],
+    uint8_t sender_priority,
+    int64_t receive_time_us,
+    bool *yielded
+);
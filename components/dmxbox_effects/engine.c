@@ -0,0 +1,394 @@
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "dmxbox_const.h"
+#include "effect_storage.h"
+#include "engine.h"
+#include "layers.h"
+#include "show.h"
+
+#define WAVEFORM_TABLE_SIZE 256
+
+static const uint32_t us_per_ms = 1000;
+
+static const uint8_t default_effect_rate_raw = 127;
+
+double rate_from_fader_level[UINT8_MAX + 1];
+
+// 8-bit samples of one cycle of each waveform, indexed by the top 8 bits of a
+// 16-bit phase. The random table is indexed by cycle instead.
+static uint8_t waveform_tables[dmxbox_waveform_shape_count]
+                              [WAVEFORM_TABLE_SIZE];
+
+static uint32_t ms_to_us(uint32_t value) { return value * us_per_ms; }
+
+static uint32_t get_step_in_end_us(const step_t *step) {
+  return ms_to_us(step->in);
+}
+
+static uint32_t get_step_dwell_end_us(const step_t *step) {
+  return ms_to_us(step->in + step->dwell);
+}
+
+static uint32_t get_step_out_end_us(const step_t *step) {
+  return ms_to_us(step->in + step->dwell + step->out);
+}
+
+static double get_rate_from_fader_level(uint8_t level) {
+  if (level == 0) {
+    return 0;
+  }
+
+  // 2^((x - 127) / 30.035) * 104.5 - 4.5 works out to:
+  // around 1 at x=1
+  // 100 at x=127
+  // around 2000 at x=255
+  return (pow(2, ((double)level - 127) / 30.035) * 1.045 - .045);
+}
+
+static void init_waveform_tables() {
+  // fixed seed so that the random waveform is the same on every box
+  uint32_t random_state = 0x2545F491;
+
+  for (int i = 0; i < WAVEFORM_TABLE_SIZE; i++) {
+    double phase = (double)i / WAVEFORM_TABLE_SIZE;
+
+    waveform_tables[dmxbox_waveform_sine][i] =
+        (uint8_t)lround(127.5 - 127.5 * cos(2 * M_PI * phase));
+    waveform_tables[dmxbox_waveform_triangle][i] =
+        (uint8_t)lround(255 * (phase < 0.5 ? 2 * phase : 2 - 2 * phase));
+    waveform_tables[dmxbox_waveform_square][i] = phase < 0.5 ? 255 : 0;
+    waveform_tables[dmxbox_waveform_saw][i] = (uint8_t)i;
+
+    // xorshift32
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    waveform_tables[dmxbox_waveform_random][i] = (uint8_t)random_state;
+  }
+}
+
+static int add_control_channel(
+    uint16_t channel,
+    int control_index[DMX_CHANNEL_COUNT],
+    uint16_t *channels,
+    size_t *channel_count
+) {
+  if (!channel || channel > DMX_CHANNEL_COUNT) {
+    return -1;
+  }
+
+  if (control_index[channel - 1] < 0) {
+    control_index[channel - 1] = *channel_count;
+    channels[(*channel_count)++] = channel;
+  }
+  return control_index[channel - 1];
+}
+
+void engine_init_tables() {
+  for (int i = 0; i <= UINT8_MAX; i++) {
+    rate_from_fader_level[i] = get_rate_from_fader_level(i);
+  }
+
+  init_waveform_tables();
+}
+
+bool engine_start(engine_t *engine) {
+  return layers_init(&engine->layers, &engine->show);
+}
+
+void engine_stop(engine_t *engine) {
+  layers_free(&engine->layers);
+  show_free(&engine->show);
+}
+
+size_t engine_assign_controls(engine_t *engine, uint16_t *channels) {
+  static int control_index[DMX_CHANNEL_COUNT];
+  for (int i = 0; i < DMX_CHANNEL_COUNT; i++) {
+    control_index[i] = -1;
+  }
+
+  size_t channel_count = 0;
+  for (size_t i = 0; i < engine->show.effect_count; i++) {
+    effect_t *effect = &engine->show.effects[i];
+    effect->level_control = add_control_channel(
+        effect->level_channel,
+        control_index,
+        channels,
+        &channel_count
+    );
+    effect->rate_control = add_control_channel(
+        effect->rate_channel,
+        control_index,
+        channels,
+        &channel_count
+    );
+  }
+  return channel_count;
+}
+
+static uint8_t multiply_levels(uint8_t level1, uint8_t level2) {
+  if (level1 == 255)
+    return level2;
+  if (level2 == 255)
+    return level1;
+  if (level1 == 0)
+    return 0;
+  if (level2 == 0)
+    return 0;
+
+  return (uint8_t)(level1 * level2 / 255);
+}
+
+void engine_advance_progress(
+    effect_t *effect,
+    uint8_t rate_raw,
+    int64_t time_increment_us
+) {
+  if (!effect->effect_length_us) {
+    return; // nothing to play
+  }
+
+  effect->progress += (time_increment_us * rate_from_fader_level[rate_raw]);
+
+  if (effect->effect_length_us <= effect->progress) {
+    int cycles = (int)(effect->progress / effect->effect_length_us);
+    effect->first_pass = false;
+    effect->cycle += cycles;
+    effect->progress -= cycles * effect->effect_length_us;
+  }
+}
+
+// Places a tempo locked effect by the beat clock alone, so that the effect
+// stays on the beat (and in step with other boxes) whatever the tempo does
+static void follow_tempo(effect_t *effect, bool starting, double beats) {
+  if (beats < 0) {
+    beats = 0;
+  }
+
+  uint32_t cycle = (uint32_t)(beats / effect->beats);
+  double position = beats / effect->beats - cycle;
+
+  if (!starting && cycle != effect->cycle) {
+    effect->first_pass = false;
+  }
+  effect->cycle = cycle;
+  effect->progress = position * effect->effect_length_us;
+}
+
+// Places a timed effect by show time alone, so that seeking the timecode
+// doesn't need to replay anything
+static void follow_timeline(effect_t *effect, int64_t show_time_us) {
+  if (!effect->effect_length_us) {
+    return; // nothing to play
+  }
+
+  int64_t elapsed_us = show_time_us - (int64_t)ms_to_us(effect->start);
+  effect->cycle = (uint32_t)(elapsed_us / effect->effect_length_us);
+  effect->progress = (double)(elapsed_us % effect->effect_length_us);
+  effect->first_pass = effect->cycle == 0;
+}
+
+// A timed effect plays at full level (or its fader's, if it has one) within
+// its span on the timeline, and not at all outside of it
+static uint8_t get_timed_effect_level(
+    const effect_t *effect,
+    uint8_t fader_level,
+    const engine_input_t *input
+) {
+  if (!input->timecode) {
+    return 0;
+  }
+
+  int64_t show_time_ms = input->show_time_us / us_per_ms;
+  if (show_time_ms < effect->start ||
+      (effect->timed_end && show_time_ms >= effect->end)) {
+    return 0;
+  }
+
+  return effect->level_channel ? fader_level : UINT8_MAX;
+}
+
+static void process_chase_effect(engine_t *engine, effect_t *effect) {
+  for (uint32_t i = 0; i < effect->step_count; i++) {
+    const step_t *step = &engine->show.steps[effect->first_step + i];
+
+    double progress_in_step = effect->progress - step->offset_us;
+
+    if (progress_in_step < 0 && !effect->first_pass) {
+      // There might be overlapping steps from the previous pass
+      progress_in_step += effect->effect_length_us;
+    }
+
+    if (progress_in_step <= 0) {
+      continue; // too early
+    }
+
+    if (get_step_out_end_us(step) <= progress_in_step) {
+      continue; // too late
+    }
+
+    uint8_t step_fade_level = 0;
+    if (progress_in_step < get_step_in_end_us(step)) {
+      step_fade_level = (uint8_t)(255 * progress_in_step / ms_to_us(step->in));
+    } else if (progress_in_step < get_step_dwell_end_us(step)) {
+      step_fade_level = 255;
+    } else if (progress_in_step < get_step_out_end_us(step)) {
+      step_fade_level =
+          (uint8_t)(255 -
+                    (255 * (progress_in_step - get_step_dwell_end_us(step)) /
+                     ms_to_us(step->out)));
+    }
+
+    const step_channel_t *channels =
+        &engine->show.channels[step->first_channel];
+    for (uint32_t j = 0; j < step->channel_count; j++) {
+      const step_channel_t *channel = &channels[j];
+      uint8_t level = multiply_levels(step_fade_level, channel->level);
+      layers_put(&engine->layers, channel->channel - 1, level);
+    }
+  }
+}
+
+static uint8_t sample_waveform(
+    uint8_t shape,
+    uint32_t phase,
+    uint32_t cycle,
+    size_t channel_index
+) {
+  const uint8_t *table = waveform_tables[shape];
+
+  if (shape == dmxbox_waveform_random) {
+    // sample and hold, a new value every cycle
+    cycle += phase >> 16;
+    return table[(cycle * 97 + channel_index * 31) % WAVEFORM_TABLE_SIZE];
+  }
+
+  uint8_t index = (phase >> 8) & 0xFF;
+  uint8_t fraction = phase & 0xFF;
+  if (shape == dmxbox_waveform_square || !fraction) {
+    return table[index];
+  }
+
+  // linear interpolation between neighboring samples, in 8.8 fixed point
+  int current = table[index];
+  int next = table[(uint8_t)(index + 1)];
+  return (uint8_t)(current + (((next - current) * fraction) >> 8));
+}
+
+static void process_waveform_effect(engine_t *engine, effect_t *effect) {
+  const waveform_t *waveform = &effect->waveform;
+  uint32_t phase =
+      (uint32_t)(effect->progress * 65536 / effect->effect_length_us);
+
+  const step_channel_t *channels =
+      &engine->show.channels[effect->first_channel];
+  for (uint32_t i = 0; i < effect->channel_count; i++) {
+    const step_channel_t *channel = &channels[i];
+
+    uint32_t phase_offset =
+        (uint32_t)(((uint64_t)i * waveform->channel_phase_step) >> 16);
+    uint8_t sample = sample_waveform(
+        waveform->shape,
+        phase + phase_offset,
+        effect->cycle,
+        i
+    );
+
+    // size is peak-to-peak around the offset
+    int level = waveform->offset + (((int)sample - 128) * waveform->size) / 255;
+    if (level < 0) {
+      level = 0;
+    } else if (level > UINT8_MAX) {
+      level = UINT8_MAX;
+    }
+
+    uint8_t channel_level = multiply_levels(channel->level, (uint8_t)level);
+    layers_put(&engine->layers, channel->channel - 1, channel_level);
+  }
+}
+
+static void process_effect(
+    engine_t *engine,
+    size_t effect_index,
+    uint8_t effect_level,
+    uint8_t rate_raw,
+    const engine_input_t *input
+) {
+  effect_t *effect = &engine->show.effects[effect_index];
+  int64_t time_increment_us = input->time_increment_us;
+
+  if (effect->timed) {
+    // timecode keeps boxes in step already
+    effect_level = get_timed_effect_level(effect, effect_level, input);
+  } else if (effect->distributed && input->distribute) {
+    input->distribute(effect, &effect_level, &rate_raw, input);
+  }
+
+  // the effect level is applied by the compositor
+  layers_begin(&engine->layers, effect_index, effect_level);
+
+  if (effect_level == 0) {
+    effect->active = false;
+    return;
+  }
+
+  bool starting = !effect->active;
+  if (starting) {
+    effect->active = true;
+    effect->progress = 0;
+    effect->first_pass = true;
+    effect->cycle = 0;
+    time_increment_us = 0; // Start from beginning
+  }
+
+  if (effect->timed) {
+    follow_timeline(effect, input->show_time_us);
+  } else if (effect->beats) {
+    follow_tempo(effect, starting, input->beats);
+  } else {
+    engine_advance_progress(effect, rate_raw, time_increment_us);
+  }
+
+  switch (effect->type) {
+  case dmxbox_effect_type_waveform:
+    process_waveform_effect(engine, effect);
+    break;
+
+  default:
+    process_chase_effect(engine, effect);
+    break;
+  }
+}
+
+static uint8_t get_control_value(
+    const engine_input_t *input,
+    int control,
+    uint8_t default_value
+) {
+  if (control >= 0 && input->control_values) {
+    return input->control_values[control];
+  }
+  return default_value;
+}
+
+void engine_tick(
+    engine_t *engine,
+    const engine_input_t *input,
+    uint8_t output[DMX_CHANNEL_COUNT]
+) {
+  for (size_t i = 0; i < engine->show.effect_count; i++) {
+    const effect_t *effect = &engine->show.effects[i];
+    uint8_t effect_level = get_control_value(input, effect->level_control, 0);
+    uint8_t rate_raw = get_control_value(
+        input,
+        effect->rate_control,
+        default_effect_rate_raw
+    );
+
+    process_effect(engine, i, effect_level, rate_raw, input);
+  }
+
+  layers_composite(&engine->layers, output);
+}
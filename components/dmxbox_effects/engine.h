@@ -0,0 +1,80 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "dmxbox_const.h"
+#include "layers.h"
+#include "show.h"
+
+// Evaluates the effects of a show one tick at a time. Everything a tick
+// depends on is either in the engine or passed in with it (the time, the
+// control channels, the tempo and timecode), so the same show and inputs
+// always give the same output, on the box or in a simulation on the host.
+
+typedef struct engine_input engine_input_t;
+
+// Called for each distributed effect before it's evaluated, to take part in
+// the sync with other boxes. May replace the level and rate with the
+// leader's.
+typedef void (*engine_distribute_t)(
+    effect_t *effect,
+    uint8_t *level,
+    uint8_t *rate_raw,
+    const engine_input_t *input
+);
+
+struct engine_input {
+  int64_t current_time_us;
+  int64_t time_increment_us;
+
+  // indexed by the effects' level_control and rate_control (see
+  // engine_assign_controls), NULL if there are none
+  const uint8_t *control_values;
+
+  // the tempo clock at current_time_us
+  double beats;
+
+  // whether timed effects play, and where on the timeline
+  bool timecode;
+  int64_t show_time_us;
+
+  // NULL plays distributed effects like any other
+  engine_distribute_t distribute;
+};
+
+typedef struct engine {
+  show_t show;
+  layers_t layers;
+} engine_t;
+
+// speed factors by rate fader level, 1 at 127
+extern double rate_from_fader_level[UINT8_MAX + 1];
+
+// Fills the lookup tables shared by all engines, once before any runs
+void engine_init_tables();
+
+// Gets ready to evaluate engine->show, once it's been loaded. Returns false
+// if out of memory.
+bool engine_start(engine_t *engine);
+
+// Frees the show along with everything else
+void engine_stop(engine_t *engine);
+
+// Numbers the control channels the effects use, setting their level_control
+// and rate_control. channels (room for two per effect) gets the channel of
+// each control value, returns how many there are.
+size_t engine_assign_controls(engine_t *engine, uint16_t *channels);
+
+void engine_tick(
+    engine_t *engine,
+    const engine_input_t *input,
+    uint8_t output[DMX_CHANNEL_COUNT]
+);
+
+// Moves a free running effect on by time_increment_us at the given rate
+void engine_advance_progress(
+    effect_t *effect,
+    uint8_t rate_raw,
+    int64_t time_increment_us
+);
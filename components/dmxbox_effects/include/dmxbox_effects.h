@@ -1,8 +1,28 @@
 #pragma once
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <stdint.h>
+
 #include "dmxbox_const.h"
 
+// When set, effects are evaluated once per DMX output frame, for the time at
+// which that frame goes out. Otherwise they run on their own at
+// CONFIG_DMXBOX_EFFECTS_RATE.
+#ifndef CONFIG_DMXBOX_EFFECTS_FRAME_ALIGNED
+#define CONFIG_DMXBOX_EFFECTS_FRAME_ALIGNED 1
+#endif
+
+// evaluations per second when not frame aligned
+#ifndef CONFIG_DMXBOX_EFFECTS_RATE
+#define CONFIG_DMXBOX_EFFECTS_RATE 33
+#endif
+
 extern portMUX_TYPE dmxbox_effects_spinlock;
 extern uint8_t dmxbox_effects_data[DMX_CHANNEL_COUNT];
 
 void dmxbox_effects_init();
 void dmxbox_effects_task(void *parameter);
+
+// The task gets a notification (xTaskNotifyGive) after every tick, once
+// dmxbox_effects_data has been updated.
+void dmxbox_effects_set_tick_listener(TaskHandle_t task);
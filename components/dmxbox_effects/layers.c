@@ -0,0 +1,166 @@
+#include <esp_log.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dmxbox_const.h"
+#include "layers.h"
+#include "show.h"
+
+static const char *TAG = "effects_layers";
+
+#ifndef MAX
+#define MAX(x, y) ((x) > (y) ? (x) : (y))
+#endif
+
+static uint8_t scale_level(uint8_t level, uint8_t scale) {
+  if (scale == 255) {
+    return level;
+  }
+  return (uint8_t)(level * scale / 255);
+}
+
+void layers_free(layers_t *layers) {
+  free(layers->layers);
+  free(layers->channels);
+  free(layers->composite_order);
+  layers->layers = NULL;
+  layers->channels = NULL;
+  layers->composite_order = NULL;
+  layers->current = NULL;
+  layers->show = NULL;
+}
+
+// stable, so that ties stay in show order
+static void sort_by_priority(layers_t *layers) {
+  const effect_t *effects = layers->show->effects;
+  uint16_t *order = layers->composite_order;
+  for (size_t i = 1; i < layers->show->effect_count; i++) {
+    uint16_t effect_index = order[i];
+    uint8_t priority = effects[effect_index].priority;
+    size_t j = i;
+    while (j > 0 && effects[order[j - 1]].priority > priority) {
+      order[j] = order[j - 1];
+      j--;
+    }
+    order[j] = effect_index;
+  }
+}
+
+bool layers_init(layers_t *layers, const show_t *show) {
+  layers_free(layers);
+  if (!show->effect_count) {
+    return true;
+  }
+
+  // an effect can't touch more channels than its steps list
+  size_t channel_count = 0;
+  for (size_t i = 0; i < show->effect_count; i++) {
+    channel_count += MAX(show->effects[i].channel_count, 1);
+  }
+
+  layers->layers = calloc(show->effect_count, sizeof(layer_t));
+  layers->channels = calloc(channel_count, sizeof(layer_channel_t));
+  layers->composite_order = calloc(show->effect_count, sizeof(uint16_t));
+  if (!layers->layers || !layers->channels || !layers->composite_order) {
+    ESP_LOGE(TAG, "Failed to allocate layers");
+    layers_free(layers);
+    return false;
+  }
+
+  size_t next_channel = 0;
+  for (size_t i = 0; i < show->effect_count; i++) {
+    layers->layers[i].channels = &layers->channels[next_channel];
+    next_channel += MAX(show->effects[i].channel_count, 1);
+    layers->composite_order[i] = i;
+  }
+
+  layers->show = show;
+  sort_by_priority(layers);
+  return true;
+}
+
+void layers_begin(layers_t *layers, size_t effect_index, uint8_t level) {
+  layer_t *layer = &layers->layers[effect_index];
+  layer->channel_count = 0;
+  layer->level = level;
+  layers->current = layer;
+  layers->render_stamp++;
+}
+
+void layers_put(layers_t *layers, uint16_t channel_index, uint8_t level) {
+  layer_t *layer = layers->current;
+  if (layers->channel_stamp[channel_index] == layers->render_stamp) {
+    layer_channel_t *channel =
+        &layer->channels[layers->channel_slot[channel_index]];
+    channel->level = MAX(channel->level, level);
+    return;
+  }
+
+  layers->channel_stamp[channel_index] = layers->render_stamp;
+  layers->channel_slot[channel_index] = layer->channel_count;
+  layer->channels[layer->channel_count++] = (layer_channel_t){
+      .channel = channel_index,
+      .level = level,
+  };
+}
+
+static void composite_layer(
+    const layer_t *layer,
+    uint8_t blend,
+    uint8_t output[DMX_CHANNEL_COUNT]
+) {
+  uint8_t layer_level = layer->level;
+  for (uint16_t i = 0; i < layer->channel_count; i++) {
+    const layer_channel_t *channel = &layer->channels[i];
+    uint8_t below = output[channel->channel];
+    uint8_t level = channel->level;
+
+    switch (blend) {
+    case dmxbox_effect_blend_ltp:
+      // crossfades from the levels below as the effect fader comes up
+      output[channel->channel] =
+          below + ((int)level - below) * layer_level / 255;
+      break;
+
+    case dmxbox_effect_blend_add: {
+      int sum = below + scale_level(level, layer_level);
+      output[channel->channel] = sum > UINT8_MAX ? UINT8_MAX : sum;
+      break;
+    }
+
+    case dmxbox_effect_blend_multiply: {
+      // a layer at zero level leaves the output alone
+      uint8_t factor = 255 - scale_level(255 - level, layer_level);
+      output[channel->channel] = scale_level(below, factor);
+      break;
+    }
+
+    default:
+      output[channel->channel] = MAX(below, scale_level(level, layer_level));
+      break;
+    }
+  }
+}
+
+void layers_composite(
+    const layers_t *layers,
+    uint8_t output[DMX_CHANNEL_COUNT]
+) {
+  memset(output, 0, DMX_CHANNEL_COUNT);
+  if (!layers->show) {
+    return;
+  }
+
+  for (size_t i = 0; i < layers->show->effect_count; i++) {
+    uint16_t effect_index = layers->composite_order[i];
+    const layer_t *layer = &layers->layers[effect_index];
+    if (!layer->level || !layer->channel_count) {
+      continue;
+    }
+    composite_layer(
+        layer,
+        layers->show->effects[effect_index].blend,
+        output
+    );
+  }
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <stdint.h>
+
+#include "dmxbox_const.h"
+#include "show.h"
+
+// Every effect renders into its own sparse layer: the list of channels it
+// touched in the current tick, at full effect level. The compositor then
+// flattens the layers in priority order, applying each effect's level and
+// blend mode.
+
+typedef struct layer_channel {
+  uint16_t channel; // 0-based
+  uint8_t level;
+} layer_channel_t;
+
+typedef struct layer {
+  layer_channel_t *channels;
+  uint16_t channel_count;
+  uint8_t level; // effect level, 0 = layer is skipped
+} layer_t;
+
+// The layers of one show. Zeroed, it's an empty set of layers.
+typedef struct layers {
+  const show_t *show;
+  layer_t *layers;
+  layer_channel_t *channels;
+
+  // effect indexes by ascending priority, ties in show order
+  uint16_t *composite_order;
+
+  // the layer being rendered
+  layer_t *current;
+
+  // where each channel is in the current layer, valid if its stamp matches
+  // render_stamp; saves clearing the whole map for every layer
+  uint16_t channel_slot[DMX_CHANNEL_COUNT];
+  uint32_t channel_stamp[DMX_CHANNEL_COUNT];
+  uint32_t render_stamp;
+} layers_t;
+
+// Allocates a layer per effect of the show (show->effects must not move
+// afterwards). Returns false if out of memory.
+bool layers_init(layers_t *layers, const show_t *show);
+void layers_free(layers_t *layers);
+
+// Clears the effect's layer, sets its level and starts a new render into it
+void layers_begin(layers_t *layers, size_t effect_index, uint8_t level);
+
+// Channels touched more than once in a tick (overlapping chase steps) keep
+// the highest level.
+void layers_put(layers_t *layers, uint16_t channel_index, uint8_t level);
+
+// Flattens all layers into output, lowest priority first
+void layers_composite(
+    const layers_t *layers,
+    uint8_t output[DMX_CHANNEL_COUNT]
+);
@@ -0,0 +1,529 @@
+#include <esp_log.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dmxbox_const.h"
+#include "dmxbox_storage.h"
+#include "effect_step_storage.h"
+#include "effect_storage.h"
+#include "esp_err.h"
+#include "show.h"
+#include "show_image_storage.h"
+
+static const char *TAG = "effects_show";
+
+#define DEFAULT_WAVEFORM_PERIOD 1000
+
+#ifndef MAX
+#define MAX(x, y) ((x) > (y) ? (x) : (y))
+#endif
+
+static const uint32_t us_per_ms = 1000;
+
+// Body of the compiled show image. The arrays follow, each 8-byte aligned.
+typedef struct show_image_header {
+  uint32_t effect_count;
+  uint32_t step_count;
+  uint32_t channel_count;
+
+  // in case SHOW_LAYOUT_VERSION wasn't bumped
+  uint32_t effect_size;
+  uint32_t step_size;
+  uint32_t channel_size;
+} show_image_header_t;
+
+typedef struct show_builder {
+  effect_t *effects;
+  size_t effect_count;
+  size_t effect_capacity;
+
+  step_t *steps;
+  size_t step_count;
+  size_t step_capacity;
+
+  step_channel_t *channels;
+  size_t channel_count;
+  size_t channel_capacity;
+} show_builder_t;
+
+static uint32_t ms_to_us(uint32_t value) { return value * us_per_ms; }
+
+static size_t align_size(size_t size) { return (size + 7) & ~(size_t)7; }
+
+static size_t get_effects_offset() {
+  return align_size(sizeof(show_image_header_t));
+}
+
+static size_t get_steps_offset(const show_image_header_t *header) {
+  return get_effects_offset() +
+         align_size(header->effect_count * sizeof(effect_t));
+}
+
+static size_t get_channels_offset(const show_image_header_t *header) {
+  return get_steps_offset(header) +
+         align_size(header->step_count * sizeof(step_t));
+}
+
+static size_t get_body_size(const show_image_header_t *header) {
+  return get_channels_offset(header) +
+         align_size(header->channel_count * sizeof(step_channel_t));
+}
+
+// effects are left pointing into the image, callers make sure it's writable
+static void attach_image(show_t *show, const dmxbox_show_image_t *image) {
+  const show_image_header_t *header = (const void *)image->body;
+
+  show->effects = (effect_t *)(image->body + get_effects_offset());
+  show->effect_count = header->effect_count;
+  show->steps = (const step_t *)(image->body + get_steps_offset(header));
+  show->step_count = header->step_count;
+  show->channels =
+      (const step_channel_t *)(image->body + get_channels_offset(header));
+  show->channel_count = header->channel_count;
+}
+
+static void reset_effect_state(effect_t *effect) {
+  effect->level_control = -1;
+  effect->rate_control = -1;
+  effect->active = false;
+  effect->progress = 0;
+  effect->first_pass = true;
+  effect->cycle = 0;
+  memset(&effect->distributed_state, 0, sizeof(effect->distributed_state));
+}
+
+static bool reserve(
+    void **array,
+    size_t *capacity,
+    size_t count,
+    size_t item_size
+) {
+  if (count < *capacity) {
+    return true;
+  }
+
+  size_t new_capacity = MAX(*capacity * 2, 8);
+  void *new_array = realloc(*array, new_capacity * item_size);
+  if (!new_array) {
+    return false;
+  }
+
+  *array = new_array;
+  *capacity = new_capacity;
+  return true;
+}
+
+static void builder_free(show_builder_t *builder) {
+  free(builder->effects);
+  free(builder->steps);
+  free(builder->channels);
+  memset(builder, 0, sizeof(show_builder_t));
+}
+
+static void prepare_chase(show_builder_t *builder, effect_t *effect) {
+  uint32_t current_offset_us = 0;
+
+  for (uint32_t i = 0; i < effect->step_count; i++) {
+    step_t *step = &builder->steps[effect->first_step + i];
+    if ((step->in == 0) && (step->dwell == 0) && (step->out == 0)) {
+      step->dwell = step->time;
+    }
+
+    step->offset_us = current_offset_us;
+    current_offset_us += ms_to_us(step->time);
+  }
+
+  effect->effect_length_us = current_offset_us;
+}
+
+static void prepare_waveform(effect_t *effect) {
+  waveform_t *waveform = &effect->waveform;
+
+  // the spread is distributed evenly across the channel list, in order
+  if (effect->channel_count) {
+    waveform->channel_phase_step =
+        (uint32_t)(((uint64_t)waveform->spread << 32) /
+                   (360 * (uint64_t)effect->channel_count));
+  }
+
+  if (!waveform->period) {
+    waveform->period = DEFAULT_WAVEFORM_PERIOD;
+  }
+  effect->effect_length_us = ms_to_us(waveform->period);
+}
+
+static void
+load_waveform(effect_t *effect, const dmxbox_effect_t *effect_data) {
+  waveform_t *waveform = &effect->waveform;
+  waveform->shape = effect_data->waveform.shape;
+  waveform->size = effect_data->waveform.size;
+  waveform->offset = effect_data->waveform.offset;
+  waveform->spread = effect_data->waveform.spread;
+  waveform->period = effect_data->waveform.period;
+
+  if (waveform->shape >= dmxbox_waveform_shape_count) {
+    ESP_LOGW(
+        TAG,
+        "Unknown waveform shape %d in effect %d, using sine",
+        waveform->shape,
+        effect->id
+    );
+    waveform->shape = dmxbox_waveform_sine;
+  }
+
+  ESP_LOGI(
+      TAG,
+      "waveform shape = %d, size = %d, offset = %d, spread = %d, period = %d",
+      waveform->shape,
+      waveform->size,
+      waveform->offset,
+      waveform->spread,
+      (int)waveform->period
+  );
+}
+
+static bool load_step(
+    show_builder_t *builder,
+    uint16_t step_id,
+    const dmxbox_effect_step_t *step_data
+) {
+  if (!reserve(
+          (void **)&builder->steps,
+          &builder->step_capacity,
+          builder->step_count,
+          sizeof(step_t)
+      )) {
+    return false;
+  }
+
+  step_t *step = &builder->steps[builder->step_count++];
+  memset(step, 0, sizeof(step_t));
+  step->time = step_data->time;
+  step->in = step_data->in;
+  step->dwell = step_data->dwell;
+  step->out = step_data->out;
+  step->first_channel = builder->channel_count;
+
+  ESP_LOGI(TAG, "step %d time = %d", step_id, (int)step->time);
+  ESP_LOGI(TAG, "step %d in = %d", step_id, (int)step->in);
+  ESP_LOGI(TAG, "step %d dwell = %d", step_id, (int)step->dwell);
+  ESP_LOGI(TAG, "step %d out = %d", step_id, (int)step->out);
+
+  for (size_t i = 0; i < step_data->channel_count; i++) {
+    uint16_t channel_index = step_data->channels[i].channel.index;
+    if (channel_index < 1 || channel_index > DMX_CHANNEL_COUNT) {
+      ESP_LOGW(TAG, "step %d: invalid channel %d", step_id, channel_index);
+      continue;
+    }
+
+    if (!reserve(
+            (void **)&builder->channels,
+            &builder->channel_capacity,
+            builder->channel_count,
+            sizeof(step_channel_t)
+        )) {
+      return false;
+    }
+
+    step_channel_t *channel = &builder->channels[builder->channel_count++];
+    memset(channel, 0, sizeof(step_channel_t));
+    channel->channel = channel_index;
+    channel->level = step_data->channels[i].level;
+    step->channel_count++;
+
+    ESP_LOGI(
+        TAG,
+        "step %d channel %d: %d @ %d",
+        step_id,
+        i,
+        channel->channel,
+        channel->level
+    );
+  }
+
+  return true;
+}
+
+static bool load_effect(
+    show_builder_t *builder,
+    uint16_t effect_id,
+    const dmxbox_effect_t *effect_data
+) {
+  ESP_LOGI(TAG, "Loading effect %d (%s)", effect_id, effect_data->name);
+
+  if (!reserve(
+          (void **)&builder->effects,
+          &builder->effect_capacity,
+          builder->effect_count,
+          sizeof(effect_t)
+      )) {
+    return false;
+  }
+
+  effect_t *effect = &builder->effects[builder->effect_count];
+  memset(effect, 0, sizeof(effect_t));
+  effect->id = effect_id;
+  effect->level_channel = effect_data->level_channel.index;
+  effect->rate_channel = effect_data->rate_channel.index;
+  effect->distributed = effect_data->distributed_id != 0;
+  effect->distributed_id = effect_data->distributed_id;
+  effect->type = effect_data->type;
+  effect->priority = effect_data->priority;
+  effect->blend = effect_data->blend;
+  effect->beats = effect_data->beats;
+  effect->timed = effect_data->start.set;
+  effect->timed_end = effect_data->start.set && effect_data->end.set;
+  effect->start = effect_data->start.ms;
+  effect->end = effect_data->end.ms;
+  effect->first_step = builder->step_count;
+  effect->first_channel = builder->channel_count;
+
+  if (effect->blend >= dmxbox_effect_blend_count) {
+    ESP_LOGW(
+        TAG,
+        "Unknown blend mode %d in effect %d, using HTP",
+        effect->blend,
+        effect_id
+    );
+    effect->blend = dmxbox_effect_blend_htp;
+  }
+
+  if (effect->type == dmxbox_effect_type_waveform) {
+    load_waveform(effect, effect_data);
+  }
+
+  for (int i = 0; i < effect_data->step_count; i++) {
+    uint16_t step_id = effect_data->steps[i];
+
+    ESP_LOGI(TAG, "step %d", step_id);
+
+    dmxbox_effect_step_t *step_data;
+    esp_err_t ret = (dmxbox_effect_step_get(effect_id, step_id, &step_data));
+    if (ret == ESP_ERR_NOT_FOUND) {
+      ESP_LOGW(
+          TAG,
+          "step %d not found, skipping effect %d",
+          step_id,
+          effect_id
+      );
+      builder->step_count = effect->first_step;
+      builder->channel_count = effect->first_channel;
+      return true;
+    }
+    if (ret != ESP_OK) {
+      // unlike a missing step, this may not happen on the next try
+      ESP_LOGE(
+          TAG,
+          "Failed to read step %d of effect %d: %s",
+          step_id,
+          effect_id,
+          esp_err_to_name(ret)
+      );
+      return false;
+    }
+
+    bool loaded = load_step(builder, step_id, step_data);
+    free(step_data);
+    if (!loaded) {
+      return false;
+    }
+  }
+
+  effect->step_count = builder->step_count - effect->first_step;
+  effect->channel_count = builder->channel_count - effect->first_channel;
+
+  if (effect->type == dmxbox_effect_type_waveform) {
+    prepare_waveform(effect);
+  } else {
+    prepare_chase(builder, effect);
+  }
+
+  builder->effect_count++;
+  return true;
+}
+
+static bool load_effects_from_storage(show_builder_t *builder) {
+  dmxbox_storage_entry_t effects[10];
+  const uint16_t buffer_length = sizeof(effects) / sizeof(effects[0]);
+
+  uint16_t count;
+  uint16_t skip = 0;
+
+  do {
+    count = buffer_length;
+    if (dmxbox_effect_list(skip, &count, effects) != ESP_OK) {
+      // an incomplete show must not be compiled, let alone stored
+      ESP_LOGE(TAG, "Failed to list effects");
+      return false;
+    }
+
+    ESP_LOGI(TAG, "Loading %d effects", count);
+
+    skip += count;
+
+    bool loaded = true;
+    for (size_t i = 0; i < count; i++) {
+      if (loaded) {
+        loaded = load_effect(builder, effects[i].id, effects[i].data);
+      }
+      free(effects[i].data);
+    }
+    if (!loaded) {
+      return false;
+    }
+  } while (count == buffer_length);
+
+  return true;
+}
+
+static dmxbox_show_image_t *compile_show(show_builder_t *builder) {
+  show_image_header_t header = {
+      .effect_count = builder->effect_count,
+      .step_count = builder->step_count,
+      .channel_count = builder->channel_count,
+      .effect_size = sizeof(effect_t),
+      .step_size = sizeof(step_t),
+      .channel_size = sizeof(step_channel_t),
+  };
+
+  dmxbox_show_image_t *image = dmxbox_show_image_alloc(get_body_size(&header));
+  if (!image) {
+    return NULL;
+  }
+
+  image->layout_version = SHOW_LAYOUT_VERSION;
+  memcpy(image->body, &header, sizeof(header));
+  memcpy(
+      image->body + get_effects_offset(),
+      builder->effects,
+      builder->effect_count * sizeof(effect_t)
+  );
+  memcpy(
+      image->body + get_steps_offset(&header),
+      builder->steps,
+      builder->step_count * sizeof(step_t)
+  );
+  memcpy(
+      image->body + get_channels_offset(&header),
+      builder->channels,
+      builder->channel_count * sizeof(step_channel_t)
+  );
+  return image;
+}
+
+static bool validate_image(const dmxbox_show_image_t *image) {
+  const show_image_header_t *header = (const void *)image->body;
+  if (image->body_size < sizeof(show_image_header_t) ||
+      header->effect_size != sizeof(effect_t) ||
+      header->step_size != sizeof(step_t) ||
+      header->channel_size != sizeof(step_channel_t) ||
+      image->body_size != get_body_size(header)) {
+    return false;
+  }
+
+  const effect_t *effects =
+      (const effect_t *)(image->body + get_effects_offset());
+  for (uint32_t i = 0; i < header->effect_count; i++) {
+    if (effects[i].first_step + effects[i].step_count > header->step_count ||
+        effects[i].first_channel + effects[i].channel_count >
+            header->channel_count) {
+      return false;
+    }
+  }
+
+  const step_t *steps =
+      (const step_t *)(image->body + get_steps_offset(header));
+  for (uint32_t i = 0; i < header->step_count; i++) {
+    if (steps[i].first_channel + steps[i].channel_count >
+        header->channel_count) {
+      return false;
+    }
+  }
+
+  const step_channel_t *channels =
+      (const step_channel_t *)(image->body + get_channels_offset(header));
+  for (uint32_t i = 0; i < header->channel_count; i++) {
+    if (channels[i].channel < 1 || channels[i].channel > DMX_CHANNEL_COUNT) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+static bool load_image(show_t *show) {
+  dmxbox_show_image_ref_t ref;
+  esp_err_t ret = dmxbox_show_image_open(SHOW_LAYOUT_VERSION, &ref);
+  if (ret != ESP_OK) {
+    ESP_LOGI(TAG, "No usable show image: %s", esp_err_to_name(ret));
+    return false;
+  }
+
+  if (!validate_image(ref.image)) {
+    ESP_LOGW(TAG, "Show image has an invalid layout");
+    dmxbox_show_image_close(&ref);
+    return false;
+  }
+
+  attach_image(show, ref.image);
+  if (ref.pin >= 0) {
+    // mapped flash is read-only, the effects' runtime state needs RAM
+    size_t effects_size = show->effect_count * sizeof(effect_t);
+    show->buffer = malloc(effects_size);
+    if (effects_size && !show->buffer) {
+      ESP_LOGE(TAG, "Failed to allocate %u bytes for effects", effects_size);
+      dmxbox_show_image_close(&ref);
+      memset(show, 0, sizeof(show_t));
+      return false;
+    }
+    memcpy(show->buffer, show->effects, effects_size);
+    show->effects = show->buffer;
+  }
+  show->image_ref = ref;
+  return true;
+}
+
+void show_load(show_t *show) {
+  memset(show, 0, sizeof(show_t));
+
+  if (load_image(show)) {
+    ESP_LOGI(TAG, "Loaded %d effects from show image", show->effect_count);
+  } else {
+    // read before compiling so that changes made meanwhile make it stale
+    uint32_t generation = dmxbox_show_generation();
+
+    show_builder_t builder = {0};
+    dmxbox_show_image_t *image = NULL;
+    if (load_effects_from_storage(&builder)) {
+      image = compile_show(&builder);
+    }
+    builder_free(&builder);
+
+    if (!image) {
+      ESP_LOGE(TAG, "Failed to compile the show, running without effects");
+      return;
+    }
+
+    image->generation = generation;
+    show->buffer = image;
+    attach_image(show, image);
+    ESP_LOGI(TAG, "Compiled %d effects", show->effect_count);
+
+    esp_err_t ret = dmxbox_show_image_set(image);
+    if (ret != ESP_OK) {
+      ESP_LOGW(TAG, "Failed to store show image: %s", esp_err_to_name(ret));
+    }
+  }
+
+  for (size_t i = 0; i < show->effect_count; i++) {
+    reset_effect_state(&show->effects[i]);
+  }
+}
+
+void show_free(show_t *show) {
+  free(show->buffer);
+  if (show->image_ref.image) {
+    dmxbox_show_image_close(&show->image_ref);
+  }
+  memset(show, 0, sizeof(show_t));
+}
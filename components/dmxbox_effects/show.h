@@ -0,0 +1,116 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "effect_storage.h"
+#include "election.h"
+#include "show_image_storage.h"
+
+// Runtime layout of the effects. All effects, steps and channels of a show
+// live in three arrays, laid out the same way as in the compiled show image.
+// Steps and channels are only ever read, so they're used straight from the
+// image, which can be mapped flash. Effects carry runtime state and always
+// live in RAM.
+
+// Bump whenever any of the structs below changes.
+#define SHOW_LAYOUT_VERSION 6
+
+typedef struct step_channel {
+  uint16_t channel;
+  uint8_t level;
+} step_channel_t;
+
+typedef struct step {
+  uint32_t time;
+  uint32_t in;
+  uint32_t dwell;
+  uint32_t out;
+
+  uint32_t first_channel;
+  uint32_t channel_count;
+
+  // precalculated values
+  uint32_t offset_us;
+} step_t;
+
+typedef struct waveform {
+  uint8_t shape;
+  uint8_t size;
+  uint8_t offset;
+  uint16_t spread;
+  uint32_t period;
+
+  // precalculated values
+  uint32_t channel_phase_step; // in 1/2^32 of a cycle
+} waveform_t;
+
+typedef struct effect_distributed_state {
+  election_t election;
+
+  uint8_t last_level;
+  uint8_t last_rate_raw;
+  uint8_t last_priority;
+  uint64_t last_sync_us;
+} effect_distributed_state_t;
+
+typedef struct effect {
+  uint16_t id;
+  uint16_t level_channel;
+  uint16_t rate_channel;
+  int level_control; // index into control_values, -1 if none
+  int rate_control;  // index into control_values, -1 if none
+  bool distributed;
+  uint16_t distributed_id;
+  dmxbox_effect_type_t type;
+  uint8_t priority;
+  uint8_t blend; // dmxbox_effect_blend_t
+  uint16_t beats; // locked to the tempo if nonzero
+
+  // placed on the timecode timeline, in ms of show time
+  bool timed;
+  bool timed_end;
+  uint32_t start;
+  uint32_t end;
+
+  uint32_t first_step;
+  uint32_t step_count;
+
+  // channels of all steps, in order (steps' channels are contiguous)
+  uint32_t first_channel;
+  uint32_t channel_count;
+
+  waveform_t waveform;
+
+  // precalculated values
+  uint32_t effect_length_us;
+
+  // internal state
+  bool active;
+  double progress;
+  bool first_pass;
+  uint32_t cycle;
+
+  effect_distributed_state_t distributed_state;
+} effect_t;
+
+typedef struct show {
+  effect_t *effects;
+  size_t effect_count;
+
+  const step_t *steps;
+  size_t step_count;
+
+  const step_channel_t *channels;
+  size_t channel_count;
+
+  // a compiled image or a copy of the stored image's effects, NULL if none
+  void *buffer;
+  // the stored image the arrays point into, image is NULL if none
+  dmxbox_show_image_ref_t image_ref;
+} show_t;
+
+// Loads the compiled show image, or compiles the effects from storage (and
+// stores a new image) if it's missing or stale.
+void show_load(show_t *show);
+void show_free(show_t *show);
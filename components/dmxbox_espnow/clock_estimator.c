@@ -0,0 +1,59 @@
+#include <string.h>
+
+#include "clock_estimator.h"
+
+// The offset moves towards a new best sample by 1/n, so that a single
+// lucky exchange doesn't make the clock jump
+#define OFFSET_FILTER 4
+
+// Offsets further off than this are taken as is (e.g. the reference
+// changed or rebooted)
+#define STEP_THRESHOLD_US 5000
+
+void clock_estimator_reset(clock_estimator_t *estimator) {
+  memset(estimator, 0, sizeof(clock_estimator_t));
+}
+
+bool clock_estimator_add(
+    clock_estimator_t *estimator,
+    int64_t t1,
+    int64_t t2,
+    int64_t t3,
+    int64_t t4
+) {
+  int64_t delay_us = (t4 - t1) - (t3 - t2);
+  if (t4 < t1 || t3 < t2 || delay_us < 0) {
+    return false;
+  }
+
+  clock_sample_t sample = {
+      .offset_us = ((t2 - t1) + (t3 - t4)) / 2,
+      .delay_us = delay_us,
+  };
+  estimator->samples[estimator->sample_count % CLOCK_ESTIMATOR_SAMPLES] =
+      sample;
+  estimator->sample_count++;
+
+  // the exchange with the shortest round trip had the least queueing, and
+  // so the most symmetric delays
+  uint32_t count = estimator->sample_count < CLOCK_ESTIMATOR_SAMPLES
+                       ? estimator->sample_count
+                       : CLOCK_ESTIMATOR_SAMPLES;
+  const clock_sample_t *best = &estimator->samples[0];
+  for (uint32_t i = 1; i < count; i++) {
+    if (estimator->samples[i].delay_us < best->delay_us) {
+      best = &estimator->samples[i];
+    }
+  }
+
+  int64_t error_us = best->offset_us - estimator->offset_us;
+  if (!estimator->valid || error_us > STEP_THRESHOLD_US ||
+      error_us < -STEP_THRESHOLD_US) {
+    estimator->offset_us = best->offset_us;
+  } else {
+    estimator->offset_us += error_us / OFFSET_FILTER;
+  }
+  estimator->delay_us = best->delay_us;
+  estimator->valid = true;
+  return true;
+}
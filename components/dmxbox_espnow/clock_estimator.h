@@ -0,0 +1,39 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+// NTP-style estimate of the offset between the local clock and a reference
+// clock, from request/response exchanges. Plain C, without any ESP-IDF
+// dependencies, so that it can be exercised off target.
+
+// exchanges kept for picking the best one
+#define CLOCK_ESTIMATOR_SAMPLES 8
+
+typedef struct clock_sample {
+  int64_t offset_us; // reference minus local
+  int64_t delay_us;  // round trip, minus the time spent at the reference
+} clock_sample_t;
+
+typedef struct clock_estimator {
+  clock_sample_t samples[CLOCK_ESTIMATOR_SAMPLES];
+  uint32_t sample_count;
+
+  bool valid;
+  int64_t offset_us;
+  int64_t delay_us;
+} clock_estimator_t;
+
+void clock_estimator_reset(clock_estimator_t *estimator);
+
+// t1: request sent (local clock)
+// t2: request received (reference clock)
+// t3: response sent (reference clock)
+// t4: response received (local clock)
+// Returns false if the exchange makes no sense and was ignored.
+bool clock_estimator_add(
+    clock_estimator_t *estimator,
+    int64_t t1,
+    int64_t t2,
+    int64_t t3,
+    int64_t t4
+);
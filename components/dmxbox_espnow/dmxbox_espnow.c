@@ -3,10 +3,18 @@
 #include <esp_log.h>
 #include <esp_mac.h>
 #include <esp_now.h>
+#include <esp_timer.h>
+#include <esp_wifi.h>
+#include <freertos/semphr.h>
+#include <math.h>
 #include <string.h>
 
 #include "dmxbox_espnow.h"
 #include "esp_random.h"
+#include "metrics.h"
+#include "packets.h"
+#include "time_sync.h"
+#include "universe_stream.h"
 
 static const char *TAG = "dmxbox_espnow";
 
@@ -17,12 +25,14 @@ static const char *TAG = "dmxbox_espnow";
 
 #define ESPNOW_QUEUE_SIZE 6
 
-#define ESPNOW_MAXDELAY 512
+// Received packets waiting to be handled
+#define RECV_SLOT_COUNT 16
+
+// ESP-NOW peers added for the boxes heard from, the least recently heard
+// one is replaced when full. Stays within the encrypted peer limit.
+#define PEER_CACHE_SIZE 6
 
-typedef enum {
-  PACKET_TYPE_INVALID = 0,
-  PACKET_TYPE_EFFECT_SYNC,
-} packet_type_t;
+#define ESPNOW_MAXDELAY 512
 
 typedef struct {
   uint8_t mac_addr[ESP_NOW_ETH_ALEN];
@@ -31,28 +41,52 @@ typedef struct {
 
 typedef struct {
   uint8_t mac_addr[ESP_NOW_ETH_ALEN];
-  uint8_t *data;
   int data_len;
-} recv_queue_event_t;
+  int64_t receive_time_us;
+  uint8_t data[ESP_NOW_MAX_DATA_LEN];
+} recv_slot_t;
 
-typedef struct __attribute__((packed)) {
-  packet_type_t type;
-  uint16_t crc;
-  uint8_t data[0];
-} packet_envelope_t;
+typedef struct {
+  uint8_t mac_addr[ESP_NOW_ETH_ALEN];
+  int64_t last_seen_us; // 0 if unused
+} cached_peer_t;
 
 typedef struct __attribute__((packed)) {
-  uint16_t effect_id;
-  uint8_t level;
-  uint8_t rate_raw;
-  double progress;
-  bool first_pass;
-} effect_sync_packet_t;
+  double bpm;
+  double beats;
+  int64_t sender_time_us; // shared clock, 0 if unknown
+} tempo_packet_t;
 
 static dmxbox_espnow_effect_state_callback_t effect_state_callback = NULL;
+static dmxbox_espnow_tempo_callback_t tempo_callback = NULL;
+
+static uint8_t own_mac[ESP_NOW_ETH_ALEN];
 
 static QueueHandle_t send_queue;
-static QueueHandle_t recv_queue;
+
+// Filled by the Wi-Fi task and drained by the receive task, in order
+static portMUX_TYPE recv_spinlock = portMUX_INITIALIZER_UNLOCKED;
+static recv_slot_t recv_slots[RECV_SLOT_COUNT];
+static uint32_t recv_head; // slots filled, protected by recv_spinlock
+static uint32_t recv_tail; // slots handled, protected by recv_spinlock
+static TaskHandle_t recv_task;
+
+// only used from the receive task
+static cached_peer_t peer_cache[PEER_CACHE_SIZE];
+
+// Guards send_buffer, packets are sent from several tasks
+static SemaphoreHandle_t send_mutex;
+static uint8_t send_buffer[ESP_NOW_MAX_DATA_LEN];
+static uint16_t send_sequence;
+
+// Effect states being batched, only used from the effects task
+static struct {
+  effect_states_packet_t header;
+  effect_state_entry_t entries[EFFECT_STATES_PER_PACKET];
+} __attribute__((packed)) effect_states_batch;
+
+// Unpacked effect states, only used from the receive task
+static dmxbox_espnow_effect_state_t received_states[EFFECT_STATES_PER_PACKET];
 
 static const uint8_t broadcast_mac[ESP_NOW_ETH_ALEN] =
     {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
@@ -66,6 +100,7 @@ dmxbox_espnow_send_cb(const uint8_t *mac_addr, esp_now_send_status_t status) {
     ESP_LOGE(TAG, "Send cb arg error");
     return;
   }
+  metrics_record_send_status(status == ESP_NOW_SEND_SUCCESS);
 
   send_queue_event_t evt = {
       .status = status,
@@ -83,25 +118,39 @@ static void dmxbox_espnow_recv_cb(
 ) {
   uint8_t *mac_addr = recv_info->src_addr;
 
-  if (mac_addr == NULL || data == NULL || len <= 0) {
-    ESP_LOGE(TAG, "Receive cb arg error");
+  // Stray ESP-NOW traffic is turned away here, before it takes up a slot
+  packet_envelope_t envelope;
+  if (mac_addr == NULL || data == NULL || len < sizeof(envelope) ||
+      len > ESP_NOW_MAX_DATA_LEN) {
+    metrics_record_rejected();
     return;
   }
-
-  recv_queue_event_t evt = {
-      .data = malloc(len),
-  };
-  if (evt.data == NULL) {
-    ESP_LOGE(TAG, "Malloc receive data fail");
+  memcpy(&envelope, data, sizeof(envelope));
+  if (envelope.type <= PACKET_TYPE_EFFECT_SYNC ||
+      envelope.type >= PACKET_TYPE_COUNT) {
+    metrics_record_rejected();
     return;
   }
-  memcpy(evt.mac_addr, mac_addr, ESP_NOW_ETH_ALEN);
-  memcpy(evt.data, data, len);
-  evt.data_len = len;
-  if (xQueueSend(recv_queue, &evt, ESPNOW_MAXDELAY) != pdTRUE) {
-    ESP_LOGW(TAG, "Receive queue fail");
-    free(evt.data);
+
+  taskENTER_CRITICAL(&recv_spinlock);
+  bool full = recv_head - recv_tail == RECV_SLOT_COUNT;
+  uint32_t index = recv_head % RECV_SLOT_COUNT;
+  taskEXIT_CRITICAL(&recv_spinlock);
+  if (full) {
+    metrics_record_dropped();
+    return;
   }
+
+  recv_slot_t *slot = &recv_slots[index];
+  memcpy(slot->mac_addr, mac_addr, ESP_NOW_ETH_ALEN);
+  memcpy(slot->data, data, len);
+  slot->data_len = len;
+  slot->receive_time_us = esp_timer_get_time();
+
+  taskENTER_CRITICAL(&recv_spinlock);
+  recv_head++;
+  taskEXIT_CRITICAL(&recv_spinlock);
+  xTaskNotifyGive(recv_task);
 }
 
 packet_type_t
@@ -128,20 +177,44 @@ process_incoming_packet(uint8_t *data, uint16_t data_len, void **result) {
 }
 
 void send_packet(packet_type_t type, void *data, size_t length) {
+  send_stamped_packet(type, data, length, NULL);
+}
+
+void send_stamped_packet(
+    packet_type_t type,
+    void *data,
+    size_t length,
+    send_stamp_t stamp
+) {
   size_t total_length = offsetof(packet_envelope_t, data) + length;
+  if (total_length > sizeof(send_buffer)) {
+    ESP_LOGE(TAG, "Packet type %d too long, len: %d", type, total_length);
+    return;
+  }
 
-  packet_envelope_t *packet = calloc(1, total_length);
+  xSemaphoreTake(send_mutex, portMAX_DELAY);
+
+  packet_envelope_t *packet = (packet_envelope_t *)send_buffer;
   packet->type = type;
+  packet->sequence = ++send_sequence;
   memcpy(&packet->data, data, length);
+  if (stamp) {
+    stamp(&packet->data, esp_timer_get_time());
+  }
 
   packet->crc = 0;
   packet->crc = esp_crc16_le(UINT16_MAX, (uint8_t const *)packet, total_length);
 
-  ESP_ERROR_CHECK(
-      esp_now_send(broadcast_mac, (const uint8_t *)packet, total_length)
-  );
+  // the data is copied before esp_now_send returns
+  esp_err_t ret =
+      esp_now_send(broadcast_mac, (const uint8_t *)packet, total_length);
+  metrics_record_sent(ret);
+
+  xSemaphoreGive(send_mutex);
 
-  free(packet);
+  if (ret != ESP_OK) {
+    ESP_LOGW(TAG, "Failed to send packet: %s", esp_err_to_name(ret));
+  }
 }
 
 static void espnow_send_loop(void *pvParameter) {
@@ -158,7 +231,7 @@ static void espnow_send_loop(void *pvParameter) {
 
   send_queue_event_t evt;
   while (xQueueReceive(send_queue, &evt, portMAX_DELAY) == pdTRUE) {
-    ESP_LOGI(
+    ESP_LOGD(
         TAG,
         "Send data to " MACSTR ", status: %d",
         MAC2STR(evt.mac_addr),
@@ -179,79 +252,223 @@ static void espnow_send_loop(void *pvParameter) {
   }
 }
 
-static void handle_effect_sync_packet(
-    const effect_sync_packet_t *packet,
-    const uint8_t *mac_addr
+static bool
+has_payload(const recv_slot_t *evt, size_t size, const char *name) {
+  if (evt->data_len < offsetof(packet_envelope_t, data) + size) {
+    ESP_LOGE(TAG, "%s packet too short, len: %d", name, evt->data_len);
+    return false;
+  }
+  return true;
+}
+
+static void handle_effect_states_packet(
+    const recv_slot_t *evt,
+    const effect_states_packet_t *packet
 ) {
+  size_t count = packet->count;
+  if (count > EFFECT_STATES_PER_PACKET ||
+      !has_payload(
+          evt,
+          sizeof(effect_states_packet_t) + count * sizeof(effect_state_entry_t),
+          "Effect states"
+      )) {
+    return;
+  }
+
+  ESP_LOGD(
+      TAG,
+      "Received %d effect states from: " MACSTR,
+      count,
+      MAC2STR(evt->mac_addr)
+  );
+  if (!effect_state_callback) {
+    return;
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    const effect_state_entry_t *entry = &packet->entries[i];
+    received_states[i] = (dmxbox_espnow_effect_state_t){
+        .effect_id = entry->effect_id,
+        .level = entry->level,
+        .rate_raw = entry->rate_raw,
+        .phase = entry->phase / 65536.0,
+        .first_pass = entry->flags & EFFECT_STATE_FIRST_PASS,
+        .priority = entry->priority,
+    };
+  }
+  effect_state_callback(
+      evt->mac_addr,
+      received_states,
+      count,
+      packet->leader_time_us,
+      evt->receive_time_us
+  );
+}
+
+static void
+handle_tempo_packet(const recv_slot_t *evt, const tempo_packet_t *packet) {
   ESP_LOGI(
       TAG,
-      "Received effect state data from: " MACSTR
-      ", level: %d, rate: %d, progress: %f, first_pass: %d",
-      MAC2STR(mac_addr),
-      packet->level,
-      packet->rate_raw,
-      packet->progress,
-      packet->first_pass
+      "Received tempo from: " MACSTR ", bpm: %f, beats: %f",
+      MAC2STR(evt->mac_addr),
+      packet->bpm,
+      packet->beats
   );
-  if (effect_state_callback) {
-    effect_state_callback(
-        packet->effect_id,
-        packet->level,
-        packet->rate_raw,
-        packet->progress,
-        packet->first_pass
+  if (tempo_callback) {
+    tempo_callback(
+        packet->bpm,
+        packet->beats,
+        packet->sender_time_us,
+        evt->receive_time_us
     );
   }
 }
 
-static void espnow_recv_loop(void *pvParameter) {
-  vTaskDelay(5000 / portTICK_PERIOD_MS);
-  ESP_LOGI(TAG, "Start receiving broadcast data");
+// Adds the box as an ESP-NOW peer, unless it's one already
+static void touch_peer(const uint8_t *mac_addr, int64_t time_us) {
+  cached_peer_t *slot = NULL;
+  for (size_t i = 0; i < PEER_CACHE_SIZE; i++) {
+    cached_peer_t *cached = &peer_cache[i];
+    if (cached->last_seen_us &&
+        !memcmp(cached->mac_addr, mac_addr, ESP_NOW_ETH_ALEN)) {
+      cached->last_seen_us = time_us;
+      return;
+    }
+    if (!slot || cached->last_seen_us < slot->last_seen_us) {
+      slot = cached;
+    }
+  }
+
+  if (slot->last_seen_us) {
+    ESP_LOGI(TAG, "Evicting peer " MACSTR, MAC2STR(slot->mac_addr));
+    esp_err_t ret = esp_now_del_peer(slot->mac_addr);
+    if (ret != ESP_OK && ret != ESP_ERR_ESPNOW_NOT_FOUND) {
+      ESP_LOGW(TAG, "Failed to remove peer: %s", esp_err_to_name(ret));
+    }
+    slot->last_seen_us = 0;
+  }
+
+  esp_now_peer_info_t peer = {
+      .channel = 0, // use current
+      .ifidx = ESP_IF_WIFI_AP,
+      .encrypt = true,
+  };
+  memcpy(peer.lmk, CONFIG_ESPNOW_LMK, ESP_NOW_KEY_LEN);
+  memcpy(peer.peer_addr, mac_addr, ESP_NOW_ETH_ALEN);
+  esp_err_t ret = esp_now_add_peer(&peer);
+  if (ret != ESP_OK && ret != ESP_ERR_ESPNOW_EXIST) {
+    ESP_LOGW(TAG, "Failed to add peer: %s", esp_err_to_name(ret));
+    return;
+  }
+
+  memcpy(slot->mac_addr, mac_addr, ESP_NOW_ETH_ALEN);
+  slot->last_seen_us = time_us;
+}
+
+static void handle_received_packet(recv_slot_t *evt) {
+  void *packet_data;
+  packet_type_t packet_type =
+      process_incoming_packet(evt->data, evt->data_len, &packet_data);
+  metrics_record_received(
+      evt->mac_addr,
+      evt->receive_time_us,
+      packet_type != PACKET_TYPE_INVALID,
+      ((const packet_envelope_t *)evt->data)->sequence
+  );
+
+  if (packet_type != PACKET_TYPE_INVALID) {
+    time_sync_saw_peer(evt->mac_addr, evt->receive_time_us);
+    touch_peer(evt->mac_addr, evt->receive_time_us);
+  }
 
-  recv_queue_event_t evt;
-  while (xQueueReceive(recv_queue, &evt, portMAX_DELAY) == pdTRUE) {
-    void *packet_data;
-    packet_type_t packet_type =
-        process_incoming_packet(evt.data, evt.data_len, &packet_data);
-
-    switch (packet_type) {
-    case PACKET_TYPE_EFFECT_SYNC:
-      handle_effect_sync_packet(
-          (effect_sync_packet_t *)packet_data,
-          evt.mac_addr
-      );
+  switch (packet_type) {
+  case PACKET_TYPE_EFFECT_STATES:
+    if (!has_payload(evt, sizeof(effect_states_packet_t), "Effect states")) {
       break;
+    }
+    handle_effect_states_packet(evt, (effect_states_packet_t *)packet_data);
+    break;
 
-    case PACKET_TYPE_INVALID:
-      ESP_LOGI(
-          TAG,
-          "Received invalid data from: " MACSTR "",
-          MAC2STR(evt.mac_addr)
-      );
+  case PACKET_TYPE_TEMPO:
+    if (!has_payload(evt, sizeof(tempo_packet_t), "Tempo")) {
       break;
+    }
+    handle_tempo_packet(evt, (tempo_packet_t *)packet_data);
+    break;
 
-    default:
-      ESP_LOGI(
-          TAG,
-          "Received unknown data type %d from: " MACSTR "",
-          packet_type,
-          MAC2STR(evt.mac_addr)
-      );
+  case PACKET_TYPE_UNIVERSE:
+    if (!has_payload(evt, sizeof(universe_packet_t), "Universe")) {
       break;
     }
+    universe_stream_handle_packet(
+        (universe_packet_t *)packet_data,
+        evt->data_len - offsetof(packet_envelope_t, data),
+        evt->mac_addr,
+        evt->receive_time_us
+    );
+    break;
+
+  case PACKET_TYPE_TIME_REQUEST:
+    if (!has_payload(evt, sizeof(time_request_packet_t), "Time request")) {
+      break;
+    }
+    time_sync_handle_request(
+        (time_request_packet_t *)packet_data,
+        evt->mac_addr,
+        evt->receive_time_us
+    );
+    break;
+
+  case PACKET_TYPE_TIME_RESPONSE:
+    if (!has_payload(evt, sizeof(time_response_packet_t), "Time response")) {
+      break;
+    }
+    time_sync_handle_response(
+        (time_response_packet_t *)packet_data,
+        evt->mac_addr,
+        evt->receive_time_us
+    );
+    break;
+
+  case PACKET_TYPE_INVALID:
+    ESP_LOGI(
+        TAG,
+        "Received invalid data from: " MACSTR "",
+        MAC2STR(evt->mac_addr)
+    );
+    break;
+
+  default:
+    ESP_LOGI(
+        TAG,
+        "Received unknown data type %d from: " MACSTR "",
+        packet_type,
+        MAC2STR(evt->mac_addr)
+    );
+    break;
+  }
+}
+
+static void espnow_recv_loop(void *pvParameter) {
+  ESP_LOGI(TAG, "Start receiving broadcast data");
+
+  while (true) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    while (true) {
+      taskENTER_CRITICAL(&recv_spinlock);
+      bool empty = recv_head == recv_tail;
+      uint32_t index = recv_tail % RECV_SLOT_COUNT;
+      taskEXIT_CRITICAL(&recv_spinlock);
+      if (empty) {
+        break;
+      }
 
-    free(evt.data);
-
-    /* If MAC address does not exist in peer list, add it to peer list. */
-    if (esp_now_is_peer_exist(evt.mac_addr) == false) {
-      esp_now_peer_info_t *peer = calloc(1, sizeof(esp_now_peer_info_t));
-      peer->channel = 0; // use current
-      peer->ifidx = ESP_IF_WIFI_AP;
-      peer->encrypt = true;
-      memcpy(peer->lmk, CONFIG_ESPNOW_LMK, ESP_NOW_KEY_LEN);
-      memcpy(peer->peer_addr, evt.mac_addr, ESP_NOW_ETH_ALEN);
-      ESP_ERROR_CHECK(esp_now_add_peer(peer));
-      free(peer);
+      handle_received_packet(&recv_slots[index]);
+
+      taskENTER_CRITICAL(&recv_spinlock);
+      recv_tail++;
+      taskEXIT_CRITICAL(&recv_spinlock);
     }
   }
 }
@@ -266,27 +483,83 @@ void dmxbox_espnow_register_effect_state_callback(
   effect_state_callback = cb;
 }
 
-void dmxbox_espnow_send_effect_state(
-    uint16_t effect_id,
-    uint8_t level,
-    uint8_t rate_raw,
-    double progress,
-    bool first_pass
+void dmxbox_espnow_begin_effect_states(int64_t leader_time_us) {
+  effect_states_batch.header.leader_time_us = leader_time_us;
+  effect_states_batch.header.count = 0;
+}
+
+void dmxbox_espnow_add_effect_state(const dmxbox_espnow_effect_state_t *state
 ) {
-  effect_sync_packet_t packet = {
-      .effect_id = effect_id,
-      .level = level,
-      .rate_raw = rate_raw,
-      .progress = progress,
-      .first_pass = first_pass,
+  if (effect_states_batch.header.count == EFFECT_STATES_PER_PACKET) {
+    dmxbox_espnow_flush_effect_states();
+  }
+
+  long phase = lround(state->phase * 65536);
+  effect_states_batch.entries[effect_states_batch.header.count++] =
+      (effect_state_entry_t){
+          .effect_id = state->effect_id,
+          .level = state->level,
+          .rate_raw = state->rate_raw,
+          .phase = phase < 0 ? 0 : phase > UINT16_MAX ? UINT16_MAX : phase,
+          .flags = state->first_pass ? EFFECT_STATE_FIRST_PASS : 0,
+          .priority = state->priority,
+      };
+}
+
+void dmxbox_espnow_flush_effect_states() {
+  size_t count = effect_states_batch.header.count;
+  if (!count) {
+    return;
+  }
+
+  send_packet(
+      PACKET_TYPE_EFFECT_STATES,
+      &effect_states_batch,
+      sizeof(effect_states_packet_t) + count * sizeof(effect_state_entry_t)
+  );
+  effect_states_batch.header.count = 0;
+}
+
+void dmxbox_espnow_register_tempo_callback(dmxbox_espnow_tempo_callback_t cb
+) {
+  if (tempo_callback) {
+    ESP_LOGW(TAG, "Tempo callback is already set");
+  }
+
+  tempo_callback = cb;
+}
+
+void dmxbox_espnow_send_tempo(double bpm, double beats, int64_t time_us) {
+  tempo_packet_t packet = {
+      .bpm = bpm,
+      .beats = beats,
+      .sender_time_us =
+          dmxbox_espnow_time_synced() ? dmxbox_espnow_get_shared_time(time_us)
+                                      : 0,
   };
 
-  send_packet(PACKET_TYPE_EFFECT_SYNC, &packet, sizeof(effect_sync_packet_t));
+  send_packet(PACKET_TYPE_TEMPO, &packet, sizeof(tempo_packet_t));
 }
 
+const uint8_t *dmxbox_espnow_get_mac() { return own_mac; }
+
 void dmxbox_espnow_init() {
+  // peers are added on the AP interface, so that's what packets come from
+  ESP_ERROR_CHECK(esp_wifi_get_mac(WIFI_IF_AP, own_mac));
+
   send_queue = xQueueCreate(ESPNOW_QUEUE_SIZE, sizeof(send_queue_event_t));
-  recv_queue = xQueueCreate(ESPNOW_QUEUE_SIZE, sizeof(recv_queue_event_t));
+  send_mutex = xSemaphoreCreateMutex();
+
+  // the receive callback notifies the task, so it has to exist first
+  xTaskCreate(espnow_send_loop, "espnow_send_loop", 2048, NULL, 4, NULL);
+  xTaskCreate(
+      espnow_recv_loop,
+      "espnow_recv_loop",
+      4096,
+      NULL,
+      4,
+      &recv_task
+  );
 
   ESP_ERROR_CHECK(esp_now_init());
   ESP_ERROR_CHECK(esp_now_register_send_cb(dmxbox_espnow_send_cb));
@@ -295,20 +568,18 @@ void dmxbox_espnow_init() {
   ESP_ERROR_CHECK(esp_now_set_pmk((uint8_t *)CONFIG_ESPNOW_PMK));
 
   // Add broadcast peer information to peer list.
-  esp_now_peer_info_t *peer = calloc(1, sizeof(esp_now_peer_info_t));
-  peer->channel = 0; // use current
-  peer->ifidx = ESP_IF_WIFI_AP;
-  peer->encrypt = false;
-  memcpy(peer->peer_addr, broadcast_mac, ESP_NOW_ETH_ALEN);
-  ESP_ERROR_CHECK(esp_now_add_peer(peer));
-  free(peer);
+  esp_now_peer_info_t peer = {
+      .channel = 0, // use current
+      .ifidx = ESP_IF_WIFI_AP,
+      .encrypt = false,
+  };
+  memcpy(peer.peer_addr, broadcast_mac, ESP_NOW_ETH_ALEN);
+  ESP_ERROR_CHECK(esp_now_add_peer(&peer));
 
-  xTaskCreate(espnow_send_loop, "espnow_send_loop", 2048, NULL, 4, NULL);
-  xTaskCreate(espnow_recv_loop, "espnow_recv_loop", 2048, NULL, 4, NULL);
+  time_sync_init();
 }
 
 // static void example_espnow_deinit() {
 //   vSemaphoreDelete(send_queue);
-//   vSemaphoreDelete(recv_queue);
 //   esp_now_deinit();
 // }
@@ -1,25 +1,121 @@
 #pragma once
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+#include "dmxbox_const.h"
+
+// Whether a box with wired DMX in streams it to the other boxes
+#ifndef CONFIG_DMXBOX_ESPNOW_STREAM_DMX_IN
+#define CONFIG_DMXBOX_ESPNOW_STREAM_DMX_IN 1
+#endif
+
+#define DMXBOX_ESPNOW_MAC_LEN 6
+
+typedef struct dmxbox_espnow_effect_state {
+  uint16_t effect_id;
+  uint8_t level;
+  uint8_t rate_raw;
+  double phase; // position in the effect's cycle, from 0 to 1
+  bool first_pass;
+  uint8_t priority; // the leader's, higher wins the election
+} dmxbox_espnow_effect_state_t;
+
+// Called once for every packet of effect states, from the box with the given
+// MAC. leader_time_us is the leader's shared time the states were current at,
+// or 0 if it wasn't synced. receive_time_us is the local time the packet
+// arrived at.
 typedef void (*dmxbox_espnow_effect_state_callback_t)(
-    uint16_t effect_id,
-    uint8_t level,
-    uint8_t rate_raw,
-    double progress,
-    bool first_pass
+    const uint8_t mac[DMXBOX_ESPNOW_MAC_LEN],
+    const dmxbox_espnow_effect_state_t *states,
+    size_t count,
+    int64_t leader_time_us,
+    int64_t receive_time_us
+);
+
+// beats is the sender's tempo clock position at its shared time
+// sender_time_us, which is 0 if it wasn't synced. receive_time_us is the
+// local time the packet arrived at.
+typedef void (*dmxbox_espnow_tempo_callback_t)(
+    double bpm,
+    double beats,
+    int64_t sender_time_us,
+    int64_t receive_time_us
 );
 
 void dmxbox_espnow_init();
 
+// MAC address the other boxes see this one as
+const uint8_t *dmxbox_espnow_get_mac();
+
 void dmxbox_espnow_register_effect_state_callback(
     dmxbox_espnow_effect_state_callback_t cb
 );
 
-void dmxbox_espnow_send_effect_state(
-    uint16_t effect_id,
-    uint8_t level,
-    uint8_t rate_raw,
-    double progress,
-    bool first_pass
+// Effect states are sent in batches, as few packets as they fit in. Only to
+// be used from one task.
+void dmxbox_espnow_begin_effect_states(int64_t leader_time_us);
+void dmxbox_espnow_add_effect_state(const dmxbox_espnow_effect_state_t *state);
+void dmxbox_espnow_flush_effect_states();
+
+void dmxbox_espnow_register_tempo_callback(dmxbox_espnow_tempo_callback_t cb);
+
+// beats is the position at the local time time_us
+void dmxbox_espnow_send_tempo(double bpm, double beats, int64_t time_us);
+
+// All boxes keep a shared clock, following the box with the lowest MAC
+// address. Local times are esp_timer times.
+bool dmxbox_espnow_time_synced();
+int64_t dmxbox_espnow_get_shared_time(int64_t local_us);
+int64_t dmxbox_espnow_to_local_time(int64_t shared_us);
+
+// Streams a universe to the other boxes, to be called with every frame of it.
+// Only changes against the last keyframe are sent, and nothing but small
+// keepalives while the universe doesn't change.
+void dmxbox_espnow_stream_universe(
+    const uint8_t data[DMX_CHANNEL_COUNT],
+    int64_t time_us
 );
+
+// Copies the universe streamed by another box. Returns false, leaving data
+// alone, if there's no stream.
+bool dmxbox_espnow_get_streamed_universe(uint8_t data[DMX_CHANNEL_COUNT]);
+
+#define DMXBOX_ESPNOW_STATS_PEERS 12
+#define DMXBOX_ESPNOW_JITTER_BUCKETS 8
+
+typedef struct dmxbox_espnow_peer_stats {
+  uint8_t mac[DMXBOX_ESPNOW_MAC_LEN];
+  uint32_t received;
+  uint32_t crc_failures;
+  uint32_t duplicates; // or arrived out of order
+  uint32_t gaps;       // packets missed, going by sequence numbers
+
+  // How much the time between two packets differed from the time between
+  // the two before. Bucket 0 counts under 1 ms, each next one is twice as
+  // wide, and the last one counts everything above.
+  uint32_t jitter[DMXBOX_ESPNOW_JITTER_BUCKETS];
+} dmxbox_espnow_peer_stats_t;
+
+typedef struct dmxbox_espnow_stats {
+  uint32_t sent;
+  uint32_t send_errors;   // esp_now_send failed
+  uint32_t send_failures; // reported as failed by the send callback
+  uint32_t rejected;      // malformed or unknown packets
+  uint32_t dropped;       // no free receive slot
+
+  // the follower's effect position against the leader's, on every sync
+  uint32_t phase_samples;
+  int32_t phase_error_last_us;
+  int32_t phase_error_average_us; // of the magnitude
+  uint32_t phase_error_max_us;
+
+  // the boxes heard from most recently
+  size_t peer_count;
+  dmxbox_espnow_peer_stats_t peers[DMXBOX_ESPNOW_STATS_PEERS];
+} dmxbox_espnow_stats_t;
+
+// A snapshot of the counters, which aren't read all at once
+void dmxbox_espnow_get_stats(dmxbox_espnow_stats_t *stats);
+
+void dmxbox_espnow_record_phase_error(int32_t error_us);
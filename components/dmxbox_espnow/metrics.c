@@ -0,0 +1,184 @@
+#include <stdatomic.h>
+#include <string.h>
+
+#include "dmxbox_espnow.h"
+#include "metrics.h"
+
+// weight of a new phase error sample in the average, 1/n
+#define PHASE_ERROR_FILTER 16
+
+typedef struct peer_metrics {
+  // only used from the receive task
+  int64_t last_seen_us; // 0 if unused
+  int64_t last_interval_us;
+  uint16_t last_sequence;
+
+  uint8_t mac[ESP_NOW_ETH_ALEN];
+  atomic_uint received;
+  atomic_uint crc_failures;
+  atomic_uint duplicates;
+  atomic_uint gaps;
+  atomic_uint jitter[DMXBOX_ESPNOW_JITTER_BUCKETS];
+} peer_metrics_t;
+
+static peer_metrics_t peers[DMXBOX_ESPNOW_STATS_PEERS];
+
+static atomic_uint sent;
+static atomic_uint send_errors;
+static atomic_uint send_failures;
+static atomic_uint rejected;
+static atomic_uint dropped;
+
+// only written from the effects task
+static atomic_uint phase_samples;
+static atomic_int phase_error_last_us;
+static atomic_int phase_error_average_us;
+static atomic_uint phase_error_max_us;
+
+static void increment(atomic_uint *counter) {
+  atomic_fetch_add_explicit(counter, 1, memory_order_relaxed);
+}
+
+static uint32_t load(atomic_uint *counter) {
+  return atomic_load_explicit(counter, memory_order_relaxed);
+}
+
+void metrics_record_sent(esp_err_t ret) {
+  increment(ret == ESP_OK ? &sent : &send_errors);
+}
+
+void metrics_record_send_status(bool success) {
+  if (!success) {
+    increment(&send_failures);
+  }
+}
+
+void metrics_record_rejected() { increment(&rejected); }
+
+void metrics_record_dropped() { increment(&dropped); }
+
+static peer_metrics_t *find_peer(const uint8_t mac[ESP_NOW_ETH_ALEN]) {
+  peer_metrics_t *slot = NULL;
+  for (size_t i = 0; i < DMXBOX_ESPNOW_STATS_PEERS; i++) {
+    peer_metrics_t *peer = &peers[i];
+    if (peer->last_seen_us && !memcmp(peer->mac, mac, ESP_NOW_ETH_ALEN)) {
+      return peer;
+    }
+    if (!slot || peer->last_seen_us < slot->last_seen_us) {
+      slot = peer; // replace the one heard from least recently
+    }
+  }
+
+  slot->last_seen_us = 0;
+  slot->last_interval_us = 0;
+  memcpy(slot->mac, mac, ESP_NOW_ETH_ALEN);
+  atomic_store_explicit(&slot->received, 0, memory_order_relaxed);
+  atomic_store_explicit(&slot->crc_failures, 0, memory_order_relaxed);
+  atomic_store_explicit(&slot->duplicates, 0, memory_order_relaxed);
+  atomic_store_explicit(&slot->gaps, 0, memory_order_relaxed);
+  for (size_t i = 0; i < DMXBOX_ESPNOW_JITTER_BUCKETS; i++) {
+    atomic_store_explicit(&slot->jitter[i], 0, memory_order_relaxed);
+  }
+  return slot;
+}
+
+// bucket 0 is under 1 ms, every next one twice as wide
+static size_t get_jitter_bucket(int64_t deviation_us) {
+  int64_t ms = deviation_us / 1000;
+  size_t bucket = 0;
+  while (ms && bucket < DMXBOX_ESPNOW_JITTER_BUCKETS - 1) {
+    ms >>= 1;
+    bucket++;
+  }
+  return bucket;
+}
+
+void metrics_record_received(
+    const uint8_t mac[ESP_NOW_ETH_ALEN],
+    int64_t receive_time_us,
+    bool valid,
+    uint16_t sequence
+) {
+  peer_metrics_t *peer = find_peer(mac);
+  bool first = !peer->last_seen_us;
+
+  if (!first) {
+    int64_t interval_us = receive_time_us - peer->last_seen_us;
+    if (peer->last_interval_us) {
+      int64_t deviation_us = interval_us - peer->last_interval_us;
+      if (deviation_us < 0) {
+        deviation_us = -deviation_us;
+      }
+      increment(&peer->jitter[get_jitter_bucket(deviation_us)]);
+    }
+    peer->last_interval_us = interval_us;
+  }
+  peer->last_seen_us = receive_time_us;
+
+  if (!valid) {
+    increment(&peer->crc_failures);
+    return;
+  }
+
+  increment(&peer->received);
+  if (!first) {
+    int16_t gap = (int16_t)(sequence - peer->last_sequence);
+    if (gap <= 0) {
+      increment(&peer->duplicates); // or late
+      return;
+    }
+    atomic_fetch_add_explicit(&peer->gaps, gap - 1, memory_order_relaxed);
+  }
+  peer->last_sequence = sequence;
+}
+
+void dmxbox_espnow_record_phase_error(int32_t error_us) {
+  uint32_t magnitude = error_us < 0 ? -error_us : error_us;
+  int32_t average =
+      atomic_load_explicit(&phase_error_average_us, memory_order_relaxed);
+  average += ((int32_t)magnitude - average) / PHASE_ERROR_FILTER;
+
+  atomic_store_explicit(&phase_error_last_us, error_us, memory_order_relaxed);
+  atomic_store_explicit(
+      &phase_error_average_us,
+      average,
+      memory_order_relaxed
+  );
+  if (magnitude > load(&phase_error_max_us)) {
+    atomic_store_explicit(&phase_error_max_us, magnitude, memory_order_relaxed);
+  }
+  increment(&phase_samples);
+}
+
+void dmxbox_espnow_get_stats(dmxbox_espnow_stats_t *stats) {
+  memset(stats, 0, sizeof(dmxbox_espnow_stats_t));
+  stats->sent = load(&sent);
+  stats->send_errors = load(&send_errors);
+  stats->send_failures = load(&send_failures);
+  stats->rejected = load(&rejected);
+  stats->dropped = load(&dropped);
+
+  stats->phase_samples = load(&phase_samples);
+  stats->phase_error_last_us =
+      atomic_load_explicit(&phase_error_last_us, memory_order_relaxed);
+  stats->phase_error_average_us =
+      atomic_load_explicit(&phase_error_average_us, memory_order_relaxed);
+  stats->phase_error_max_us = load(&phase_error_max_us);
+
+  for (size_t i = 0; i < DMXBOX_ESPNOW_STATS_PEERS; i++) {
+    peer_metrics_t *peer = &peers[i];
+    if (!peer->last_seen_us) {
+      continue;
+    }
+
+    dmxbox_espnow_peer_stats_t *result = &stats->peers[stats->peer_count++];
+    memcpy(result->mac, peer->mac, ESP_NOW_ETH_ALEN);
+    result->received = load(&peer->received);
+    result->crc_failures = load(&peer->crc_failures);
+    result->duplicates = load(&peer->duplicates);
+    result->gaps = load(&peer->gaps);
+    for (size_t j = 0; j < DMXBOX_ESPNOW_JITTER_BUCKETS; j++) {
+      result->jitter[j] = load(&peer->jitter[j]);
+    }
+  }
+}
@@ -0,0 +1,23 @@
+#pragma once
+#include <esp_err.h>
+#include <esp_now.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Counters behind dmxbox_espnow_get_stats. Each is written by one task only
+// (or under the send mutex), and read without locking.
+
+void metrics_record_sent(esp_err_t ret);
+void metrics_record_send_status(bool success);
+
+// from the Wi-Fi task
+void metrics_record_rejected();
+void metrics_record_dropped();
+
+// from the receive task
+void metrics_record_received(
+    const uint8_t mac[ESP_NOW_ETH_ALEN],
+    int64_t receive_time_us,
+    bool valid,
+    uint16_t sequence
+);
@@ -0,0 +1,110 @@
+#pragma once
+#include <esp_now.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum {
+  PACKET_TYPE_INVALID = 0,
+  PACKET_TYPE_EFFECT_SYNC, // a single effect state, no longer sent
+  PACKET_TYPE_TEMPO,
+  PACKET_TYPE_TIME_REQUEST,
+  PACKET_TYPE_TIME_RESPONSE,
+  PACKET_TYPE_EFFECT_STATES,
+  PACKET_TYPE_UNIVERSE,
+  PACKET_TYPE_COUNT,
+} packet_type_t;
+
+typedef struct __attribute__((packed)) {
+  packet_type_t type;
+  uint16_t sequence; // of the packets sent by this box
+  uint16_t crc;
+  uint8_t data[0];
+} packet_envelope_t;
+
+#define EFFECT_STATE_FIRST_PASS (1 << 0)
+
+// 8 bytes, so a packet holds 29 of them
+typedef struct __attribute__((packed)) {
+  uint16_t effect_id;
+  uint8_t level;
+  uint8_t rate_raw;
+  uint16_t phase; // position in the cycle, in 1/65536ths
+  uint8_t flags;
+  uint8_t priority; // of the leader, for the election
+} effect_state_entry_t;
+
+// The states of the effects a box leads that changed (or are due for a
+// heartbeat) in one tick
+typedef struct __attribute__((packed)) {
+  int64_t leader_time_us; // shared clock, 0 if not synced
+  uint8_t count;
+  effect_state_entry_t entries[0];
+} effect_states_packet_t;
+
+#define EFFECT_STATES_PER_PACKET                                               \
+  ((ESP_NOW_MAX_DATA_LEN - sizeof(packet_envelope_t) -                         \
+    sizeof(effect_states_packet_t)) /                                          \
+   sizeof(effect_state_entry_t))
+
+_Static_assert(
+    sizeof(effect_state_entry_t) == 8 && EFFECT_STATES_PER_PACKET == 29,
+    "effect states changed size, update the comment on the entry"
+);
+
+typedef enum {
+  UNIVERSE_PACKET_KEYFRAME = 0, // one chunk of a keyframe
+  UNIVERSE_PACKET_DELTA = 1,    // runs of slots that differ from the keyframe
+} universe_packet_kind_t;
+
+typedef struct __attribute__((packed)) {
+  uint16_t sequence; // of the packets from this box
+  uint16_t keyframe; // id of the keyframe, a delta is against
+  uint8_t kind;      // universe_packet_kind_t
+  uint8_t data[0];
+} universe_packet_t;
+
+// A keyframe is sent in this many slots per packet
+#define UNIVERSE_CHUNK_SIZE 171
+#define UNIVERSE_CHUNK_COUNT 3
+
+typedef struct __attribute__((packed)) {
+  uint8_t chunk;
+  uint8_t values[0];
+} universe_chunk_t;
+
+// A delta is a sequence of these, each followed by its values
+typedef struct __attribute__((packed)) {
+  uint16_t start; // 0-based slot
+  uint8_t length;
+} universe_run_t;
+
+#define UNIVERSE_PACKET_DATA_SIZE                                              \
+  (ESP_NOW_MAX_DATA_LEN - sizeof(packet_envelope_t) - sizeof(universe_packet_t))
+
+// Broadcast, answered only by the box it's for
+typedef struct __attribute__((packed)) {
+  uint8_t reference_mac[ESP_NOW_ETH_ALEN];
+  uint32_t sequence;
+  int64_t request_sent_us; // requester's clock
+} time_request_packet_t;
+
+typedef struct __attribute__((packed)) {
+  uint8_t requester_mac[ESP_NOW_ETH_ALEN];
+  uint32_t sequence;
+  int64_t request_sent_us;     // requester's clock, echoed
+  int64_t request_received_us; // reference's shared clock
+  int64_t response_sent_us;    // reference's shared clock
+} time_response_packet_t;
+
+void send_packet(packet_type_t type, void *data, size_t length);
+
+// Puts the send time into a packet that's about to go out. Called on the copy
+// of the data in the send buffer, with the send mutex held, so that waiting
+// for another packet to go out first doesn't count as time on the air.
+typedef void (*send_stamp_t)(void *data, int64_t time_us);
+void send_stamped_packet(
+    packet_type_t type,
+    void *data,
+    size_t length,
+    send_stamp_t stamp
+);
@@ -0,0 +1,241 @@
+#include <esp_log.h>
+#include <esp_mac.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <string.h>
+
+#include "clock_estimator.h"
+#include "dmxbox_espnow.h"
+#include "time_sync.h"
+
+static const char TAG[] = "dmxbox_espnow_time";
+
+#ifndef CONFIG_DMXBOX_ESPNOW_TIME_SYNC_MS
+#define CONFIG_DMXBOX_ESPNOW_TIME_SYNC_MS 1000
+#endif
+
+// boxes not heard from for this long no longer count as present
+#define PEER_TIMEOUT_US (5000 * 1000)
+
+#define MAX_PEERS 16
+
+typedef struct peer {
+  uint8_t mac[ESP_NOW_ETH_ALEN];
+  int64_t last_seen_us;
+} peer_t;
+
+static portMUX_TYPE time_sync_spinlock = portMUX_INITIALIZER_UNLOCKED;
+
+static uint8_t own_mac[ESP_NOW_ETH_ALEN];
+static peer_t peers[MAX_PEERS];
+
+// protected by time_sync_spinlock
+static uint8_t reference_mac[ESP_NOW_ETH_ALEN];
+static int64_t offset_us; // shared minus local
+static bool synced;
+static uint32_t request_sequence;
+static bool reference_changed;
+
+// only touched from the receive task
+static clock_estimator_t estimator;
+
+static int64_t get_shared_time_locked(int64_t local_us) {
+  return local_us + offset_us;
+}
+
+bool dmxbox_espnow_time_synced() {
+  taskENTER_CRITICAL(&time_sync_spinlock);
+  bool result = synced;
+  taskEXIT_CRITICAL(&time_sync_spinlock);
+  return result;
+}
+
+int64_t dmxbox_espnow_get_shared_time(int64_t local_us) {
+  taskENTER_CRITICAL(&time_sync_spinlock);
+  int64_t result = get_shared_time_locked(local_us);
+  taskEXIT_CRITICAL(&time_sync_spinlock);
+  return result;
+}
+
+int64_t dmxbox_espnow_to_local_time(int64_t shared_us) {
+  taskENTER_CRITICAL(&time_sync_spinlock);
+  int64_t result = shared_us - offset_us;
+  taskEXIT_CRITICAL(&time_sync_spinlock);
+  return result;
+}
+
+void time_sync_saw_peer(const uint8_t mac[ESP_NOW_ETH_ALEN], int64_t time_us) {
+  peer_t *slot = NULL;
+  taskENTER_CRITICAL(&time_sync_spinlock);
+  for (size_t i = 0; i < MAX_PEERS; i++) {
+    peer_t *peer = &peers[i];
+    if (peer->last_seen_us && !memcmp(peer->mac, mac, ESP_NOW_ETH_ALEN)) {
+      slot = peer;
+      break;
+    }
+    if (!slot || peer->last_seen_us < slot->last_seen_us) {
+      slot = peer; // reuse the least recently seen one
+    }
+  }
+  memcpy(slot->mac, mac, ESP_NOW_ETH_ALEN);
+  slot->last_seen_us = time_us;
+  taskEXIT_CRITICAL(&time_sync_spinlock);
+}
+
+// The reference is the lowest MAC among this box and the present peers, so
+// every box picks the same one without having to negotiate
+static void find_reference(int64_t time_us, uint8_t mac[ESP_NOW_ETH_ALEN]) {
+  memcpy(mac, own_mac, ESP_NOW_ETH_ALEN);
+  for (size_t i = 0; i < MAX_PEERS; i++) {
+    const peer_t *peer = &peers[i];
+    if (!peer->last_seen_us ||
+        peer->last_seen_us + PEER_TIMEOUT_US < time_us) {
+      continue;
+    }
+    if (memcmp(peer->mac, mac, ESP_NOW_ETH_ALEN) < 0) {
+      memcpy(mac, peer->mac, ESP_NOW_ETH_ALEN);
+    }
+  }
+}
+
+static void stamp_request(void *data, int64_t time_us) {
+  time_request_packet_t *request = data;
+  request->request_sent_us = time_us;
+}
+
+static void stamp_response(void *data, int64_t time_us) {
+  time_response_packet_t *response = data;
+  response->response_sent_us = dmxbox_espnow_get_shared_time(time_us);
+}
+
+void time_sync_handle_request(
+    const time_request_packet_t *packet,
+    const uint8_t mac[ESP_NOW_ETH_ALEN],
+    int64_t receive_time_us
+) {
+  if (memcmp(packet->reference_mac, own_mac, ESP_NOW_ETH_ALEN)) {
+    return; // meant for someone else
+  }
+
+  time_response_packet_t response = {
+      .sequence = packet->sequence,
+      .request_sent_us = packet->request_sent_us,
+  };
+  memcpy(response.requester_mac, mac, ESP_NOW_ETH_ALEN);
+
+  response.request_received_us = dmxbox_espnow_get_shared_time(receive_time_us);
+  send_stamped_packet(
+      PACKET_TYPE_TIME_RESPONSE,
+      &response,
+      sizeof(response),
+      stamp_response
+  );
+}
+
+void time_sync_handle_response(
+    const time_response_packet_t *packet,
+    const uint8_t mac[ESP_NOW_ETH_ALEN],
+    int64_t receive_time_us
+) {
+  if (memcmp(packet->requester_mac, own_mac, ESP_NOW_ETH_ALEN)) {
+    return; // someone else's exchange
+  }
+
+  taskENTER_CRITICAL(&time_sync_spinlock);
+  bool expected = packet->sequence == request_sequence &&
+                  !memcmp(mac, reference_mac, ESP_NOW_ETH_ALEN);
+  bool reset = expected && reference_changed;
+  if (reset) {
+    reference_changed = false;
+  }
+  taskEXIT_CRITICAL(&time_sync_spinlock);
+  if (!expected) {
+    ESP_LOGD(TAG, "Ignoring stale time response from " MACSTR, MAC2STR(mac));
+    return;
+  }
+  if (reset) {
+    // samples against the previous reference are meaningless
+    clock_estimator_reset(&estimator);
+  }
+
+  if (!clock_estimator_add(
+          &estimator,
+          packet->request_sent_us,
+          packet->request_received_us,
+          packet->response_sent_us,
+          receive_time_us
+      )) {
+    ESP_LOGW(TAG, "Ignoring inconsistent time response");
+    return;
+  }
+
+  taskENTER_CRITICAL(&time_sync_spinlock);
+  offset_us = estimator.offset_us;
+  synced = true;
+  taskEXIT_CRITICAL(&time_sync_spinlock);
+
+  ESP_LOGD(
+      TAG,
+      "Offset %lld us, round trip %lld us",
+      estimator.offset_us,
+      estimator.delay_us
+  );
+}
+
+static void time_sync_loop(void *parameter) {
+  TickType_t last_wake_time = xTaskGetTickCount();
+  while (true) {
+    vTaskDelayUntil(
+        &last_wake_time,
+        CONFIG_DMXBOX_ESPNOW_TIME_SYNC_MS / portTICK_PERIOD_MS
+    );
+
+    int64_t time_us = esp_timer_get_time();
+    time_request_packet_t request;
+
+    taskENTER_CRITICAL(&time_sync_spinlock);
+    find_reference(time_us, request.reference_mac);
+    bool changed =
+        memcmp(request.reference_mac, reference_mac, ESP_NOW_ETH_ALEN);
+    bool is_reference =
+        !memcmp(request.reference_mac, own_mac, ESP_NOW_ETH_ALEN);
+    memcpy(reference_mac, request.reference_mac, ESP_NOW_ETH_ALEN);
+    if (changed) {
+      // keeps the current offset, so the shared clock doesn't jump until
+      // the new reference answers
+      synced = is_reference;
+      reference_changed = true;
+    }
+    request.sequence = ++request_sequence;
+    taskEXIT_CRITICAL(&time_sync_spinlock);
+
+    if (changed) {
+      ESP_LOGI(
+          TAG,
+          "Time reference is now " MACSTR "%s",
+          MAC2STR(request.reference_mac),
+          is_reference ? " (this box)" : ""
+      );
+    }
+
+    if (is_reference) {
+      continue;
+    }
+
+    send_stamped_packet(
+        PACKET_TYPE_TIME_REQUEST,
+        &request,
+        sizeof(request),
+        stamp_request
+    );
+  }
+}
+
+void time_sync_init() {
+  memcpy(own_mac, dmxbox_espnow_get_mac(), ESP_NOW_ETH_ALEN);
+  memcpy(reference_mac, own_mac, ESP_NOW_ETH_ALEN);
+  synced = true;
+
+  xTaskCreate(time_sync_loop, "espnow_time_sync", 2048, NULL, 4, NULL);
+}
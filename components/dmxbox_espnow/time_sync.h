@@ -0,0 +1,24 @@
+#pragma once
+#include <esp_now.h>
+#include <stdint.h>
+
+#include "packets.h"
+
+// Two-way time sync between boxes. The box with the lowest MAC address
+// heard recently is the reference, everyone else follows its shared clock.
+
+void time_sync_init();
+
+// Any packet from a box marks it as present
+void time_sync_saw_peer(const uint8_t mac[ESP_NOW_ETH_ALEN], int64_t time_us);
+
+void time_sync_handle_request(
+    const time_request_packet_t *packet,
+    const uint8_t mac[ESP_NOW_ETH_ALEN],
+    int64_t receive_time_us
+);
+void time_sync_handle_response(
+    const time_response_packet_t *packet,
+    const uint8_t mac[ESP_NOW_ETH_ALEN],
+    int64_t receive_time_us
+);
@@ -0,0 +1,380 @@
+#include <esp_log.h>
+#include <esp_mac.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <string.h>
+
+#include "dmxbox_const.h"
+#include "dmxbox_espnow.h"
+#include "universe_stream.h"
+
+static const char TAG[] = "dmxbox_espnow_universe";
+
+// While the universe changes, a full keyframe is sent at least this often
+#ifndef CONFIG_DMXBOX_ESPNOW_KEYFRAME_MS
+#define CONFIG_DMXBOX_ESPNOW_KEYFRAME_MS 1000
+#endif
+
+// While it doesn't, one keyframe chunk is sent this often
+#ifndef CONFIG_DMXBOX_ESPNOW_KEEPALIVE_MS
+#define CONFIG_DMXBOX_ESPNOW_KEEPALIVE_MS 250
+#endif
+
+// A stream not heard from for this long is gone
+#ifndef CONFIG_DMXBOX_ESPNOW_STREAM_TIMEOUT_MS
+#define CONFIG_DMXBOX_ESPNOW_STREAM_TIMEOUT_MS 1000
+#endif
+
+#define KEYFRAME_US ((int64_t)CONFIG_DMXBOX_ESPNOW_KEYFRAME_MS * 1000)
+#define KEEPALIVE_US ((int64_t)CONFIG_DMXBOX_ESPNOW_KEEPALIVE_MS * 1000)
+#define STREAM_TIMEOUT_US                                                      \
+  ((int64_t)CONFIG_DMXBOX_ESPNOW_STREAM_TIMEOUT_MS * 1000)
+
+#define ALL_CHUNKS ((1 << UNIVERSE_CHUNK_COUNT) - 1)
+
+// Packets from further back than this aren't late, the sender restarted and
+// its sequence started over
+#define MAX_REORDER 64
+
+_Static_assert(
+    UNIVERSE_CHUNK_SIZE * UNIVERSE_CHUNK_COUNT >= DMX_CHANNEL_COUNT,
+    "keyframe chunks don't cover the universe"
+);
+_Static_assert(
+    sizeof(universe_chunk_t) + UNIVERSE_CHUNK_SIZE <=
+        UNIVERSE_PACKET_DATA_SIZE,
+    "keyframe chunks don't fit in a packet"
+);
+
+// only used from the streaming task
+static struct {
+  bool started;
+  uint8_t keyframe[DMX_CHANNEL_COUNT];
+  uint8_t last[DMX_CHANNEL_COUNT];
+  uint16_t keyframe_id;
+  int64_t keyframe_time_us;
+  uint8_t next_chunk;
+  uint16_t sequence;
+  int64_t last_send_time_us;
+} sender;
+
+static struct {
+  universe_packet_t header;
+  uint8_t data[UNIVERSE_PACKET_DATA_SIZE];
+} __attribute__((packed)) send_buffer;
+
+// only used from the receive task
+static struct {
+  bool started;
+  uint8_t source_mac[ESP_NOW_ETH_ALEN];
+  uint16_t sequence;
+  uint32_t lost;
+  uint8_t keyframe[DMX_CHANNEL_COUNT];
+  uint16_t keyframe_id;
+  uint8_t chunks; // of the keyframe received so far
+  int64_t last_receive_time_us;
+  bool published;
+} receiver;
+
+// protected by stream_spinlock
+static portMUX_TYPE stream_spinlock = portMUX_INITIALIZER_UNLOCKED;
+static uint8_t streamed_universe[DMX_CHANNEL_COUNT];
+static int64_t streamed_time_us;
+
+static size_t get_chunk_size(uint8_t chunk) {
+  size_t start = chunk * UNIVERSE_CHUNK_SIZE;
+  size_t remaining = DMX_CHANNEL_COUNT - start;
+  return remaining < UNIVERSE_CHUNK_SIZE ? remaining : UNIVERSE_CHUNK_SIZE;
+}
+
+static void send_universe_packet(
+    universe_packet_kind_t kind,
+    size_t data_size,
+    int64_t time_us
+) {
+  send_buffer.header.sequence = ++sender.sequence;
+  send_buffer.header.keyframe = sender.keyframe_id;
+  send_buffer.header.kind = kind;
+  send_packet(
+      PACKET_TYPE_UNIVERSE,
+      &send_buffer,
+      sizeof(universe_packet_t) + data_size
+  );
+  sender.last_send_time_us = time_us;
+}
+
+static void send_chunk(uint8_t chunk, int64_t time_us) {
+  universe_chunk_t *header = (universe_chunk_t *)send_buffer.data;
+  size_t size = get_chunk_size(chunk);
+  header->chunk = chunk;
+  memcpy(
+      header->values,
+      sender.keyframe + chunk * UNIVERSE_CHUNK_SIZE,
+      size
+  );
+  send_universe_packet(
+      UNIVERSE_PACKET_KEYFRAME,
+      sizeof(universe_chunk_t) + size,
+      time_us
+  );
+}
+
+static void
+send_keyframe(const uint8_t data[DMX_CHANNEL_COUNT], int64_t time_us) {
+  memcpy(sender.keyframe, data, DMX_CHANNEL_COUNT);
+  sender.keyframe_id++;
+  sender.keyframe_time_us = time_us;
+  sender.next_chunk = 0;
+  for (uint8_t chunk = 0; chunk < UNIVERSE_CHUNK_COUNT; chunk++) {
+    send_chunk(chunk, time_us);
+  }
+}
+
+// Writes runs of the slots that differ from the keyframe into out. Returns
+// the size, or -1 if they don't fit.
+static int encode_delta(
+    const uint8_t data[DMX_CHANNEL_COUNT],
+    uint8_t *out,
+    size_t capacity
+) {
+  size_t size = 0;
+  size_t i = 0;
+  while (i < DMX_CHANNEL_COUNT) {
+    if (data[i] == sender.keyframe[i]) {
+      i++;
+      continue;
+    }
+
+    // unchanged slots are taken into the run as long as that's cheaper than
+    // starting another one
+    size_t end = i + 1;
+    for (size_t j = i + 1; j < DMX_CHANNEL_COUNT && j - i < UINT8_MAX; j++) {
+      if (data[j] != sender.keyframe[j]) {
+        end = j + 1;
+      } else if (j + 1 - end > sizeof(universe_run_t)) {
+        break;
+      }
+    }
+
+    universe_run_t run = {
+        .start = i,
+        .length = end - i,
+    };
+    if (size + sizeof(run) + run.length > capacity) {
+      return -1;
+    }
+    memcpy(out + size, &run, sizeof(run));
+    memcpy(out + size + sizeof(run), data + i, run.length);
+    size += sizeof(run) + run.length;
+    i = end;
+  }
+  return size;
+}
+
+void dmxbox_espnow_stream_universe(
+    const uint8_t data[DMX_CHANNEL_COUNT],
+    int64_t time_us
+) {
+  if (sender.started && !memcmp(data, sender.last, DMX_CHANNEL_COUNT)) {
+    if (time_us - sender.last_send_time_us < KEEPALIVE_US) {
+      return;
+    }
+
+    // Settled away from the keyframe, so it's time for a new one. Receivers
+    // drop deltas until they have all of it, so it goes out whole, or the
+    // next change would be lost until the keepalives had cycled through.
+    if (memcmp(data, sender.keyframe, DMX_CHANNEL_COUNT)) {
+      send_keyframe(data, time_us);
+      return;
+    }
+
+    // keepalives carry the keyframe, for boxes that joined late or lost it
+    send_chunk(sender.next_chunk, time_us);
+    sender.next_chunk = (sender.next_chunk + 1) % UNIVERSE_CHUNK_COUNT;
+    return;
+  }
+
+  memcpy(sender.last, data, DMX_CHANNEL_COUNT);
+
+  int delta_size = -1;
+  if (sender.started && time_us - sender.keyframe_time_us < KEYFRAME_US) {
+    delta_size =
+        encode_delta(data, send_buffer.data, sizeof(send_buffer.data));
+  }
+  sender.started = true;
+
+  if (delta_size >= 0) {
+    send_universe_packet(UNIVERSE_PACKET_DELTA, delta_size, time_us);
+    return;
+  }
+
+  send_keyframe(data, time_us);
+}
+
+bool dmxbox_espnow_get_streamed_universe(uint8_t data[DMX_CHANNEL_COUNT]) {
+  int64_t time_us = esp_timer_get_time();
+  bool result = false;
+  taskENTER_CRITICAL(&stream_spinlock);
+  if (streamed_time_us && time_us - streamed_time_us < STREAM_TIMEOUT_US) {
+    memcpy(data, streamed_universe, DMX_CHANNEL_COUNT);
+    result = true;
+  }
+  taskEXIT_CRITICAL(&stream_spinlock);
+  return result;
+}
+
+// universe is NULL to keep the current one alive
+static void publish(const uint8_t *universe, int64_t receive_time_us) {
+  taskENTER_CRITICAL(&stream_spinlock);
+  if (universe) {
+    memcpy(streamed_universe, universe, DMX_CHANNEL_COUNT);
+  }
+  streamed_time_us = receive_time_us;
+  taskEXIT_CRITICAL(&stream_spinlock);
+  receiver.published = true;
+}
+
+// Return whether they published a new universe
+static bool handle_chunk(
+    const universe_packet_t *packet,
+    size_t size,
+    int64_t receive_time_us
+) {
+  const universe_chunk_t *chunk = (const universe_chunk_t *)packet->data;
+  if (size < sizeof(universe_chunk_t) ||
+      chunk->chunk >= UNIVERSE_CHUNK_COUNT ||
+      size != sizeof(universe_chunk_t) + get_chunk_size(chunk->chunk)) {
+    ESP_LOGW(TAG, "Malformed keyframe chunk, len: %d", size);
+    return false;
+  }
+
+  if (packet->keyframe != receiver.keyframe_id) {
+    receiver.keyframe_id = packet->keyframe;
+    receiver.chunks = 0;
+  }
+
+  bool was_complete = receiver.chunks == ALL_CHUNKS;
+  memcpy(
+      receiver.keyframe + chunk->chunk * UNIVERSE_CHUNK_SIZE,
+      chunk->values,
+      get_chunk_size(chunk->chunk)
+  );
+  receiver.chunks |= 1 << chunk->chunk;
+
+  if (was_complete || receiver.chunks != ALL_CHUNKS) {
+    return false;
+  }
+  publish(receiver.keyframe, receive_time_us);
+  return true;
+}
+
+static bool handle_delta(
+    const universe_packet_t *packet,
+    size_t size,
+    int64_t receive_time_us
+) {
+  if (packet->keyframe != receiver.keyframe_id ||
+      receiver.chunks != ALL_CHUNKS) {
+    ESP_LOGD(TAG, "Dropping delta against missing keyframe");
+    return false;
+  }
+
+  uint8_t universe[DMX_CHANNEL_COUNT];
+  memcpy(universe, receiver.keyframe, DMX_CHANNEL_COUNT);
+
+  size_t offset = 0;
+  while (offset < size) {
+    universe_run_t run;
+    if (size - offset < sizeof(run)) {
+      ESP_LOGW(TAG, "Malformed delta, len: %d", size);
+      return false;
+    }
+    memcpy(&run, packet->data + offset, sizeof(run));
+    offset += sizeof(run);
+
+    if (run.length > size - offset ||
+        run.start + run.length > DMX_CHANNEL_COUNT) {
+      ESP_LOGW(TAG, "Malformed delta, len: %d", size);
+      return false;
+    }
+    memcpy(universe + run.start, packet->data + offset, run.length);
+    offset += run.length;
+  }
+
+  publish(universe, receive_time_us);
+  return true;
+}
+
+// Starts over with what the source sends from now on, the first complete
+// keyframe
+static void follow_source(const uint8_t mac[ESP_NOW_ETH_ALEN]) {
+  memset(&receiver, 0, sizeof(receiver));
+  memcpy(receiver.source_mac, mac, ESP_NOW_ETH_ALEN);
+  receiver.started = true;
+}
+
+void universe_stream_handle_packet(
+    const universe_packet_t *packet,
+    size_t length,
+    const uint8_t mac[ESP_NOW_ETH_ALEN],
+    int64_t receive_time_us
+) {
+  bool same_source =
+      receiver.started &&
+      !memcmp(mac, receiver.source_mac, ESP_NOW_ETH_ALEN);
+  bool timed_out =
+      receiver.started &&
+      receive_time_us - receiver.last_receive_time_us >= STREAM_TIMEOUT_US;
+  if (!same_source) {
+    if (receiver.started && !timed_out) {
+      return; // someone else is streaming already
+    }
+
+    ESP_LOGI(TAG, "Following universe stream from " MACSTR, MAC2STR(mac));
+    follow_source(mac);
+  } else {
+    // deltas are against the keyframe, so a lost packet is repaired by the
+    // next one, but an old one must not be applied over a newer one
+    int16_t gap = (int16_t)(packet->sequence - receiver.sequence);
+    if (timed_out || gap < -MAX_REORDER) {
+      // After a reboot its sequence and keyframe ids start over, and a
+      // keyframe id it used before would have deltas applied to the old
+      // keyframe. After a silence there's no telling either way.
+      ESP_LOGI(
+          TAG,
+          "Universe stream from " MACSTR " restarted, resyncing",
+          MAC2STR(mac)
+      );
+      follow_source(mac);
+    } else if (gap <= 0) {
+      ESP_LOGD(TAG, "Dropping out of order packet %u", packet->sequence);
+      return;
+    } else {
+      receiver.lost += gap - 1;
+    }
+  }
+  receiver.sequence = packet->sequence;
+  receiver.last_receive_time_us = receive_time_us;
+
+  size_t size = length - sizeof(universe_packet_t);
+  bool published = false;
+  switch (packet->kind) {
+  case UNIVERSE_PACKET_KEYFRAME:
+    published = handle_chunk(packet, size, receive_time_us);
+    break;
+
+  case UNIVERSE_PACKET_DELTA:
+    published = handle_delta(packet, size, receive_time_us);
+    break;
+
+  default:
+    ESP_LOGW(TAG, "Unknown universe packet kind %d", packet->kind);
+    break;
+  }
+
+  // anything from the source keeps what it sent last alive
+  if (!published && receiver.published) {
+    publish(NULL, receive_time_us);
+  }
+}
@@ -0,0 +1,12 @@
+#pragma once
+#include <esp_now.h>
+#include <stdint.h>
+
+#include "packets.h"
+
+void universe_stream_handle_packet(
+    const universe_packet_t *packet,
+    size_t length,
+    const uint8_t mac[ESP_NOW_ETH_ALEN],
+    int64_t receive_time_us
+);
@@ -18,10 +18,33 @@ dmxbox_httpd_cors_register_options(httpd_handle_t server, const char *path);
 
 esp_err_t dmxbox_httpd_receive_json(httpd_req_t *req, cJSON **json);
 
+// Called for each value of the streamed top-level object, with index -1, or
+// for each element when the value is an array. Returning false stops the
+// stream.
+typedef bool (*dmxbox_httpd_json_item_cb_t)(
+    const char *key,
+    int index,
+    const cJSON *item,
+    void *ctx
+);
+
+// Parses a top-level JSON object body as it arrives, so only one item is in
+// memory at a time. Items are limited to the scratch buffer, the body isn't.
+// Doesn't send a response. Returns ESP_ERR_INVALID_ARG for malformed JSON,
+// ESP_ERR_INVALID_SIZE for an item that's too long and ESP_FAIL when the
+// callback stopped the stream.
+esp_err_t dmxbox_httpd_receive_json_stream(
+    httpd_req_t *req,
+    dmxbox_httpd_json_item_cb_t callback,
+    void *ctx
+);
+
 esp_err_t dmxbox_httpd_send_201_created(httpd_req_t *req);
 esp_err_t dmxbox_httpd_send_204_no_content(httpd_req_t *req);
 esp_err_t dmxbox_httpd_send_json(httpd_req_t *req, cJSON *json);
 esp_err_t dmxbox_httpd_send_jsonstr(httpd_req_t *req, const char *json);
+// sends json as the next chunk of a chunked response
+esp_err_t dmxbox_httpd_send_json_chunk(httpd_req_t *req, const cJSON *json);
 
 esp_err_t dmxbox_httpd_statics_register(httpd_handle_t server);
 
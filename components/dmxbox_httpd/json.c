@@ -84,3 +84,15 @@ esp_err_t dmxbox_httpd_send_json(httpd_req_t *req, cJSON *json) {
   }
   return dmxbox_httpd_send_jsonstr(req, dmxbox_httpd_scratch);
 }
+
+esp_err_t dmxbox_httpd_send_json_chunk(httpd_req_t *req, const cJSON *json) {
+  if (!cJSON_PrintPreallocated(
+          (cJSON *)json,
+          dmxbox_httpd_scratch,
+          sizeof(dmxbox_httpd_scratch),
+          false
+      )) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  return httpd_resp_sendstr_chunk(req, dmxbox_httpd_scratch);
+}
@@ -0,0 +1,287 @@
+#include "cJSON.h"
+#include "dmxbox_httpd.h"
+#include "scratch.h"
+#include <ctype.h>
+#include <esp_check.h>
+#include <esp_err.h>
+#include <esp_http_server.h>
+#include <esp_log.h>
+#include <stdbool.h>
+#include <string.h>
+
+static const char TAG[] = "dmxbox_httpd_json_stream";
+
+#define RECEIVE_BUFFER_SIZE 512
+#define MAX_KEY_LENGTH 32
+
+typedef enum stream_state {
+  expect_object_start,
+  expect_key,
+  in_key,
+  expect_colon,
+  expect_value,
+  expect_element,
+  in_item,
+  after_element,
+  after_value,
+  done,
+} stream_state_t;
+
+typedef struct json_stream {
+  stream_state_t state;
+  dmxbox_httpd_json_item_cb_t callback;
+  void *ctx;
+
+  char key[MAX_KEY_LENGTH + 1];
+  size_t key_length;
+  bool in_array;
+  int index;
+
+  // the item being captured, in dmxbox_httpd_scratch
+  size_t item_length;
+  int depth;
+  bool in_string;
+  bool escaped;
+} json_stream_t;
+
+static esp_err_t append(json_stream_t *stream, char c) {
+  // one byte is kept for the terminator cJSON doesn't need but logs do
+  if (stream->item_length + 1 >= sizeof(dmxbox_httpd_scratch)) {
+    ESP_LOGE(TAG, "'%s' item %d is too long", stream->key, stream->index);
+    return ESP_ERR_INVALID_SIZE;
+  }
+  dmxbox_httpd_scratch[stream->item_length++] = c;
+  return ESP_OK;
+}
+
+static void start_item(json_stream_t *stream) {
+  stream->state = in_item;
+  stream->item_length = 0;
+  stream->depth = 0;
+  stream->in_string = false;
+  stream->escaped = false;
+}
+
+static esp_err_t finish_item(json_stream_t *stream) {
+  cJSON *item =
+      cJSON_ParseWithLength(dmxbox_httpd_scratch, stream->item_length);
+  if (!item) {
+    ESP_LOGE(TAG, "'%s' item %d isn't valid JSON", stream->key, stream->index);
+    return ESP_ERR_INVALID_ARG;
+  }
+  bool ok = stream->callback(
+      stream->key,
+      stream->in_array ? stream->index : -1,
+      item,
+      stream->ctx
+  );
+  cJSON_Delete(item);
+  if (!ok) {
+    return ESP_FAIL;
+  }
+  stream->state = stream->in_array ? after_element : after_value;
+  return ESP_OK;
+}
+
+// Feeds one character of the item. Scalars only end at the character after
+// them, which *consumed leaves to the outer states.
+static esp_err_t feed_item(json_stream_t *stream, char c, bool *consumed) {
+  *consumed = true;
+  if (stream->in_string) {
+    ESP_RETURN_ON_ERROR(append(stream, c), TAG, "item");
+    if (stream->escaped) {
+      stream->escaped = false;
+    } else if (c == '\\') {
+      stream->escaped = true;
+    } else if (c == '"') {
+      stream->in_string = false;
+      if (!stream->depth) {
+        return finish_item(stream);
+      }
+    }
+    return ESP_OK;
+  }
+
+  switch (c) {
+  case '"':
+    stream->in_string = true;
+    break;
+  case '{':
+  case '[':
+    stream->depth++;
+    break;
+  case '}':
+  case ']':
+  case ',':
+    if (!stream->depth) {
+      *consumed = false;
+      return finish_item(stream);
+    }
+    if (c != ',') {
+      stream->depth--;
+    }
+    break;
+  default:
+    if (isspace((unsigned char)c) && !stream->depth) {
+      return finish_item(stream);
+    }
+    break;
+  }
+
+  ESP_RETURN_ON_ERROR(append(stream, c), TAG, "item");
+  if ((c == '}' || c == ']') && !stream->depth) {
+    return finish_item(stream);
+  }
+  return ESP_OK;
+}
+
+static esp_err_t unexpected(const json_stream_t *stream, char c) {
+  ESP_LOGE(TAG, "unexpected '%c' in state %d", c, stream->state);
+  return ESP_ERR_INVALID_ARG;
+}
+
+static esp_err_t feed(json_stream_t *stream, char c, bool *consumed) {
+  *consumed = true;
+  if (stream->state == in_item) {
+    return feed_item(stream, c, consumed);
+  }
+  if (stream->state == in_key) {
+    if (c == '"') {
+      stream->key[stream->key_length] = '\0';
+      stream->state = expect_colon;
+    } else if (c == '\\' || stream->key_length >= MAX_KEY_LENGTH) {
+      ESP_LOGE(TAG, "unsupported key");
+      return ESP_ERR_INVALID_ARG;
+    } else {
+      stream->key[stream->key_length++] = c;
+    }
+    return ESP_OK;
+  }
+  if (isspace((unsigned char)c)) {
+    return ESP_OK;
+  }
+
+  switch (stream->state) {
+  case expect_object_start:
+    if (c != '{') {
+      return unexpected(stream, c);
+    }
+    stream->state = expect_key;
+    break;
+
+  case expect_key:
+    if (c == '}') {
+      stream->state = done;
+    } else if (c == '"') {
+      stream->key_length = 0;
+      stream->in_array = false;
+      stream->state = in_key;
+    } else {
+      return unexpected(stream, c);
+    }
+    break;
+
+  case expect_colon:
+    if (c != ':') {
+      return unexpected(stream, c);
+    }
+    stream->state = expect_value;
+    break;
+
+  case expect_value:
+    if (c == '[') {
+      // only arrays at the top level are split into their elements
+      stream->in_array = true;
+      stream->index = 0;
+      stream->state = expect_element;
+    } else {
+      start_item(stream);
+      *consumed = false;
+    }
+    break;
+
+  case expect_element:
+    if (c == ']' && !stream->index) {
+      stream->state = after_value;
+    } else {
+      start_item(stream);
+      *consumed = false;
+    }
+    break;
+
+  case after_element:
+    if (c == ',') {
+      stream->index++;
+      stream->state = expect_element;
+    } else if (c == ']') {
+      stream->state = after_value;
+    } else {
+      return unexpected(stream, c);
+    }
+    break;
+
+  case after_value:
+    if (c == ',') {
+      stream->state = expect_key;
+    } else if (c == '}') {
+      stream->state = done;
+    } else {
+      return unexpected(stream, c);
+    }
+    break;
+
+  default:
+    return unexpected(stream, c);
+  }
+  return ESP_OK;
+}
+
+esp_err_t dmxbox_httpd_receive_json_stream(
+    httpd_req_t *req,
+    dmxbox_httpd_json_item_cb_t callback,
+    void *ctx
+) {
+  json_stream_t stream = {
+      .state = expect_object_start,
+      .callback = callback,
+      .ctx = ctx,
+  };
+  char buffer[RECEIVE_BUFFER_SIZE];
+  size_t remaining = req->content_len;
+  while (remaining) {
+    int received = httpd_req_recv(
+        req,
+        buffer,
+        remaining < sizeof(buffer) ? remaining : sizeof(buffer)
+    );
+    if (received == HTTPD_SOCK_ERR_TIMEOUT) {
+      ESP_LOGE(TAG, "timed out with %u bytes to go", remaining);
+      return ESP_ERR_TIMEOUT;
+    }
+    if (received <= 0) {
+      ESP_LOGE(TAG, "failed to read from the socket");
+      return ESP_FAIL;
+    }
+    remaining -= received;
+
+    int i = 0;
+    while (i < received) {
+      bool consumed;
+      ESP_RETURN_ON_ERROR(
+          feed(&stream, buffer[i], &consumed),
+          TAG,
+          "failed at byte %u",
+          req->content_len - remaining - received + i
+      );
+      if (consumed) {
+        i++;
+      }
+    }
+  }
+
+  if (stream.state != done) {
+    ESP_LOGE(TAG, "body ended early");
+    return ESP_ERR_INVALID_ARG;
+  }
+  return ESP_OK;
+}
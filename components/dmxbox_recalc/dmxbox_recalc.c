@@ -3,11 +3,14 @@
 
 #include "dmxbox_artnet.h"
 #include "dmxbox_const.h"
+#include "dmxbox_cues.h"
 #include "dmxbox_dmx_receive.h"
 #include "dmxbox_dmx_send.h"
 #include "dmxbox_effects.h"
+#include "dmxbox_espnow.h"
 #include "dmxbox_led.h"
 #include "dmxbox_recalc.h"
+#include "esp_timer.h"
 
 static const char *TAG = "recalc";
 
@@ -32,7 +35,21 @@ static void dmxbox_recalc(
     taskENTER_CRITICAL(&dmxbox_dmx_in_spinlock);
     memcpy(data + 1, dmxbox_dmx_in_data + 1, DMX_CHANNEL_COUNT);
     taskEXIT_CRITICAL(&dmxbox_dmx_in_spinlock);
+
+    if (CONFIG_DMXBOX_ESPNOW_STREAM_DMX_IN) {
+      dmxbox_espnow_stream_universe(data + 1, esp_timer_get_time());
+    }
+  } else {
+    // stands in for DMX in on boxes without it wired
+    dmxbox_espnow_get_streamed_universe(data + 1);
+  }
+
+  // cue fades are evaluated for the frame this data will go out in
+  int64_t time_us = dmxbox_dmx_send_get_next_frame_time();
+  if (!time_us) {
+    time_us = esp_timer_get_time();
   }
+  dmxbox_cues_evaluate(time_us, data + 1);
 
   taskENTER_CRITICAL(&dmxbox_artnet_spinlock);
   const uint8_t *artnet_data = dmxbox_artnet_get_native_universe_data();
@@ -48,7 +65,9 @@ static void dmxbox_recalc(
 void dmxbox_recalc_task(void *parameter) {
   ESP_LOGI(TAG, "Recalc task started");
 
-  TickType_t xLastWakeTime = xTaskGetTickCount();
+  // run right after every effects tick, so fresh effect output makes it into
+  // the next frame; keep the old period when effects aren't ticking
+  dmxbox_effects_set_tick_listener(xTaskGetCurrentTaskHandle());
 
   uint8_t data[DMX_PACKET_SIZE_MAX];
   while (1) {
@@ -64,6 +83,6 @@ void dmxbox_recalc_task(void *parameter) {
     dmxbox_set_artnet_active(artnet_active);
     dmxbox_set_dmx_out_active(dmx_out_active);
 
-    vTaskDelayUntil(&xLastWakeTime, CONFIG_RECALC_PERIOD / portTICK_PERIOD_MS);
+    ulTaskNotifyTake(pdTRUE, CONFIG_RECALC_PERIOD / portTICK_PERIOD_MS);
   }
 }
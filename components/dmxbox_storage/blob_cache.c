@@ -0,0 +1,229 @@
+#include "blob_cache.h"
+#include "dmxbox_storage.h"
+#include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <nvs.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char TAG[] = "dmxbox_storage_cache";
+
+#ifndef CONFIG_DMXBOX_STORAGE_CACHE_ENTRIES
+#define CONFIG_DMXBOX_STORAGE_CACHE_ENTRIES 32
+#endif
+
+#ifndef CONFIG_DMXBOX_STORAGE_CACHE_BYTES
+#define CONFIG_DMXBOX_STORAGE_CACHE_BYTES (16 * 1024)
+#endif
+
+// a single big blob (like the show image) shouldn't evict everything else
+#define MAX_ENTRY_BYTES (CONFIG_DMXBOX_STORAGE_CACHE_BYTES / 4)
+
+typedef struct cache_entry {
+  char ns[NVS_NS_NAME_MAX_SIZE];
+  uint16_t parent_id;
+  uint16_t id;
+  uint32_t last_used;
+  size_t size;
+  void *data; // NULL when the slot is free
+} cache_entry_t;
+
+static SemaphoreHandle_t cache_mutex;
+
+// protected by cache_mutex
+static cache_entry_t entries[CONFIG_DMXBOX_STORAGE_CACHE_ENTRIES];
+static size_t cached_bytes;
+static uint32_t use_counter;
+static uint32_t epoch;
+static dmxbox_storage_cache_stats_t stats;
+
+static cache_entry_t *find(const char *ns, uint16_t parent_id, uint16_t id) {
+  for (size_t i = 0; i < CONFIG_DMXBOX_STORAGE_CACHE_ENTRIES; i++) {
+    cache_entry_t *entry = &entries[i];
+    if (entry->data && entry->parent_id == parent_id && entry->id == id &&
+        !strcmp(entry->ns, ns)) {
+      return entry;
+    }
+  }
+  return NULL;
+}
+
+static void drop(cache_entry_t *entry) {
+  cached_bytes -= entry->size;
+  free(entry->data);
+  entry->data = NULL;
+  entry->size = 0;
+}
+
+static cache_entry_t *least_recently_used() {
+  cache_entry_t *result = NULL;
+  for (size_t i = 0; i < CONFIG_DMXBOX_STORAGE_CACHE_ENTRIES; i++) {
+    cache_entry_t *entry = &entries[i];
+    if (entry->data &&
+        (!result || (int32_t)(entry->last_used - result->last_used) < 0)) {
+      result = entry;
+    }
+  }
+  return result;
+}
+
+static cache_entry_t *free_slot() {
+  for (size_t i = 0; i < CONFIG_DMXBOX_STORAGE_CACHE_ENTRIES; i++) {
+    if (!entries[i].data) {
+      return &entries[i];
+    }
+  }
+  return NULL;
+}
+
+static void store(
+    const char *ns,
+    uint16_t parent_id,
+    uint16_t id,
+    size_t size,
+    const void *data
+) {
+  cache_entry_t *entry = find(ns, parent_id, id);
+  if (entry) {
+    drop(entry);
+  }
+  if (!size || size > MAX_ENTRY_BYTES ||
+      strlen(ns) >= NVS_NS_NAME_MAX_SIZE) {
+    return;
+  }
+
+  while (cached_bytes + size > CONFIG_DMXBOX_STORAGE_CACHE_BYTES ||
+         !(entry = free_slot())) {
+    drop(least_recently_used());
+    stats.evictions++;
+  }
+
+  entry->data = malloc(size);
+  if (!entry->data) {
+    ESP_LOGW(TAG, "failed to allocate %u bytes", size);
+    return;
+  }
+  memcpy(entry->data, data, size);
+  strlcpy(entry->ns, ns, sizeof(entry->ns));
+  entry->parent_id = parent_id;
+  entry->id = id;
+  entry->size = size;
+  entry->last_used = use_counter++;
+  cached_bytes += size;
+}
+
+void blob_cache_init() {
+  cache_mutex = xSemaphoreCreateMutex();
+  if (!cache_mutex) {
+    ESP_LOGE(TAG, "failed to create mutex");
+    abort();
+  }
+}
+
+void blob_cache_clear() {
+  if (!cache_mutex) {
+    return; // not initialized yet, so there's nothing cached
+  }
+  xSemaphoreTake(cache_mutex, portMAX_DELAY);
+  for (size_t i = 0; i < CONFIG_DMXBOX_STORAGE_CACHE_ENTRIES; i++) {
+    if (entries[i].data) {
+      drop(&entries[i]);
+    }
+  }
+  epoch++;
+  xSemaphoreGive(cache_mutex);
+}
+
+uint32_t blob_cache_epoch() {
+  xSemaphoreTake(cache_mutex, portMAX_DELAY);
+  uint32_t result = epoch;
+  xSemaphoreGive(cache_mutex);
+  return result;
+}
+
+bool blob_cache_get(
+    const char *ns,
+    uint16_t parent_id,
+    uint16_t id,
+    size_t *size,
+    void **buffer
+) {
+  xSemaphoreTake(cache_mutex, portMAX_DELAY);
+  cache_entry_t *entry = find(ns, parent_id, id);
+  bool hit = false;
+  if (entry) {
+    void *copy = NULL;
+    if (buffer) {
+      copy = malloc(entry->size);
+    }
+    if (!buffer || copy) {
+      if (copy) {
+        memcpy(copy, entry->data, entry->size);
+        *buffer = copy;
+      }
+      *size = entry->size;
+      entry->last_used = use_counter++;
+      hit = true;
+    }
+  }
+  if (hit) {
+    stats.hits++;
+  } else {
+    stats.misses++;
+  }
+  xSemaphoreGive(cache_mutex);
+  return hit;
+}
+
+void blob_cache_fill(
+    const char *ns,
+    uint16_t parent_id,
+    uint16_t id,
+    size_t size,
+    const void *data,
+    uint32_t read_epoch
+) {
+  xSemaphoreTake(cache_mutex, portMAX_DELAY);
+  if (read_epoch == epoch) {
+    store(ns, parent_id, id, size, data);
+  }
+  xSemaphoreGive(cache_mutex);
+}
+
+void blob_cache_update(
+    const char *ns,
+    uint16_t parent_id,
+    uint16_t id,
+    size_t size,
+    const void *data
+) {
+  xSemaphoreTake(cache_mutex, portMAX_DELAY);
+  epoch++;
+  store(ns, parent_id, id, size, data);
+  xSemaphoreGive(cache_mutex);
+}
+
+void blob_cache_invalidate(const char *ns, uint16_t parent_id, uint16_t id) {
+  xSemaphoreTake(cache_mutex, portMAX_DELAY);
+  epoch++;
+  cache_entry_t *entry = find(ns, parent_id, id);
+  if (entry) {
+    drop(entry);
+  }
+  xSemaphoreGive(cache_mutex);
+}
+
+void dmxbox_storage_get_cache_stats(dmxbox_storage_cache_stats_t *result) {
+  xSemaphoreTake(cache_mutex, portMAX_DELAY);
+  *result = stats;
+  result->entries = 0;
+  for (size_t i = 0; i < CONFIG_DMXBOX_STORAGE_CACHE_ENTRIES; i++) {
+    if (entries[i].data) {
+      result->entries++;
+    }
+  }
+  result->bytes = cached_bytes;
+  result->capacity_bytes = CONFIG_DMXBOX_STORAGE_CACHE_BYTES;
+  xSemaphoreGive(cache_mutex);
+}
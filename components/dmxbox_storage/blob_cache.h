@@ -0,0 +1,41 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Bounded RAM cache of blob contents, keyed by (namespace, parent_id, id).
+// Writes update it, deletes drop the entry. Reads that missed fill it, unless
+// a write to any blob happened while they were reading from flash (the epoch
+// changed), in which case what they read might already be stale.
+
+void blob_cache_init();
+void blob_cache_clear();
+
+uint32_t blob_cache_epoch();
+
+// copies the cached blob into a new malloc()ed *buffer, buffer can be NULL to
+// only get the size
+bool blob_cache_get(
+    const char *ns,
+    uint16_t parent_id,
+    uint16_t id,
+    size_t *size,
+    void **buffer
+);
+
+void blob_cache_fill(
+    const char *ns,
+    uint16_t parent_id,
+    uint16_t id,
+    size_t size,
+    const void *data,
+    uint32_t epoch
+);
+void blob_cache_update(
+    const char *ns,
+    uint16_t parent_id,
+    uint16_t id,
+    size_t size,
+    const void *data
+);
+void blob_cache_invalidate(const char *ns, uint16_t parent_id, uint16_t id);
@@ -0,0 +1,381 @@
+#include "blob_index.h"
+#include "storage_metrics.h"
+#include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <nvs.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char TAG[] = "dmxbox_storage_index";
+
+// only namespaces with our blob keys are indexed
+static const char INDEXED_NS_PREFIX[] = "dmxbox/";
+
+#define MAX_NAMESPACES 8
+
+typedef struct blob_index_entry {
+  uint16_t parent_id;
+  uint16_t id;
+  uint32_t size;
+} blob_index_entry_t;
+
+typedef struct blob_index {
+  char ns[NVS_NS_NAME_MAX_SIZE];
+  bool stale; // an update was lost, rescan before listing
+  size_t count;
+  size_t capacity;
+  blob_index_entry_t *entries;
+} blob_index_t;
+
+static SemaphoreHandle_t index_mutex;
+static blob_index_t indexes[MAX_NAMESPACES];
+
+static bool parse_blob_key(const char *key, uint16_t *parent_id, uint16_t *id) {
+  char *last = NULL;
+  long value = strtol(key, &last, 16);
+  if (last == key || value < 0 || value > UINT16_MAX) {
+    return false;
+  }
+  if (*last == '\0') {
+    *parent_id = 0;
+    *id = value;
+    return true;
+  }
+  if (*last == ':') {
+    *parent_id = value;
+    const char *rest = last + 1;
+    value = strtol(rest, &last, 16);
+    if (last == rest || value < 0 || value > UINT16_MAX || *last != '\0') {
+      return false;
+    }
+    *id = value;
+    return true;
+  }
+  return false;
+}
+
+static bool is_indexed(const char *ns) {
+  return !strncmp(ns, INDEXED_NS_PREFIX, sizeof(INDEXED_NS_PREFIX) - 1);
+}
+
+static int
+compare(uint16_t parent_a, uint16_t id_a, uint16_t parent_b, uint16_t id_b) {
+  if (parent_a != parent_b) {
+    return parent_a < parent_b ? -1 : 1;
+  }
+  if (id_a != id_b) {
+    return id_a < id_b ? -1 : 1;
+  }
+  return 0;
+}
+
+static int compare_entries(const void *a, const void *b) {
+  const blob_index_entry_t *x = a;
+  const blob_index_entry_t *y = b;
+  return compare(x->parent_id, x->id, y->parent_id, y->id);
+}
+
+static blob_index_t *find_index(const char *ns, bool create) {
+  blob_index_t *empty = NULL;
+  for (size_t i = 0; i < MAX_NAMESPACES; i++) {
+    if (!indexes[i].ns[0]) {
+      if (!empty) {
+        empty = &indexes[i];
+      }
+    } else if (!strcmp(indexes[i].ns, ns)) {
+      return &indexes[i];
+    }
+  }
+  if (!create) {
+    return NULL;
+  }
+  if (!empty) {
+    ESP_LOGE(TAG, "no room to index %s", ns);
+    return NULL;
+  }
+  strlcpy(empty->ns, ns, sizeof(empty->ns));
+  return empty;
+}
+
+// first entry not less than (parent_id, id)
+static size_t lower_bound(
+    const blob_index_t *index,
+    uint16_t parent_id,
+    uint16_t id
+) {
+  size_t low = 0;
+  size_t high = index->count;
+  while (low < high) {
+    size_t middle = low + (high - low) / 2;
+    const blob_index_entry_t *entry = &index->entries[middle];
+    if (compare(entry->parent_id, entry->id, parent_id, id) < 0) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  return low;
+}
+
+static bool is_at(
+    const blob_index_t *index,
+    size_t position,
+    uint16_t parent_id,
+    uint16_t id
+) {
+  return position < index->count &&
+         index->entries[position].parent_id == parent_id &&
+         index->entries[position].id == id;
+}
+
+static bool reserve(blob_index_t *index, size_t count) {
+  if (count <= index->capacity) {
+    return true;
+  }
+  size_t capacity = index->capacity ? index->capacity * 2 : 16;
+  if (capacity < count) {
+    capacity = count;
+  }
+  blob_index_entry_t *entries =
+      realloc(index->entries, capacity * sizeof(blob_index_entry_t));
+  if (!entries) {
+    ESP_LOGE(TAG, "failed to grow the %s index to %u", index->ns, capacity);
+    return false;
+  }
+  index->entries = entries;
+  index->capacity = capacity;
+  return true;
+}
+
+static void reset(blob_index_t *index) {
+  free(index->entries);
+  memset(index, 0, sizeof(*index));
+}
+
+// Rebuilds the index of one namespace, or of all of them when ns is NULL.
+// Entries are appended in NVS order and sorted once at the end.
+static void scan(const char *ns) {
+  if (ns) {
+    blob_index_t *index = find_index(ns, false);
+    if (index) {
+      index->count = 0;
+      index->stale = false;
+    }
+  } else {
+    for (size_t i = 0; i < MAX_NAMESPACES; i++) {
+      reset(&indexes[i]);
+    }
+  }
+
+  int64_t start = storage_metrics_start();
+  nvs_iterator_t iterator = NULL;
+  esp_err_t ret =
+      nvs_entry_find(NVS_DEFAULT_PART_NAME, ns, NVS_TYPE_BLOB, &iterator);
+
+  // sizes need a handle, reopened whenever the namespace changes
+  nvs_handle_t storage = 0;
+  blob_index_t *index = NULL;
+  size_t blob_count = 0;
+
+  while (ret == ESP_OK) {
+    nvs_entry_info_t info;
+    nvs_entry_info(iterator, &info);
+
+    uint16_t parent_id;
+    uint16_t id;
+    if (!is_indexed(info.namespace_name) ||
+        !parse_blob_key(info.key, &parent_id, &id)) {
+      goto next;
+    }
+
+    if (!index || strcmp(index->ns, info.namespace_name)) {
+      if (index) {
+        nvs_close(storage);
+      }
+      index = find_index(info.namespace_name, true);
+      if (!index) {
+        goto next;
+      }
+      if (nvs_open(info.namespace_name, NVS_READONLY, &storage) != ESP_OK) {
+        ESP_LOGE(TAG, "failed to open %s", info.namespace_name);
+        index->stale = true;
+        index = NULL;
+        goto next;
+      }
+    }
+
+    size_t size = 0;
+    if (nvs_get_blob(storage, info.key, NULL, &size) != ESP_OK ||
+        !reserve(index, index->count + 1)) {
+      index->stale = true;
+      goto next;
+    }
+    index->entries[index->count++] = (blob_index_entry_t){
+        .parent_id = parent_id,
+        .id = id,
+        .size = size,
+    };
+    blob_count++;
+
+  next:
+    ret = nvs_entry_next(&iterator);
+  }
+  if (index) {
+    nvs_close(storage);
+  }
+  if (iterator) {
+    nvs_release_iterator(iterator);
+  }
+  storage_metrics_record(dmxbox_storage_op_iterate, start, ret, 0);
+  if (ret != ESP_ERR_NVS_NOT_FOUND) {
+    ESP_LOGE(TAG, "failed to scan blobs: %s", esp_err_to_name(ret));
+  }
+
+  for (size_t i = 0; i < MAX_NAMESPACES; i++) {
+    blob_index_t *sorted = &indexes[i];
+    if (sorted->ns[0] && (!ns || !strcmp(sorted->ns, ns))) {
+      qsort(
+          sorted->entries,
+          sorted->count,
+          sizeof(blob_index_entry_t),
+          compare_entries
+      );
+    }
+  }
+
+  ESP_LOGI(TAG, "indexed %u blobs in %s", blob_count, ns ? ns : "all");
+}
+
+void blob_index_init() {
+  if (!index_mutex) {
+    index_mutex = xSemaphoreCreateMutex();
+    if (!index_mutex) {
+      ESP_LOGE(TAG, "failed to create mutex");
+      abort();
+    }
+  }
+
+  xSemaphoreTake(index_mutex, portMAX_DELAY);
+  scan(NULL);
+  xSemaphoreGive(index_mutex);
+}
+
+void blob_index_clear() {
+  if (!index_mutex) {
+    return; // not initialized yet, so there's nothing indexed
+  }
+  xSemaphoreTake(index_mutex, portMAX_DELAY);
+  for (size_t i = 0; i < MAX_NAMESPACES; i++) {
+    reset(&indexes[i]);
+  }
+  xSemaphoreGive(index_mutex);
+}
+
+void blob_index_clear_ns(const char *ns) {
+  xSemaphoreTake(index_mutex, portMAX_DELAY);
+  blob_index_t *index = find_index(ns, false);
+  if (index) {
+    index->count = 0;
+    index->stale = false;
+  }
+  xSemaphoreGive(index_mutex);
+}
+
+void blob_index_put(
+    const char *ns,
+    uint16_t parent_id,
+    uint16_t id,
+    size_t size
+) {
+  if (!is_indexed(ns)) {
+    return;
+  }
+
+  xSemaphoreTake(index_mutex, portMAX_DELAY);
+  blob_index_t *index = find_index(ns, true);
+  if (!index) {
+    goto exit;
+  }
+
+  size_t position = lower_bound(index, parent_id, id);
+  if (is_at(index, position, parent_id, id)) {
+    index->entries[position].size = size;
+    goto exit;
+  }
+
+  if (!reserve(index, index->count + 1)) {
+    index->stale = true;
+    goto exit;
+  }
+  blob_index_entry_t *entry = &index->entries[position];
+  memmove(
+      entry + 1,
+      entry,
+      (index->count - position) * sizeof(blob_index_entry_t)
+  );
+  *entry = (blob_index_entry_t){
+      .parent_id = parent_id,
+      .id = id,
+      .size = size,
+  };
+  index->count++;
+
+exit:
+  xSemaphoreGive(index_mutex);
+}
+
+void blob_index_remove(const char *ns, uint16_t parent_id, uint16_t id) {
+  xSemaphoreTake(index_mutex, portMAX_DELAY);
+  blob_index_t *index = find_index(ns, false);
+  if (!index) {
+    goto exit;
+  }
+
+  size_t position = lower_bound(index, parent_id, id);
+  if (!is_at(index, position, parent_id, id)) {
+    goto exit;
+  }
+  blob_index_entry_t *entry = &index->entries[position];
+  memmove(
+      entry,
+      entry + 1,
+      (index->count - position - 1) * sizeof(blob_index_entry_t)
+  );
+  index->count--;
+
+exit:
+  xSemaphoreGive(index_mutex);
+}
+
+uint16_t blob_index_list(
+    const char *ns,
+    uint16_t parent_id,
+    uint16_t skip,
+    uint16_t count,
+    dmxbox_storage_entry_t *page
+) {
+  xSemaphoreTake(index_mutex, portMAX_DELAY);
+  blob_index_t *index = find_index(ns, false);
+  if (index && index->stale) {
+    ESP_LOGW(TAG, "index of %s is stale, rescanning", ns);
+    scan(ns);
+  }
+
+  uint16_t read = 0;
+  if (index) {
+    size_t position = lower_bound(index, parent_id, 0) + skip;
+    while (read < count && position < index->count &&
+           index->entries[position].parent_id == parent_id) {
+      page[read++] = (dmxbox_storage_entry_t){
+          .id = index->entries[position].id,
+          .size = index->entries[position].size,
+      };
+      position++;
+    }
+  }
+
+  xSemaphoreGive(index_mutex);
+  return read;
+}
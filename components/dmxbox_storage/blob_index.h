@@ -0,0 +1,27 @@
+#pragma once
+#include "entry.h"
+#include <stdint.h>
+
+// In-RAM index of the blobs in the dmxbox/ namespaces, sorted by
+// (parent_id, id), so listing doesn't have to walk the whole of NVS
+
+void blob_index_init();
+void blob_index_clear();
+void blob_index_clear_ns(const char *ns);
+
+void blob_index_put(
+    const char *ns,
+    uint16_t parent_id,
+    uint16_t id,
+    size_t size
+);
+void blob_index_remove(const char *ns, uint16_t parent_id, uint16_t id);
+
+// fills in id and size of up to count entries, data is left NULL
+uint16_t blob_index_list(
+    const char *ns,
+    uint16_t parent_id,
+    uint16_t skip,
+    uint16_t count,
+    dmxbox_storage_entry_t *page
+);
@@ -0,0 +1,201 @@
+#include "cue_storage.h"
+#include "dmxbox_storage.h"
+#include "entry.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "private.h"
+#include <esp_check.h>
+#include <nvs.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char CUES_NS[] = "dmxbox/cues";
+static const char TAG[] = "dmxbox_storage_cue";
+
+// Sizes of everything preceding channel_count in older versions of
+// dmxbox_cue_t. Like effects, new fields only go right before channel_count.
+static const size_t legacy_header_sizes[] = {
+    offsetof(dmxbox_cue_t, time), // before timecode
+};
+
+static size_t cue_size(size_t channel_count) {
+  return sizeof(dmxbox_cue_t) +
+         (channel_count - 1) * sizeof(dmxbox_channel_level_t);
+}
+
+static size_t blob_size(size_t header_size, size_t channel_count) {
+  return header_size + sizeof(size_t) +
+         channel_count * sizeof(dmxbox_channel_level_t);
+}
+
+static bool read_channel_count(
+    const void *buffer,
+    size_t size,
+    size_t header_size,
+    size_t *channel_count
+) {
+  if (size < header_size + sizeof(size_t)) {
+    return false;
+  }
+  memcpy(channel_count, (const uint8_t *)buffer + header_size, sizeof(size_t));
+  return size == blob_size(header_size, *channel_count);
+}
+
+// replaces *buffer with a blob in the current layout if it's an older one
+static esp_err_t upgrade_cue(uint16_t cue_id, void **buffer, size_t *size) {
+  size_t channel_count;
+  if (read_channel_count(
+          *buffer,
+          *size,
+          offsetof(dmxbox_cue_t, channel_count),
+          &channel_count
+      )) {
+    return ESP_OK;
+  }
+
+  for (size_t i = 0;
+       i < sizeof(legacy_header_sizes) / sizeof(legacy_header_sizes[0]);
+       i++) {
+    size_t header_size = legacy_header_sizes[i];
+    if (!read_channel_count(*buffer, *size, header_size, &channel_count)) {
+      continue;
+    }
+
+    dmxbox_cue_t *upgraded = dmxbox_cue_alloc(channel_count);
+    if (!upgraded) {
+      return ESP_ERR_NO_MEM;
+    }
+    memcpy(upgraded, *buffer, header_size);
+    memcpy(
+        upgraded->channels,
+        (const uint8_t *)*buffer + header_size + sizeof(size_t),
+        channel_count * sizeof(dmxbox_channel_level_t)
+    );
+
+    ESP_LOGI(TAG, "upgraded cue %u from layout %u", cue_id, i);
+    free(*buffer);
+    *buffer = upgraded;
+    *size = cue_size(channel_count);
+    return ESP_OK;
+  }
+
+  ESP_LOGE(TAG, "cue %u has unknown %u-byte layout", cue_id, *size);
+  return ESP_ERR_INVALID_SIZE;
+}
+
+dmxbox_cue_t *dmxbox_cue_alloc(size_t channel_count) {
+  dmxbox_cue_t *cue = calloc(1, cue_size(channel_count));
+  if (cue) {
+    cue->channel_count = channel_count;
+  }
+  return cue;
+}
+
+esp_err_t dmxbox_cue_get(uint16_t cue_id, dmxbox_cue_t **result) {
+  size_t size = 0;
+  void *buffer = NULL;
+  ESP_RETURN_ON_ERROR(
+      dmxbox_storage_get_blob(
+          CUES_NS,
+          0,
+          cue_id,
+          &size,
+          result ? &buffer : NULL
+      ),
+      TAG,
+      "failed to get the blob for cue id '%u'",
+      cue_id
+  );
+
+  if (result) {
+    esp_err_t ret = upgrade_cue(cue_id, &buffer, &size);
+    if (ret != ESP_OK) {
+      free(buffer);
+      return ret;
+    }
+    *result = buffer;
+  }
+  return ESP_OK;
+}
+
+esp_err_t dmxbox_cue_set(uint16_t cue_id, const dmxbox_cue_t *cue) {
+  return dmxbox_storage_set_blob(
+      CUES_NS,
+      0,
+      cue_id,
+      cue_size(cue->channel_count),
+      cue
+  );
+}
+
+esp_err_t dmxbox_cue_create(const dmxbox_cue_t *cue, uint16_t *id) {
+  return dmxbox_storage_create_blob(
+      CUES_NS,
+      0,
+      cue,
+      cue_size(cue->channel_count),
+      id
+  );
+}
+
+esp_err_t dmxbox_cue_reserve_ids(uint16_t last_id) {
+  return dmxbox_storage_reserve_ids(CUES_NS, 0, last_id);
+}
+
+esp_err_t dmxbox_cue_delete(uint16_t cue_id) {
+  ESP_RETURN_ON_ERROR(
+      dmxbox_storage_delete_blob(CUES_NS, 0, cue_id),
+      TAG,
+      "failed to delete the blob for cue id '%u'",
+      cue_id
+  );
+  return ESP_OK;
+}
+
+esp_err_t dmxbox_cue_delete_all() {
+  ESP_RETURN_ON_ERROR(
+      dmxbox_storage_delete_all_blobs(CUES_NS),
+      TAG,
+      "failed to delete all cues"
+  );
+  return ESP_OK;
+}
+
+esp_err_t dmxbox_cue_list(
+    uint16_t skip,
+    uint16_t *count,
+    dmxbox_storage_entry_t *page
+) {
+  ESP_RETURN_ON_ERROR(
+      dmxbox_storage_list_blobs(CUES_NS, 0, skip, count, page),
+      TAG,
+      "failed to list cues"
+  );
+
+  for (uint16_t i = 0; i < *count; i++) {
+    if (upgrade_cue(page[i].id, &page[i].data, &page[i].size) == ESP_OK) {
+      continue;
+    }
+
+    ESP_LOGE(TAG, "cue %u corrupted, listing it without channels", page[i].id);
+    free(page[i].data);
+    page[i].data = dmxbox_cue_alloc(0);
+    page[i].size = cue_size(0);
+    if (!page[i].data) {
+      for (uint16_t j = 0; j < *count; j++) {
+        free(page[j].data);
+      }
+      *count = 0;
+      return ESP_ERR_NO_MEM;
+    }
+  }
+  return ESP_OK;
+}
+
+esp_err_t dmxbox_cue_list_ids(
+    uint16_t skip,
+    uint16_t *count,
+    dmxbox_storage_entry_t *page
+) {
+  return dmxbox_storage_list_blob_ids(CUES_NS, 0, skip, count, page);
+}
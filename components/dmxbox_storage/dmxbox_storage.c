@@ -5,7 +5,11 @@
 #include <string.h>
 
 #include "dmxbox_const.h"
+#include "dmxbox_storage.h"
+#include "blob_cache.h"
+#include "blob_index.h"
 #include "private.h"
+#include "show_partition.h"
 
 static const char *TAG = "storage";
 
@@ -16,6 +20,9 @@ static const char *key_sta_mode_enabled = "sta_mode";
 static const char *key_hostname = "hostname";
 static const char *key_native_universe = "native_uni";
 static const char *key_effect_control_universe = "effect_uni";
+static const char *key_cue_go_channel = "cue_go";
+static const char *key_cue_back_channel = "cue_back";
+static const char *key_tempo_tap_channel = "tempo_tap";
 
 static const char *default_hostname = "dmx-box";
 static const uint16_t default_native_universe = 0;
@@ -26,6 +33,9 @@ static uint8_t sta_mode_enabled_ = 0;
 static char hostname_[16] = "dmx-box";
 static uint16_t native_universe_ = 0;
 static uint16_t effect_control_universe_ = 0;
+static uint16_t cue_go_channel_ = 0;
+static uint16_t cue_back_channel_ = 0;
+static uint16_t tempo_tap_channel_ = 0;
 
 uint8_t dmxbox_get_first_run_completed() { return first_run_completed_; }
 uint8_t dmxbox_get_sta_mode_enabled() { return sta_mode_enabled_; }
@@ -35,6 +45,9 @@ uint16_t dmxbox_get_native_universe() { return native_universe_; }
 uint16_t dmxbox_get_effect_control_universe() {
   return effect_control_universe_;
 }
+uint16_t dmxbox_get_cue_go_channel() { return cue_go_channel_; }
+uint16_t dmxbox_get_cue_back_channel() { return cue_back_channel_; }
+uint16_t dmxbox_get_tempo_tap_channel() { return tempo_tap_channel_; }
 
 void dmxbox_set_first_run_completed(uint8_t value) {
   first_run_completed_ = value;
@@ -64,6 +77,21 @@ void dmxbox_set_effect_control_universe(uint16_t value) {
   dmxbox_storage_set_u16(key_effect_control_universe, effect_control_universe_);
 }
 
+void dmxbox_set_cue_go_channel(uint16_t value) {
+  cue_go_channel_ = value;
+  dmxbox_storage_set_u16(key_cue_go_channel, cue_go_channel_);
+}
+
+void dmxbox_set_cue_back_channel(uint16_t value) {
+  cue_back_channel_ = value;
+  dmxbox_storage_set_u16(key_cue_back_channel, cue_back_channel_);
+}
+
+void dmxbox_set_tempo_tap_channel(uint16_t value) {
+  tempo_tap_channel_ = value;
+  dmxbox_storage_set_u16(key_tempo_tap_channel, tempo_tap_channel_);
+}
+
 bool dmxbox_get_artnet_snapshot(
     uint16_t universe,
     uint8_t data[DMX_CHANNEL_COUNT]
@@ -122,6 +150,11 @@ void dmxbox_storage_init() {
     err = nvs_flash_init();
   }
   ESP_ERROR_CHECK(err);
+  dmxbox_storage_txn_init();
+  blob_index_init();
+  blob_cache_init();
+  dmxbox_storage_writer_init();
+  dmxbox_show_image_init();
 
   nvs_handle_t storage = dmxbox_storage_open(NVS_READONLY);
   first_run_completed_ =
@@ -131,9 +164,14 @@ void dmxbox_storage_init() {
   native_universe_ = dmxbox_storage_get_u16(storage, key_native_universe);
   effect_control_universe_ =
       dmxbox_storage_get_u16(storage, key_effect_control_universe);
-  nvs_close(storage);
+  cue_go_channel_ = dmxbox_storage_get_u16(storage, key_cue_go_channel);
+  cue_back_channel_ = dmxbox_storage_get_u16(storage, key_cue_back_channel);
+  tempo_tap_channel_ = dmxbox_storage_get_u16(storage, key_tempo_tap_channel);
+  dmxbox_storage_close_ns(storage);
 }
 
+// The settings are queued for the writer in this order, so a setting queued
+// after these (like first_init) only reaches flash once they're there.
 void dmxbox_storage_set_defaults() {
   dmxbox_set_hostname(default_hostname);
   dmxbox_set_native_universe(default_native_universe);
@@ -143,4 +181,16 @@ void dmxbox_storage_set_defaults() {
 void dmxbox_storage_factory_reset() {
   ESP_LOGI(TAG, "Erasing storage");
   ESP_ERROR_CHECK(nvs_flash_erase());
+  blob_index_clear();
+  blob_cache_clear();
+
+  // runs before dmxbox_storage_init, so the partition isn't open yet
+  esp_err_t ret = show_partition_erase();
+  if (ret != ESP_OK && ret != ESP_ERR_NOT_FOUND) {
+    ESP_LOGW(
+        TAG,
+        "Failed to erase the show partition: %s",
+        esp_err_to_name(ret)
+    );
+  }
 }
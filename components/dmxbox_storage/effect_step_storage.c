@@ -4,6 +4,7 @@
 #include "nvs.h"
 #include "nvs_flash.h"
 #include "private.h"
+#include "step_codec.h"
 #include <esp_check.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -25,6 +26,57 @@ dmxbox_effect_step_t *dmxbox_effect_step_alloc(size_t channel_count) {
   return effect_step;
 }
 
+// Rewrites a step read in the legacy layout in the compact one. The content
+// doesn't change, so neither does the show. This is queued like
+// dmxbox_effect_step_set is, so a later set or delete of the same step
+// replaces it.
+static void migrate(
+    uint16_t effect_id,
+    uint16_t step_id,
+    const dmxbox_effect_step_t *step
+) {
+  void *encoded;
+  size_t size;
+  if (step_codec_encode(step, &encoded, &size) != ESP_OK) {
+    return;
+  }
+  ESP_LOGI(TAG, "migrating effect %u step %u", effect_id, step_id);
+  if (dmxbox_storage_set_blob(
+          effect_step_ns,
+          effect_id,
+          step_id,
+          size,
+          encoded
+      ) != ESP_OK) {
+    ESP_LOGW(TAG, "failed to migrate effect %u step %u", effect_id, step_id);
+  }
+  free(encoded);
+}
+
+// replaces *buffer with the decoded step
+static esp_err_t decode(
+    uint16_t effect_id,
+    uint16_t step_id,
+    void **buffer,
+    size_t *size
+) {
+  dmxbox_effect_step_t *step;
+  ESP_RETURN_ON_ERROR(
+      step_codec_decode(*buffer, *size, &step),
+      TAG,
+      "failed to decode effect %u step %u",
+      effect_id,
+      step_id
+  );
+  if (step_codec_is_legacy(*size)) {
+    migrate(effect_id, step_id, step);
+  }
+  free(*buffer);
+  *buffer = step;
+  *size = step_size(step->channel_count);
+  return ESP_OK;
+}
+
 esp_err_t dmxbox_effect_step_get(
     uint16_t effect_id,
     uint16_t step_id,
@@ -47,21 +99,12 @@ esp_err_t dmxbox_effect_step_get(
   );
 
   if (result) {
-    *result = buffer;
-    size_t expected_size = step_size((*result)->channel_count);
-    if (expected_size != size) {
-      ESP_LOGE(
-          TAG,
-          "effect %u step %u corrupted. blob size %u bytes, expected %u bytes "
-          "because declared channel count %u. deleting all channels",
-          effect_id,
-          step_id,
-          size,
-          expected_size,
-          (*result)->channel_count
-      );
-      (*result)->channel_count = 0;
+    esp_err_t ret = decode(effect_id, step_id, &buffer, &size);
+    if (ret != ESP_OK) {
+      free(buffer);
+      return ret;
     }
+    *result = buffer;
   }
   return ESP_OK;
 }
@@ -71,17 +114,35 @@ esp_err_t dmxbox_effect_step_set(
     uint16_t step_id,
     const dmxbox_effect_step_t *value
 ) {
-  size_t size = step_size(value->channel_count);
-  return dmxbox_storage_set_blob(
+  ESP_RETURN_ON_ERROR(dmxbox_show_changed(), TAG, "failed to invalidate show");
+
+  void *encoded;
+  size_t size;
+  ESP_RETURN_ON_ERROR(
+      step_codec_encode(value, &encoded, &size),
+      TAG,
+      "failed to encode effect %u step %u",
+      effect_id,
+      step_id
+  );
+  esp_err_t ret = dmxbox_storage_set_blob(
       effect_step_ns,
       effect_id,
       step_id,
       size,
-      value
+      encoded
   );
+  free(encoded);
+  return ret;
+}
+
+esp_err_t
+dmxbox_effect_step_reserve_ids(uint16_t effect_id, uint16_t last_id) {
+  return dmxbox_storage_reserve_ids(effect_step_ns, effect_id, last_id);
 }
 
 esp_err_t dmxbox_effect_step_delete(uint16_t effect_id, uint16_t step_id) {
+  ESP_RETURN_ON_ERROR(dmxbox_show_changed(), TAG, "failed to invalidate show");
   ESP_RETURN_ON_ERROR(
       dmxbox_storage_delete_blob(effect_step_ns, effect_id, step_id),
       TAG,
@@ -92,13 +153,50 @@ esp_err_t dmxbox_effect_step_delete(uint16_t effect_id, uint16_t step_id) {
   return ESP_OK;
 }
 
+esp_err_t dmxbox_effect_step_delete_all() {
+  ESP_RETURN_ON_ERROR(dmxbox_show_changed(), TAG, "failed to invalidate show");
+  ESP_RETURN_ON_ERROR(
+      dmxbox_storage_delete_all_blobs(effect_step_ns),
+      TAG,
+      "failed to delete all effect steps"
+  );
+  return ESP_OK;
+}
+
 esp_err_t dmxbox_effect_step_list(
     uint16_t effect_id,
     uint16_t skip,
     uint16_t *count,
     dmxbox_storage_entry_t *page
 ) {
-  return dmxbox_storage_list_blobs(
+  ESP_RETURN_ON_ERROR(
+      dmxbox_storage_list_blobs(effect_step_ns, effect_id, skip, count, page),
+      TAG,
+      "failed to list steps of effect %u",
+      effect_id
+  );
+
+  // steps that fail to decode are left out, like unreadable blobs are
+  uint16_t decoded = 0;
+  for (uint16_t i = 0; i < *count; i++) {
+    dmxbox_storage_entry_t entry = page[i];
+    if (decode(effect_id, entry.id, &entry.data, &entry.size) != ESP_OK) {
+      free(entry.data);
+      continue;
+    }
+    page[decoded++] = entry;
+  }
+  *count = decoded;
+  return ESP_OK;
+}
+
+esp_err_t dmxbox_effect_step_list_ids(
+    uint16_t effect_id,
+    uint16_t skip,
+    uint16_t *count,
+    dmxbox_storage_entry_t *page
+) {
+  return dmxbox_storage_list_blob_ids(
       effect_step_ns,
       effect_id,
       skip,
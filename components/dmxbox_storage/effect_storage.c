@@ -6,14 +6,216 @@
 #include "private.h"
 #include <esp_check.h>
 #include <nvs.h>
+#include <stdlib.h>
+#include <string.h>
 
 static const char EFFECTS_NS[] = "dmxbox/effect";
 static const char TAG[] = "dmxbox_storage_effect";
 
+#define EFFECT_FORMAT_VERSION 1
+#define MAX_PADDING 7
+#define PADDING 0
+
+// Effects are stored as a version byte, the struct up to step_count as is,
+// then the step count and the step ids as uint16s. Changes to the struct
+// bump the version.
+//
+// Before there was a version byte, a blob was the struct itself and only its
+// size told the layouts apart. These are the sizes of everything preceding
+// step_count in those layouts, newest first; new fields were only ever added
+// right before it. A blob that fits one of them is upgraded by copying its
+// header and zero-filling the rest, and rewritten in the current format the
+// first time it's read. Encoded blobs are padded until they don't fit any of
+// them, so they're never mistaken for one (the current layout's never need
+// it, their sizes are even where the legacy ones are odd).
+static const size_t legacy_header_sizes[] = {
+    offsetof(dmxbox_effect_t, step_count), // before the format version
+    offsetof(dmxbox_effect_t, type),       // before waveform effects
+    offsetof(dmxbox_effect_t, priority),   // before blend modes
+    offsetof(dmxbox_effect_t, beats),      // before tempo sync
+    offsetof(dmxbox_effect_t, start),      // before timecode
+};
+
+static const size_t header_size = offsetof(dmxbox_effect_t, step_count);
+
 static size_t effect_size(size_t step_count) {
   return sizeof(dmxbox_effect_t) + (step_count - 1) * sizeof(uint16_t);
 }
 
+static size_t encoded_size(size_t step_count) {
+  return 1 + header_size + (1 + step_count) * sizeof(uint16_t);
+}
+
+static size_t legacy_size(size_t legacy_header_size, size_t step_count) {
+  return legacy_header_size + sizeof(size_t) + step_count * sizeof(uint16_t);
+}
+
+// Finds the legacy layout the blob fits, if any
+static bool find_legacy_layout(
+    const void *buffer,
+    size_t size,
+    size_t *layout,
+    size_t *step_count
+) {
+  for (size_t i = 0;
+       i < sizeof(legacy_header_sizes) / sizeof(legacy_header_sizes[0]);
+       i++) {
+    size_t legacy_header_size = legacy_header_sizes[i];
+    if (size < legacy_size(legacy_header_size, 0)) {
+      continue;
+    }
+    memcpy(
+        step_count,
+        (const uint8_t *)buffer + legacy_header_size,
+        sizeof(size_t)
+    );
+    if (size == legacy_size(legacy_header_size, *step_count)) {
+      *layout = i;
+      return true;
+    }
+  }
+  return false;
+}
+
+// *result must be free()d when ESP_OK
+static esp_err_t
+encode_effect(const dmxbox_effect_t *effect, void **result, size_t *size) {
+  if (effect->step_count > UINT16_MAX) {
+    ESP_LOGE(TAG, "effect has too many steps: %u", effect->step_count);
+    return ESP_ERR_INVALID_SIZE;
+  }
+  uint16_t step_count = effect->step_count;
+  uint8_t *buffer = malloc(encoded_size(step_count) + MAX_PADDING);
+  if (!buffer) {
+    return ESP_ERR_NO_MEM;
+  }
+
+  uint8_t *out = buffer;
+  *out++ = EFFECT_FORMAT_VERSION;
+  memcpy(out, effect, header_size);
+  out += header_size;
+  memcpy(out, &step_count, sizeof(step_count));
+  out += sizeof(step_count);
+  memcpy(out, effect->steps, step_count * sizeof(uint16_t));
+  out += step_count * sizeof(uint16_t);
+
+  size_t layout;
+  size_t legacy_step_count;
+  size_t padding = 0;
+  while (find_legacy_layout(buffer, out - buffer, &layout, &legacy_step_count)
+  ) {
+    if (padding++ == MAX_PADDING) {
+      ESP_LOGE(TAG, "effect would read as legacy layout %u", layout);
+      free(buffer);
+      return ESP_ERR_INVALID_SIZE;
+    }
+    *out++ = PADDING;
+  }
+
+  *result = buffer;
+  *size = out - buffer;
+  return ESP_OK;
+}
+
+// Replaces *buffer with the effect it holds. *legacy is set if it was
+// stored in a layout from before the format version.
+static esp_err_t decode_effect(
+    uint16_t effect_id,
+    void **buffer,
+    size_t *size,
+    bool *legacy
+) {
+  const uint8_t *data = *buffer;
+  const uint8_t *steps;
+  size_t copied_header_size;
+  size_t step_count;
+  size_t layout;
+  *legacy = find_legacy_layout(data, *size, &layout, &step_count);
+  if (*legacy) {
+    copied_header_size = legacy_header_sizes[layout];
+    steps = data + copied_header_size + sizeof(size_t);
+  } else {
+    if (*size < encoded_size(0) || data[0] != EFFECT_FORMAT_VERSION) {
+      ESP_LOGE(
+          TAG,
+          "effect %u has unknown %u-byte format",
+          effect_id,
+          *size
+      );
+      return ESP_ERR_INVALID_VERSION;
+    }
+    uint16_t encoded_step_count;
+    memcpy(
+        &encoded_step_count,
+        data + 1 + header_size,
+        sizeof(encoded_step_count)
+    );
+    step_count = encoded_step_count;
+    if (*size < encoded_size(step_count) ||
+        *size > encoded_size(step_count) + MAX_PADDING) {
+      ESP_LOGE(
+          TAG,
+          "effect %u is %u bytes for %u steps",
+          effect_id,
+          *size,
+          step_count
+      );
+      return ESP_ERR_INVALID_SIZE;
+    }
+    copied_header_size = header_size;
+    data++;
+    steps = data + header_size + sizeof(uint16_t);
+  }
+
+  dmxbox_effect_t *effect = dmxbox_effect_alloc(step_count);
+  if (!effect) {
+    return ESP_ERR_NO_MEM;
+  }
+  memcpy(effect, data, copied_header_size);
+  memcpy(effect->steps, steps, step_count * sizeof(uint16_t));
+  if (*legacy) {
+    ESP_LOGI(TAG, "upgraded effect %u from layout %u", effect_id, layout);
+  }
+
+  free(*buffer);
+  *buffer = effect;
+  *size = effect_size(step_count);
+  return ESP_OK;
+}
+
+// Rewrites an effect read in a legacy layout in the current format. The
+// content doesn't change, so neither does the show. This is queued like
+// dmxbox_effect_set is, so a later set or delete of the effect replaces it.
+static void migrate(uint16_t effect_id, const dmxbox_effect_t *effect) {
+  void *encoded;
+  size_t size;
+  if (encode_effect(effect, &encoded, &size) != ESP_OK) {
+    return;
+  }
+  ESP_LOGI(TAG, "migrating effect %u", effect_id);
+  if (dmxbox_storage_set_blob(EFFECTS_NS, 0, effect_id, size, encoded) !=
+      ESP_OK) {
+    ESP_LOGW(TAG, "failed to migrate effect %u", effect_id);
+  }
+  free(encoded);
+}
+
+// replaces *buffer with the effect it holds, migrating it if it's legacy
+static esp_err_t
+read_effect(uint16_t effect_id, void **buffer, size_t *size) {
+  bool legacy;
+  ESP_RETURN_ON_ERROR(
+      decode_effect(effect_id, buffer, size, &legacy),
+      TAG,
+      "failed to decode effect %u",
+      effect_id
+  );
+  if (legacy) {
+    migrate(effect_id, *buffer);
+  }
+  return ESP_OK;
+}
+
 dmxbox_effect_t *dmxbox_effect_alloc(size_t step_count) {
   size_t size = effect_size(step_count);
   dmxbox_effect_t *effect = calloc(1, size);
@@ -39,6 +241,11 @@ esp_err_t dmxbox_effect_get(uint16_t effect_id, dmxbox_effect_t **result) {
       effect_id
   );
   if (result) {
+    esp_err_t ret = read_effect(effect_id, &buffer, &size);
+    if (ret != ESP_OK) {
+      free(buffer);
+      return ret;
+    }
     *result = buffer;
   } else {
     free(buffer);
@@ -47,6 +254,7 @@ esp_err_t dmxbox_effect_get(uint16_t effect_id, dmxbox_effect_t **result) {
 }
 
 esp_err_t dmxbox_effect_delete(uint16_t effect_id) {
+  ESP_RETURN_ON_ERROR(dmxbox_show_changed(), TAG, "failed to invalidate show");
   ESP_RETURN_ON_ERROR(
       dmxbox_storage_delete_blob(EFFECTS_NS, 0, effect_id),
       TAG,
@@ -56,30 +264,88 @@ esp_err_t dmxbox_effect_delete(uint16_t effect_id) {
   return ESP_OK;
 }
 
+esp_err_t dmxbox_effect_delete_all() {
+  ESP_RETURN_ON_ERROR(dmxbox_show_changed(), TAG, "failed to invalidate show");
+  ESP_RETURN_ON_ERROR(
+      dmxbox_storage_delete_all_blobs(EFFECTS_NS),
+      TAG,
+      "failed to delete all effects"
+  );
+  return ESP_OK;
+}
+
 esp_err_t dmxbox_effect_list(
     uint16_t skip,
     uint16_t *count,
     dmxbox_storage_entry_t *page
 ) {
-  return dmxbox_storage_list_blobs(EFFECTS_NS, 0, skip, count, page);
+  ESP_RETURN_ON_ERROR(
+      dmxbox_storage_list_blobs(EFFECTS_NS, 0, skip, count, page),
+      TAG,
+      "failed to list effects"
+  );
+
+  for (uint16_t i = 0; i < *count; i++) {
+    if (read_effect(page[i].id, &page[i].data, &page[i].size) == ESP_OK) {
+      continue;
+    }
+
+    ESP_LOGE(TAG, "effect %u corrupted, listing it without steps", page[i].id);
+    free(page[i].data);
+    page[i].data = dmxbox_effect_alloc(0);
+    page[i].size = effect_size(0);
+    if (!page[i].data) {
+      for (uint16_t j = 0; j < *count; j++) {
+        free(page[j].data);
+      }
+      *count = 0;
+      return ESP_ERR_NO_MEM;
+    }
+  }
+  return ESP_OK;
+}
+
+esp_err_t dmxbox_effect_list_ids(
+    uint16_t skip,
+    uint16_t *count,
+    dmxbox_storage_entry_t *page
+) {
+  return dmxbox_storage_list_blob_ids(EFFECTS_NS, 0, skip, count, page);
 }
 
 esp_err_t dmxbox_effect_create(const dmxbox_effect_t *effect, uint16_t *id) {
-  return dmxbox_storage_create_blob(
-      EFFECTS_NS,
-      0,
-      effect,
-      effect_size(effect->step_count),
-      id
+  ESP_RETURN_ON_ERROR(dmxbox_show_changed(), TAG, "failed to invalidate show");
+
+  void *encoded;
+  size_t size;
+  ESP_RETURN_ON_ERROR(
+      encode_effect(effect, &encoded, &size),
+      TAG,
+      "failed to encode new effect"
   );
+  esp_err_t ret =
+      dmxbox_storage_create_blob(EFFECTS_NS, 0, encoded, size, id);
+  free(encoded);
+  return ret;
 }
 
 esp_err_t dmxbox_effect_set(uint16_t effect_id, const dmxbox_effect_t *effect) {
-  return dmxbox_storage_set_blob(
-      EFFECTS_NS,
-      0,
-      effect_id,
-      effect_size(effect->step_count),
-      effect
+  ESP_RETURN_ON_ERROR(dmxbox_show_changed(), TAG, "failed to invalidate show");
+
+  void *encoded;
+  size_t size;
+  ESP_RETURN_ON_ERROR(
+      encode_effect(effect, &encoded, &size),
+      TAG,
+      "failed to encode effect %u",
+      effect_id
   );
+  esp_err_t ret =
+      dmxbox_storage_set_blob(EFFECTS_NS, 0, effect_id, size, encoded);
+  free(encoded);
+  return ret;
+}
+
+esp_err_t dmxbox_effect_reserve_ids(uint16_t last_id) {
+  return dmxbox_storage_reserve_ids(EFFECTS_NS, 0, last_id);
 }
@@ -0,0 +1,43 @@
+#pragma once
+#include "effect_step_storage.h"
+#include "entry.h"
+#include "show_time.h"
+#include <esp_err.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A look in the cue list. Cues play in id order; channels that aren't listed
+// are at zero.
+typedef struct dmxbox_cue {
+  char name[33];
+  uint32_t fade_in;  // ms, for channels going up
+  uint32_t fade_out; // ms, for channels going down
+  uint32_t delay;    // ms between GO and the start of the fade
+  uint32_t follow;   // ms after the fade until the next cue starts, 0 = manual
+  dmxbox_show_time_t time; // GO at this point of the timecode
+  size_t channel_count;
+  dmxbox_channel_level_t channels[1];
+} __attribute__((packed)) dmxbox_cue_t;
+
+dmxbox_cue_t *dmxbox_cue_alloc(size_t channel_count);
+
+// result can be NULL
+// caller must free() *result if they provided one and this returns ESP_OK
+esp_err_t dmxbox_cue_get(uint16_t cue_id, dmxbox_cue_t **result);
+esp_err_t dmxbox_cue_set(uint16_t cue_id, const dmxbox_cue_t *cue);
+esp_err_t dmxbox_cue_create(const dmxbox_cue_t *cue, uint16_t *id);
+// dmxbox_cue_create won't hand out ids up to last_id
+esp_err_t dmxbox_cue_reserve_ids(uint16_t last_id);
+esp_err_t dmxbox_cue_delete(uint16_t cue_id);
+esp_err_t dmxbox_cue_delete_all();
+esp_err_t dmxbox_cue_list(
+    uint16_t skip,
+    uint16_t *count,
+    dmxbox_storage_entry_t *page
+);
+// like dmxbox_cue_list, but without reading the cues (data is NULL)
+esp_err_t dmxbox_cue_list_ids(
+    uint16_t skip,
+    uint16_t *count,
+    dmxbox_storage_entry_t *page
+);
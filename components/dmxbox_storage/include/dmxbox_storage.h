@@ -5,16 +5,95 @@
 #include <stdint.h>
 
 #include "channel_types.h"
+#include "cue_storage.h"
 #include "dmxbox_const.h"
 #include "effect_step_storage.h"
 #include "effect_storage.h"
 #include "entry.h"
+#include "show_image_storage.h"
 #include "universe_storage.h"
 
 void dmxbox_storage_init();
 void dmxbox_storage_set_defaults();
 void dmxbox_storage_factory_reset();
 
+// Groups the edits the calling task makes until dmxbox_storage_commit: other
+// tasks wait in dmxbox_storage_begin while a transaction is open, and the
+// show is only marked changed once. Nesting is fine, only the outermost
+// commit counts.
+void dmxbox_storage_begin();
+esp_err_t dmxbox_storage_commit();
+
+// Every write to storage is queued for a background task and reads see the
+// queued value right away, so nothing that edits the show or the settings
+// waits on flash. Waits until everything queued so far is on flash, and
+// returns the first write error since the last flush.
+esp_err_t dmxbox_storage_flush(uint32_t timeout_ms);
+
+// For callers that need to know their writes are durable: take a mark before
+// writing, then wait on it. dmxbox_storage_wait returns once everything
+// queued before the wait is on flash (or was replaced by a newer write to the
+// same key), with the first error among the writes queued after the mark.
+typedef uint32_t dmxbox_storage_mark_t;
+dmxbox_storage_mark_t dmxbox_storage_mark();
+esp_err_t
+dmxbox_storage_wait(dmxbox_storage_mark_t mark, uint32_t timeout_ms);
+
+typedef struct dmxbox_storage_cache_stats {
+  uint32_t hits;
+  uint32_t misses;
+  uint32_t evictions;
+  uint32_t entries;
+  uint32_t bytes;
+  uint32_t capacity_bytes;
+} dmxbox_storage_cache_stats_t;
+
+// blob reads are served from a bounded RAM cache when possible
+void dmxbox_storage_get_cache_stats(dmxbox_storage_cache_stats_t *stats);
+
+typedef enum dmxbox_storage_op {
+  dmxbox_storage_op_open,
+  dmxbox_storage_op_get,
+  dmxbox_storage_op_set,
+  dmxbox_storage_op_commit,
+  dmxbox_storage_op_erase,
+  dmxbox_storage_op_iterate,
+  dmxbox_storage_op_count,
+} dmxbox_storage_op_t;
+
+// bucket 0 is under 64 us, every next one twice as wide, the last one is open
+#define DMXBOX_STORAGE_LATENCY_BUCKETS 10
+
+typedef struct dmxbox_storage_op_stats {
+  uint32_t count;
+  uint32_t errors;
+  uint64_t total_us;
+  uint32_t max_us;
+  uint32_t latency[DMXBOX_STORAGE_LATENCY_BUCKETS];
+} dmxbox_storage_op_stats_t;
+
+typedef struct dmxbox_storage_stats {
+  // since boot
+  dmxbox_storage_op_stats_t ops[dmxbox_storage_op_count];
+  uint64_t bytes_read;
+  uint64_t bytes_written;
+  uint64_t entries_written; // estimated from the sizes written
+  uint32_t uptime_s;
+
+  // from nvs_get_stats
+  uint32_t used_entries;
+  uint32_t free_entries;
+  uint32_t total_entries;
+  uint32_t namespace_count;
+
+  // extrapolated from the writes since boot
+  uint32_t estimated_page_erases;
+  double erases_per_page_per_year;
+  double projected_lifetime_years; // negative until something was written
+} dmxbox_storage_stats_t;
+
+void dmxbox_storage_get_stats(dmxbox_storage_stats_t *stats);
+
 uint8_t dmxbox_get_first_run_completed();
 uint8_t dmxbox_get_sta_mode_enabled();
 const char *dmxbox_get_hostname();
@@ -22,6 +101,9 @@ const char *dmxbox_get_default_hostname();
 
 uint16_t dmxbox_get_native_universe();
 uint16_t dmxbox_get_effect_control_universe();
+uint16_t dmxbox_get_cue_go_channel();
+uint16_t dmxbox_get_cue_back_channel();
+uint16_t dmxbox_get_tempo_tap_channel();
 bool dmxbox_get_artnet_snapshot(
     uint16_t universe,
     uint8_t data[DMX_CHANNEL_COUNT]
@@ -33,6 +115,9 @@ bool dmxbox_set_hostname(const char *value);
 
 void dmxbox_set_native_universe(uint16_t value);
 void dmxbox_set_effect_control_universe(uint16_t value);
+void dmxbox_set_cue_go_channel(uint16_t value);
+void dmxbox_set_cue_back_channel(uint16_t value);
+void dmxbox_set_tempo_tap_channel(uint16_t value);
 void dmxbox_set_artnet_snapshot(
     uint16_t universe,
     const uint8_t data[DMX_CHANNEL_COUNT]
@@ -37,6 +37,13 @@ esp_err_t dmxbox_effect_step_list(
     uint16_t *count,
     dmxbox_storage_entry_t *page
 );
+// like dmxbox_effect_step_list, but without reading the steps (data is NULL)
+esp_err_t dmxbox_effect_step_list_ids(
+    uint16_t effect_id,
+    uint16_t skip,
+    uint16_t *count,
+    dmxbox_storage_entry_t *page
+);
 
 esp_err_t dmxbox_effect_step_set(
     uint16_t effect_id,
@@ -44,4 +51,10 @@ esp_err_t dmxbox_effect_step_set(
     const dmxbox_effect_step_t *value
 );
 
+// keeps the effect's step id counter past last_id
+esp_err_t
+dmxbox_effect_step_reserve_ids(uint16_t effect_id, uint16_t last_id);
+
 esp_err_t dmxbox_effect_step_delete(uint16_t effect_id, uint16_t step_id);
+// steps of all effects
+esp_err_t dmxbox_effect_step_delete_all();
@@ -1,14 +1,55 @@
 #pragma once
 #include "channel_types.h"
 #include "entry.h"
+#include "show_time.h"
 #include <esp_err.h>
 #include <stddef.h>
 
+typedef enum dmxbox_effect_type {
+  dmxbox_effect_type_chase = 0,
+  dmxbox_effect_type_waveform = 1,
+} dmxbox_effect_type_t;
+
+// How an effect's output combines with the effects below it
+typedef enum dmxbox_effect_blend {
+  dmxbox_effect_blend_htp = 0,      // highest takes precedence
+  dmxbox_effect_blend_ltp = 1,      // replaces the levels below
+  dmxbox_effect_blend_add = 2,      // adds to the levels below, clamped
+  dmxbox_effect_blend_multiply = 3, // scales the levels below (inhibit)
+  dmxbox_effect_blend_count,
+} dmxbox_effect_blend_t;
+
+typedef enum dmxbox_waveform_shape {
+  dmxbox_waveform_sine = 0,
+  dmxbox_waveform_triangle = 1,
+  dmxbox_waveform_square = 2,
+  dmxbox_waveform_saw = 3,
+  dmxbox_waveform_random = 4,
+  dmxbox_waveform_shape_count,
+} dmxbox_waveform_shape_t;
+
+// Parameters of a waveform effect. The waveform is applied to the channels of
+// the effect's steps (in order), with each channel's level acting as a scale.
+typedef struct dmxbox_effect_waveform {
+  uint32_t period; // ms per cycle at the default rate
+  uint16_t spread; // phase spread across the channel list, in degrees
+  uint8_t shape;   // dmxbox_waveform_shape_t
+  uint8_t size;    // peak-to-peak amplitude
+  uint8_t offset;  // center level
+} __attribute__((packed)) dmxbox_effect_waveform_t;
+
 typedef struct dmxbox_effect {
   char name[33];
   dmxbox_channel_t level_channel;
   dmxbox_channel_t rate_channel;
   uint16_t distributed_id;
+  uint8_t type; // dmxbox_effect_type_t
+  dmxbox_effect_waveform_t waveform;
+  uint8_t priority; // effects with a higher priority are blended on top
+  uint8_t blend;    // dmxbox_effect_blend_t
+  uint16_t beats;   // effect length in beats of the tempo, 0 = rate fader
+  dmxbox_show_time_t start; // plays from here while timecode runs
+  dmxbox_show_time_t end;   // until here, if set
   size_t step_count;
   uint16_t steps[1];
 } __attribute__((packed)) dmxbox_effect_t;
@@ -18,9 +59,19 @@ dmxbox_effect_t *dmxbox_effect_alloc(size_t step_count);
 esp_err_t dmxbox_effect_get(uint16_t effect_id, dmxbox_effect_t **result);
 esp_err_t dmxbox_effect_set(uint16_t effect_id, const dmxbox_effect_t *effect);
 esp_err_t dmxbox_effect_create(const dmxbox_effect_t *effect, uint16_t *id);
+// dmxbox_effect_create won't hand out ids up to last_id
+esp_err_t dmxbox_effect_reserve_ids(uint16_t last_id);
 esp_err_t dmxbox_effect_delete(uint16_t effect_id);
+// doesn't touch the steps, see dmxbox_effect_step_delete_all
+esp_err_t dmxbox_effect_delete_all();
 esp_err_t dmxbox_effect_list(
     uint16_t skip,
     uint16_t *count,
     dmxbox_storage_entry_t *page
 );
+// like dmxbox_effect_list, but without reading the effects (data is NULL)
+esp_err_t dmxbox_effect_list_ids(
+    uint16_t skip,
+    uint16_t *count,
+    dmxbox_storage_entry_t *page
+);
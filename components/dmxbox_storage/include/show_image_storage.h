@@ -0,0 +1,44 @@
+#pragma once
+#include <esp_err.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A compiled copy of all effects, stored as a single blob so that they can be
+// loaded with one read at boot. The body layout is owned by the effects engine
+// and identified by layout_version.
+//
+// Effects and steps stay the source of truth. Every change to them bumps the
+// show generation, which makes any image built from an older generation stale.
+typedef struct dmxbox_show_image {
+  uint32_t magic;
+  uint32_t layout_version;
+  uint32_t generation;
+  uint32_t crc;
+  uint32_t body_size;
+  uint8_t body[1] __attribute__((aligned(8)));
+} dmxbox_show_image_t;
+
+dmxbox_show_image_t *dmxbox_show_image_alloc(size_t body_size);
+
+uint32_t dmxbox_show_generation();
+
+// A stored image. With a show partition it's read in place from flash,
+// otherwise it's a heap copy of the NVS blob.
+typedef struct dmxbox_show_image_ref {
+  const dmxbox_show_image_t *image;
+  int pin; // show partition half kept from being erased, -1 for a heap copy
+} dmxbox_show_image_ref_t;
+
+// Returns ESP_ERR_NOT_FOUND if there's no image, ESP_ERR_INVALID_STATE if it's
+// stale or has a different layout version and ESP_ERR_INVALID_CRC if it's
+// corrupted.
+// caller must dmxbox_show_image_close() *ref when ESP_OK
+esp_err_t dmxbox_show_image_open(
+    uint32_t layout_version,
+    dmxbox_show_image_ref_t *ref
+);
+void dmxbox_show_image_close(dmxbox_show_image_ref_t *ref);
+
+// image->generation must be the generation read before the effects were
+// compiled, so that concurrent changes leave the stored image stale
+esp_err_t dmxbox_show_image_set(dmxbox_show_image_t *image);
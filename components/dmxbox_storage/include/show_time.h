@@ -0,0 +1,8 @@
+#pragma once
+#include <stdint.h>
+
+// A point on the timecode timeline
+typedef struct dmxbox_show_time {
+  uint8_t set; // 0 = not on the timeline
+  uint32_t ms; // since 00:00:00:00
+} __attribute__((packed)) dmxbox_show_time_t;
@@ -1,4 +1,7 @@
+#include "blob_cache.h"
+#include "blob_index.h"
 #include "private.h"
+#include "storage_metrics.h"
 #include <esp_check.h>
 #include <esp_err.h>
 #include <nvs.h>
@@ -26,33 +29,30 @@ make_blob_key(char *key, size_t key_size, uint16_t parent_id, uint16_t id) {
   return snprintf(key, key_size, "%x", id) < key_size;
 }
 
-static bool parse_blob_key(const char *key, uint16_t *parent_id, uint16_t *id) {
-  ESP_LOGI(TAG, "parsing blob key '%s'", key);
-  char *last = NULL;
-  long value = strtol(key, &last, 16);
-  if (value < 0) {
-    return false;
-  }
-  if (*last == '\0') {
-    *parent_id = 0;
-    *id = value;
-    return true;
-  }
-  if (*last == ':') {
-    *parent_id = value;
-    value = strtol(last + 1, &last, 16);
-    if (value < 0 || *last != '\0') {
-      return false;
-    }
-    *id = value;
-    return true;
-  }
-  return false;
+esp_err_t dmxbox_storage_open_ns(
+    const char *ns,
+    nvs_open_mode_t open_mode,
+    nvs_handle_t *storage
+) {
+  int64_t start = storage_metrics_start();
+  esp_err_t ret = nvs_open(ns, open_mode, storage);
+  storage_metrics_record(dmxbox_storage_op_open, start, ret, 0);
+  return ret;
+}
+
+esp_err_t dmxbox_storage_commit_ns(nvs_handle_t storage) {
+  int64_t start = storage_metrics_start();
+  esp_err_t ret = nvs_commit(storage);
+  storage_metrics_record(dmxbox_storage_op_commit, start, ret, 0);
+  return ret;
 }
 
+void dmxbox_storage_close_ns(nvs_handle_t storage) { nvs_close(storage); }
+
 nvs_handle_t dmxbox_storage_open(nvs_open_mode_t open_mode) {
   nvs_handle_t storage;
-  esp_err_t result = nvs_open(DMXBOX_NVS_NS, open_mode, &storage);
+  esp_err_t result =
+      dmxbox_storage_open_ns(DMXBOX_NVS_NS, open_mode, &storage);
   if (result == ESP_ERR_NVS_NOT_FOUND) {
     ESP_LOGW(
         TAG,
@@ -62,7 +62,7 @@ nvs_handle_t dmxbox_storage_open(nvs_open_mode_t open_mode) {
     ESP_ERROR_CHECK(nvs_open(DMXBOX_NVS_NS, NVS_READWRITE, &storage));
     nvs_close(storage);
 
-    result = nvs_open(DMXBOX_NVS_NS, open_mode, &storage);
+    result = dmxbox_storage_open_ns(DMXBOX_NVS_NS, open_mode, &storage);
   }
   ESP_ERROR_CHECK(result);
   return storage;
@@ -83,32 +83,25 @@ bool dmxbox_storage_check_error(const char *key, esp_err_t err) {
 
 void dmxbox_storage_set_u8(const char *key, uint8_t value) {
   ESP_LOGI(TAG, "Setting '%s' to %d", key, value);
-  nvs_handle_t storage = dmxbox_storage_open(NVS_READWRITE);
-  ESP_ERROR_CHECK(nvs_set_u8(storage, key, value));
-  ESP_ERROR_CHECK(nvs_commit(storage));
-  nvs_close(storage);
+  ESP_ERROR_CHECK(dmxbox_storage_queue_u8(DMXBOX_NVS_NS, key, value));
 }
 
 void dmxbox_storage_set_u16(const char *key, uint16_t value) {
   ESP_LOGI(TAG, "Setting '%s' to %d", key, value);
-  nvs_handle_t storage = dmxbox_storage_open(NVS_READWRITE);
-  ESP_ERROR_CHECK(nvs_set_u16(storage, key, value));
-  ESP_ERROR_CHECK(nvs_commit(storage));
-  nvs_close(storage);
+  ESP_ERROR_CHECK(dmxbox_storage_queue_u16(DMXBOX_NVS_NS, key, value));
 }
 
 void dmxbox_storage_set_str(const char *key, const char *value) {
   ESP_LOGI(TAG, "Setting '%s' to '%s'", key, value);
-  nvs_handle_t storage = dmxbox_storage_open(NVS_READWRITE);
-  ESP_ERROR_CHECK(nvs_set_str(storage, key, value));
-  ESP_ERROR_CHECK(nvs_commit(storage));
-  nvs_close(storage);
+  ESP_ERROR_CHECK(dmxbox_storage_queue_str(DMXBOX_NVS_NS, key, value));
 }
 
 uint8_t dmxbox_storage_get_u8(nvs_handle_t storage, const char *key) {
   ESP_LOGI(TAG, "Reading '%s' u8", key);
   uint8_t result;
+  int64_t start = storage_metrics_start();
   esp_err_t err = nvs_get_u8(storage, key, &result);
+  storage_metrics_record(dmxbox_storage_op_get, start, err, sizeof(result));
   if (dmxbox_storage_check_error(key, err)) {
     return result;
   }
@@ -118,7 +111,9 @@ uint8_t dmxbox_storage_get_u8(nvs_handle_t storage, const char *key) {
 uint16_t dmxbox_storage_get_u16(nvs_handle_t storage, const char *key) {
   ESP_LOGI(TAG, "Reading '%s' u16", key);
   uint16_t result;
+  int64_t start = storage_metrics_start();
   esp_err_t err = nvs_get_u16(storage, key, &result);
+  storage_metrics_record(dmxbox_storage_op_get, start, err, sizeof(result));
   if (dmxbox_storage_check_error(key, err)) {
     return result;
   }
@@ -132,20 +127,18 @@ bool dmxbox_storage_get_str(
     size_t buffer_size
 ) {
   ESP_LOGI(TAG, "Reading '%s' str", key);
+  int64_t start = storage_metrics_start();
   esp_err_t err = nvs_get_str(storage, key, buffer, &buffer_size);
+  storage_metrics_record(dmxbox_storage_op_get, start, err, buffer_size);
   return dmxbox_storage_check_error(key, err);
 }
 
-esp_err_t dmxbox_storage_get_blob_from_storage(
+static esp_err_t read_blob(
     nvs_handle_t storage,
     const char *key,
     size_t *size,
     void **result
 ) {
-  if (!size) {
-    return ESP_ERR_INVALID_ARG;
-  }
-
   ESP_RETURN_ON_ERROR(
       nvs_get_blob(storage, key, NULL, size),
       TAG,
@@ -183,6 +176,27 @@ free_buffer:
   return ret;
 }
 
+esp_err_t dmxbox_storage_get_blob_from_storage(
+    nvs_handle_t storage,
+    const char *key,
+    size_t *size,
+    void **result
+) {
+  if (!size) {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  int64_t start = storage_metrics_start();
+  esp_err_t ret = read_blob(storage, key, size, result);
+  storage_metrics_record(
+      dmxbox_storage_op_get,
+      start,
+      ret,
+      ret == ESP_OK && result ? *size : 0
+  );
+  return ret;
+}
+
 esp_err_t dmxbox_storage_get_blob(
     const char *ns,
     uint16_t parent_id,
@@ -190,8 +204,27 @@ esp_err_t dmxbox_storage_get_blob(
     size_t *size,
     void **buffer
 ) {
+  if (!size) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  char key[NVS_KEY_NAME_MAX_SIZE];
+  if (!make_blob_key(key, sizeof(key), parent_id, id)) {
+    return ESP_ERR_NO_MEM;
+  }
+
+  // before looking at the queue, so that a write queued meanwhile keeps what
+  // flash had from getting cached
+  uint32_t epoch = blob_cache_epoch();
+  esp_err_t ret = dmxbox_storage_get_queued_blob(ns, key, size, buffer);
+  if (ret != ESP_ERR_INVALID_STATE) {
+    return ret;
+  }
+  if (blob_cache_get(ns, parent_id, id, size, buffer)) {
+    return ESP_OK;
+  }
+
   nvs_handle_t storage;
-  esp_err_t ret = nvs_open(ns, NVS_READONLY, &storage);
+  ret = dmxbox_storage_open_ns(ns, NVS_READONLY, &storage);
   switch (ret) {
   case ESP_OK:
     break;
@@ -200,13 +233,11 @@ esp_err_t dmxbox_storage_get_blob(
   default:
     return ret;
   }
-  char key[NVS_KEY_NAME_MAX_SIZE];
-  if (make_blob_key(key, sizeof(key), parent_id, id)) {
-    ret = dmxbox_storage_get_blob_from_storage(storage, key, size, buffer);
-  } else {
-    ret = ESP_ERR_NO_MEM;
+  ret = dmxbox_storage_get_blob_from_storage(storage, key, size, buffer);
+  dmxbox_storage_close_ns(storage);
+  if (ret == ESP_OK && buffer) {
+    blob_cache_fill(ns, parent_id, id, *size, *buffer, epoch);
   }
-  nvs_close(storage);
   if (ret == ESP_ERR_NVS_NOT_FOUND) {
     return ESP_ERR_NOT_FOUND;
   }
@@ -214,135 +245,130 @@ esp_err_t dmxbox_storage_get_blob(
 }
 
 esp_err_t
-dmxbox_storage_delete_blob_from_storage(nvs_handle_t storage, const char *key) {
+dmxbox_storage_delete_blob(const char *ns, uint16_t parent_id, uint16_t id) {
+  size_t size;
+  ESP_RETURN_ON_ERROR(
+      dmxbox_storage_get_blob(ns, parent_id, id, &size, NULL),
+      TAG,
+      "no blob %u:%u in %s",
+      parent_id,
+      id,
+      ns
+  );
+
+  char key[NVS_KEY_NAME_MAX_SIZE];
+  make_blob_key(key, sizeof(key), parent_id, id);
   ESP_RETURN_ON_ERROR(
-      nvs_erase_key(storage, key),
+      dmxbox_storage_queue_erase(ns, key),
       TAG,
       "failed to delete blob '%s'",
       key
   );
-  ESP_RETURN_ON_ERROR(nvs_commit(storage), TAG, "failed to commit");
-
+  blob_index_remove(ns, parent_id, id);
+  blob_cache_invalidate(ns, parent_id, id);
   return ESP_OK;
 }
 
-esp_err_t
-dmxbox_storage_delete_blob(const char *ns, uint16_t parent_id, uint16_t id) {
-  nvs_handle_t storage;
-  esp_err_t ret = nvs_open(ns, NVS_READWRITE, &storage);
-  switch (ret) {
-  case ESP_OK:
-    break;
-  case ESP_ERR_NVS_NOT_FOUND:
-    return ESP_ERR_NOT_FOUND;
-  default:
-    return ret;
-  }
-  char key[NVS_KEY_NAME_MAX_SIZE];
-  if (make_blob_key(key, sizeof(key), parent_id, id)) {
-    ret = dmxbox_storage_delete_blob_from_storage(storage, key);
-  } else {
-    ret = ESP_ERR_NO_MEM;
-  }
-  nvs_close(storage);
-  if (ret == ESP_ERR_NVS_NOT_FOUND) {
-    return ESP_ERR_NOT_FOUND;
-  }
-  return ret;
+esp_err_t dmxbox_storage_delete_all_blobs(const char *ns) {
+  ESP_RETURN_ON_ERROR(
+      dmxbox_storage_queue_erase_all(ns),
+      TAG,
+      "failed to erase %s",
+      ns
+  );
+  blob_index_clear_ns(ns);
+  blob_cache_clear();
+  return ESP_OK;
 }
 
-esp_err_t dmxbox_storage_list_blobs(
+esp_err_t dmxbox_storage_list_blob_ids(
     const char *ns,
     uint16_t parent_id,
     uint16_t skip,
     uint16_t *count,
     dmxbox_storage_entry_t *page
 ) {
-  if (!count || !page) {
+  if (!ns || !count || !page) {
     return ESP_ERR_INVALID_ARG;
   }
+  *count = blob_index_list(ns, parent_id, skip, *count, page);
+  return ESP_OK;
+}
 
-  nvs_handle_t storage;
-  esp_err_t ret = nvs_open(ns, NVS_READONLY, &storage);
-  switch (ret) {
-  case ESP_OK:
-    break;
-  case ESP_ERR_NVS_NOT_FOUND:
-    *count = 0;
-    return ESP_OK;
-  default:
-    ESP_LOGE(TAG, "failed to open storage");
-    return ret;
-  }
-
-  nvs_iterator_t iterator = NULL;
-  ret = nvs_entry_find_in_handle(storage, NVS_TYPE_BLOB, &iterator);
-  switch (ret) {
-  case ESP_OK:
-    break;
-  case ESP_ERR_NVS_NOT_FOUND:
-    *count = 0;
+esp_err_t dmxbox_storage_list_blobs(
+    const char *ns,
+    uint16_t parent_id,
+    uint16_t skip,
+    uint16_t *count,
+    dmxbox_storage_entry_t *page
+) {
+  ESP_RETURN_ON_ERROR(
+      dmxbox_storage_list_blob_ids(ns, parent_id, skip, count, page),
+      TAG,
+      "failed to list %s",
+      ns
+  );
+  if (!*count) {
     return ESP_OK;
-  default:
-    ESP_LOGE(TAG, "failed to find first");
-    goto exit;
   }
 
-  size_t read = 0;
-  while (ret == ESP_OK && read < *count) {
-    if (skip == 0) {
-      nvs_entry_info_t entry_info;
-      nvs_entry_info(iterator, &entry_info);
-
-      uint16_t entry_parent_id;
-      if (!parse_blob_key(entry_info.key, &entry_parent_id, &page[read].id)) {
-        ESP_LOGE(TAG, "key '%s' failed to parse", entry_info.key);
-        goto next;
-      }
-
-      ESP_LOGI(
-          TAG,
-          "key '%s' id=%u parent_id=%u ",
-          entry_info.key,
-          page[read].id,
-          entry_parent_id
-      );
-      if (entry_parent_id != parent_id) {
-        ESP_LOGI(TAG, "parent_id doesn't match %u", parent_id);
-        goto next;
+  uint32_t epoch = blob_cache_epoch();
+  nvs_handle_t storage;
+  bool opened = false;
+
+  uint16_t read = 0;
+  for (uint16_t i = 0; i < *count; i++) {
+    dmxbox_storage_entry_t *entry = &page[read];
+    entry->id = page[i].id;
+    entry->data = NULL;
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    if (!make_blob_key(key, sizeof(key), parent_id, entry->id)) {
+      continue;
+    }
+    esp_err_t ret =
+        dmxbox_storage_get_queued_blob(ns, key, &entry->size, &entry->data);
+    if (ret != ESP_ERR_INVALID_STATE) {
+      if (ret == ESP_OK) {
+        read++;
       }
+      continue;
+    }
+    if (blob_cache_get(ns, parent_id, entry->id, &entry->size, &entry->data)) {
+      read++;
+      continue;
+    }
 
-      void *buffer = NULL;
-      ret = dmxbox_storage_get_blob_from_storage(
-          storage,
-          entry_info.key,
-          &page[read].size,
-          &buffer
-      );
+    if (!opened) {
+      ret = dmxbox_storage_open_ns(ns, NVS_READONLY, &storage);
       if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "failed to get blob '%s'", entry_info.key);
-        goto next;
+        ESP_LOGE(TAG, "failed to open %s", ns);
+        while (read--) {
+          free(page[read].data);
+        }
+        *count = 0;
+        return ret;
       }
-      page[read].data = buffer;
-      read++;
-    } else {
-      skip--;
+      opened = true;
     }
 
-  next:
-    ret = nvs_entry_next(&iterator);
-  }
-  if (ret == ESP_ERR_NVS_NOT_FOUND) {
-    ret = ESP_OK;
+    if (dmxbox_storage_get_blob_from_storage(
+            storage,
+            key,
+            &entry->size,
+            &entry->data
+        ) != ESP_OK) {
+      ESP_LOGE(TAG, "failed to get blob '%s'", key);
+      continue;
+    }
+    blob_cache_fill(ns, parent_id, entry->id, entry->size, entry->data, epoch);
+    read++;
   }
   *count = read;
 
-exit:
-  if (iterator) {
-    nvs_release_iterator(iterator);
+  if (opened) {
+    dmxbox_storage_close_ns(storage);
   }
-  nvs_close(storage);
-  return ret;
+  return ESP_OK;
 }
 
 esp_err_t dmxbox_storage_create_blob(
@@ -356,67 +382,19 @@ esp_err_t dmxbox_storage_create_blob(
     return ESP_ERR_INVALID_ARG;
   }
 
-  esp_err_t ret = ESP_OK;
-  nvs_handle_t storage;
-  ESP_RETURN_ON_ERROR(
-      nvs_open(ns, NVS_READWRITE, &storage),
-      TAG,
-      "failed to open %s",
-      ns
-  );
-
   char key[NVS_KEY_NAME_MAX_SIZE];
   if (!make_next_id_key(key, sizeof(key), parent_id)) {
     ESP_LOGE(TAG, "failed to create next_id key for parent_id '%u'", parent_id);
-    ret = ESP_ERR_NO_MEM;
-    goto exit;
-  }
-
-  ret = nvs_get_u16(storage, key, id);
-  switch (ret) {
-  case ESP_OK:
-    ESP_LOGI(TAG, "%s = %u", key, *id);
-    break;
-  case ESP_ERR_NVS_NOT_FOUND:
-    ESP_LOGI(TAG, "no next_id, starting from 1");
-    ret = ESP_OK;
-    *id = 1;
-    break;
-  default:
-    goto exit;
-  }
-
-  ESP_GOTO_ON_ERROR(
-      nvs_set_u16(storage, key, *id + 1),
-      exit,
-      TAG,
-      "failed to save next_id"
-  );
-
-  if (!make_blob_key(key, sizeof(key), parent_id, *id)) {
-    ESP_LOGE(
-        TAG,
-        "failed to create key for parent_id %u, id %u",
-        parent_id,
-        *id
-    );
-    ret = ESP_ERR_NO_MEM;
-    goto exit;
+    return ESP_ERR_NO_MEM;
   }
-
-  ESP_GOTO_ON_ERROR(
-      nvs_set_blob(storage, key, data, size),
-      exit,
+  ESP_RETURN_ON_ERROR(
+      dmxbox_storage_queue_take_ids(ns, key, 1, 1, id),
       TAG,
-      "failed to save %u-byte blob",
-      size
+      "failed to take an id in %s",
+      ns
   );
-
-  ESP_GOTO_ON_ERROR(nvs_commit(storage), exit, TAG, "failed to commit");
-
-exit:
-  nvs_close(storage);
-  return ret;
+  ESP_LOGI(TAG, "%s %s = %u", ns, key, *id + 1);
+  return dmxbox_storage_set_blob(ns, parent_id, *id, size, data);
 }
 
 esp_err_t dmxbox_storage_set_blob(
@@ -426,38 +404,50 @@ esp_err_t dmxbox_storage_set_blob(
     size_t size,
     const void *value
 ) {
-  esp_err_t ret = ESP_OK;
-
-  nvs_handle_t storage;
-  ESP_RETURN_ON_ERROR(
-      nvs_open(ns, NVS_READWRITE, &storage),
-      TAG,
-      "failed to open NVS"
-  );
-
   char key[NVS_KEY_NAME_MAX_SIZE];
   if (!make_blob_key(key, sizeof(key), parent_id, id)) {
     ESP_LOGE(TAG, "failed to make key for parent_id %u, id %u", parent_id, id);
-    ret = ESP_ERR_NO_MEM;
-    goto close_storage;
+    return ESP_ERR_NO_MEM;
   }
 
-  ESP_GOTO_ON_ERROR(
-      nvs_set_blob(storage, key, value, size),
-      close_storage,
+  ESP_RETURN_ON_ERROR(
+      dmxbox_storage_queue_blob(ns, key, size, value),
       TAG,
       "failed to write blob '%s'",
       key
   );
+  blob_index_put(ns, parent_id, id, size);
+  blob_cache_update(ns, parent_id, id, size, value);
+  return ESP_OK;
+}
 
-  ESP_GOTO_ON_ERROR(
-      nvs_commit(storage),
-      close_storage,
+esp_err_t dmxbox_storage_reserve_ids(
+    const char *ns,
+    uint16_t parent_id,
+    uint16_t last_id
+) {
+  if (!ns) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  if (!last_id) {
+    return ESP_OK;
+  }
+  if (last_id == UINT16_MAX) {
+    ESP_LOGE(TAG, "no ids left after %u in %s", last_id, ns);
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  char key[NVS_KEY_NAME_MAX_SIZE];
+  if (!make_next_id_key(key, sizeof(key), parent_id)) {
+    ESP_LOGE(TAG, "failed to create next_id key for parent_id '%u'", parent_id);
+    return ESP_ERR_NO_MEM;
+  }
+  uint16_t next_id;
+  ESP_RETURN_ON_ERROR(
+      dmxbox_storage_queue_take_ids(ns, key, last_id + 1, 0, &next_id),
       TAG,
-      "failed to commit NVS"
+      "failed to save next_id"
   );
-
-close_storage:
-  nvs_close(storage);
-  return ret;
+  ESP_LOGI(TAG, "%s %s = %u", ns, key, next_id);
+  return ESP_OK;
 }
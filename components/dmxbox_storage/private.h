@@ -3,6 +3,80 @@
 #include <nvs_flash.h>
 
 nvs_handle_t dmxbox_storage_open(nvs_open_mode_t open_mode);
+
+// Namespaces are opened, committed and closed through these, so that the
+// time spent on it shows up in the storage metrics
+void dmxbox_storage_txn_init();
+esp_err_t dmxbox_storage_open_ns(
+    const char *ns,
+    nvs_open_mode_t open_mode,
+    nvs_handle_t *storage
+);
+esp_err_t dmxbox_storage_commit_ns(nvs_handle_t storage);
+void dmxbox_storage_close_ns(nvs_handle_t storage);
+
+// Everything that writes NVS or the show partition queues the write for the
+// storage writer task, so the caller doesn't wait on flash. Values are
+// copied. Writes reach flash in the order they were queued, except that a
+// write that hasn't reached flash yet is replaced by a newer one to the same
+// key, and dropped by an erase of its whole namespace. Queueing only blocks
+// while the queue is full.
+void dmxbox_storage_writer_init();
+esp_err_t
+dmxbox_storage_queue_u8(const char *ns, const char *key, uint8_t value);
+esp_err_t
+dmxbox_storage_queue_u16(const char *ns, const char *key, uint16_t value);
+esp_err_t
+dmxbox_storage_queue_str(const char *ns, const char *key, const char *value);
+esp_err_t dmxbox_storage_queue_blob(
+    const char *ns,
+    const char *key,
+    size_t size,
+    const void *value
+);
+esp_err_t dmxbox_storage_queue_erase(const char *ns, const char *key);
+esp_err_t dmxbox_storage_queue_erase_all(const char *ns);
+
+// A counter covers the writes queued after it, like the show generation
+// does: a newer value takes the place of the queued one instead of moving
+// behind them, so the counter always reaches flash first.
+esp_err_t dmxbox_storage_queue_counter_u32(
+    const char *ns,
+    const char *key,
+    uint32_t value
+);
+
+// Hands out ids from the u16 counter at key, which holds the next free id (1
+// when there's none yet): *id is the counter or first_id, whichever is
+// higher, and the counter is queued count ids past it. Reading and queueing
+// the counter is atomic.
+esp_err_t dmxbox_storage_queue_take_ids(
+    const char *ns,
+    const char *key,
+    uint16_t first_id,
+    uint16_t count,
+    uint16_t *id
+);
+
+// appends a record to the show partition
+esp_err_t dmxbox_storage_queue_show_record(size_t size, const void *value);
+
+// What a blob that's still queued reads as: ESP_OK with a malloc()ed copy in
+// *buffer (if buffer isn't NULL), ESP_ERR_NOT_FOUND if it's queued to be
+// erased, or ESP_ERR_INVALID_STATE when nothing is queued for it and flash
+// has the latest value.
+esp_err_t dmxbox_storage_get_queued_blob(
+    const char *ns,
+    const char *key,
+    size_t *size,
+    void **buffer
+);
+
+void dmxbox_show_image_init();
+
+// whether the show was already marked changed in the current transaction
+bool dmxbox_storage_txn_show_changed();
+void dmxbox_storage_txn_set_show_changed();
 bool dmxbox_storage_check_error(const char *key, esp_err_t err);
 
 void dmxbox_storage_set_u8(const char *key, uint8_t value);
@@ -18,6 +92,8 @@ bool dmxbox_storage_get_str(
     size_t buffer_size
 );
 
+// Blob writes and deletes are queued, with the index and the cache updated
+// right away. Reads see what's queued.
 esp_err_t dmxbox_storage_set_blob(
     const char *ns,
     uint16_t parent_id,
@@ -46,14 +122,23 @@ esp_err_t dmxbox_storage_get_blob(
 esp_err_t
 dmxbox_storage_get_blob_size(const char *ns, const char *key, size_t *size);
 
-esp_err_t
-dmxbox_storage_delete_blob_from_storage(nvs_handle_t storage, const char *key);
-
 esp_err_t
 dmxbox_storage_delete_blob(const char *ns, uint16_t parent_id, uint16_t id);
 
+// deletes every key in the namespace
+esp_err_t dmxbox_storage_delete_all_blobs(const char *ns);
+
 typedef uint16_t (*dmxbox_storage_parse_id_t)(const char *key, void *ctx);
 
+// fills in ids and sizes only, data is left NULL
+esp_err_t dmxbox_storage_list_blob_ids(
+    const char *ns,
+    uint16_t parent_id,
+    uint16_t skip,
+    uint16_t *count,
+    dmxbox_storage_entry_t *page
+);
+
 esp_err_t dmxbox_storage_list_blobs(
     const char *ns,
     uint16_t parent_id,
@@ -69,3 +154,15 @@ esp_err_t dmxbox_storage_create_blob(
     size_t size,
     uint16_t *id
 );
+
+// keeps dmxbox_storage_create_blob from handing out ids up to last_id, for
+// blobs that were written with explicit ids
+esp_err_t dmxbox_storage_reserve_ids(
+    const char *ns,
+    uint16_t parent_id,
+    uint16_t last_id
+);
+
+// Marks the compiled show image stale. Must succeed before effects or steps
+// are modified.
+esp_err_t dmxbox_show_changed();
@@ -0,0 +1,215 @@
+#include "show_image_storage.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "private.h"
+#include "show_partition.h"
+#include "storage_metrics.h"
+#include <esp_check.h>
+#include <esp_crc.h>
+#include <inttypes.h>
+#include <nvs.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+static const char TAG[] = "dmxbox_storage_show";
+static const char SHOW_NS[] = "dmxbox/show";
+static const char KEY_GENERATION[] = "generation";
+
+#define SHOW_IMAGE_ID 1
+#define SHOW_IMAGE_MAGIC 0x574f4853 // "SHOW"
+
+static uint32_t generation_ = 0;
+static bool generation_loaded_ = false;
+
+static size_t image_size(size_t body_size) {
+  return offsetof(dmxbox_show_image_t, body) + body_size;
+}
+
+static uint32_t image_crc(const dmxbox_show_image_t *image) {
+  return esp_crc32_le(0, image->body, image->body_size);
+}
+
+static esp_err_t load_generation() {
+  if (generation_loaded_) {
+    return ESP_OK;
+  }
+
+  nvs_handle_t storage;
+  esp_err_t ret = dmxbox_storage_open_ns(SHOW_NS, NVS_READONLY, &storage);
+  if (ret == ESP_OK) {
+    int64_t start = storage_metrics_start();
+    ret = nvs_get_u32(storage, KEY_GENERATION, &generation_);
+    storage_metrics_record(
+        dmxbox_storage_op_get,
+        start,
+        ret,
+        sizeof(generation_)
+    );
+    dmxbox_storage_close_ns(storage);
+  }
+  switch (ret) {
+  case ESP_OK:
+    break;
+  case ESP_ERR_NVS_NOT_FOUND:
+    generation_ = 0;
+    break;
+  default:
+    ESP_LOGE(TAG, "failed to read show generation: %s", esp_err_to_name(ret));
+    return ret;
+  }
+
+  generation_loaded_ = true;
+  return ESP_OK;
+}
+
+dmxbox_show_image_t *dmxbox_show_image_alloc(size_t body_size) {
+  dmxbox_show_image_t *image = calloc(1, image_size(body_size));
+  if (image) {
+    image->body_size = body_size;
+  }
+  return image;
+}
+
+uint32_t dmxbox_show_generation() {
+  if (load_generation() != ESP_OK) {
+    // an image built now will never match, so it can't hide a change
+    return UINT32_MAX;
+  }
+  return generation_;
+}
+
+esp_err_t dmxbox_show_changed() {
+  if (dmxbox_storage_txn_show_changed()) {
+    return ESP_OK; // once per transaction is enough
+  }
+  ESP_RETURN_ON_ERROR(load_generation(), TAG, "can't bump show generation");
+
+  uint32_t generation = generation_ + 1;
+  if (generation == UINT32_MAX) {
+    generation = 0;
+  }
+
+  // queued ahead of the change it covers, so that it reaches flash first
+  ESP_RETURN_ON_ERROR(
+      dmxbox_storage_queue_counter_u32(SHOW_NS, KEY_GENERATION, generation),
+      TAG,
+      "failed to save show generation"
+  );
+  generation_ = generation;
+  dmxbox_storage_txn_set_show_changed();
+  return ESP_OK;
+}
+
+static esp_err_t
+check_image(const dmxbox_show_image_t *image, size_t size, uint32_t layout) {
+  if (size < image_size(0) || image->magic != SHOW_IMAGE_MAGIC ||
+      size != image_size(image->body_size)) {
+    ESP_LOGW(TAG, "show image is corrupted (%u bytes)", size);
+    return ESP_ERR_INVALID_SIZE;
+  }
+
+  if (image->layout_version != layout) {
+    ESP_LOGI(
+        TAG,
+        "show image has layout %" PRIu32 ", expected %" PRIu32,
+        image->layout_version,
+        layout
+    );
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  uint32_t generation = dmxbox_show_generation();
+  if (image->generation != generation) {
+    ESP_LOGI(
+        TAG,
+        "show image is stale (generation %" PRIu32 ", current %" PRIu32 ")",
+        image->generation,
+        generation
+    );
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  if (image->crc != image_crc(image)) {
+    ESP_LOGW(TAG, "show image crc mismatch");
+    return ESP_ERR_INVALID_CRC;
+  }
+
+  return ESP_OK;
+}
+
+esp_err_t dmxbox_show_image_open(
+    uint32_t layout_version,
+    dmxbox_show_image_ref_t *ref
+) {
+  const void *data = NULL;
+  size_t size = 0;
+  int pin = -1;
+  esp_err_t ret;
+  if (show_partition_available()) {
+    ret = show_partition_get_latest(&data, &size, &pin);
+  } else {
+    void *buffer = NULL;
+    ret = dmxbox_storage_get_blob(SHOW_NS, 0, SHOW_IMAGE_ID, &size, &buffer);
+    data = buffer;
+  }
+  if (ret != ESP_OK) {
+    return ret;
+  }
+
+  *ref = (dmxbox_show_image_ref_t){
+      .image = data,
+      .pin = pin,
+  };
+  ret = check_image(ref->image, size, layout_version);
+  if (ret != ESP_OK) {
+    dmxbox_show_image_close(ref);
+  }
+  return ret;
+}
+
+void dmxbox_show_image_close(dmxbox_show_image_ref_t *ref) {
+  if (ref->pin >= 0) {
+    show_partition_unpin(ref->pin);
+  } else {
+    free((void *)ref->image);
+  }
+  ref->image = NULL;
+  ref->pin = -1;
+}
+
+esp_err_t dmxbox_show_image_set(dmxbox_show_image_t *image) {
+  image->magic = SHOW_IMAGE_MAGIC;
+  image->crc = image_crc(image);
+
+  size_t size = image_size(image->body_size);
+  ESP_RETURN_ON_ERROR(
+      show_partition_available()
+          ? dmxbox_storage_queue_show_record(size, image)
+          : dmxbox_storage_set_blob(SHOW_NS, 0, SHOW_IMAGE_ID, size, image),
+      TAG,
+      "failed to queue show image"
+  );
+
+  ESP_LOGI(
+      TAG,
+      "queued %" PRIu32 "-byte show image, generation %" PRIu32,
+      image->body_size,
+      image->generation
+  );
+  return ESP_OK;
+}
+
+void dmxbox_show_image_init() {
+  if (show_partition_init() != ESP_OK) {
+    return;
+  }
+
+  // images from before the show partition existed only take up NVS space
+  dmxbox_storage_entry_t legacy;
+  uint16_t count = 1;
+  if (dmxbox_storage_list_blob_ids(SHOW_NS, 0, 0, &count, &legacy) == ESP_OK &&
+      count) {
+    ESP_LOGI(TAG, "deleting the show image from NVS");
+    dmxbox_storage_delete_blob(SHOW_NS, 0, SHOW_IMAGE_ID);
+  }
+}
@@ -0,0 +1,254 @@
+#include "show_partition.h"
+#include <esp_crc.h>
+#include <esp_log.h>
+#include <esp_partition.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+static const char TAG[] = "dmxbox_storage_show_part";
+
+static const char PARTITION_LABEL[] = "show";
+
+#define RECORD_MAGIC 0x44524352 // "RCRD"
+#define ERASED_WORD 0xffffffff
+#define RECORD_ALIGN 16
+#define HALVES 2
+
+typedef struct record_header {
+  uint32_t magic;
+  uint32_t sequence;
+  uint32_t size; // of the payload that follows
+  uint32_t crc;  // of the payload
+} record_header_t;
+
+_Static_assert(
+    sizeof(record_header_t) % 8 == 0,
+    "payloads must stay 8-byte aligned"
+);
+
+typedef struct record {
+  bool found;
+  int half;
+  size_t offset;
+  size_t size;
+  uint32_t sequence;
+} record_t;
+
+static const esp_partition_t *partition;
+static const uint8_t *mapped; // the whole partition
+static esp_partition_mmap_handle_t mmap_handle;
+static size_t half_size;
+
+static SemaphoreHandle_t partition_mutex;
+
+// protected by partition_mutex
+static record_t latest;
+static int current_half;
+static size_t append_offset[HALVES]; // relative to the start of the half
+static unsigned pins[HALVES];
+
+static size_t record_size(size_t payload_size) {
+  size_t size = sizeof(record_header_t) + payload_size;
+  return (size + RECORD_ALIGN - 1) & ~(size_t)(RECORD_ALIGN - 1);
+}
+
+static size_t half_start(int half) { return half * half_size; }
+
+static void scan_half(int half) {
+  size_t offset = 0;
+  while (offset + sizeof(record_header_t) <= half_size) {
+    const record_header_t *header =
+        (const void *)(mapped + half_start(half) + offset);
+    if (header->magic == ERASED_WORD) {
+      break;
+    }
+    if (header->magic != RECORD_MAGIC ||
+        header->size > half_size - offset - sizeof(record_header_t)) {
+      // whatever follows isn't erased, so nothing can be appended after it
+      ESP_LOGW(TAG, "garbage at %u in half %d", offset, half);
+      offset = half_size;
+      break;
+    }
+
+    bool newer = !latest.found ||
+                 (int32_t)(header->sequence - latest.sequence) > 0;
+    const uint8_t *payload = (const uint8_t *)(header + 1);
+    if (newer && esp_crc32_le(0, payload, header->size) == header->crc) {
+      latest = (record_t){
+          .found = true,
+          .half = half,
+          .offset = offset,
+          .size = header->size,
+          .sequence = header->sequence,
+      };
+    }
+    offset += record_size(header->size);
+  }
+  append_offset[half] = offset;
+}
+
+esp_err_t show_partition_init() {
+  partition = esp_partition_find_first(
+      ESP_PARTITION_TYPE_DATA,
+      ESP_PARTITION_SUBTYPE_ANY,
+      PARTITION_LABEL
+  );
+  if (!partition) {
+    ESP_LOGW(TAG, "no %s partition, show image stays in NVS", PARTITION_LABEL);
+    return ESP_ERR_NOT_FOUND;
+  }
+
+  half_size = partition->size / HALVES;
+  half_size -= half_size % partition->erase_size;
+
+  const void *data;
+  esp_err_t ret = esp_partition_mmap(
+      partition,
+      0,
+      partition->size,
+      ESP_PARTITION_MMAP_DATA,
+      &data,
+      &mmap_handle
+  );
+  if (ret != ESP_OK) {
+    ESP_LOGE(TAG, "failed to map the partition: %s", esp_err_to_name(ret));
+    partition = NULL;
+    return ret;
+  }
+  mapped = data;
+
+  partition_mutex = xSemaphoreCreateMutex();
+  if (!partition_mutex) {
+    ESP_LOGE(TAG, "failed to create mutex");
+    abort();
+  }
+
+  for (int half = 0; half < HALVES; half++) {
+    scan_half(half);
+  }
+  current_half = latest.found ? latest.half : 0;
+
+  if (latest.found) {
+    ESP_LOGI(
+        TAG,
+        "latest show record %" PRIu32 ": %u bytes at %u in half %d",
+        latest.sequence,
+        latest.size,
+        latest.offset,
+        latest.half
+    );
+  }
+  return ESP_OK;
+}
+
+bool show_partition_available() { return partition; }
+
+static esp_err_t write_at(size_t offset, const void *data, size_t size) {
+  return esp_partition_write(partition, offset, data, size);
+}
+
+esp_err_t show_partition_append(const void *data, size_t size) {
+  if (!partition) {
+    return ESP_ERR_NOT_FOUND;
+  }
+  size_t needed = record_size(size);
+  if (needed > half_size) {
+    ESP_LOGE(TAG, "%u-byte record doesn't fit", size);
+    return ESP_ERR_INVALID_SIZE;
+  }
+
+  esp_err_t ret = ESP_OK;
+  xSemaphoreTake(partition_mutex, portMAX_DELAY);
+
+  int half = current_half;
+  if (append_offset[half] + needed > half_size) {
+    half = (half + 1) % HALVES;
+    if (pins[half]) {
+      // an older image from there is still being read
+      ESP_LOGW(TAG, "half %d is in use, not saving", half);
+      ret = ESP_ERR_INVALID_STATE;
+      goto exit;
+    }
+    ESP_LOGI(TAG, "erasing half %d", half);
+    ret = esp_partition_erase_range(partition, half_start(half), half_size);
+    if (ret != ESP_OK) {
+      goto exit;
+    }
+    append_offset[half] = 0;
+    current_half = half;
+  }
+
+  size_t offset = half_start(half) + append_offset[half];
+  record_header_t header = {
+      .magic = RECORD_MAGIC,
+      .sequence = latest.found ? latest.sequence + 1 : 1,
+      .size = size,
+      .crc = esp_crc32_le(0, data, size),
+  };
+
+  // even if the payload is cut short, the header says how far to skip
+  append_offset[half] += needed;
+  ret = write_at(offset, &header, sizeof(header));
+  if (ret == ESP_OK && size) {
+    ret = write_at(offset + sizeof(header), data, size);
+  }
+  if (ret != ESP_OK) {
+    ESP_LOGE(TAG, "failed to append record: %s", esp_err_to_name(ret));
+    goto exit;
+  }
+
+  latest = (record_t){
+      .found = true,
+      .half = half,
+      .offset = offset - half_start(half),
+      .size = size,
+      .sequence = header.sequence,
+  };
+
+exit:
+  xSemaphoreGive(partition_mutex);
+  return ret;
+}
+
+esp_err_t show_partition_clear() { return show_partition_append(NULL, 0); }
+
+esp_err_t show_partition_erase() {
+  const esp_partition_t *found = esp_partition_find_first(
+      ESP_PARTITION_TYPE_DATA,
+      ESP_PARTITION_SUBTYPE_ANY,
+      PARTITION_LABEL
+  );
+  if (!found) {
+    return ESP_ERR_NOT_FOUND;
+  }
+  return esp_partition_erase_range(found, 0, found->size);
+}
+
+esp_err_t
+show_partition_get_latest(const void **data, size_t *size, int *pin) {
+  if (!partition) {
+    return ESP_ERR_NOT_FOUND;
+  }
+
+  esp_err_t ret = ESP_ERR_NOT_FOUND;
+  xSemaphoreTake(partition_mutex, portMAX_DELAY);
+  if (latest.found && latest.size) {
+    *data = mapped + half_start(latest.half) + latest.offset +
+            sizeof(record_header_t);
+    *size = latest.size;
+    *pin = latest.half;
+    pins[latest.half]++;
+    ret = ESP_OK;
+  }
+  xSemaphoreGive(partition_mutex);
+  return ret;
+}
+
+void show_partition_unpin(int pin) {
+  xSemaphoreTake(partition_mutex, portMAX_DELAY);
+  pins[pin]--;
+  xSemaphoreGive(partition_mutex);
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <esp_err.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Log of show image records in the "show" data partition, which stays mapped
+// into the address space so that records are read in place. The partition is
+// used as two halves in turn: records are appended to the current one, and the
+// other is erased when it runs out of room. The latest intact record wins, so
+// a crash while appending leaves the previous one in place.
+
+// returns ESP_ERR_NOT_FOUND when the partition table has no show partition
+esp_err_t show_partition_init();
+bool show_partition_available();
+
+esp_err_t show_partition_append(const void *data, size_t size);
+// appends an empty record, which hides the previous ones without erasing
+// anything that might still be pinned
+esp_err_t show_partition_clear();
+
+// Erases the whole partition, for a factory reset. Finds the partition by
+// itself, as that runs before show_partition_init; not to be used after it,
+// while records may be mapped and pinned.
+esp_err_t show_partition_erase();
+
+// Pins the latest record until show_partition_unpin(*pin), so it can't be
+// erased while in use. Returns ESP_ERR_NOT_FOUND if there's no record or the
+// latest one is empty.
+esp_err_t
+show_partition_get_latest(const void **data, size_t *size, int *pin);
+void show_partition_unpin(int pin);
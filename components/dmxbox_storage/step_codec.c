@@ -0,0 +1,261 @@
+#include "step_codec.h"
+#include <esp_log.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char TAG[] = "dmxbox_storage_step_codec";
+
+#define STEP_FORMAT_VERSION 1
+#define MAX_VARINT_SIZE 5
+#define PADDING 0
+
+// a group and a run started for a single channel, plus its level
+#define MAX_CHANNEL_SIZE (4 * MAX_VARINT_SIZE + 1)
+
+static size_t legacy_size(size_t channel_count) {
+  return sizeof(dmxbox_effect_step_t) +
+         (channel_count - 1) * sizeof(dmxbox_channel_level_t);
+}
+
+bool step_codec_is_legacy(size_t size) {
+  return size >= legacy_size(0) &&
+         (size - legacy_size(0)) % sizeof(dmxbox_channel_level_t) == 0;
+}
+
+static uint8_t *put_varint(uint8_t *out, uint32_t value) {
+  while (value >= 0x80) {
+    *out++ = (value & 0x7f) | 0x80;
+    value >>= 7;
+  }
+  *out++ = value;
+  return out;
+}
+
+static uint32_t zigzag(int32_t value) {
+  return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static int32_t unzigzag(uint32_t value) {
+  return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+static bool same_universe(
+    const dmxbox_channel_level_t *a,
+    const dmxbox_channel_level_t *b
+) {
+  return a->channel.universe.address == b->channel.universe.address;
+}
+
+static bool continues_run(
+    const dmxbox_channel_level_t *previous,
+    const dmxbox_channel_level_t *next
+) {
+  return same_universe(previous, next) &&
+         next->channel.index == previous->channel.index + 1;
+}
+
+esp_err_t step_codec_encode(
+    const dmxbox_effect_step_t *step,
+    void **result,
+    size_t *size
+) {
+  size_t count = step->channel_count;
+  // version, timings, channel count, channels and padding
+  uint8_t *buffer =
+      malloc(1 + 5 * MAX_VARINT_SIZE + count * MAX_CHANNEL_SIZE + 1);
+  if (!buffer) {
+    ESP_LOGE(TAG, "failed to allocate buffer for %u channels", count);
+    return ESP_ERR_NO_MEM;
+  }
+
+  uint8_t *out = buffer;
+  *out++ = STEP_FORMAT_VERSION;
+  out = put_varint(out, step->time);
+  out = put_varint(out, step->in);
+  out = put_varint(out, step->dwell);
+  out = put_varint(out, step->out);
+  out = put_varint(out, count);
+
+  const dmxbox_channel_level_t *channels = step->channels;
+  size_t group = 0;
+  while (group < count) {
+    size_t group_end = group + 1;
+    while (group_end < count &&
+           same_universe(&channels[group], &channels[group_end])) {
+      group_end++;
+    }
+    out = put_varint(out, channels[group].channel.universe.address);
+    out = put_varint(out, group_end - group);
+
+    uint32_t previous_end = 0;
+    size_t run = group;
+    while (run < group_end) {
+      size_t run_end = run + 1;
+      while (run_end < group_end &&
+             continues_run(&channels[run_end - 1], &channels[run_end])) {
+        run_end++;
+      }
+      uint32_t index = channels[run].channel.index;
+      out = put_varint(out, zigzag((int32_t)index - (int32_t)previous_end));
+      out = put_varint(out, run_end - run);
+      for (size_t i = run; i < run_end; i++) {
+        *out++ = channels[i].level;
+      }
+      previous_end = index + (run_end - run);
+      run = run_end;
+    }
+    group = group_end;
+  }
+
+  if (step_codec_is_legacy(out - buffer)) {
+    *out++ = PADDING;
+  }
+
+  *result = buffer;
+  *size = out - buffer;
+  return ESP_OK;
+}
+
+typedef struct reader {
+  const uint8_t *next;
+  const uint8_t *end;
+  bool failed;
+} reader_t;
+
+static uint32_t get_varint(reader_t *reader) {
+  uint32_t value = 0;
+  for (int shift = 0; shift < 7 * MAX_VARINT_SIZE; shift += 7) {
+    if (reader->next >= reader->end) {
+      break;
+    }
+    uint8_t byte = *reader->next++;
+    value |= (uint32_t)(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      return value;
+    }
+  }
+  reader->failed = true;
+  return 0;
+}
+
+static uint32_t get_bounded_varint(reader_t *reader, uint32_t max) {
+  uint32_t value = get_varint(reader);
+  if (value > max) {
+    reader->failed = true;
+    return 0;
+  }
+  return value;
+}
+
+static esp_err_t decode_legacy(
+    const void *data,
+    size_t size,
+    dmxbox_effect_step_t **result
+) {
+  dmxbox_effect_step_t *step = malloc(size);
+  if (!step) {
+    return ESP_ERR_NO_MEM;
+  }
+  memcpy(step, data, size);
+  size_t expected_size = legacy_size(step->channel_count);
+  if (expected_size != size) {
+    ESP_LOGE(
+        TAG,
+        "legacy step corrupted. blob size %u bytes, expected %u bytes because "
+        "declared channel count %u. deleting all channels",
+        size,
+        expected_size,
+        step->channel_count
+    );
+    step->channel_count = 0;
+  }
+  *result = step;
+  return ESP_OK;
+}
+
+static bool decode_channels(reader_t *reader, dmxbox_effect_step_t *step) {
+  size_t decoded = 0;
+  while (decoded < step->channel_count && !reader->failed) {
+    uint32_t universe = get_bounded_varint(reader, 0x7fff);
+    size_t group_end =
+        decoded + get_bounded_varint(reader, step->channel_count - decoded);
+    if (group_end == decoded) {
+      return false;
+    }
+
+    int32_t previous_end = 0;
+    while (decoded < group_end && !reader->failed) {
+      int32_t index = previous_end + unzigzag(get_varint(reader));
+      uint32_t length = get_bounded_varint(reader, group_end - decoded);
+      if (!length || index < 0 || index + length - 1 > UINT16_MAX ||
+          (size_t)(reader->end - reader->next) < length) {
+        return false;
+      }
+      for (uint32_t i = 0; i < length; i++) {
+        dmxbox_channel_level_t *channel = &step->channels[decoded++];
+        channel->channel.universe.address = universe;
+        channel->channel.index = index + i;
+        channel->level = *reader->next++;
+      }
+      previous_end = index + length;
+    }
+  }
+  return !reader->failed;
+}
+
+esp_err_t step_codec_decode(
+    const void *data,
+    size_t size,
+    dmxbox_effect_step_t **result
+) {
+  if (step_codec_is_legacy(size)) {
+    return decode_legacy(data, size, result);
+  }
+
+  reader_t reader = {
+      .next = data,
+      .end = (const uint8_t *)data + size,
+  };
+  if (!size || *reader.next++ != STEP_FORMAT_VERSION) {
+    ESP_LOGE(TAG, "unknown %u-byte step format", size);
+    return ESP_ERR_INVALID_VERSION;
+  }
+
+  uint32_t time = get_varint(&reader);
+  uint32_t in = get_varint(&reader);
+  uint32_t dwell = get_varint(&reader);
+  uint32_t out = get_varint(&reader);
+  // every channel takes at least its level byte
+  uint32_t count = get_bounded_varint(&reader, reader.end - reader.next);
+  if (reader.failed) {
+    ESP_LOGE(TAG, "truncated step header");
+    return ESP_ERR_INVALID_SIZE;
+  }
+
+  dmxbox_effect_step_t *step = dmxbox_effect_step_alloc(count);
+  if (!step) {
+    return ESP_ERR_NO_MEM;
+  }
+  step->time = time;
+  step->in = in;
+  step->dwell = dwell;
+  step->out = out;
+
+  if (!decode_channels(&reader, step)) {
+    ESP_LOGE(TAG, "corrupted channels in %u-byte step", size);
+    free(step);
+    return ESP_ERR_INVALID_SIZE;
+  }
+  if (reader.next < reader.end && *reader.next == PADDING) {
+    reader.next++;
+  }
+  if (reader.next != reader.end) {
+    ESP_LOGE(TAG, "%u trailing bytes after step", reader.end - reader.next);
+    free(step);
+    return ESP_ERR_INVALID_SIZE;
+  }
+
+  *result = step;
+  return ESP_OK;
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include "effect_step_storage.h"
+#include <esp_err.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Compact on-flash encoding of dmxbox_effect_step_t. After a version byte,
+// the timings and channel count are varints. Channels are split into groups
+// sharing a universe, which is stored once per group, and each group into
+// runs of consecutive indexes, stored as the zigzag delta from where the
+// previous run ended plus the run length. The levels of a run follow it.
+//
+// Blobs in the older layout, a plain copy of the struct, are still decoded.
+// Their size is always step_size(n) for their channel count n, and encoded
+// blobs are padded by a byte whenever they'd have such a size.
+
+bool step_codec_is_legacy(size_t size);
+
+// *result must be free()d when ESP_OK
+esp_err_t step_codec_encode(
+    const dmxbox_effect_step_t *step,
+    void **result,
+    size_t *size
+);
+
+// decodes either layout, *result must be free()d when ESP_OK
+esp_err_t step_codec_decode(
+    const void *data,
+    size_t size,
+    dmxbox_effect_step_t **result
+);
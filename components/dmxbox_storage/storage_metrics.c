@@ -0,0 +1,122 @@
+#include "storage_metrics.h"
+#include "dmxbox_storage.h"
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <nvs.h>
+#include <string.h>
+
+static const char TAG[] = "dmxbox_storage_metrics";
+
+// bucket 0 is under this, every next one twice as wide
+#define FIRST_BUCKET_US 64
+
+// NVS stores everything in 32-byte entries, 126 of them per 4 KB page
+#define NVS_ENTRY_SIZE 32
+#define NVS_ENTRIES_PER_PAGE 126
+
+// typical erase cycles of the flash before sectors start failing
+#define FLASH_ENDURANCE_CYCLES 100000
+
+#define SECONDS_PER_YEAR (365.25 * 24 * 60 * 60)
+
+static portMUX_TYPE metrics_spinlock = portMUX_INITIALIZER_UNLOCKED;
+
+// protected by metrics_spinlock
+static dmxbox_storage_op_stats_t ops[dmxbox_storage_op_count];
+static uint64_t bytes_read;
+static uint64_t bytes_written;
+static uint64_t entries_written;
+
+static size_t get_latency_bucket(uint32_t duration_us) {
+  uint32_t limit = FIRST_BUCKET_US;
+  size_t bucket = 0;
+  while (duration_us >= limit &&
+         bucket < DMXBOX_STORAGE_LATENCY_BUCKETS - 1) {
+    limit <<= 1;
+    bucket++;
+  }
+  return bucket;
+}
+
+// Scalars fit in their entry, everything else takes a header entry plus the
+// data. Blobs also have an index entry. Close enough for an estimate.
+static uint32_t get_entries(size_t bytes) {
+  if (bytes <= sizeof(uint64_t)) {
+    return 1;
+  }
+  return 2 + (bytes + NVS_ENTRY_SIZE - 1) / NVS_ENTRY_SIZE;
+}
+
+int64_t storage_metrics_start() { return esp_timer_get_time(); }
+
+void storage_metrics_record(
+    dmxbox_storage_op_t op,
+    int64_t start_us,
+    esp_err_t ret,
+    size_t bytes
+) {
+  uint32_t duration_us = esp_timer_get_time() - start_us;
+  size_t bucket = get_latency_bucket(duration_us);
+
+  portENTER_CRITICAL(&metrics_spinlock);
+  dmxbox_storage_op_stats_t *stats = &ops[op];
+  stats->count++;
+  // not found is an answer, not a failure
+  if (ret != ESP_OK && ret != ESP_ERR_NVS_NOT_FOUND) {
+    stats->errors++;
+  }
+  stats->total_us += duration_us;
+  if (duration_us > stats->max_us) {
+    stats->max_us = duration_us;
+  }
+  stats->latency[bucket]++;
+  if (ret == ESP_OK) {
+    if (op == dmxbox_storage_op_get) {
+      bytes_read += bytes;
+    } else if (op == dmxbox_storage_op_set) {
+      bytes_written += bytes;
+      entries_written += get_entries(bytes);
+    }
+  }
+  portEXIT_CRITICAL(&metrics_spinlock);
+}
+
+void dmxbox_storage_get_stats(dmxbox_storage_stats_t *result) {
+  memset(result, 0, sizeof(dmxbox_storage_stats_t));
+
+  portENTER_CRITICAL(&metrics_spinlock);
+  memcpy(result->ops, ops, sizeof(ops));
+  result->bytes_read = bytes_read;
+  result->bytes_written = bytes_written;
+  result->entries_written = entries_written;
+  portEXIT_CRITICAL(&metrics_spinlock);
+
+  nvs_stats_t nvs_stats;
+  esp_err_t ret = nvs_get_stats(NULL, &nvs_stats);
+  if (ret == ESP_OK) {
+    result->used_entries = nvs_stats.used_entries;
+    result->free_entries = nvs_stats.free_entries;
+    result->total_entries = nvs_stats.total_entries;
+    result->namespace_count = nvs_stats.namespace_count;
+  } else {
+    ESP_LOGW(TAG, "failed to get NVS stats: %s", esp_err_to_name(ret));
+  }
+
+  // Every page NVS fills up is erased again when it's reclaimed, and erases
+  // are spread over all pages. Extrapolating the rate since boot gives the
+  // wear per page and year.
+  result->uptime_s = esp_timer_get_time() / 1000000;
+  uint32_t pages = result->total_entries / NVS_ENTRIES_PER_PAGE;
+  result->estimated_page_erases =
+      result->entries_written / NVS_ENTRIES_PER_PAGE;
+  result->erases_per_page_per_year = 0;
+  result->projected_lifetime_years = -1;
+  if (pages && result->uptime_s && result->entries_written) {
+    double page_fills = (double)result->entries_written / NVS_ENTRIES_PER_PAGE;
+    result->erases_per_page_per_year =
+        page_fills / pages * SECONDS_PER_YEAR / result->uptime_s;
+    result->projected_lifetime_years =
+        FLASH_ENDURANCE_CYCLES / result->erases_per_page_per_year;
+  }
+}
@@ -0,0 +1,20 @@
+#pragma once
+#include "dmxbox_storage.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Latency histograms and byte counters for the NVS calls, since boot. Call
+// sites take a timestamp before the call and record the result after it:
+//   int64_t start = storage_metrics_start();
+//   ret = nvs_set_blob(storage, key, value, size);
+//   storage_metrics_record(dmxbox_storage_op_set, start, ret, size);
+
+int64_t storage_metrics_start();
+
+// bytes are read for get, written for set, and ignored otherwise
+void storage_metrics_record(
+    dmxbox_storage_op_t op,
+    int64_t start_us,
+    esp_err_t ret,
+    size_t bytes
+);
@@ -0,0 +1,61 @@
+#include "dmxbox_storage.h"
+#include "private.h"
+#include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <stdlib.h>
+
+static const char TAG[] = "dmxbox_storage_txn";
+
+// Only one transaction is open at a time, owned by the task that began it.
+// Everything else is only touched by the owner. Writes are queued for the
+// storage writer, which never takes txn_mutex, so a transaction doesn't wait
+// on flash and nobody waits on one for long.
+static SemaphoreHandle_t txn_mutex;
+static TaskHandle_t txn_owner;
+static unsigned txn_depth;
+static bool txn_show_changed;
+
+static bool in_txn() {
+  return txn_owner && txn_owner == xTaskGetCurrentTaskHandle();
+}
+
+void dmxbox_storage_txn_init() {
+  txn_mutex = xSemaphoreCreateRecursiveMutex();
+  if (!txn_mutex) {
+    ESP_LOGE(TAG, "failed to create mutex");
+    abort();
+  }
+}
+
+void dmxbox_storage_begin() {
+  xSemaphoreTakeRecursive(txn_mutex, portMAX_DELAY);
+  if (!txn_depth++) {
+    txn_owner = xTaskGetCurrentTaskHandle();
+    txn_show_changed = false;
+  }
+}
+
+esp_err_t dmxbox_storage_commit() {
+  if (!in_txn()) {
+    ESP_LOGE(TAG, "commit without a transaction");
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  if (!--txn_depth) {
+    txn_owner = NULL;
+  }
+  xSemaphoreGiveRecursive(txn_mutex);
+  return ESP_OK;
+}
+
+bool dmxbox_storage_txn_show_changed() {
+  return in_txn() && txn_show_changed;
+}
+
+void dmxbox_storage_txn_set_show_changed() {
+  if (in_txn()) {
+    txn_show_changed = true;
+  }
+}
@@ -0,0 +1,661 @@
+#include "dmxbox_storage.h"
+#include "private.h"
+#include "show_partition.h"
+#include "storage_metrics.h"
+#include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <nvs.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char TAG[] = "dmxbox_storage_writer";
+
+#ifndef CONFIG_DMXBOX_STORAGE_WRITER_SLOTS
+#define CONFIG_DMXBOX_STORAGE_WRITER_SLOTS 16
+#endif
+
+// failed writes remembered for dmxbox_storage_wait
+#define WRITER_ERRORS 8
+
+// namespaces written in one drain, committed once at its end
+#define WRITER_MAX_NAMESPACES 4
+
+#define WRITER_IDLE_BIT (1 << 0)      // nothing queued or being written
+#define WRITER_SLOT_FREE_BIT (1 << 1) // cleared while the queue is full
+#define WRITER_PROGRESS_BIT (1 << 2)  // set whenever writes reach flash
+
+typedef enum write_type {
+  write_type_u8,
+  write_type_u16,
+  write_type_u32,
+  write_type_str,
+  write_type_blob,
+  write_type_erase,     // one key
+  write_type_erase_all, // the whole namespace
+  write_type_show_record,
+} write_type_t;
+
+typedef struct pending_write {
+  bool used;
+  bool applying;    // taken by the writer task, newer writes get a new slot
+  bool keeps_place; // a counter, see dmxbox_storage_queue_counter_u32
+  uint32_t position; // slots are written in this order
+  uint32_t ticket;   // of the latest write that went into the slot
+  write_type_t type;
+  char ns[NVS_NS_NAME_MAX_SIZE];
+  char key[NVS_KEY_NAME_MAX_SIZE]; // all but erase_all and show_record
+  union {
+    uint8_t u8;
+    uint16_t u16;
+    uint32_t u32;
+  } value;
+  size_t size;
+  void *data; // copy of the str or blob
+} pending_write_t;
+
+typedef struct write_error {
+  uint32_t ticket;
+  esp_err_t err;
+} write_error_t;
+
+typedef struct batch_ns {
+  char ns[NVS_NS_NAME_MAX_SIZE];
+  nvs_handle_t handle;
+  uint32_t last_ticket;
+} batch_ns_t;
+
+static SemaphoreHandle_t writer_mutex;
+static EventGroupHandle_t writer_events;
+static TaskHandle_t writer_task;
+
+// protected by writer_mutex
+static pending_write_t pending[CONFIG_DMXBOX_STORAGE_WRITER_SLOTS];
+static uint32_t next_ticket = 1;
+static esp_err_t first_error;
+static write_error_t errors[WRITER_ERRORS];
+static size_t error_count;
+static size_t next_error;
+static write_error_t lost_error; // the newest one pushed out of errors
+
+// only touched by the writer task
+static batch_ns_t batch[WRITER_MAX_NAMESPACES];
+static size_t batch_count;
+
+static bool is_after(uint32_t ticket, uint32_t other) {
+  return (int32_t)(ticket - other) > 0;
+}
+
+static bool has_key(write_type_t type) {
+  return type != write_type_erase_all && type != write_type_show_record;
+}
+
+static bool same_target(const pending_write_t *a, const pending_write_t *b) {
+  if (strcmp(a->ns, b->ns)) {
+    return false;
+  }
+  if (!has_key(a->type) || !has_key(b->type)) {
+    // only the latest show record is ever read
+    return a->type == write_type_show_record && b->type == a->type;
+  }
+  return !strcmp(a->key, b->key); // also a blob and an erase of it
+}
+
+static void drop(pending_write_t *slot) {
+  free(slot->data);
+  slot->data = NULL;
+  slot->used = false;
+  slot->applying = false;
+  xEventGroupSetBits(writer_events, WRITER_SLOT_FREE_BIT);
+}
+
+static pending_write_t *find_free_slot() {
+  for (size_t i = 0; i < CONFIG_DMXBOX_STORAGE_WRITER_SLOTS; i++) {
+    if (!pending[i].used) {
+      return &pending[i];
+    }
+  }
+  return NULL;
+}
+
+// Takes writer_mutex once there's a free slot. Callers block here while the
+// queue is full, which is the only time queueing waits on flash.
+static void lock_with_free_slot() {
+  xSemaphoreTake(writer_mutex, portMAX_DELAY);
+  while (!find_free_slot()) {
+    ESP_LOGW(TAG, "queue full, waiting for the writer");
+    xEventGroupClearBits(writer_events, WRITER_SLOT_FREE_BIT);
+    xSemaphoreGive(writer_mutex);
+    xEventGroupWaitBits(
+        writer_events,
+        WRITER_SLOT_FREE_BIT,
+        pdFALSE,
+        pdTRUE,
+        portMAX_DELAY
+    );
+    xSemaphoreTake(writer_mutex, portMAX_DELAY);
+  }
+}
+
+static void unlock_and_notify() {
+  xSemaphoreGive(writer_mutex);
+  xTaskNotifyGive(writer_task);
+}
+
+// Call with writer_mutex held and a slot free. Takes ownership of
+// write->data.
+static void insert(const pending_write_t *write) {
+  uint32_t ticket = next_ticket++;
+  pending_write_t *slot = NULL;
+  for (size_t i = 0; i < CONFIG_DMXBOX_STORAGE_WRITER_SLOTS; i++) {
+    pending_write_t *other = &pending[i];
+    if (!other->used || other->applying) {
+      continue;
+    }
+    if (write->type == write_type_erase_all && !strcmp(other->ns, write->ns)) {
+      drop(other); // erased before anything reads it
+    } else if (same_target(other, write)) {
+      slot = other;
+      break;
+    }
+  }
+
+  uint32_t position = ticket;
+  if (slot) {
+    // the older value never needs to reach flash
+    if (write->keeps_place) {
+      position = slot->position;
+    }
+    free(slot->data);
+  } else {
+    slot = find_free_slot();
+  }
+  *slot = *write;
+  slot->used = true;
+  slot->applying = false;
+  slot->position = position;
+  slot->ticket = ticket;
+  xEventGroupClearBits(writer_events, WRITER_IDLE_BIT);
+}
+
+// takes ownership of write->data
+static esp_err_t queue_write(const pending_write_t *write) {
+  lock_with_free_slot();
+  insert(write);
+  unlock_and_notify();
+  return ESP_OK;
+}
+
+// The newest queued write that decides what key in ns reads as, NULL when
+// it's whatever is on flash. Call with writer_mutex held.
+static const pending_write_t *find_newest(const char *ns, const char *key) {
+  const pending_write_t *newest = NULL;
+  for (size_t i = 0; i < CONFIG_DMXBOX_STORAGE_WRITER_SLOTS; i++) {
+    const pending_write_t *write = &pending[i];
+    if (!write->used || strcmp(write->ns, ns) ||
+        (write->type != write_type_erase_all &&
+         (!has_key(write->type) || strcmp(write->key, key)))) {
+      continue;
+    }
+    if (!newest || is_after(write->position, newest->position)) {
+      newest = write;
+    }
+  }
+  return newest;
+}
+
+static pending_write_t *take_oldest() {
+  xSemaphoreTake(writer_mutex, portMAX_DELAY);
+  pending_write_t *oldest = NULL;
+  for (size_t i = 0; i < CONFIG_DMXBOX_STORAGE_WRITER_SLOTS; i++) {
+    if (pending[i].used && !pending[i].applying &&
+        (!oldest || is_after(oldest->position, pending[i].position))) {
+      oldest = &pending[i];
+    }
+  }
+  if (oldest) {
+    oldest->applying = true; // left alone by everyone else from now on
+  }
+  xSemaphoreGive(writer_mutex);
+  return oldest;
+}
+
+static void record_error(uint32_t ticket, esp_err_t err) {
+  xSemaphoreTake(writer_mutex, portMAX_DELAY);
+  if (first_error == ESP_OK) {
+    first_error = err;
+  }
+  if (error_count == WRITER_ERRORS) {
+    lost_error = errors[next_error];
+  } else {
+    error_count++;
+  }
+  errors[next_error] = (write_error_t){.ticket = ticket, .err = err};
+  next_error = (next_error + 1) % WRITER_ERRORS;
+  xSemaphoreGive(writer_mutex);
+}
+
+static void commit_batch() {
+  for (size_t i = 0; i < batch_count; i++) {
+    esp_err_t ret = dmxbox_storage_commit_ns(batch[i].handle);
+    if (ret != ESP_OK) {
+      ESP_LOGE(
+          TAG,
+          "failed to commit %s: %s",
+          batch[i].ns,
+          esp_err_to_name(ret)
+      );
+      record_error(batch[i].last_ticket, ret);
+    }
+    dmxbox_storage_close_ns(batch[i].handle);
+  }
+  batch_count = 0;
+}
+
+// Opens the namespace for the rest of the drain. When there are already too
+// many open, those are committed first.
+static esp_err_t
+open_in_batch(const char *ns, uint32_t ticket, nvs_handle_t *storage) {
+  for (size_t i = 0; i < batch_count; i++) {
+    if (!strcmp(batch[i].ns, ns)) {
+      batch[i].last_ticket = ticket;
+      *storage = batch[i].handle;
+      return ESP_OK;
+    }
+  }
+
+  if (batch_count == WRITER_MAX_NAMESPACES) {
+    commit_batch();
+  }
+  esp_err_t ret = dmxbox_storage_open_ns(ns, NVS_READWRITE, storage);
+  if (ret == ESP_OK) {
+    batch_ns_t *opened = &batch[batch_count++];
+    strlcpy(opened->ns, ns, sizeof(opened->ns));
+    opened->handle = *storage;
+    opened->last_ticket = ticket;
+  }
+  return ret;
+}
+
+static esp_err_t apply(const pending_write_t *write) {
+  if (write->type == write_type_show_record) {
+    return show_partition_append(write->data, write->size);
+  }
+
+  nvs_handle_t storage;
+  esp_err_t ret = open_in_batch(write->ns, write->ticket, &storage);
+  if (ret != ESP_OK) {
+    return ret;
+  }
+  int64_t start = storage_metrics_start();
+  dmxbox_storage_op_t op = dmxbox_storage_op_set;
+  size_t size = 0;
+  switch (write->type) {
+  case write_type_u8:
+    ret = nvs_set_u8(storage, write->key, write->value.u8);
+    size = sizeof(write->value.u8);
+    break;
+  case write_type_u16:
+    ret = nvs_set_u16(storage, write->key, write->value.u16);
+    size = sizeof(write->value.u16);
+    break;
+  case write_type_u32:
+    ret = nvs_set_u32(storage, write->key, write->value.u32);
+    size = sizeof(write->value.u32);
+    break;
+  case write_type_str:
+    ret = nvs_set_str(storage, write->key, write->data);
+    size = strlen(write->data) + 1;
+    break;
+  case write_type_blob:
+    ret = nvs_set_blob(storage, write->key, write->data, write->size);
+    size = write->size;
+    break;
+  case write_type_erase:
+    op = dmxbox_storage_op_erase;
+    ret = nvs_erase_key(storage, write->key);
+    if (ret == ESP_ERR_NVS_NOT_FOUND) {
+      ret = ESP_OK; // never reached flash
+    }
+    break;
+  default:
+    op = dmxbox_storage_op_erase;
+    ret = nvs_erase_all(storage);
+    break;
+  }
+  storage_metrics_record(op, start, ret, size);
+  return ret;
+}
+
+// frees the slots written in the drain, once they're committed
+static void release_applied() {
+  xSemaphoreTake(writer_mutex, portMAX_DELAY);
+  bool empty = true;
+  for (size_t i = 0; i < CONFIG_DMXBOX_STORAGE_WRITER_SLOTS; i++) {
+    if (pending[i].applying) {
+      drop(&pending[i]);
+    } else if (pending[i].used) {
+      empty = false;
+    }
+  }
+  EventBits_t bits = WRITER_PROGRESS_BIT;
+  if (empty) {
+    bits |= WRITER_IDLE_BIT;
+  }
+  xEventGroupSetBits(writer_events, bits);
+  xSemaphoreGive(writer_mutex);
+}
+
+static void writer_loop(void *parameter) {
+  while (true) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    pending_write_t *write;
+    while ((write = take_oldest())) {
+      esp_err_t ret = apply(write);
+      if (ret != ESP_OK) {
+        ESP_LOGE(
+            TAG,
+            "failed to write to %s: %s",
+            write->ns,
+            esp_err_to_name(ret)
+        );
+        record_error(write->ticket, ret);
+      }
+    }
+
+    // everything that piled up shares one commit per namespace
+    commit_batch();
+    release_applied();
+  }
+}
+
+void dmxbox_storage_writer_init() {
+  writer_mutex = xSemaphoreCreateMutex();
+  writer_events = xEventGroupCreate();
+  if (!writer_mutex || !writer_events) {
+    ESP_LOGE(TAG, "failed to create writer sync primitives");
+    abort();
+  }
+  xEventGroupSetBits(writer_events, WRITER_IDLE_BIT | WRITER_SLOT_FREE_BIT);
+
+  // below everything that produces output, flash can wait
+  if (xTaskCreate(writer_loop, "Storage writer", 4096, NULL, 1, &writer_task) !=
+      pdPASS) {
+    ESP_LOGE(TAG, "failed to create writer task");
+    abort();
+  }
+}
+
+esp_err_t dmxbox_storage_flush(uint32_t timeout_ms) {
+  EventBits_t bits = xEventGroupWaitBits(
+      writer_events,
+      WRITER_IDLE_BIT,
+      pdFALSE,
+      pdTRUE,
+      timeout_ms / portTICK_PERIOD_MS
+  );
+  if (!(bits & WRITER_IDLE_BIT)) {
+    ESP_LOGW(TAG, "timed out flushing storage writes");
+    return ESP_ERR_TIMEOUT;
+  }
+
+  xSemaphoreTake(writer_mutex, portMAX_DELAY);
+  esp_err_t ret = first_error;
+  first_error = ESP_OK;
+  xSemaphoreGive(writer_mutex);
+  return ret;
+}
+
+dmxbox_storage_mark_t dmxbox_storage_mark() {
+  xSemaphoreTake(writer_mutex, portMAX_DELAY);
+  dmxbox_storage_mark_t mark = next_ticket - 1;
+  xSemaphoreGive(writer_mutex);
+  return mark;
+}
+
+// call with writer_mutex held
+static bool is_queued_until(uint32_t ticket) {
+  for (size_t i = 0; i < CONFIG_DMXBOX_STORAGE_WRITER_SLOTS; i++) {
+    if (pending[i].used && !is_after(pending[i].ticket, ticket)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// call with writer_mutex held
+static esp_err_t error_after(uint32_t ticket) {
+  if (lost_error.err != ESP_OK && is_after(lost_error.ticket, ticket)) {
+    return lost_error.err; // older than everything still in errors
+  }
+  size_t oldest = (next_error + WRITER_ERRORS - error_count) % WRITER_ERRORS;
+  for (size_t i = 0; i < error_count; i++) {
+    const write_error_t *error = &errors[(oldest + i) % WRITER_ERRORS];
+    if (is_after(error->ticket, ticket)) {
+      return error->err;
+    }
+  }
+  return ESP_OK;
+}
+
+esp_err_t
+dmxbox_storage_wait(dmxbox_storage_mark_t mark, uint32_t timeout_ms) {
+  TickType_t start = xTaskGetTickCount();
+  TickType_t timeout = timeout_ms / portTICK_PERIOD_MS;
+
+  xSemaphoreTake(writer_mutex, portMAX_DELAY);
+  uint32_t until = next_ticket - 1;
+  while (is_queued_until(until)) {
+    TickType_t waited = xTaskGetTickCount() - start;
+    if (waited >= timeout) {
+      xSemaphoreGive(writer_mutex);
+      ESP_LOGW(TAG, "timed out waiting for storage writes");
+      return ESP_ERR_TIMEOUT;
+    }
+    xEventGroupClearBits(writer_events, WRITER_PROGRESS_BIT);
+    xSemaphoreGive(writer_mutex);
+    xEventGroupWaitBits(
+        writer_events,
+        WRITER_PROGRESS_BIT,
+        pdFALSE,
+        pdTRUE,
+        timeout - waited
+    );
+    xSemaphoreTake(writer_mutex, portMAX_DELAY);
+  }
+  esp_err_t ret = error_after(mark);
+  xSemaphoreGive(writer_mutex);
+  return ret;
+}
+
+static esp_err_t queue_keyed(
+    const char *ns,
+    const char *key,
+    write_type_t type,
+    pending_write_t *write
+) {
+  write->type = type;
+  if (strlcpy(write->ns, ns, sizeof(write->ns)) >= sizeof(write->ns) ||
+      strlcpy(write->key, key, sizeof(write->key)) >= sizeof(write->key)) {
+    free(write->data);
+    return ESP_ERR_INVALID_ARG;
+  }
+  return queue_write(write);
+}
+
+esp_err_t
+dmxbox_storage_queue_u8(const char *ns, const char *key, uint8_t value) {
+  pending_write_t write = {.value.u8 = value};
+  return queue_keyed(ns, key, write_type_u8, &write);
+}
+
+esp_err_t
+dmxbox_storage_queue_u16(const char *ns, const char *key, uint16_t value) {
+  pending_write_t write = {.value.u16 = value};
+  return queue_keyed(ns, key, write_type_u16, &write);
+}
+
+esp_err_t dmxbox_storage_queue_counter_u32(
+    const char *ns,
+    const char *key,
+    uint32_t value
+) {
+  pending_write_t write = {.keeps_place = true, .value.u32 = value};
+  return queue_keyed(ns, key, write_type_u32, &write);
+}
+
+esp_err_t
+dmxbox_storage_queue_str(const char *ns, const char *key, const char *value) {
+  pending_write_t write = {.data = strdup(value)};
+  if (!write.data) {
+    return ESP_ERR_NO_MEM;
+  }
+  return queue_keyed(ns, key, write_type_str, &write);
+}
+
+esp_err_t dmxbox_storage_queue_blob(
+    const char *ns,
+    const char *key,
+    size_t size,
+    const void *value
+) {
+  pending_write_t write = {.size = size, .data = malloc(size)};
+  if (!write.data) {
+    ESP_LOGE(TAG, "failed to allocate %u-byte blob copy", size);
+    return ESP_ERR_NO_MEM;
+  }
+  memcpy(write.data, value, size);
+  return queue_keyed(ns, key, write_type_blob, &write);
+}
+
+esp_err_t dmxbox_storage_queue_erase(const char *ns, const char *key) {
+  pending_write_t write = {0};
+  return queue_keyed(ns, key, write_type_erase, &write);
+}
+
+esp_err_t dmxbox_storage_queue_erase_all(const char *ns) {
+  pending_write_t write = {.type = write_type_erase_all};
+  if (strlcpy(write.ns, ns, sizeof(write.ns)) >= sizeof(write.ns)) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  return queue_write(&write);
+}
+
+esp_err_t dmxbox_storage_queue_show_record(size_t size, const void *value) {
+  pending_write_t write = {
+      .type = write_type_show_record,
+      .ns = "show partition",
+      .size = size,
+      .data = malloc(size),
+  };
+  if (!write.data) {
+    ESP_LOGE(TAG, "failed to allocate %u-byte record copy", size);
+    return ESP_ERR_NO_MEM;
+  }
+  memcpy(write.data, value, size);
+  return queue_write(&write);
+}
+
+esp_err_t dmxbox_storage_get_queued_blob(
+    const char *ns,
+    const char *key,
+    size_t *size,
+    void **buffer
+) {
+  esp_err_t ret = ESP_ERR_INVALID_STATE;
+  xSemaphoreTake(writer_mutex, portMAX_DELAY);
+  const pending_write_t *write = find_newest(ns, key);
+  if (!write) {
+    goto exit;
+  }
+  if (write->type != write_type_blob) {
+    ret = ESP_ERR_NOT_FOUND;
+    goto exit;
+  }
+
+  ret = ESP_OK;
+  *size = write->size;
+  if (buffer) {
+    *buffer = malloc(write->size);
+    if (*buffer) {
+      memcpy(*buffer, write->data, write->size);
+    } else {
+      ret = ESP_ERR_NO_MEM;
+    }
+  }
+
+exit:
+  xSemaphoreGive(writer_mutex);
+  return ret;
+}
+
+static esp_err_t read_u16(const char *ns, const char *key, uint16_t *value) {
+  nvs_handle_t storage;
+  esp_err_t ret = dmxbox_storage_open_ns(ns, NVS_READONLY, &storage);
+  if (ret != ESP_OK) {
+    return ret;
+  }
+  int64_t start = storage_metrics_start();
+  ret = nvs_get_u16(storage, key, value);
+  storage_metrics_record(dmxbox_storage_op_get, start, ret, sizeof(*value));
+  dmxbox_storage_close_ns(storage);
+  return ret;
+}
+
+esp_err_t dmxbox_storage_queue_take_ids(
+    const char *ns,
+    const char *key,
+    uint16_t first_id,
+    uint16_t count,
+    uint16_t *id
+) {
+  pending_write_t write = {
+      .keeps_place = true,
+      .type = write_type_u16,
+  };
+  if (strlcpy(write.ns, ns, sizeof(write.ns)) >= sizeof(write.ns) ||
+      strlcpy(write.key, key, sizeof(write.key)) >= sizeof(write.key)) {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  lock_with_free_slot();
+  uint16_t next_id = 1;
+  esp_err_t ret = ESP_OK;
+  bool found = true;
+  const pending_write_t *queued = find_newest(ns, key);
+  if (queued && queued->type == write_type_u16) {
+    next_id = queued->value.u16;
+  } else if (queued) {
+    found = false; // erased
+  } else {
+    ret = read_u16(ns, key, &next_id);
+    if (ret == ESP_ERR_NVS_NOT_FOUND) {
+      ret = ESP_OK;
+      found = false;
+      next_id = 1;
+    }
+  }
+
+  bool queue = false;
+  if (ret == ESP_OK) {
+    *id = next_id > first_id ? next_id : first_id;
+    if (count && *id > UINT16_MAX - count) {
+      ESP_LOGE(TAG, "no ids left after %u in %s", *id, ns);
+      ret = ESP_ERR_INVALID_SIZE;
+    } else if (!found || *id + count != next_id) {
+      write.value.u16 = *id + count;
+      insert(&write);
+      queue = true;
+    }
+  }
+
+  if (queue) {
+    unlock_and_notify();
+  } else {
+    xSemaphoreGive(writer_mutex);
+  }
+  return ret;
+}
@@ -0,0 +1,257 @@
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <math.h>
+#include <string.h>
+
+#include "dmxbox_artnet.h"
+#include "dmxbox_espnow.h"
+#include "dmxbox_storage.h"
+#include "dmxbox_tempo.h"
+
+static const char TAG[] = "dmxbox_tempo";
+
+// taps further apart than this start a new tempo
+#define TAP_TIMEOUT_US 2000000
+
+// the tempo is averaged over this many taps
+#define TAP_HISTORY 8
+
+// tap channel levels at or above this are a tap
+#define TAP_THRESHOLD 128
+
+// how often the leader repeats the tempo for boxes that missed it
+#define SHARE_PERIOD_US 1000000
+
+// Phase corrections are slewed in at this fraction of the tempo, so the
+// position keeps moving forwards while it catches up or drops back
+#define SLEW_RATE 0.25
+
+// received positions further off than this are jumped to, it's a new leader
+// or a new tempo rather than drift
+#define MAX_SLEW_BEATS 0.5
+
+static const double us_per_minute = 60e6;
+
+// Synchronizes everything below
+static portMUX_TYPE tempo_spinlock = portMUX_INITIALIZER_UNLOCKED;
+
+// position is anchor_beats at anchor_time_us, moving at bpm, with slew_beats
+// added in evenly over the slew_us after it
+static double anchor_beats = 0;
+static int64_t anchor_time_us = 0;
+static double bpm = CONFIG_DMXBOX_TEMPO_DEFAULT_BPM;
+static double slew_beats = 0;
+static int64_t slew_us = 0;
+
+static bool leader = false;
+static bool changed = false;
+static int64_t last_shared_us = 0;
+
+static int64_t taps[TAP_HISTORY];
+static size_t tap_count = 0;
+
+// owned by the task calling dmxbox_tempo_update
+static dmxbox_artnet_subscription_t *tap_subscription = NULL;
+static bool tap_pressed = false;
+
+static double get_beats_locked(int64_t time_us) {
+  int64_t elapsed_us = time_us - anchor_time_us;
+  double beats = anchor_beats + elapsed_us * bpm / us_per_minute;
+  if (elapsed_us <= 0) {
+    return beats;
+  }
+  if (elapsed_us >= slew_us) {
+    return beats + slew_beats;
+  }
+  return beats + slew_beats * elapsed_us / slew_us;
+}
+
+// the position once the slew in progress is done
+static double get_target_beats_locked(int64_t time_us) {
+  return anchor_beats + (time_us - anchor_time_us) * bpm / us_per_minute +
+         slew_beats;
+}
+
+static void slew_to_locked(int64_t time_us, double target_beats) {
+  anchor_beats = get_beats_locked(time_us);
+  anchor_time_us = time_us;
+  slew_beats = target_beats - anchor_beats;
+  slew_us = fabs(slew_beats) * us_per_minute / (bpm * SLEW_RATE);
+}
+
+static void set_bpm_locked(int64_t time_us, double new_bpm) {
+  // re-anchor so that the position doesn't jump, and carry on with the
+  // rest of the slew at the new tempo
+  double target_beats = get_target_beats_locked(time_us);
+  anchor_beats = get_beats_locked(time_us);
+  anchor_time_us = time_us;
+  bpm = new_bpm;
+  slew_to_locked(time_us, target_beats);
+}
+
+static bool is_valid_bpm(double value) {
+  return value >= DMXBOX_TEMPO_MIN_BPM && value <= DMXBOX_TEMPO_MAX_BPM;
+}
+
+void dmxbox_tempo_tap(int64_t time_us) {
+  taskENTER_CRITICAL(&tempo_spinlock);
+
+  if (tap_count && time_us - taps[tap_count - 1] > TAP_TIMEOUT_US) {
+    tap_count = 0;
+  }
+  if (tap_count == TAP_HISTORY) {
+    memmove(taps, taps + 1, (TAP_HISTORY - 1) * sizeof(taps[0]));
+    tap_count--;
+  }
+  taps[tap_count++] = time_us;
+
+  // a single tap could be anything, it takes a second one to say it's a beat
+  if (tap_count >= 2) {
+    double interval_us = (double)(time_us - taps[0]) / (tap_count - 1);
+    double tapped_bpm = us_per_minute / interval_us;
+    if (is_valid_bpm(tapped_bpm)) {
+      set_bpm_locked(time_us, tapped_bpm);
+    }
+
+    // the tap is on the beat
+    slew_to_locked(time_us, round(get_target_beats_locked(time_us)));
+
+    leader = true;
+    changed = true;
+  }
+  taskEXIT_CRITICAL(&tempo_spinlock);
+}
+
+bool dmxbox_tempo_set_bpm(int64_t time_us, double value) {
+  if (!is_valid_bpm(value)) {
+    return false;
+  }
+
+  taskENTER_CRITICAL(&tempo_spinlock);
+  set_bpm_locked(time_us, value);
+  tap_count = 0;
+  leader = true;
+  changed = true;
+  taskEXIT_CRITICAL(&tempo_spinlock);
+  return true;
+}
+
+double dmxbox_tempo_get_beats(int64_t time_us) {
+  taskENTER_CRITICAL(&tempo_spinlock);
+  double beats = get_beats_locked(time_us);
+  taskEXIT_CRITICAL(&tempo_spinlock);
+  return beats;
+}
+
+void dmxbox_tempo_get_state(int64_t time_us, dmxbox_tempo_state_t *state) {
+  taskENTER_CRITICAL(&tempo_spinlock);
+  state->bpm = bpm;
+  state->beats = get_beats_locked(time_us);
+  state->leader = leader;
+  taskEXIT_CRITICAL(&tempo_spinlock);
+}
+
+static void tempo_received(
+    double received_bpm,
+    double beats,
+    int64_t sender_time_us,
+    int64_t receive_time_us
+) {
+  if (!is_valid_bpm(received_bpm)) {
+    ESP_LOGW(TAG, "Ignoring received tempo of %f bpm", received_bpm);
+    return;
+  }
+
+  // beats was the sender's position when it sent the packet, which is best
+  // known on the shared clock; without one it's when the packet arrived
+  int64_t sent_us = receive_time_us;
+  if (sender_time_us && dmxbox_espnow_time_synced()) {
+    sent_us = dmxbox_espnow_to_local_time(sender_time_us);
+  }
+
+  // the last box to set the tempo leads
+  int64_t time_us = esp_timer_get_time();
+  double target_beats =
+      beats + (time_us - sent_us) * received_bpm / us_per_minute;
+  taskENTER_CRITICAL(&tempo_spinlock);
+  set_bpm_locked(time_us, received_bpm);
+  if (fabs(target_beats - get_beats_locked(time_us)) > MAX_SLEW_BEATS) {
+    anchor_beats = target_beats;
+    anchor_time_us = time_us;
+    slew_beats = 0;
+    slew_us = 0;
+  } else {
+    slew_to_locked(time_us, target_beats);
+  }
+  tap_count = 0;
+  leader = false;
+  changed = false;
+  taskEXIT_CRITICAL(&tempo_spinlock);
+}
+
+static void poll_tap_channel() {
+  uint8_t level;
+  if (!tap_subscription ||
+      !dmxbox_artnet_subscription_poll(tap_subscription, &level)) {
+    return;
+  }
+
+  bool pressed = level >= TAP_THRESHOLD;
+  if (pressed && !tap_pressed) {
+    dmxbox_tempo_tap(esp_timer_get_time());
+  }
+  tap_pressed = pressed;
+}
+
+static void share_tempo() {
+  int64_t now_us = esp_timer_get_time();
+
+  taskENTER_CRITICAL(&tempo_spinlock);
+  bool should_share =
+      leader && (changed || now_us - last_shared_us >= SHARE_PERIOD_US);
+  double current_bpm = bpm;
+  double beats = get_target_beats_locked(now_us);
+  if (should_share) {
+    changed = false;
+    last_shared_us = now_us;
+  }
+  taskEXIT_CRITICAL(&tempo_spinlock);
+
+  if (should_share) {
+    dmxbox_espnow_send_tempo(current_bpm, beats, now_us);
+  }
+}
+
+void dmxbox_tempo_update() {
+  poll_tap_channel();
+  share_tempo();
+}
+
+void dmxbox_tempo_init() {
+  dmxbox_espnow_register_tempo_callback(tempo_received);
+
+  uint16_t tap_channel = dmxbox_get_tempo_tap_channel();
+  if (!tap_channel) {
+    return;
+  }
+
+  esp_err_t ret = dmxbox_artnet_subscribe(
+      dmxbox_get_effect_control_universe(),
+      &tap_channel,
+      1,
+      &tap_subscription
+  );
+  if (ret != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to subscribe to tap: %s", esp_err_to_name(ret));
+    tap_subscription = NULL;
+    return;
+  }
+
+  // a level that's already up at boot isn't a tap
+  uint8_t level;
+  if (dmxbox_artnet_subscription_poll(tap_subscription, &level)) {
+    tap_pressed = level >= TAP_THRESHOLD;
+  }
+}
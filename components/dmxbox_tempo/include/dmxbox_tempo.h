@@ -0,0 +1,36 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+// A free running beat clock. Its position is counted in beats since boot and
+// stays continuous when the tempo changes. A bar is 4 beats.
+
+#ifndef CONFIG_DMXBOX_TEMPO_DEFAULT_BPM
+#define CONFIG_DMXBOX_TEMPO_DEFAULT_BPM 120
+#endif
+
+#define DMXBOX_TEMPO_MIN_BPM 20
+#define DMXBOX_TEMPO_MAX_BPM 300
+
+typedef struct dmxbox_tempo_state {
+  double bpm;
+  double beats;
+  bool leader; // the tempo was set on this box rather than received
+} dmxbox_tempo_state_t;
+
+void dmxbox_tempo_init();
+
+// A tap, or a beat from an external source. Consecutive taps set the tempo,
+// and the position is slewed over the next beats so the last tap lands on
+// one. A single tap changes nothing.
+void dmxbox_tempo_tap(int64_t time_us);
+
+// Returns false if bpm is out of range
+bool dmxbox_tempo_set_bpm(int64_t time_us, double bpm);
+
+double dmxbox_tempo_get_beats(int64_t time_us);
+void dmxbox_tempo_get_state(int64_t time_us, dmxbox_tempo_state_t *state);
+
+// Polls the tap channel and shares the tempo with other boxes. Called from
+// the effects task every tick.
+void dmxbox_tempo_update();
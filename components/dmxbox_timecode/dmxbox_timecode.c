@@ -0,0 +1,154 @@
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <stdlib.h>
+
+#include "dmxbox_artnet.h"
+#include "dmxbox_timecode.h"
+
+static const char TAG[] = "dmxbox_timecode";
+
+// errors above this are a jump in the timecode rather than jitter
+#define RELOCK_THRESHOLD_US 250000
+
+// how much of the error to correct per frame, as 1/n
+#define JITTER_FILTER 8
+
+// frames missed before freewheeling
+#define FREEWHEEL_FRAMES 3
+
+static const uint16_t frame_rates[dmxbox_artnet_timecode_type_count] = {
+    [dmxbox_artnet_timecode_film] = 2400,
+    [dmxbox_artnet_timecode_ebu] = 2500,
+    [dmxbox_artnet_timecode_df] = 2997,
+    [dmxbox_artnet_timecode_smpte] = 3000,
+};
+
+// Synchronizes everything below
+static portMUX_TYPE timecode_spinlock = portMUX_INITIALIZER_UNLOCKED;
+
+static dmxbox_timecode_state_t state = dmxbox_timecode_none;
+static uint8_t timecode_type = 0;
+
+// show time is anchor_show_us at anchor_local_us, running in real time
+static int64_t anchor_show_us = 0;
+static int64_t anchor_local_us = 0;
+
+static int64_t last_frame_show_us = -1;
+static int64_t last_frame_local_us = 0;
+
+static int64_t get_frame_period_us(uint8_t type) {
+  return 100000000LL / frame_rates[type];
+}
+
+static int64_t timecode_to_us(const dmxbox_artnet_timecode_t *timecode) {
+  int64_t minutes = timecode->hours * 60 + timecode->minutes;
+  int64_t seconds = minutes * 60 + timecode->seconds;
+
+  switch (timecode->type) {
+  case dmxbox_artnet_timecode_df: {
+    // frames 0 and 1 are skipped every minute, except every tenth minute
+    int64_t frame = seconds * 30 + timecode->frames -
+                    2 * (minutes - minutes / 10);
+    return frame * 1001000 / 30;
+  }
+
+  default: {
+    int64_t fps = frame_rates[timecode->type] / 100;
+    return seconds * 1000000 + timecode->frames * 1000000 / fps;
+  }
+  }
+}
+
+static int64_t predict_locked(int64_t time_us) {
+  return anchor_show_us + (time_us - anchor_local_us);
+}
+
+static void relock(int64_t show_us, int64_t time_us) {
+  anchor_show_us = show_us;
+  anchor_local_us = time_us;
+}
+
+static void handle_timecode(const dmxbox_artnet_timecode_t *timecode) {
+  int64_t time_us = esp_timer_get_time();
+  int64_t show_us = timecode_to_us(timecode);
+
+  taskENTER_CRITICAL(&timecode_spinlock);
+  dmxbox_timecode_state_t previous_state = state;
+
+  if (show_us == last_frame_show_us) {
+    // the same frame repeated, the source is paused
+    relock(show_us, time_us);
+    state = dmxbox_timecode_stopped;
+  } else if (state != dmxbox_timecode_locked &&
+             state != dmxbox_timecode_freewheel) {
+    relock(show_us, time_us);
+    state = dmxbox_timecode_locked;
+  } else {
+    int64_t error_us = show_us - predict_locked(time_us);
+    if (llabs(error_us) > RELOCK_THRESHOLD_US) {
+      relock(show_us, time_us);
+    } else {
+      // packets arrive with network jitter, follow them gently
+      relock(predict_locked(time_us) + error_us / JITTER_FILTER, time_us);
+    }
+    state = dmxbox_timecode_locked;
+  }
+
+  timecode_type = timecode->type;
+  last_frame_show_us = show_us;
+  last_frame_local_us = time_us;
+  taskEXIT_CRITICAL(&timecode_spinlock);
+
+  if (state != previous_state) {
+    ESP_LOGI(
+        TAG,
+        "Timecode %02u:%02u:%02u:%02u, state %d",
+        timecode->hours,
+        timecode->minutes,
+        timecode->seconds,
+        timecode->frames,
+        state
+    );
+  }
+}
+
+dmxbox_timecode_state_t
+dmxbox_timecode_get(int64_t time_us, int64_t *show_time_us) {
+  taskENTER_CRITICAL(&timecode_spinlock);
+
+  int64_t since_frame_us = time_us - last_frame_local_us;
+  if (state == dmxbox_timecode_locked &&
+      since_frame_us > FREEWHEEL_FRAMES * get_frame_period_us(timecode_type)) {
+    state = dmxbox_timecode_freewheel;
+  }
+
+  int64_t freewheel_us = CONFIG_DMXBOX_TIMECODE_FREEWHEEL_MS * 1000LL;
+  if (state == dmxbox_timecode_freewheel && since_frame_us > freewheel_us) {
+    // hold where freewheeling ended
+    relock(predict_locked(last_frame_local_us + freewheel_us), time_us);
+    state = dmxbox_timecode_stopped;
+  }
+
+  dmxbox_timecode_state_t result = state;
+  if (state == dmxbox_timecode_stopped) {
+    *show_time_us = anchor_show_us;
+  } else if (state != dmxbox_timecode_none) {
+    *show_time_us = predict_locked(time_us);
+  }
+  taskEXIT_CRITICAL(&timecode_spinlock);
+  return result;
+}
+
+uint16_t dmxbox_timecode_get_frame_rate() {
+  taskENTER_CRITICAL(&timecode_spinlock);
+  uint16_t frame_rate =
+      state == dmxbox_timecode_none ? 0 : frame_rates[timecode_type];
+  taskEXIT_CRITICAL(&timecode_spinlock);
+  return frame_rate;
+}
+
+void dmxbox_timecode_init() {
+  dmxbox_artnet_set_timecode_handler(handle_timecode);
+}
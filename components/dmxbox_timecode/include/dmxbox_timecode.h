@@ -0,0 +1,26 @@
+#pragma once
+#include <stdint.h>
+
+// Show clock locked to incoming Art-Net timecode
+
+// how long the clock keeps running after timecode stops arriving
+#ifndef CONFIG_DMXBOX_TIMECODE_FREEWHEEL_MS
+#define CONFIG_DMXBOX_TIMECODE_FREEWHEEL_MS 2000
+#endif
+
+typedef enum dmxbox_timecode_state {
+  dmxbox_timecode_none,      // no timecode yet
+  dmxbox_timecode_locked,    // following incoming timecode
+  dmxbox_timecode_freewheel, // timecode dropped out, still running
+  dmxbox_timecode_stopped,   // timecode stopped or paused, time is held
+} dmxbox_timecode_state_t;
+
+void dmxbox_timecode_init();
+
+// Returns the state of the show clock, and the show time (in us since
+// 00:00:00:00) at the local time time_us unless the state is none
+dmxbox_timecode_state_t
+dmxbox_timecode_get(int64_t time_us, int64_t *show_time_us);
+
+// frames per second of the incoming timecode times 100, 0 if none
+uint16_t dmxbox_timecode_get_frame_rate();
@@ -0,0 +1,53 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// A failed check reports where it was and ends the run with a failure, which
+// is all ctest needs.
+#define CHECK(condition)                                                       \
+  do {                                                                         \
+    if (!(condition)) {                                                        \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__,         \
+              #condition);                                                     \
+      exit(1);                                                                 \
+    }                                                                          \
+  } while (0)
+
+#define CHECK_MSG(condition, ...)                                              \
+  do {                                                                         \
+    if (!(condition)) {                                                        \
+      fprintf(stderr, "%s:%d: check failed: %s: ", __FILE__, __LINE__,         \
+              #condition);                                                     \
+      fprintf(stderr, __VA_ARGS__);                                            \
+      fprintf(stderr, "\n");                                                   \
+      exit(1);                                                                 \
+    }                                                                          \
+  } while (0)
+
+#define RUN(test)                                                              \
+  do {                                                                         \
+    printf("%s\n", #test);                                                     \
+    test();                                                                    \
+  } while (0)
+
+// xorshift32, so that runs are the same everywhere
+static inline uint32_t test_random(uint32_t *state) {
+  *state ^= *state << 13;
+  *state ^= *state >> 17;
+  *state ^= *state << 5;
+  return *state;
+}
+
+// uniform in [0, 1)
+static inline double test_random_unit(uint32_t *state) {
+  return (test_random(state) >> 8) / (double)(1 << 24);
+}
+
+// monotonic, for benchmarks
+static inline double test_time_us() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1e6 + now.tv_nsec / 1e3;
+}
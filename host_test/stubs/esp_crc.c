@@ -0,0 +1,13 @@
+#include "esp_crc.h"
+
+// the same CRC-32 as the ROM's
+uint32_t esp_crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len) {
+  crc = ~crc;
+  for (uint32_t i = 0; i < len; i++) {
+    crc ^= buf[i];
+    for (int bit = 0; bit < 8; bit++) {
+      crc = crc & 1 ? (crc >> 1) ^ 0xedb88320 : crc >> 1;
+    }
+  }
+  return ~crc;
+}
@@ -0,0 +1,5 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+uint32_t esp_crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len);
@@ -0,0 +1,3 @@
+#pragma once
+
+#define DMX_PACKET_SIZE_MAX 513
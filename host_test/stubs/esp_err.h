@@ -0,0 +1,36 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// The parts of ESP-IDF the tested sources use, for building them on the host
+
+typedef int esp_err_t;
+
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_NO_MEM 0x101
+#define ESP_ERR_INVALID_ARG 0x102
+#define ESP_ERR_INVALID_STATE 0x103
+#define ESP_ERR_INVALID_SIZE 0x104
+#define ESP_ERR_NOT_FOUND 0x105
+#define ESP_ERR_NOT_SUPPORTED 0x106
+#define ESP_ERR_TIMEOUT 0x107
+#define ESP_ERR_INVALID_CRC 0x109
+#define ESP_ERR_INVALID_VERSION 0x10a
+
+static inline const char *esp_err_to_name(esp_err_t code) {
+  static char name[16];
+  snprintf(name, sizeof(name), "0x%x", code);
+  return name;
+}
+
+#define ESP_ERROR_CHECK(x)                                                     \
+  do {                                                                         \
+    esp_err_t err_ = (x);                                                      \
+    if (err_ != ESP_OK) {                                                      \
+      fprintf(stderr, "%s:%d: %s failed: 0x%x\n", __FILE__, __LINE__, #x,      \
+              err_);                                                           \
+      abort();                                                                 \
+    }                                                                          \
+  } while (0)
@@ -0,0 +1,9 @@
+#include "esp_log.h"
+
+static esp_log_level_t level = ESP_LOG_ERROR;
+
+void esp_log_level_set(const char *tag, esp_log_level_t set_level) {
+  level = set_level;
+}
+
+esp_log_level_t host_log_level() { return level; }
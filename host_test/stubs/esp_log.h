@@ -0,0 +1,36 @@
+#pragma once
+#include <stdio.h>
+
+// Errors are printed unless esp_log_level_set turned them off, everything
+// else is only type-checked
+
+typedef enum {
+  ESP_LOG_NONE,
+  ESP_LOG_ERROR,
+  ESP_LOG_WARN,
+  ESP_LOG_INFO,
+  ESP_LOG_DEBUG,
+  ESP_LOG_VERBOSE,
+} esp_log_level_t;
+
+// the tag is ignored, the level applies to all of them
+void esp_log_level_set(const char *tag, esp_log_level_t level);
+esp_log_level_t host_log_level();
+
+#define ESP_LOGE(tag, format, ...)                                             \
+  do {                                                                         \
+    if (host_log_level() >= ESP_LOG_ERROR) {                                   \
+      fprintf(stderr, "E %s: " format "\n", tag, ##__VA_ARGS__);               \
+    }                                                                          \
+  } while (0)
+#define ESP_LOG_QUIET(tag, format, ...)                                        \
+  do {                                                                         \
+    (void)(tag);                                                               \
+    if (0) {                                                                   \
+      printf(format, ##__VA_ARGS__);                                           \
+    }                                                                          \
+  } while (0)
+#define ESP_LOGW ESP_LOG_QUIET
+#define ESP_LOGI ESP_LOG_QUIET
+#define ESP_LOGD ESP_LOG_QUIET
+#define ESP_LOGV ESP_LOG_QUIET
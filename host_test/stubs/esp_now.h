@@ -0,0 +1,5 @@
+#pragma once
+
+// Only the sizes, for the packet layouts
+#define ESP_NOW_ETH_ALEN 6
+#define ESP_NOW_MAX_DATA_LEN 250
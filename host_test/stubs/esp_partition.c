@@ -0,0 +1,151 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "esp_partition.h"
+
+// one partition, opened in whichever process uses it first
+static esp_partition_t fake;
+static char fake_path[256];
+static int fake_fd = -1;
+static bool power_cut_armed;
+static size_t power_left;
+
+void fake_partition_create(
+    const char *label,
+    const char *path,
+    uint32_t size,
+    uint32_t erase_size
+) {
+  fake = (esp_partition_t){
+      .type = ESP_PARTITION_TYPE_DATA,
+      .subtype = ESP_PARTITION_SUBTYPE_ANY,
+      .size = size,
+      .erase_size = erase_size,
+  };
+  strncpy(fake.label, label, sizeof(fake.label) - 1);
+  strncpy(fake_path, path, sizeof(fake_path) - 1);
+  if (fake_fd >= 0) {
+    close(fake_fd);
+    fake_fd = -1;
+  }
+
+  int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    abort();
+  }
+  uint8_t *erased = malloc(size);
+  memset(erased, 0xff, size);
+  if (write(fd, erased, size) != size) {
+    abort();
+  }
+  free(erased);
+  close(fd);
+}
+
+void fake_partition_cut_power_after(size_t bytes) {
+  power_cut_armed = true;
+  power_left = bytes;
+}
+
+const esp_partition_t *esp_partition_find_first(
+    esp_partition_type_t type,
+    esp_partition_subtype_t subtype,
+    const char *label
+) {
+  if (!fake.size || type != fake.type || strcmp(label, fake.label)) {
+    return NULL;
+  }
+  if (fake_fd < 0) {
+    fake_fd = open(fake_path, O_RDWR);
+    if (fake_fd < 0) {
+      return NULL;
+    }
+  }
+  return &fake;
+}
+
+esp_err_t esp_partition_mmap(
+    const esp_partition_t *partition,
+    size_t offset,
+    size_t size,
+    esp_partition_mmap_memory_t memory,
+    const void **out_ptr,
+    esp_partition_mmap_handle_t *out_handle
+) {
+  if (offset + size > partition->size) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  // shared, so writes through the file show up in the mapping like they do
+  // in the flash cache
+  void *mapped = mmap(NULL, size, PROT_READ, MAP_SHARED, fake_fd, offset);
+  if (mapped == MAP_FAILED) {
+    return ESP_ERR_NO_MEM;
+  }
+  *out_ptr = mapped;
+  *out_handle = 1;
+  return ESP_OK;
+}
+
+void esp_partition_munmap(esp_partition_mmap_handle_t handle) {}
+
+// how many of size bytes get done before the power goes
+static size_t powered(size_t size) {
+  if (!power_cut_armed) {
+    return size;
+  }
+  size_t done = size < power_left ? size : power_left;
+  power_left -= done;
+  return done;
+}
+
+esp_err_t esp_partition_write(
+    const esp_partition_t *partition,
+    size_t dst_offset,
+    const void *src,
+    size_t size
+) {
+  if (dst_offset + size > partition->size) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  size_t done = powered(size);
+  uint8_t *bytes = malloc(size ? size : 1);
+  if (pread(fake_fd, bytes, size, dst_offset) != size) {
+    abort();
+  }
+  for (size_t i = 0; i < done; i++) {
+    bytes[i] &= ((const uint8_t *)src)[i];
+  }
+  if (pwrite(fake_fd, bytes, done, dst_offset) != done) {
+    abort();
+  }
+  free(bytes);
+  if (done < size) {
+    _exit(FAKE_POWER_CUT_STATUS);
+  }
+  return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(
+    const esp_partition_t *partition,
+    size_t offset,
+    size_t size
+) {
+  if (offset % partition->erase_size || size % partition->erase_size ||
+      offset + size > partition->size) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  size_t done = powered(size);
+  uint8_t *erased = malloc(size ? size : 1);
+  memset(erased, 0xff, size);
+  if (pwrite(fake_fd, erased, done, offset) != done) {
+    abort();
+  }
+  free(erased);
+  if (done < size) {
+    _exit(FAKE_POWER_CUT_STATUS);
+  }
+  return ESP_OK;
+}
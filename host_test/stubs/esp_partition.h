@@ -0,0 +1,74 @@
+#pragma once
+#include <esp_err.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A partition backed by a file, with flash semantics: writes only clear
+// bits and erases set whole sectors back to 0xff
+
+typedef enum {
+  ESP_PARTITION_TYPE_APP = 0x00,
+  ESP_PARTITION_TYPE_DATA = 0x01,
+} esp_partition_type_t;
+
+typedef enum {
+  ESP_PARTITION_SUBTYPE_ANY = 0xff,
+} esp_partition_subtype_t;
+
+typedef enum {
+  ESP_PARTITION_MMAP_DATA,
+  ESP_PARTITION_MMAP_INST,
+} esp_partition_mmap_memory_t;
+
+typedef uint32_t esp_partition_mmap_handle_t;
+
+typedef struct esp_partition {
+  esp_partition_type_t type;
+  esp_partition_subtype_t subtype;
+  uint32_t address;
+  uint32_t size;
+  uint32_t erase_size;
+  char label[17];
+} esp_partition_t;
+
+const esp_partition_t *esp_partition_find_first(
+    esp_partition_type_t type,
+    esp_partition_subtype_t subtype,
+    const char *label
+);
+esp_err_t esp_partition_mmap(
+    const esp_partition_t *partition,
+    size_t offset,
+    size_t size,
+    esp_partition_mmap_memory_t memory,
+    const void **out_ptr,
+    esp_partition_mmap_handle_t *out_handle
+);
+void esp_partition_munmap(esp_partition_mmap_handle_t handle);
+esp_err_t esp_partition_write(
+    const esp_partition_t *partition,
+    size_t dst_offset,
+    const void *src,
+    size_t size
+);
+esp_err_t esp_partition_erase_range(
+    const esp_partition_t *partition,
+    size_t offset,
+    size_t size
+);
+
+// Creates (or recreates, erased) the file behind the partition with this
+// label. Until then there's no such partition.
+void fake_partition_create(
+    const char *label,
+    const char *path,
+    uint32_t size,
+    uint32_t erase_size
+);
+
+// Cuts the power once this many more bytes have been written or erased: the
+// write or erase in progress stops part way and the process exits with
+// FAKE_POWER_CUT_STATUS.
+#define FAKE_POWER_CUT_STATUS 42
+void fake_partition_cut_power_after(size_t bytes);
@@ -0,0 +1,227 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+// Mutexes are recursive pthread mutexes, only ever waited on forever
+struct host_semaphore {
+  pthread_mutex_t mutex;
+};
+
+SemaphoreHandle_t xSemaphoreCreateMutex() {
+  SemaphoreHandle_t semaphore = malloc(sizeof(*semaphore));
+  if (!semaphore) {
+    return NULL;
+  }
+  pthread_mutexattr_t attributes;
+  pthread_mutexattr_init(&attributes);
+  pthread_mutexattr_settype(&attributes, PTHREAD_MUTEX_RECURSIVE);
+  pthread_mutex_init(&semaphore->mutex, &attributes);
+  pthread_mutexattr_destroy(&attributes);
+  return semaphore;
+}
+
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex() {
+  return xSemaphoreCreateMutex();
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t wait) {
+  return pthread_mutex_lock(&semaphore->mutex) == 0 ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) {
+  return pthread_mutex_unlock(&semaphore->mutex) == 0 ? pdTRUE : pdFALSE;
+}
+
+static void init_condition(pthread_cond_t *condition) {
+  pthread_condattr_t attributes;
+  pthread_condattr_init(&attributes);
+  pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+  pthread_cond_init(condition, &attributes);
+  pthread_condattr_destroy(&attributes);
+}
+
+static struct timespec deadline_after(TickType_t wait) {
+  struct timespec deadline;
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  deadline.tv_sec += wait / 1000;
+  deadline.tv_nsec += (long)(wait % 1000) * 1000000;
+  if (deadline.tv_nsec >= 1000000000) {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000;
+  }
+  return deadline;
+}
+
+// Waits on condition until it's signalled or wait runs out. Returns false
+// when it ran out.
+static bool wait_condition(
+    pthread_cond_t *condition,
+    pthread_mutex_t *mutex,
+    const struct timespec *deadline,
+    TickType_t wait
+) {
+  if (wait == portMAX_DELAY) {
+    return pthread_cond_wait(condition, mutex) == 0;
+  }
+  return pthread_cond_timedwait(condition, mutex, deadline) == 0;
+}
+
+// Tasks are threads with a notification count
+struct host_task {
+  pthread_t thread;
+  TaskFunction_t function;
+  void *parameter;
+  pthread_mutex_t mutex;
+  pthread_cond_t notified;
+  uint32_t notifications;
+};
+
+static __thread TaskHandle_t current_task;
+
+static TaskHandle_t new_task() {
+  TaskHandle_t task = calloc(1, sizeof(*task));
+  if (!task) {
+    abort();
+  }
+  pthread_mutex_init(&task->mutex, NULL);
+  init_condition(&task->notified);
+  return task;
+}
+
+static void *run_task(void *parameter) {
+  TaskHandle_t task = parameter;
+  current_task = task;
+  task->function(task->parameter);
+  return NULL;
+}
+
+BaseType_t xTaskCreate(
+    TaskFunction_t function,
+    const char *name,
+    uint32_t stack_size,
+    void *parameter,
+    UBaseType_t priority,
+    TaskHandle_t *task
+) {
+  TaskHandle_t created = new_task();
+  created->function = function;
+  created->parameter = parameter;
+  if (task) {
+    *task = created;
+  }
+  if (pthread_create(&created->thread, NULL, run_task, created)) {
+    return pdFALSE;
+  }
+  pthread_detach(created->thread);
+  return pdPASS;
+}
+
+// threads that weren't created as tasks, like main, get one on first use
+TaskHandle_t xTaskGetCurrentTaskHandle() {
+  if (!current_task) {
+    current_task = new_task();
+    current_task->thread = pthread_self();
+  }
+  return current_task;
+}
+
+TickType_t xTaskGetTickCount() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (TickType_t)(now.tv_sec * 1000 + now.tv_nsec / 1000000);
+}
+
+void vTaskDelay(TickType_t ticks) { usleep(ticks * 1000); }
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+  pthread_mutex_lock(&task->mutex);
+  task->notifications++;
+  pthread_cond_signal(&task->notified);
+  pthread_mutex_unlock(&task->mutex);
+  return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t wait) {
+  TaskHandle_t task = xTaskGetCurrentTaskHandle();
+  struct timespec deadline = deadline_after(wait);
+  pthread_mutex_lock(&task->mutex);
+  while (!task->notifications &&
+         wait_condition(&task->notified, &task->mutex, &deadline, wait)) {
+  }
+  uint32_t notifications = task->notifications;
+  if (notifications) {
+    task->notifications = clear_on_exit ? 0 : notifications - 1;
+  }
+  pthread_mutex_unlock(&task->mutex);
+  return notifications;
+}
+
+struct host_event_group {
+  pthread_mutex_t mutex;
+  pthread_cond_t changed;
+  EventBits_t bits;
+};
+
+EventGroupHandle_t xEventGroupCreate() {
+  EventGroupHandle_t group = calloc(1, sizeof(*group));
+  if (!group) {
+    return NULL;
+  }
+  pthread_mutex_init(&group->mutex, NULL);
+  init_condition(&group->changed);
+  return group;
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits) {
+  pthread_mutex_lock(&group->mutex);
+  group->bits |= bits;
+  EventBits_t result = group->bits;
+  pthread_cond_broadcast(&group->changed);
+  pthread_mutex_unlock(&group->mutex);
+  return result;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits) {
+  pthread_mutex_lock(&group->mutex);
+  EventBits_t before = group->bits;
+  group->bits &= ~bits;
+  pthread_mutex_unlock(&group->mutex);
+  return before;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group) {
+  pthread_mutex_lock(&group->mutex);
+  EventBits_t bits = group->bits;
+  pthread_mutex_unlock(&group->mutex);
+  return bits;
+}
+
+static bool bits_set(EventBits_t bits, EventBits_t wanted, bool all) {
+  return all ? (bits & wanted) == wanted : (bits & wanted);
+}
+
+EventBits_t xEventGroupWaitBits(
+    EventGroupHandle_t group,
+    EventBits_t bits,
+    BaseType_t clear_on_exit,
+    BaseType_t wait_for_all,
+    TickType_t wait
+) {
+  struct timespec deadline = deadline_after(wait);
+  pthread_mutex_lock(&group->mutex);
+  while (!bits_set(group->bits, bits, wait_for_all) &&
+         wait_condition(&group->changed, &group->mutex, &deadline, wait)) {
+  }
+  EventBits_t result = group->bits;
+  if (clear_on_exit && bits_set(result, bits, wait_for_all)) {
+    group->bits &= ~bits;
+  }
+  pthread_mutex_unlock(&group->mutex);
+  return result;
+}
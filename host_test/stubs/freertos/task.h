@@ -0,0 +1,21 @@
+#pragma once
+#include "FreeRTOS.h"
+
+// Tasks are threads; priorities and stack sizes are ignored
+
+typedef struct host_task *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *parameter);
+
+BaseType_t xTaskCreate(
+    TaskFunction_t function,
+    const char *name,
+    uint32_t stack_size,
+    void *parameter,
+    UBaseType_t priority,
+    TaskHandle_t *task
+);
+TaskHandle_t xTaskGetCurrentTaskHandle();
+TickType_t xTaskGetTickCount();
+void vTaskDelay(TickType_t ticks);
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t wait);
@@ -0,0 +1,17 @@
+#pragma once
+#include <string.h>
+
+// What ESP-IDF's newlib has and glibc (before 2.38) doesn't. Included ahead
+// of every source built against the stubs.
+
+static inline size_t
+host_strlcpy(char *destination, const char *source, size_t size) {
+  size_t length = strlen(source);
+  if (size) {
+    size_t copied = length < size - 1 ? length : size - 1;
+    memcpy(destination, source, copied);
+    destination[copied] = '\0';
+  }
+  return length;
+}
+#define strlcpy host_strlcpy
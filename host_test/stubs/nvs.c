@@ -0,0 +1,453 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "nvs.h"
+#include "nvs_flash.h"
+
+// NVS keeps everything in 32-byte entries: scalars take one, strings and
+// blobs a header entry plus their data
+#define ENTRY_SIZE 32
+#define PAGE_ENTRIES 126
+#define TOTAL_ENTRIES (126 * 64)
+#define MAX_HANDLES 64
+#define MAX_NAMESPACES 32
+
+typedef struct fake_entry {
+  char ns[NVS_NS_NAME_MAX_SIZE];
+  char key[NVS_KEY_NAME_MAX_SIZE];
+  nvs_type_t type;
+  size_t size;
+  void *data;
+} fake_entry_t;
+
+typedef struct fake_handle {
+  bool used;
+  char ns[NVS_NS_NAME_MAX_SIZE];
+  nvs_open_mode_t mode;
+} fake_handle_t;
+
+struct nvs_opaque_iterator_t {
+  size_t position;
+  char ns[NVS_NS_NAME_MAX_SIZE]; // empty for all of them
+  nvs_type_t type;
+};
+
+static pthread_mutex_t fake_mutex = PTHREAD_MUTEX_INITIALIZER;
+static fake_entry_t *entries;
+static size_t entry_count;
+static size_t entry_capacity;
+static fake_handle_t handles[MAX_HANDLES];
+static char namespaces[MAX_NAMESPACES][NVS_NS_NAME_MAX_SIZE];
+static fake_nvs_stats_t stats;
+static uint32_t write_latency_us;
+static uint32_t commit_latency_us;
+static uint32_t page_erase_latency_us;
+static fake_nvs_observer_t observer;
+
+static size_t entries_for(nvs_type_t type, size_t size) {
+  if (type != NVS_TYPE_STR && type != NVS_TYPE_BLOB) {
+    return 1;
+  }
+  return 1 + (size + ENTRY_SIZE - 1) / ENTRY_SIZE;
+}
+
+static bool has_namespace(const char *ns) {
+  for (size_t i = 0; i < MAX_NAMESPACES; i++) {
+    if (!strcmp(namespaces[i], ns)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool add_namespace(const char *ns) {
+  for (size_t i = 0; i < MAX_NAMESPACES; i++) {
+    if (!namespaces[i][0]) {
+      strcpy(namespaces[i], ns);
+      return true;
+    }
+  }
+  return false;
+}
+
+static fake_handle_t *get_handle(nvs_handle_t handle) {
+  if (!handle || handle > MAX_HANDLES || !handles[handle - 1].used) {
+    return NULL;
+  }
+  return &handles[handle - 1];
+}
+
+static fake_entry_t *find(const char *ns, const char *key) {
+  for (size_t i = 0; i < entry_count; i++) {
+    if (!strcmp(entries[i].ns, ns) && !strcmp(entries[i].key, key)) {
+      return &entries[i];
+    }
+  }
+  return NULL;
+}
+
+static void remove_entry(fake_entry_t *entry) {
+  free(entry->data);
+  size_t position = entry - entries;
+  memmove(
+      entry,
+      entry + 1,
+      (entry_count - position - 1) * sizeof(fake_entry_t)
+  );
+  entry_count--;
+}
+
+static esp_err_t
+set(nvs_handle_t handle, const char *key, nvs_type_t type, const void *value,
+    size_t size) {
+  if (strlen(key) >= NVS_KEY_NAME_MAX_SIZE) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  esp_err_t ret = ESP_OK;
+  char written_ns[NVS_NS_NAME_MAX_SIZE];
+  bool page_full = false;
+  pthread_mutex_lock(&fake_mutex);
+  fake_handle_t *opened = get_handle(handle);
+  if (!opened) {
+    ret = ESP_ERR_NVS_INVALID_HANDLE;
+    goto exit;
+  }
+  if (opened->mode != NVS_READWRITE) {
+    ret = ESP_ERR_NVS_READ_ONLY;
+    goto exit;
+  }
+
+  // a new value goes into a new entry and the old one is erased
+  fake_entry_t *old = find(opened->ns, key);
+  if (old) {
+    remove_entry(old);
+  }
+  if (entry_count == entry_capacity) {
+    size_t capacity = entry_capacity ? entry_capacity * 2 : 64;
+    fake_entry_t *grown = realloc(entries, capacity * sizeof(fake_entry_t));
+    if (!grown) {
+      ret = ESP_ERR_NO_MEM;
+      goto exit;
+    }
+    entries = grown;
+    entry_capacity = capacity;
+  }
+  fake_entry_t *entry = &entries[entry_count];
+  *entry = (fake_entry_t){.type = type, .size = size, .data = malloc(size)};
+  if (!entry->data) {
+    ret = ESP_ERR_NO_MEM;
+    goto exit;
+  }
+  memcpy(entry->data, value, size);
+  strcpy(entry->ns, opened->ns);
+  strcpy(entry->key, key);
+  strcpy(written_ns, opened->ns);
+  entry_count++;
+
+  stats.sets++;
+  stats.bytes_written += size;
+  uint64_t pages_before = stats.entries_written / PAGE_ENTRIES;
+  stats.entries_written += entries_for(type, size);
+  page_full = stats.entries_written / PAGE_ENTRIES != pages_before;
+
+exit:
+  pthread_mutex_unlock(&fake_mutex);
+  if (ret == ESP_OK) {
+    usleep(write_latency_us + (page_full ? page_erase_latency_us : 0));
+    if (observer) {
+      observer(written_ns, key);
+    }
+  }
+  return ret;
+}
+
+static esp_err_t
+get(nvs_handle_t handle, const char *key, nvs_type_t type, void *value,
+    size_t *size) {
+  esp_err_t ret = ESP_OK;
+  pthread_mutex_lock(&fake_mutex);
+  fake_handle_t *opened = get_handle(handle);
+  if (!opened) {
+    ret = ESP_ERR_NVS_INVALID_HANDLE;
+    goto exit;
+  }
+  fake_entry_t *entry = find(opened->ns, key);
+  if (!entry) {
+    ret = ESP_ERR_NVS_NOT_FOUND;
+    goto exit;
+  }
+  if (entry->type != type) {
+    ret = ESP_ERR_NVS_TYPE_MISMATCH;
+    goto exit;
+  }
+  if (value) {
+    if (*size < entry->size) {
+      ret = ESP_ERR_NVS_INVALID_LENGTH;
+      goto exit;
+    }
+    memcpy(value, entry->data, entry->size);
+  }
+  *size = entry->size;
+
+exit:
+  pthread_mutex_unlock(&fake_mutex);
+  return ret;
+}
+
+void fake_nvs_reset() {
+  pthread_mutex_lock(&fake_mutex);
+  for (size_t i = 0; i < entry_count; i++) {
+    free(entries[i].data);
+  }
+  entry_count = 0;
+  memset(namespaces, 0, sizeof(namespaces));
+  memset(&stats, 0, sizeof(stats));
+  pthread_mutex_unlock(&fake_mutex);
+}
+
+fake_nvs_stats_t fake_nvs_get_stats() {
+  pthread_mutex_lock(&fake_mutex);
+  fake_nvs_stats_t result = stats;
+  pthread_mutex_unlock(&fake_mutex);
+  return result;
+}
+
+void fake_nvs_set_latency(
+    uint32_t write_us,
+    uint32_t commit_us,
+    uint32_t page_erase_us
+) {
+  write_latency_us = write_us;
+  commit_latency_us = commit_us;
+  page_erase_latency_us = page_erase_us;
+}
+
+void fake_nvs_set_observer(fake_nvs_observer_t set_observer) {
+  observer = set_observer;
+}
+
+esp_err_t nvs_flash_init() { return ESP_OK; }
+
+esp_err_t nvs_flash_erase() {
+  fake_nvs_reset();
+  return ESP_OK;
+}
+
+esp_err_t
+nvs_open(const char *ns, nvs_open_mode_t mode, nvs_handle_t *handle) {
+  if (strlen(ns) >= NVS_NS_NAME_MAX_SIZE) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  esp_err_t ret = ESP_OK;
+  pthread_mutex_lock(&fake_mutex);
+  if (!has_namespace(ns)) {
+    if (mode == NVS_READONLY) {
+      ret = ESP_ERR_NVS_NOT_FOUND;
+      goto exit;
+    }
+    if (!add_namespace(ns)) {
+      ret = ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+      goto exit;
+    }
+  }
+  ret = ESP_ERR_NO_MEM;
+  for (size_t i = 0; i < MAX_HANDLES; i++) {
+    if (!handles[i].used) {
+      handles[i] = (fake_handle_t){.used = true, .mode = mode};
+      strcpy(handles[i].ns, ns);
+      *handle = i + 1;
+      ret = ESP_OK;
+      break;
+    }
+  }
+
+exit:
+  pthread_mutex_unlock(&fake_mutex);
+  return ret;
+}
+
+void nvs_close(nvs_handle_t handle) {
+  pthread_mutex_lock(&fake_mutex);
+  fake_handle_t *opened = get_handle(handle);
+  if (opened) {
+    opened->used = false;
+  }
+  pthread_mutex_unlock(&fake_mutex);
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle) {
+  pthread_mutex_lock(&fake_mutex);
+  stats.commits++;
+  esp_err_t ret = get_handle(handle) ? ESP_OK : ESP_ERR_NVS_INVALID_HANDLE;
+  pthread_mutex_unlock(&fake_mutex);
+  usleep(commit_latency_us);
+  return ret;
+}
+
+esp_err_t nvs_set_u8(nvs_handle_t handle, const char *key, uint8_t value) {
+  return set(handle, key, NVS_TYPE_U8, &value, sizeof(value));
+}
+
+esp_err_t nvs_set_u16(nvs_handle_t handle, const char *key, uint16_t value) {
+  return set(handle, key, NVS_TYPE_U16, &value, sizeof(value));
+}
+
+esp_err_t nvs_set_u32(nvs_handle_t handle, const char *key, uint32_t value) {
+  return set(handle, key, NVS_TYPE_U32, &value, sizeof(value));
+}
+
+esp_err_t nvs_set_str(nvs_handle_t handle, const char *key, const char *value) {
+  return set(handle, key, NVS_TYPE_STR, value, strlen(value) + 1);
+}
+
+esp_err_t nvs_set_blob(
+    nvs_handle_t handle,
+    const char *key,
+    const void *value,
+    size_t size
+) {
+  return set(handle, key, NVS_TYPE_BLOB, value, size);
+}
+
+esp_err_t nvs_get_u8(nvs_handle_t handle, const char *key, uint8_t *value) {
+  size_t size = sizeof(*value);
+  return get(handle, key, NVS_TYPE_U8, value, &size);
+}
+
+esp_err_t nvs_get_u16(nvs_handle_t handle, const char *key, uint16_t *value) {
+  size_t size = sizeof(*value);
+  return get(handle, key, NVS_TYPE_U16, value, &size);
+}
+
+esp_err_t nvs_get_u32(nvs_handle_t handle, const char *key, uint32_t *value) {
+  size_t size = sizeof(*value);
+  return get(handle, key, NVS_TYPE_U32, value, &size);
+}
+
+esp_err_t
+nvs_get_str(nvs_handle_t handle, const char *key, char *value, size_t *size) {
+  return get(handle, key, NVS_TYPE_STR, value, size);
+}
+
+esp_err_t
+nvs_get_blob(nvs_handle_t handle, const char *key, void *value, size_t *size) {
+  return get(handle, key, NVS_TYPE_BLOB, value, size);
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key) {
+  esp_err_t ret = ESP_OK;
+  pthread_mutex_lock(&fake_mutex);
+  fake_handle_t *opened = get_handle(handle);
+  fake_entry_t *entry = opened ? find(opened->ns, key) : NULL;
+  if (!opened) {
+    ret = ESP_ERR_NVS_INVALID_HANDLE;
+  } else if (!entry) {
+    ret = ESP_ERR_NVS_NOT_FOUND;
+  } else {
+    remove_entry(entry);
+    stats.erases++;
+  }
+  pthread_mutex_unlock(&fake_mutex);
+  usleep(ret == ESP_OK ? write_latency_us : 0);
+  return ret;
+}
+
+esp_err_t nvs_erase_all(nvs_handle_t handle) {
+  pthread_mutex_lock(&fake_mutex);
+  fake_handle_t *opened = get_handle(handle);
+  if (!opened) {
+    pthread_mutex_unlock(&fake_mutex);
+    return ESP_ERR_NVS_INVALID_HANDLE;
+  }
+  for (size_t i = entry_count; i > 0; i--) {
+    if (!strcmp(entries[i - 1].ns, opened->ns)) {
+      remove_entry(&entries[i - 1]);
+    }
+  }
+  stats.erases++;
+  pthread_mutex_unlock(&fake_mutex);
+  usleep(write_latency_us);
+  return ESP_OK;
+}
+
+static bool matches(const nvs_iterator_t iterator, const fake_entry_t *entry) {
+  return (!iterator->ns[0] || !strcmp(iterator->ns, entry->ns)) &&
+         (iterator->type == NVS_TYPE_ANY || iterator->type == entry->type);
+}
+
+// moves to the first match at or after position, releasing the iterator if
+// there's none
+static esp_err_t seek(nvs_iterator_t *iterator) {
+  pthread_mutex_lock(&fake_mutex);
+  while ((*iterator)->position < entry_count &&
+         !matches(*iterator, &entries[(*iterator)->position])) {
+    (*iterator)->position++;
+  }
+  bool found = (*iterator)->position < entry_count;
+  pthread_mutex_unlock(&fake_mutex);
+  if (!found) {
+    free(*iterator);
+    *iterator = NULL;
+    return ESP_ERR_NVS_NOT_FOUND;
+  }
+  return ESP_OK;
+}
+
+esp_err_t nvs_entry_find(
+    const char *part,
+    const char *ns,
+    nvs_type_t type,
+    nvs_iterator_t *iterator
+) {
+  *iterator = calloc(1, sizeof(**iterator));
+  if (!*iterator) {
+    return ESP_ERR_NO_MEM;
+  }
+  if (ns) {
+    strcpy((*iterator)->ns, ns);
+  }
+  (*iterator)->type = type;
+  return seek(iterator);
+}
+
+esp_err_t nvs_entry_next(nvs_iterator_t *iterator) {
+  (*iterator)->position++;
+  return seek(iterator);
+}
+
+esp_err_t
+nvs_entry_info(const nvs_iterator_t iterator, nvs_entry_info_t *info) {
+  pthread_mutex_lock(&fake_mutex);
+  const fake_entry_t *entry = &entries[iterator->position];
+  strcpy(info->namespace_name, entry->ns);
+  strcpy(info->key, entry->key);
+  info->type = entry->type;
+  pthread_mutex_unlock(&fake_mutex);
+  return ESP_OK;
+}
+
+void nvs_release_iterator(nvs_iterator_t iterator) { free(iterator); }
+
+esp_err_t nvs_get_stats(const char *part, nvs_stats_t *result) {
+  pthread_mutex_lock(&fake_mutex);
+  size_t used = 0;
+  size_t namespace_count = 0;
+  for (size_t i = 0; i < entry_count; i++) {
+    used += entries_for(entries[i].type, entries[i].size);
+  }
+  for (size_t i = 0; i < MAX_NAMESPACES; i++) {
+    namespace_count += namespaces[i][0] != 0;
+  }
+  pthread_mutex_unlock(&fake_mutex);
+
+  *result = (nvs_stats_t){
+      .used_entries = used,
+      .free_entries = used < TOTAL_ENTRIES ? TOTAL_ENTRIES - used : 0,
+      .available_entries = used < TOTAL_ENTRIES ? TOTAL_ENTRIES - used : 0,
+      .total_entries = TOTAL_ENTRIES,
+      .namespace_count = namespace_count,
+  };
+  return ESP_OK;
+}
@@ -0,0 +1,110 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+typedef uint32_t nvs_handle_t;
+typedef enum { NVS_READONLY, NVS_READWRITE } nvs_open_mode_t;
+typedef enum {
+  NVS_TYPE_U8 = 0x01,
+  NVS_TYPE_U16 = 0x02,
+  NVS_TYPE_U32 = 0x04,
+  NVS_TYPE_STR = 0x21,
+  NVS_TYPE_BLOB = 0x42,
+  NVS_TYPE_ANY = 0xff,
+} nvs_type_t;
+
+#define NVS_KEY_NAME_MAX_SIZE 16
+#define NVS_NS_NAME_MAX_SIZE 16
+#define NVS_DEFAULT_PART_NAME "nvs"
+
+#define ESP_ERR_NVS_BASE 0x1100
+#define ESP_ERR_NVS_NOT_FOUND (ESP_ERR_NVS_BASE + 0x02)
+#define ESP_ERR_NVS_TYPE_MISMATCH (ESP_ERR_NVS_BASE + 0x03)
+#define ESP_ERR_NVS_READ_ONLY (ESP_ERR_NVS_BASE + 0x04)
+#define ESP_ERR_NVS_NOT_ENOUGH_SPACE (ESP_ERR_NVS_BASE + 0x05)
+#define ESP_ERR_NVS_INVALID_HANDLE (ESP_ERR_NVS_BASE + 0x07)
+#define ESP_ERR_NVS_INVALID_LENGTH (ESP_ERR_NVS_BASE + 0x0c)
+#define ESP_ERR_NVS_NO_FREE_PAGES (ESP_ERR_NVS_BASE + 0x0d)
+#define ESP_ERR_NVS_NEW_VERSION_FOUND (ESP_ERR_NVS_BASE + 0x10)
+
+typedef struct nvs_opaque_iterator_t *nvs_iterator_t;
+
+typedef struct {
+  char namespace_name[NVS_NS_NAME_MAX_SIZE];
+  char key[NVS_KEY_NAME_MAX_SIZE];
+  nvs_type_t type;
+} nvs_entry_info_t;
+
+typedef struct {
+  size_t used_entries;
+  size_t free_entries;
+  size_t available_entries;
+  size_t total_entries;
+  size_t namespace_count;
+} nvs_stats_t;
+
+esp_err_t nvs_open(const char *ns, nvs_open_mode_t mode, nvs_handle_t *handle);
+void nvs_close(nvs_handle_t handle);
+esp_err_t nvs_commit(nvs_handle_t handle);
+
+esp_err_t nvs_set_u8(nvs_handle_t handle, const char *key, uint8_t value);
+esp_err_t nvs_set_u16(nvs_handle_t handle, const char *key, uint16_t value);
+esp_err_t nvs_set_u32(nvs_handle_t handle, const char *key, uint32_t value);
+esp_err_t nvs_set_str(nvs_handle_t handle, const char *key, const char *value);
+esp_err_t nvs_set_blob(
+    nvs_handle_t handle,
+    const char *key,
+    const void *value,
+    size_t size
+);
+
+esp_err_t nvs_get_u8(nvs_handle_t handle, const char *key, uint8_t *value);
+esp_err_t nvs_get_u16(nvs_handle_t handle, const char *key, uint16_t *value);
+esp_err_t nvs_get_u32(nvs_handle_t handle, const char *key, uint32_t *value);
+esp_err_t
+nvs_get_str(nvs_handle_t handle, const char *key, char *value, size_t *size);
+esp_err_t
+nvs_get_blob(nvs_handle_t handle, const char *key, void *value, size_t *size);
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key);
+esp_err_t nvs_erase_all(nvs_handle_t handle);
+
+esp_err_t nvs_entry_find(
+    const char *part,
+    const char *ns,
+    nvs_type_t type,
+    nvs_iterator_t *iterator
+);
+esp_err_t nvs_entry_next(nvs_iterator_t *iterator);
+esp_err_t nvs_entry_info(const nvs_iterator_t iterator, nvs_entry_info_t *info);
+void nvs_release_iterator(nvs_iterator_t iterator);
+
+esp_err_t nvs_get_stats(const char *part, nvs_stats_t *stats);
+
+// In RAM, in the order things were written, like NVS iterates its pages.
+// Counts what would be written to flash.
+typedef struct fake_nvs_stats {
+  uint32_t sets;
+  uint32_t erases;
+  uint32_t commits;
+  uint64_t bytes_written;
+  uint64_t entries_written; // 32-byte NVS entries
+} fake_nvs_stats_t;
+
+void fake_nvs_reset();
+fake_nvs_stats_t fake_nvs_get_stats();
+
+// How long every set or erase, and every commit, takes, like on flash. The
+// set that fills a page also waits for NVS to erase one to move on to.
+void fake_nvs_set_latency(
+    uint32_t write_us,
+    uint32_t commit_us,
+    uint32_t page_erase_us
+);
+
+// called after every set, outside the fake's lock, so it can read NVS
+typedef void (*fake_nvs_observer_t)(const char *ns, const char *key);
+void fake_nvs_set_observer(fake_nvs_observer_t observer);
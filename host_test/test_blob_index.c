@@ -0,0 +1,238 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "blob_index.h"
+#include "host_test.h"
+#include "nvs.h"
+
+// Listing steps out of shows with over a thousand blobs, through the index
+// and by walking NVS the way listing worked before there was one. Both have
+// to return the same pages; the index has to be faster at it.
+
+#define STEPS_NS "dmxbox/steps"
+#define STEP_SIZE 40
+#define PAGE_SIZE 8
+#define MAX_STEPS 64
+#define CHURN_OPS 4000
+
+static void make_key(char *key, uint16_t parent_id, uint16_t id) {
+  snprintf(key, NVS_KEY_NAME_MAX_SIZE, "%x:%x", parent_id, id);
+}
+
+// a show with effect_count effects of step_count steps each, written in a
+// random order like edits over time would
+static void fill_nvs(int effect_count, int step_count, uint32_t *random) {
+  fake_nvs_reset();
+  nvs_handle_t storage;
+  CHECK(nvs_open(STEPS_NS, NVS_READWRITE, &storage) == ESP_OK);
+  int total = effect_count * step_count;
+  int *order = malloc(total * sizeof(int));
+  CHECK(order);
+  for (int i = 0; i < total; i++) {
+    order[i] = i;
+  }
+  for (int i = total - 1; i > 0; i--) {
+    int other = test_random(random) % (i + 1);
+    int swap = order[i];
+    order[i] = order[other];
+    order[other] = swap;
+  }
+
+  uint8_t blob[STEP_SIZE] = {0};
+  char key[NVS_KEY_NAME_MAX_SIZE];
+  for (int i = 0; i < total; i++) {
+    make_key(key, order[i] / step_count + 1, order[i] % step_count + 1);
+    CHECK(nvs_set_blob(storage, key, blob, sizeof(blob)) == ESP_OK);
+  }
+  for (uint16_t effect = 1; effect <= effect_count; effect++) {
+    CHECK(snprintf(key, sizeof(key), "%x:next_id", effect) < sizeof(key));
+    CHECK(nvs_set_u16(storage, key, step_count + 1) == ESP_OK);
+  }
+  nvs_close(storage);
+  free(order);
+}
+
+// What listing did before the index: walk every blob in the namespace,
+// keep the effect's, sort them and cut out the page
+static int compare_ids(const void *a, const void *b) {
+  const dmxbox_storage_entry_t *x = a;
+  const dmxbox_storage_entry_t *y = b;
+  return (int)x->id - (int)y->id;
+}
+
+static uint16_t list_by_walking(
+    uint16_t parent_id,
+    uint16_t skip,
+    uint16_t count,
+    dmxbox_storage_entry_t *page
+) {
+  static dmxbox_storage_entry_t found[MAX_STEPS];
+  uint16_t found_count = 0;
+
+  nvs_handle_t storage;
+  CHECK(nvs_open(STEPS_NS, NVS_READONLY, &storage) == ESP_OK);
+  nvs_iterator_t iterator;
+  esp_err_t ret =
+      nvs_entry_find(NVS_DEFAULT_PART_NAME, STEPS_NS, NVS_TYPE_BLOB, &iterator);
+  while (ret == ESP_OK) {
+    nvs_entry_info_t info;
+    nvs_entry_info(iterator, &info);
+    unsigned parsed_parent;
+    unsigned parsed_id;
+    if (sscanf(info.key, "%x:%x", &parsed_parent, &parsed_id) == 2 &&
+        parsed_parent == parent_id && found_count < MAX_STEPS) {
+      size_t size;
+      CHECK(nvs_get_blob(storage, info.key, NULL, &size) == ESP_OK);
+      found[found_count++] = (dmxbox_storage_entry_t){
+          .id = parsed_id,
+          .size = size,
+      };
+    }
+    ret = nvs_entry_next(&iterator);
+  }
+  nvs_close(storage);
+
+  qsort(found, found_count, sizeof(found[0]), compare_ids);
+  uint16_t read = 0;
+  for (uint16_t i = skip; i < found_count && read < count; i++) {
+    page[read++] = found[i];
+  }
+  return read;
+}
+
+static bool same_page(
+    const dmxbox_storage_entry_t *a,
+    const dmxbox_storage_entry_t *b,
+    uint16_t count
+) {
+  for (uint16_t i = 0; i < count; i++) {
+    if (a[i].id != b[i].id || a[i].size != b[i].size) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void benchmark(int effect_count, int step_count) {
+  uint32_t random = 1;
+  fill_nvs(effect_count, step_count, &random);
+
+  // the fake NVS looks keys up one by one where the real one hashes them,
+  // so the scan gets slower here than it would on the device
+  double start = test_time_us();
+  blob_index_init();
+  double scan_us = test_time_us() - start;
+
+  // every page of every effect, both ways
+  dmxbox_storage_entry_t indexed[PAGE_SIZE];
+  dmxbox_storage_entry_t walked[PAGE_SIZE];
+  int pages = 0;
+  double index_us = 0;
+  double walk_us = 0;
+  for (int effect = 1; effect <= effect_count; effect++) {
+    for (int skip = 0; skip < step_count; skip += PAGE_SIZE) {
+      start = test_time_us();
+      uint16_t count =
+          blob_index_list(STEPS_NS, effect, skip, PAGE_SIZE, indexed);
+      index_us += test_time_us() - start;
+
+      start = test_time_us();
+      uint16_t walked_count = list_by_walking(effect, skip, PAGE_SIZE, walked);
+      walk_us += test_time_us() - start;
+
+      int expected = step_count - skip < PAGE_SIZE ? step_count - skip
+                                                    : PAGE_SIZE;
+      CHECK_MSG(
+          count == expected && walked_count == count,
+          "effect %d skip %d: %u indexed, %u walked, %d expected",
+          effect,
+          skip,
+          count,
+          walked_count,
+          expected
+      );
+      CHECK(same_page(indexed, walked, count));
+      CHECK(indexed[0].id == skip + 1);
+      pages++;
+    }
+  }
+
+  printf(
+      "  %5d blobs: scan %7.0f us, page through the index %6.2f us, "
+      "by walking NVS %8.1f us\n",
+      effect_count * step_count,
+      scan_us,
+      index_us / pages,
+      walk_us / pages
+  );
+  CHECK(index_us < walk_us);
+  blob_index_clear();
+}
+
+static void listing_beats_walking() {
+  benchmark(25, 10);
+  benchmark(60, 20);
+  benchmark(100, 40);
+}
+
+// Random puts and removes against a plain bitmap of what should be there,
+// with the listing checked along the way
+static void churn_stays_consistent() {
+  uint32_t random = 7;
+  int effect_count = 50;
+  int step_count = 24;
+  fill_nvs(effect_count, step_count, &random);
+  blob_index_init();
+
+  static bool present[51][MAX_STEPS + 1];
+  for (int effect = 1; effect <= effect_count; effect++) {
+    for (int step = 1; step <= MAX_STEPS; step++) {
+      present[effect][step] = step <= step_count;
+    }
+  }
+
+  double start = test_time_us();
+  for (int op = 0; op < CHURN_OPS; op++) {
+    int effect = test_random(&random) % effect_count + 1;
+    int step = test_random(&random) % MAX_STEPS + 1;
+    if (test_random(&random) % 2) {
+      blob_index_put(STEPS_NS, effect, step, STEP_SIZE);
+      present[effect][step] = true;
+    } else {
+      blob_index_remove(STEPS_NS, effect, step);
+      present[effect][step] = false;
+    }
+
+    dmxbox_storage_entry_t page[MAX_STEPS];
+    uint16_t count = blob_index_list(STEPS_NS, effect, 0, MAX_STEPS, page);
+    uint16_t expected = 0;
+    for (int id = 1; id <= MAX_STEPS; id++) {
+      if (present[effect][id]) {
+        CHECK_MSG(
+            expected < count && page[expected].id == id,
+            "effect %d: step %d missing after %d ops",
+            effect,
+            id,
+            op
+        );
+        expected++;
+      }
+    }
+    CHECK(count == expected);
+  }
+  printf(
+      "  %d puts/removes with a listing each: %.2f us per op\n",
+      CHURN_OPS,
+      (test_time_us() - start) / CHURN_OPS
+  );
+  blob_index_clear();
+}
+
+int main() {
+  RUN(listing_beats_walking);
+  RUN(churn_stays_consistent);
+  return 0;
+}
@@ -0,0 +1,188 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "clock_estimator.h"
+#include "host_test.h"
+
+// A follower syncing its clock to the reference over a radio with latency,
+// jitter and loss, once a second like time_sync does. Both ends sometimes
+// wait for the send mutex while another packet (a universe stream chunk) goes
+// out. The offset error turns into the phase error of every effect synced on
+// the shared clock, which is what gets reported.
+
+#define EXCHANGE_US (1000 * 1000)
+#define EXCHANGES 900
+#define SETTLE_EXCHANGES 30    // not counted, the estimator is filling up
+#define BASE_LATENCY_US 1200   // each way
+#define PROCESSING_US 150      // at the reference, request to response
+#define MUTEX_CHANCE 0.3       // of having to wait for another packet
+#define MAX_MUTEX_WAIT_US 4000 // a full universe chunk at a low rate
+#define DRIFT_PPM 25           // crystals are within +-20 ppm each
+#define LOSS 0.1               // of each leg
+#define PHASE_RATE 4.0         // cycles per second of the effect reported
+
+typedef struct sim_result {
+  double mean_us;
+  double p95_us;
+  double max_us;
+} sim_result_t;
+
+// exponential, which is roughly what queueing on a busy channel looks like
+static double jitter(uint32_t *random, double mean_us) {
+  return -log(1 - test_random_unit(random)) * mean_us;
+}
+
+static double mutex_wait(uint32_t *random) {
+  if (test_random_unit(random) >= MUTEX_CHANCE) {
+    return 0;
+  }
+  return test_random_unit(random) * MAX_MUTEX_WAIT_US;
+}
+
+static int compare_double(const void *a, const void *b) {
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+// Times are on the reference clock unless they're called local. The local
+// clock runs DRIFT_PPM fast and starts off by a bit more than a second.
+static double to_local(double time_us) {
+  return time_us * (1 + DRIFT_PPM / 1e6) + 1234567;
+}
+
+static sim_result_t
+simulate(double jitter_us, bool stamp_at_send, uint32_t seed) {
+  uint32_t random = seed * 2654435761u + 1;
+  clock_estimator_t estimator;
+  clock_estimator_reset(&estimator);
+
+  static double errors[EXCHANGES];
+  int error_count = 0;
+  for (int i = 0; i < EXCHANGES; i++) {
+    double time_us = (double)i * EXCHANGE_US;
+
+    // the follower stamps t1, then may wait for the mutex before sending
+    double t1 = to_local(time_us);
+    time_us += mutex_wait(&random);
+    if (stamp_at_send) {
+      t1 = to_local(time_us);
+    }
+    time_us += BASE_LATENCY_US + jitter(&random, jitter_us);
+    bool lost = test_random_unit(&random) < LOSS;
+
+    double t2 = time_us;
+    time_us += PROCESSING_US;
+    double t3 = time_us;
+    time_us += mutex_wait(&random);
+    if (stamp_at_send) {
+      t3 = time_us;
+    }
+    time_us += BASE_LATENCY_US + jitter(&random, jitter_us);
+    lost = lost || test_random_unit(&random) < LOSS;
+    double t4 = to_local(time_us);
+
+    if (!lost) {
+      CHECK(clock_estimator_add(
+          &estimator,
+          (int64_t)t1,
+          (int64_t)t2,
+          (int64_t)t3,
+          (int64_t)t4
+      ));
+    }
+
+    if (i >= SETTLE_EXCHANGES && estimator.valid) {
+      // the shared clock as the follower sees it, against the real one
+      double now_us = time_us;
+      double shared_us = to_local(now_us) + estimator.offset_us;
+      errors[error_count++] = fabs(shared_us - now_us);
+    }
+  }
+
+  sim_result_t result = {0};
+  for (int i = 0; i < error_count; i++) {
+    result.mean_us += errors[i] / error_count;
+  }
+  qsort(errors, error_count, sizeof(errors[0]), compare_double);
+  result.p95_us = errors[error_count * 95 / 100];
+  result.max_us = errors[error_count - 1];
+  return result;
+}
+
+static void report(const char *name, double jitter_us, sim_result_t result) {
+  printf(
+      "  %-16s jitter %5.0f us: offset error mean %6.0f us, p95 %6.0f us, "
+      "max %6.0f us, phase error at %.0f Hz p95 %.4f cycles\n",
+      name,
+      jitter_us,
+      result.mean_us,
+      result.p95_us,
+      result.max_us,
+      PHASE_RATE,
+      result.p95_us * PHASE_RATE / 1e6
+  );
+}
+
+// the worst of a few runs
+static sim_result_t simulate_seeds(double jitter_us, bool stamp_at_send) {
+  sim_result_t worst = {0};
+  for (uint32_t seed = 1; seed <= 10; seed++) {
+    sim_result_t result = simulate(jitter_us, stamp_at_send, seed);
+    worst.mean_us = fmax(worst.mean_us, result.mean_us);
+    worst.p95_us = fmax(worst.p95_us, result.p95_us);
+    worst.max_us = fmax(worst.max_us, result.max_us);
+  }
+  return worst;
+}
+
+// On a quiet channel the error is mostly the drift between the clocks: the
+// best exchange can be a few seconds old, and the offset only moves towards
+// it gradually. Jitter adds to that, but going by the exchange with the
+// shortest round trip keeps it to a fraction of a millisecond, far under a
+// DMX frame (~23 ms).
+static void error_stays_small() {
+  for (double jitter_us = 100; jitter_us <= 3200; jitter_us *= 2) {
+    sim_result_t result = simulate_seeds(jitter_us, true);
+    report("stamped at send", jitter_us, result);
+    CHECK_MSG(
+        result.p95_us < 400 + jitter_us / 3,
+        "p95 %.0f us with %.0f us jitter",
+        result.p95_us,
+        jitter_us
+    );
+    CHECK_MSG(
+        result.max_us < 700 + jitter_us * 2 / 3,
+        "max %.0f us with %.0f us jitter",
+        result.max_us,
+        jitter_us
+    );
+  }
+}
+
+// Stamping before the send mutex counts the wait for another packet as time
+// on the air, on one side of the exchange only, which the estimator can't
+// tell apart from a genuinely asymmetric path.
+static void stamping_before_the_mutex_is_worse() {
+  for (double jitter_us = 400; jitter_us <= 1600; jitter_us *= 2) {
+    sim_result_t early = simulate_seeds(jitter_us, false);
+    sim_result_t at_send = simulate_seeds(jitter_us, true);
+    report("stamped early", jitter_us, early);
+    report("stamped at send", jitter_us, at_send);
+    CHECK_MSG(
+        at_send.p95_us < early.p95_us && at_send.max_us < early.max_us,
+        "p95 %.0f us stamped at send, %.0f us stamped early",
+        at_send.p95_us,
+        early.p95_us
+    );
+  }
+}
+
+int main() {
+  RUN(error_stays_small);
+  RUN(stamping_before_the_mutex_is_worse);
+  return 0;
+}
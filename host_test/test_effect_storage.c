@@ -0,0 +1,266 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "blob_cache.h"
+#include "blob_index.h"
+#include "dmxbox_storage.h"
+#include "effect_storage.h"
+#include "esp_log.h"
+#include "host_test.h"
+#include "nvs.h"
+
+// Effects stored in every layout there has been, from before waveforms to
+// the versioned format. Legacy blobs have to read as what they held and be
+// rewritten once, and effects written now have to read back as they were.
+
+#define EFFECTS_NS "dmxbox/effect"
+#define FORMAT_VERSION 1
+#define FLUSH_MS 5000
+
+// as in effect_storage.c, newest first
+static const size_t legacy_header_sizes[] = {
+    offsetof(dmxbox_effect_t, step_count),
+    offsetof(dmxbox_effect_t, type),
+    offsetof(dmxbox_effect_t, priority),
+    offsetof(dmxbox_effect_t, beats),
+    offsetof(dmxbox_effect_t, start),
+};
+#define LAYOUT_COUNT (sizeof(legacy_header_sizes) / sizeof(size_t))
+
+static const size_t header_size = offsetof(dmxbox_effect_t, step_count);
+
+static size_t encoded_size(size_t step_count) {
+  return 1 + header_size + (1 + step_count) * sizeof(uint16_t);
+}
+
+static void reset_storage() {
+  CHECK(dmxbox_storage_flush(FLUSH_MS) == ESP_OK);
+  fake_nvs_reset();
+  blob_index_init();
+  blob_cache_clear();
+}
+
+// every byte of the header something, so a field that isn't copied shows
+static dmxbox_effect_t *random_effect(size_t step_count, uint32_t *random) {
+  dmxbox_effect_t *effect = dmxbox_effect_alloc(step_count);
+  CHECK(effect);
+  uint8_t *bytes = (uint8_t *)effect;
+  for (size_t i = 0; i < header_size; i++) {
+    bytes[i] = test_random(random) | 1;
+  }
+  effect->name[sizeof(effect->name) - 1] = 0;
+  for (size_t i = 0; i < step_count; i++) {
+    effect->steps[i] = test_random(random);
+  }
+  return effect;
+}
+
+static void key_for(uint16_t id, char key[NVS_KEY_NAME_MAX_SIZE]) {
+  CHECK(snprintf(key, NVS_KEY_NAME_MAX_SIZE, "%x", id) < NVS_KEY_NAME_MAX_SIZE);
+}
+
+// writes straight to NVS, like a box that ran an older version did
+static void put_legacy(uint16_t id, const dmxbox_effect_t *effect, int layout) {
+  size_t legacy_header_size = legacy_header_sizes[layout];
+  size_t steps_size = effect->step_count * sizeof(uint16_t);
+  size_t size = legacy_header_size + sizeof(size_t) + steps_size;
+  uint8_t *blob = malloc(size);
+  CHECK(blob);
+  memcpy(blob, effect, legacy_header_size);
+  memcpy(blob + legacy_header_size, &effect->step_count, sizeof(size_t));
+  memcpy(blob + legacy_header_size + sizeof(size_t), effect->steps, steps_size);
+
+  nvs_handle_t storage;
+  char key[NVS_KEY_NAME_MAX_SIZE];
+  key_for(id, key);
+  CHECK(nvs_open(EFFECTS_NS, NVS_READWRITE, &storage) == ESP_OK);
+  CHECK(nvs_set_blob(storage, key, blob, size) == ESP_OK);
+  CHECK(nvs_set_u16(storage, "next_id", id + 1) == ESP_OK);
+  nvs_close(storage);
+  free(blob);
+}
+
+// what made it to NVS, to be free()d
+static uint8_t *get_raw(uint16_t id, size_t *size) {
+  CHECK(dmxbox_storage_flush(FLUSH_MS) == ESP_OK);
+  nvs_handle_t storage;
+  char key[NVS_KEY_NAME_MAX_SIZE];
+  key_for(id, key);
+  CHECK(nvs_open(EFFECTS_NS, NVS_READONLY, &storage) == ESP_OK);
+  CHECK(nvs_get_blob(storage, key, NULL, size) == ESP_OK);
+  uint8_t *blob = malloc(*size);
+  CHECK(blob);
+  CHECK(nvs_get_blob(storage, key, blob, size) == ESP_OK);
+  nvs_close(storage);
+  return blob;
+}
+
+// the fields up to copied_size are the written ones, the rest are zero
+static void expect_effect(
+    const dmxbox_effect_t *read,
+    const dmxbox_effect_t *written,
+    size_t copied_size
+) {
+  const uint8_t *bytes = (const uint8_t *)read;
+  CHECK(!memcmp(read, written, copied_size));
+  for (size_t i = copied_size; i < header_size; i++) {
+    CHECK_MSG(!bytes[i], "header byte %zu is %u", i, bytes[i]);
+  }
+  CHECK(read->step_count == written->step_count);
+  CHECK(!memcmp(
+      read->steps,
+      written->steps,
+      written->step_count * sizeof(uint16_t)
+  ));
+}
+
+static void expect_encoded(uint16_t id, size_t step_count) {
+  size_t size;
+  uint8_t *blob = get_raw(id, &size);
+  CHECK_MSG(
+      blob[0] == FORMAT_VERSION && size >= encoded_size(step_count),
+      "effect %u is %zu bytes, version %u",
+      id,
+      size,
+      blob[0]
+  );
+  free(blob);
+}
+
+static void legacy_layouts_are_migrated_once() {
+  uint32_t random = 11;
+  for (int layout = 0; layout < LAYOUT_COUNT; layout++) {
+    reset_storage();
+    size_t step_count = layout * 3;
+    dmxbox_effect_t *written = random_effect(step_count, &random);
+    put_legacy(1, written, layout);
+    blob_index_init();
+
+    dmxbox_effect_t *read;
+    CHECK(dmxbox_effect_get(1, &read) == ESP_OK);
+    expect_effect(read, written, legacy_header_sizes[layout]);
+    free(read);
+    expect_encoded(1, step_count);
+
+    // the rewrite holds the same, and reading it writes nothing more
+    fake_nvs_stats_t before = fake_nvs_get_stats();
+    CHECK(dmxbox_effect_get(1, &read) == ESP_OK);
+    expect_effect(read, written, legacy_header_sizes[layout]);
+    free(read);
+    CHECK(dmxbox_storage_flush(FLUSH_MS) == ESP_OK);
+    fake_nvs_stats_t after = fake_nvs_get_stats();
+    CHECK_MSG(
+        after.sets == before.sets,
+        "layout %d migrated again",
+        layout
+    );
+    free(written);
+  }
+}
+
+static void listing_migrates_too() {
+  reset_storage();
+  uint32_t random = 5;
+  dmxbox_effect_t *written[LAYOUT_COUNT];
+  for (int layout = 0; layout < LAYOUT_COUNT; layout++) {
+    written[layout] = random_effect(layout + 1, &random);
+    put_legacy(layout + 1, written[layout], layout);
+  }
+  blob_index_init();
+
+  dmxbox_storage_entry_t page[LAYOUT_COUNT];
+  uint16_t count = LAYOUT_COUNT;
+  CHECK(dmxbox_effect_list(0, &count, page) == ESP_OK);
+  CHECK(count == LAYOUT_COUNT);
+  for (int layout = 0; layout < LAYOUT_COUNT; layout++) {
+    CHECK(page[layout].id == layout + 1);
+    expect_effect(
+        page[layout].data,
+        written[layout],
+        legacy_header_sizes[layout]
+    );
+    free(page[layout].data);
+    expect_encoded(layout + 1, layout + 1);
+    free(written[layout]);
+  }
+}
+
+// A blob in a format this version doesn't know is refused rather than read
+// as something it isn't
+static void unknown_formats_are_refused() {
+  reset_storage();
+  uint32_t random = 9;
+  dmxbox_effect_t *written = random_effect(4, &random);
+  uint16_t id;
+  CHECK(dmxbox_effect_create(written, &id) == ESP_OK);
+  size_t size;
+  uint8_t *blob = get_raw(id, &size);
+
+  nvs_handle_t storage;
+  char key[NVS_KEY_NAME_MAX_SIZE];
+  key_for(id, key);
+  CHECK(nvs_open(EFFECTS_NS, NVS_READWRITE, &storage) == ESP_OK);
+  blob[0] = FORMAT_VERSION + 1;
+  CHECK(nvs_set_blob(storage, key, blob, size) == ESP_OK);
+  blob_cache_clear();
+  dmxbox_effect_t *read;
+  esp_log_level_set("*", ESP_LOG_NONE);
+  CHECK(dmxbox_effect_get(id, &read) == ESP_ERR_INVALID_VERSION);
+
+  // and so is one of the right version, but cut short
+  blob[0] = FORMAT_VERSION;
+  CHECK(nvs_set_blob(storage, key, blob, size - 1) == ESP_OK);
+  blob_cache_clear();
+  CHECK(dmxbox_effect_get(id, &read) == ESP_ERR_INVALID_SIZE);
+  esp_log_level_set("*", ESP_LOG_ERROR);
+  nvs_close(storage);
+  free(blob);
+  free(written);
+}
+
+// Effects written now read back as written, without being rewritten
+static void round_trips() {
+  reset_storage();
+  uint32_t random = 3;
+  for (int i = 0; i < 200; i++) {
+    size_t step_count = test_random(&random) % 64;
+    dmxbox_effect_t *written = random_effect(step_count, &random);
+    uint16_t id;
+    CHECK(dmxbox_effect_create(written, &id) == ESP_OK);
+    if (i % 2) {
+      CHECK(dmxbox_storage_flush(FLUSH_MS) == ESP_OK);
+      blob_cache_clear();
+    }
+    dmxbox_effect_t *read;
+    CHECK(dmxbox_effect_get(id, &read) == ESP_OK);
+    expect_effect(read, written, header_size);
+    free(read);
+    free(written);
+  }
+
+  CHECK(dmxbox_storage_flush(FLUSH_MS) == ESP_OK);
+  blob_cache_clear();
+  uint32_t sets = fake_nvs_get_stats().sets;
+  dmxbox_storage_entry_t page[16];
+  for (uint16_t skip = 0; skip < 200; skip += 16) {
+    uint16_t count = 16;
+    CHECK(dmxbox_effect_list(skip, &count, page) == ESP_OK);
+    for (uint16_t i = 0; i < count; i++) {
+      free(page[i].data);
+    }
+  }
+  CHECK(dmxbox_storage_flush(FLUSH_MS) == ESP_OK);
+  CHECK(fake_nvs_get_stats().sets == sets);
+}
+
+int main() {
+  dmxbox_storage_init();
+  RUN(legacy_layouts_are_migrated_once);
+  RUN(listing_migrates_too);
+  RUN(unknown_formats_are_refused);
+  RUN(round_trips);
+  return 0;
+}
@@ -0,0 +1,533 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "blob_cache.h"
+#include "blob_index.h"
+#include "dmxbox_const.h"
+#include "dmxbox_storage.h"
+#include "effect_step_storage.h"
+#include "effect_storage.h"
+#include "engine.h"
+#include "esp_log.h"
+#include "host_test.h"
+#include "nvs.h"
+
+// Shows stored the way the web UI stores them, loaded and run by the engine
+// on a simulated clock, with scripted control channels, tempo and timecode.
+// Every tick's 512 slots are compared with the golden files, so any change
+// to what a show looks like (or when) shows up as the first tick that
+// differs:
+//   test_effects <golden dir>             compares
+//   test_effects --update <golden dir>    rewrites the golden files
+//   test_effects --benchmark              ticks per second by show size
+
+#define FLUSH_MS 5000
+
+// control channels, out of the way of the outputs
+#define LEVEL_CHANNEL 501
+#define RATE_CHANNEL 502
+
+typedef struct scenario {
+  const char *name;
+  void (*build)();
+  int seconds;
+  int tick_hz;
+
+  // the control universe at the time, all zero if NULL
+  void (*controls)(int64_t time_us, uint8_t universe[DMX_CHANNEL_COUNT]);
+  // the tempo clock, 0 if NULL
+  double (*beats)(int64_t time_us);
+  // whether timecode runs, and where, none if NULL
+  bool (*timecode)(int64_t time_us, int64_t *show_time_us);
+} scenario_t;
+
+static void reset_storage() {
+  CHECK(dmxbox_storage_flush(FLUSH_MS) == ESP_OK);
+  fake_nvs_reset();
+  blob_index_init();
+  blob_cache_clear();
+}
+
+// Building shows
+
+static dmxbox_effect_t *new_effect(size_t step_count, uint8_t type) {
+  dmxbox_effect_t *effect = dmxbox_effect_alloc(step_count);
+  CHECK(effect);
+  memset(effect, 0, offsetof(dmxbox_effect_t, step_count));
+  effect->type = type;
+  effect->level_channel.index = LEVEL_CHANNEL;
+  for (size_t i = 0; i < step_count; i++) {
+    effect->steps[i] = i + 1;
+  }
+  return effect;
+}
+
+static uint16_t store_effect(dmxbox_effect_t *effect) {
+  uint16_t id;
+  CHECK(dmxbox_effect_create(effect, &id) == ESP_OK);
+  free(effect);
+  return id;
+}
+
+// count channels from first on, all at level
+static void store_step(
+    uint16_t effect_id,
+    uint16_t step_id,
+    const uint32_t timing[4], // time, in, dwell, out
+    uint16_t first,
+    size_t count,
+    uint8_t level
+) {
+  dmxbox_effect_step_t *step = dmxbox_effect_step_alloc(count);
+  CHECK(step);
+  step->time = timing[0];
+  step->in = timing[1];
+  step->dwell = timing[2];
+  step->out = timing[3];
+  step->channel_count = count;
+  for (size_t i = 0; i < count; i++) {
+    step->channels[i].channel.universe.address = 0;
+    step->channels[i].channel.index = first + i;
+    step->channels[i].level = level;
+  }
+  CHECK(dmxbox_effect_step_set(effect_id, step_id, step) == ESP_OK);
+  free(step);
+}
+
+// A chase across step_count groups of width channels, fading between them
+static uint16_t store_chase(
+    dmxbox_effect_t *effect,
+    uint16_t first,
+    uint16_t width,
+    uint8_t level
+) {
+  static const uint32_t timing[] = {500, 200, 200, 300};
+  size_t step_count = effect->step_count;
+  uint16_t id = store_effect(effect);
+  for (size_t i = 0; i < step_count; i++) {
+    store_step(id, i + 1, timing, first + i * width, width, level);
+  }
+  return id;
+}
+
+static uint16_t store_waveform(
+    dmxbox_effect_t *effect,
+    uint16_t first,
+    uint16_t count
+) {
+  static const uint32_t timing[] = {0, 0, 0, 0};
+  uint16_t id = store_effect(effect);
+  store_step(id, 1, timing, first, count, 255);
+  return id;
+}
+
+// Scenarios
+
+static void build_chase() {
+  dmxbox_effect_t *chase = new_effect(3, dmxbox_effect_type_chase);
+  chase->rate_channel.index = RATE_CHANNEL;
+  store_chase(chase, 1, 2, 255);
+}
+
+// faded in, sped up, cut and brought back from the start
+static void chase_controls(int64_t time_us, uint8_t universe[]) {
+  uint8_t level = time_us < 1000000 ? time_us * 255 / 1000000 : 255;
+  if (time_us >= 3000000 && time_us < 3500000) {
+    level = 0;
+  }
+  universe[LEVEL_CHANNEL - 1] = level;
+  universe[RATE_CHANNEL - 1] = time_us < 2000000 ? 127 : 180;
+}
+
+static void build_waveforms() {
+  static const uint32_t periods[] = {1000, 750, 500, 1200, 250};
+  for (int shape = 0; shape < dmxbox_waveform_shape_count; shape++) {
+    dmxbox_effect_t *effect = new_effect(1, dmxbox_effect_type_waveform);
+    effect->waveform.shape = shape;
+    effect->waveform.period = periods[shape];
+    effect->waveform.spread = shape * 90;
+    effect->waveform.size = 255 - shape * 30;
+    effect->waveform.offset = 128;
+    store_waveform(effect, 1 + shape * 4, 4);
+  }
+}
+
+static void full_level_controls(int64_t time_us, uint8_t universe[]) {
+  universe[LEVEL_CHANNEL - 1] = 255;
+}
+
+// Each blend mode over a base chase, brought in one after another on their
+// own faders
+static void build_blend() {
+  static const uint32_t hold[] = {1000, 0, 0, 0};
+
+  dmxbox_effect_t *base = new_effect(2, dmxbox_effect_type_chase);
+  store_chase(base, 1, 4, 200);
+
+  for (int blend = dmxbox_effect_blend_ltp; blend < dmxbox_effect_blend_count;
+       blend++) {
+    dmxbox_effect_t *effect = new_effect(1, dmxbox_effect_type_chase);
+    effect->level_channel.index = LEVEL_CHANNEL + blend;
+    effect->priority = blend;
+    effect->blend = blend;
+    uint16_t id = store_effect(effect);
+    store_step(id, 1, hold, 1 + blend, 4, 100);
+  }
+
+  // the same priority as the add, composited after it as it's later in the
+  // show
+  dmxbox_effect_t *tie = new_effect(1, dmxbox_effect_type_chase);
+  tie->priority = dmxbox_effect_blend_add;
+  tie->blend = dmxbox_effect_blend_ltp;
+  uint16_t id = store_effect(tie);
+  store_step(id, 1, hold, 4, 1, 10);
+}
+
+static void blend_controls(int64_t time_us, uint8_t universe[]) {
+  universe[LEVEL_CHANNEL - 1] = 255;
+  for (int blend = dmxbox_effect_blend_ltp; blend < dmxbox_effect_blend_count;
+       blend++) {
+    int64_t start_us = blend * 750000;
+    universe[LEVEL_CHANNEL + blend - 1] =
+        time_us < start_us ? 0 : (time_us - start_us) / 2000 % 256;
+  }
+}
+
+static void build_tempo() {
+  dmxbox_effect_t *chase = new_effect(4, dmxbox_effect_type_chase);
+  chase->beats = 2;
+  store_chase(chase, 1, 1, 255);
+
+  dmxbox_effect_t *pulse = new_effect(1, dmxbox_effect_type_waveform);
+  pulse->beats = 1;
+  pulse->waveform.shape = dmxbox_waveform_saw;
+  pulse->waveform.size = 255;
+  pulse->waveform.offset = 128;
+  store_waveform(pulse, 10, 1);
+}
+
+// 120 bpm, then 150 from 2 s
+static double tempo_beats(int64_t time_us) {
+  if (time_us < 2000000) {
+    return time_us * 120 / 60e6;
+  }
+  return 4 + (time_us - 2000000) * 150 / 60e6;
+}
+
+static void build_timecode() {
+  dmxbox_effect_t *timed = new_effect(2, dmxbox_effect_type_chase);
+  timed->level_channel.index = 0;
+  timed->start.set = 1;
+  timed->start.ms = 1000;
+  timed->end.set = 1;
+  timed->end.ms = 3000;
+  store_chase(timed, 1, 2, 255);
+
+  // no end, and at its fader's level rather than full
+  dmxbox_effect_t *open = new_effect(1, dmxbox_effect_type_waveform);
+  open->start.set = 1;
+  open->start.ms = 500;
+  open->waveform.size = 255;
+  open->waveform.offset = 128;
+  store_waveform(open, 10, 2);
+}
+
+// runs from 0 at 0.5 s, seeks back to 1.5 s of show time at 2.5 s and
+// stops at 3.5 s
+static bool timecode_at(int64_t time_us, int64_t *show_time_us) {
+  if (time_us < 500000 || time_us >= 3500000) {
+    return false;
+  }
+  if (time_us < 2500000) {
+    *show_time_us = time_us - 500000;
+  } else {
+    *show_time_us = 1500000 + time_us - 2500000;
+  }
+  return true;
+}
+
+static const scenario_t scenarios[] = {
+    {"chase", build_chase, 4, 40, chase_controls},
+    {"waveforms", build_waveforms, 3, 50, full_level_controls},
+    {"blend", build_blend, 4, 40, blend_controls},
+    {"tempo", build_tempo, 4, 44, full_level_controls, tempo_beats},
+    {"timecode", build_timecode, 4, 40, full_level_controls, NULL, timecode_at},
+};
+#define SCENARIO_COUNT (sizeof(scenarios) / sizeof(scenario_t))
+
+// Running
+
+typedef struct simulation {
+  engine_t engine;
+  uint16_t *control_channels;
+  uint8_t *control_values;
+  size_t control_count;
+} simulation_t;
+
+static void simulation_start(simulation_t *sim, void (*build)()) {
+  reset_storage();
+  build();
+  CHECK(dmxbox_storage_flush(FLUSH_MS) == ESP_OK);
+
+  // there's no show image yet, which it complains about
+  memset(sim, 0, sizeof(simulation_t));
+  esp_log_level_set("*", ESP_LOG_NONE);
+  show_load(&sim->engine.show);
+  esp_log_level_set("*", ESP_LOG_ERROR);
+  CHECK(sim->engine.show.effect_count);
+  CHECK(engine_start(&sim->engine));
+
+  size_t effect_count = sim->engine.show.effect_count;
+  sim->control_channels = calloc(effect_count * 2, sizeof(uint16_t));
+  sim->control_values = calloc(effect_count * 2, sizeof(uint8_t));
+  CHECK(sim->control_channels && sim->control_values);
+  sim->control_count =
+      engine_assign_controls(&sim->engine, sim->control_channels);
+}
+
+static void simulation_stop(simulation_t *sim) {
+  engine_stop(&sim->engine);
+  free(sim->control_channels);
+  free(sim->control_values);
+}
+
+static void simulation_set_controls(
+    simulation_t *sim,
+    const uint8_t universe[DMX_CHANNEL_COUNT]
+) {
+  for (size_t i = 0; i < sim->control_count; i++) {
+    sim->control_values[i] = universe[sim->control_channels[i] - 1];
+  }
+}
+
+static int64_t tick_time_us(int tick, int tick_hz) {
+  return (int64_t)tick * 1000000 / tick_hz;
+}
+
+// the time, then the slots up to the last one that's lit, in hex
+static void dump_tick(FILE *out, int64_t time_us, const uint8_t *output) {
+  int count = DMX_CHANNEL_COUNT;
+  while (count && !output[count - 1]) {
+    count--;
+  }
+  fprintf(out, "%lld", (long long)time_us);
+  for (int i = 0; i < count; i++) {
+    fprintf(out, " %02x", output[i]);
+  }
+  fprintf(out, "\n");
+}
+
+// the dump of a scenario, to be free()d
+static char *run_scenario(const scenario_t *scenario) {
+  simulation_t sim;
+  simulation_start(&sim, scenario->build);
+
+  char *dump;
+  size_t dump_size;
+  FILE *out = open_memstream(&dump, &dump_size);
+  CHECK(out);
+
+  int64_t last_time_us = 0;
+  for (int tick = 0; tick < scenario->seconds * scenario->tick_hz; tick++) {
+    int64_t time_us = tick_time_us(tick, scenario->tick_hz);
+    uint8_t universe[DMX_CHANNEL_COUNT] = {0};
+    if (scenario->controls) {
+      scenario->controls(time_us, universe);
+    }
+    simulation_set_controls(&sim, universe);
+
+    engine_input_t input = {
+        .current_time_us = time_us,
+        .time_increment_us = time_us - last_time_us,
+        .control_values = sim.control_values,
+        .beats = scenario->beats ? scenario->beats(time_us) : 0,
+    };
+    input.timecode =
+        scenario->timecode && scenario->timecode(time_us, &input.show_time_us);
+
+    uint8_t output[DMX_CHANNEL_COUNT];
+    engine_tick(&sim.engine, &input, output);
+    dump_tick(out, time_us, output);
+    last_time_us = time_us;
+  }
+
+  fclose(out);
+  simulation_stop(&sim);
+  return dump;
+}
+
+static char *golden_path(const char *dir, const scenario_t *scenario) {
+  static char path[1024];
+  CHECK(snprintf(path, sizeof(path), "%s/%s.txt", dir, scenario->name) <
+        sizeof(path));
+  return path;
+}
+
+static char *read_file(const char *path) {
+  FILE *file = fopen(path, "r");
+  CHECK_MSG(file, "can't open %s, run with --update to create it", path);
+  CHECK(!fseek(file, 0, SEEK_END));
+  long size = ftell(file);
+  CHECK(size >= 0);
+  rewind(file);
+  char *contents = malloc(size + 1);
+  CHECK(contents);
+  CHECK(fread(contents, 1, size, file) == size);
+  contents[size] = 0;
+  fclose(file);
+  return contents;
+}
+
+static size_t line_length(const char *line) {
+  const char *end = strchr(line, '\n');
+  return end ? end - line : strlen(line);
+}
+
+static void compare_with_golden(
+    const scenario_t *scenario,
+    const char *path,
+    const char *dump
+) {
+  char *golden = read_file(path);
+  const char *expected = golden;
+  const char *actual = dump;
+  for (int line = 1; *expected || *actual; line++) {
+    size_t expected_length = line_length(expected);
+    size_t actual_length = line_length(actual);
+    CHECK_MSG(
+        expected_length == actual_length &&
+            !memcmp(expected, actual, actual_length),
+        "%s differs from %s at line %d:\nexpected: %.*s\nactual:   %.*s",
+        scenario->name,
+        path,
+        line,
+        (int)expected_length,
+        expected,
+        (int)actual_length,
+        actual
+    );
+    expected += expected_length + (expected[expected_length] == '\n');
+    actual += actual_length + (actual[actual_length] == '\n');
+  }
+  free(golden);
+}
+
+static void run_scenarios(const char *dir, bool update) {
+  for (size_t i = 0; i < SCENARIO_COUNT; i++) {
+    const scenario_t *scenario = &scenarios[i];
+    printf("%s\n", scenario->name);
+    char *dump = run_scenario(scenario);
+    const char *path = golden_path(dir, scenario);
+    if (update) {
+      FILE *file = fopen(path, "w");
+      CHECK_MSG(file, "can't write %s", path);
+      CHECK(fputs(dump, file) >= 0);
+      fclose(file);
+    } else {
+      compare_with_golden(scenario, path, dump);
+    }
+
+    // the same show and inputs have to give the same output every time
+    char *again = run_scenario(scenario);
+    CHECK_MSG(!strcmp(dump, again), "%s isn't repeatable", scenario->name);
+    free(again);
+    free(dump);
+  }
+}
+
+// Benchmark: random shows of chases and waveforms, half of them layered
+// with a blend mode, all at full level
+
+#define BENCHMARK_TICKS 2000
+#define BENCHMARK_HZ 44
+
+static size_t benchmark_effect_count;
+
+static void build_benchmark() {
+  uint32_t random = 7;
+  for (size_t i = 0; i < benchmark_effect_count; i++) {
+    uint16_t first = 1 + test_random(&random) % 400;
+    dmxbox_effect_t *effect;
+    if (test_random(&random) % 3) {
+      effect = new_effect(2 + test_random(&random) % 3, 0);
+      effect->blend = i % 2 ? test_random(&random) % dmxbox_effect_blend_count
+                            : dmxbox_effect_blend_htp;
+      effect->priority = test_random(&random) % 4;
+      store_chase(effect, first, 1 + test_random(&random) % 8, 255);
+    } else {
+      effect = new_effect(1, dmxbox_effect_type_waveform);
+      effect->waveform.shape =
+          test_random(&random) % dmxbox_waveform_shape_count;
+      effect->waveform.period = 250 + test_random(&random) % 2000;
+      effect->waveform.spread = 360;
+      effect->waveform.size = 255;
+      effect->waveform.offset = 128;
+      store_waveform(effect, first, 4 + test_random(&random) % 16);
+    }
+  }
+}
+
+static void run_benchmark(size_t effect_count) {
+  benchmark_effect_count = effect_count;
+  simulation_t sim;
+  simulation_start(&sim, build_benchmark);
+  CHECK(sim.engine.show.effect_count == effect_count);
+
+  uint8_t universe[DMX_CHANNEL_COUNT] = {0};
+  full_level_controls(0, universe);
+  simulation_set_controls(&sim, universe);
+
+  uint8_t output[DMX_CHANNEL_COUNT];
+  size_t lit_ticks = 0;
+  double start_us = test_time_us();
+  for (int tick = 0; tick < BENCHMARK_TICKS; tick++) {
+    engine_input_t input = {
+        .current_time_us = tick_time_us(tick, BENCHMARK_HZ),
+        .time_increment_us = tick ? tick_time_us(1, BENCHMARK_HZ) : 0,
+        .control_values = sim.control_values,
+    };
+    engine_tick(&sim.engine, &input, output);
+    for (int i = 0; i < DMX_CHANNEL_COUNT; i++) {
+      if (output[i]) {
+        lit_ticks++;
+        break;
+      }
+    }
+  }
+  double elapsed_us = test_time_us() - start_us;
+
+  printf(
+      "%5zu effects: %8.0f ticks/s, %7.1f us per tick\n",
+      effect_count,
+      BENCHMARK_TICKS / elapsed_us * 1e6,
+      elapsed_us / BENCHMARK_TICKS
+  );
+  CHECK_MSG(lit_ticks == BENCHMARK_TICKS, "only %zu ticks lit", lit_ticks);
+  simulation_stop(&sim);
+}
+
+int main(int argc, char **argv) {
+  dmxbox_storage_init();
+  engine_init_tables();
+
+  if (argc == 2 && !strcmp(argv[1], "--benchmark")) {
+    static const size_t effect_counts[] = {100, 500, 1000};
+    for (size_t i = 0; i < sizeof(effect_counts) / sizeof(size_t); i++) {
+      run_benchmark(effect_counts[i]);
+    }
+    return 0;
+  }
+
+  bool update = argc == 3 && !strcmp(argv[1], "--update");
+  CHECK_MSG(
+      argc == 2 || update,
+      "usage: %s [--update] <golden dir> | --benchmark",
+      argv[0]
+  );
+  run_scenarios(argv[argc - 1], update);
+  return 0;
+}
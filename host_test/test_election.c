@@ -0,0 +1,434 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "election.h"
+#include "host_test.h"
+
+// Boxes running one distributed effect over a radio that loses and delays
+// packets. The progress of the longest-serving leader is what the audience
+// sees, so it must never jump, and after every disturbance exactly one box
+// must end up leading with everybody else following it.
+
+#define MAX_NODES 8
+#define MAX_MESSAGES 512
+#define TICK_US 25000 // a DMX frame
+#define RATE 0.5      // cycles per second
+#define BASE_LATENCY_US 3000
+#define MAX_JITTER_US 4000
+#define PHASE_TOLERANCE 0.001 // of a cycle
+
+typedef struct node {
+  uint8_t mac[ELECTION_MAC_LEN];
+  bool powered;
+  bool fader_up;
+  election_t election;
+  double phase; // in cycles
+  bool sent;
+  uint8_t sent_priority;
+  int64_t sent_us;
+  int yields;
+  int elections;
+} node_t;
+
+typedef struct message {
+  int to;
+  int from;
+  uint8_t priority;
+  double phase;
+  int64_t send_us; // on the shared clock, which the followers compensate by
+  int64_t arrival_us;
+} message_t;
+
+typedef struct sim {
+  node_t nodes[MAX_NODES];
+  int node_count;
+  message_t messages[MAX_MESSAGES];
+  int message_count;
+  double loss;
+  uint32_t random;
+  int64_t time_us;
+
+  // the leader on stage, and where its progress should be
+  int stage;
+  bool stage_set;
+  double stage_phase;
+  double max_jump;
+
+  int64_t split_us;      // more than one box leading
+  int64_t leaderless_us; // faders up, but nobody leading
+} sim_t;
+
+static double cycle_difference(double a, double b) {
+  double difference = fmod(a - b, 1);
+  if (difference >= 0.5) {
+    difference -= 1;
+  } else if (difference < -0.5) {
+    difference += 1;
+  }
+  return difference;
+}
+
+static void sim_init(sim_t *sim, int node_count, double loss, uint32_t seed) {
+  memset(sim, 0, sizeof(*sim));
+  sim->node_count = node_count;
+  sim->loss = loss;
+  sim->random = seed * 2654435761u + 1;
+  sim->stage = -1;
+  for (int i = 0; i < node_count; i++) {
+    // node 0 has the lowest MAC, so it wins every tie
+    uint8_t mac[ELECTION_MAC_LEN] = {0x24, 0x6f, 0x28, 0, 0, 1 + i};
+    memcpy(sim->nodes[i].mac, mac, ELECTION_MAC_LEN);
+  }
+}
+
+static void sim_boot(sim_t *sim, int index, bool fader_up) {
+  node_t *node = &sim->nodes[index];
+  uint8_t mac[ELECTION_MAC_LEN];
+  memcpy(mac, node->mac, ELECTION_MAC_LEN);
+  memset(node, 0, sizeof(*node));
+  memcpy(node->mac, mac, ELECTION_MAC_LEN);
+  node->powered = true;
+  node->fader_up = fader_up;
+}
+
+static void sim_power_off(sim_t *sim, int index) {
+  sim->nodes[index].powered = false;
+}
+
+static void broadcast(sim_t *sim, int from) {
+  node_t *node = &sim->nodes[from];
+  for (int to = 0; to < sim->node_count; to++) {
+    if (to == from || test_random_unit(&sim->random) < sim->loss) {
+      continue;
+    }
+    CHECK(sim->message_count < MAX_MESSAGES);
+    sim->messages[sim->message_count++] = (message_t){
+        .to = to,
+        .from = from,
+        .priority = node->election.priority,
+        .phase = node->phase,
+        .send_us = sim->time_us,
+        .arrival_us = sim->time_us + BASE_LATENCY_US +
+                      test_random(&sim->random) % MAX_JITTER_US,
+    };
+  }
+  node->sent = true;
+  node->sent_priority = node->election.priority;
+  node->sent_us = sim->time_us;
+}
+
+static void deliver(sim_t *sim) {
+  int kept = 0;
+  for (int i = 0; i < sim->message_count; i++) {
+    message_t *message = &sim->messages[i];
+    if (message->arrival_us > sim->time_us) {
+      sim->messages[kept++] = *message;
+      continue;
+    }
+    node_t *node = &sim->nodes[message->to];
+    if (!node->powered) {
+      continue;
+    }
+    bool yielded;
+    if (election_hear(
+            &node->election,
+            node->mac,
+            sim->nodes[message->from].mac,
+            message->priority,
+            message->arrival_us,
+            &yielded
+        )) {
+      node->phase = message->phase +
+                    (sim->time_us - message->send_us) * RATE / 1000000;
+    }
+    node->yields += yielded;
+  }
+  sim->message_count = kept;
+}
+
+// the leader that has led the longest, or -1
+static int find_stage(sim_t *sim, int *leader_count) {
+  int stage = -1;
+  *leader_count = 0;
+  for (int i = 0; i < sim->node_count; i++) {
+    const node_t *node = &sim->nodes[i];
+    if (!node->powered || !node->election.is_leader) {
+      continue;
+    }
+    (*leader_count)++;
+    if (stage < 0 || node->election.leading_since_us <
+                         sim->nodes[stage].election.leading_since_us) {
+      stage = i;
+    }
+  }
+  return stage;
+}
+
+static void measure(sim_t *sim) {
+  int leader_count;
+  int stage = find_stage(sim, &leader_count);
+
+  bool faders_up = false;
+  for (int i = 0; i < sim->node_count; i++) {
+    faders_up |= sim->nodes[i].powered && sim->nodes[i].fader_up;
+  }
+  if (leader_count > 1) {
+    sim->split_us += TICK_US;
+  } else if (!leader_count && faders_up) {
+    sim->leaderless_us += TICK_US;
+  }
+
+  double expected = sim->stage_phase + TICK_US * RATE / 1000000;
+  sim->stage_phase = expected;
+  sim->stage = stage;
+  if (stage < 0) {
+    return;
+  }
+  double phase = sim->nodes[stage].phase;
+  if (sim->stage_set) {
+    double jump = fabs(cycle_difference(phase, expected));
+    if (jump > sim->max_jump) {
+      sim->max_jump = jump;
+    }
+  }
+  sim->stage_set = true;
+  sim->stage_phase = phase;
+}
+
+static void sim_step(sim_t *sim) {
+  sim->time_us += TICK_US;
+  for (int i = 0; i < sim->node_count; i++) {
+    if (sim->nodes[i].powered) {
+      sim->nodes[i].phase += TICK_US * RATE / 1000000;
+    }
+  }
+
+  deliver(sim);
+
+  for (int i = 0; i < sim->node_count; i++) {
+    node_t *node = &sim->nodes[i];
+    if (!node->powered) {
+      continue;
+    }
+    election_t *election = &node->election;
+    election_change_t change =
+        election_tick(election, node->mac, node->fader_up, sim->time_us);
+    if (change == election_elected) {
+      node->elections++;
+      node->sent = false; // sent right away
+    }
+    if (election->is_leader &&
+        (!node->sent || node->sent_priority != election->priority ||
+         node->sent_us + ELECTION_HEARTBEAT_US < sim->time_us)) {
+      broadcast(sim, i);
+    }
+  }
+
+  measure(sim);
+}
+
+static void sim_run(sim_t *sim, int64_t until_us) {
+  while (sim->time_us < until_us) {
+    sim_step(sim);
+  }
+}
+
+// Once the link has been clean for a few heartbeats, there's one leader,
+// and every other box follows it and is in step with it. A box that lost
+// enough heartbeats in a row may be leading on its own until then.
+static void check_converged(sim_t *sim) {
+  sim->loss = 0;
+  sim_run(sim, sim->time_us + 3 * ELECTION_HEARTBEAT_US);
+
+  int leader_count;
+  int stage = find_stage(sim, &leader_count);
+  CHECK_MSG(leader_count == 1, "%d leaders", leader_count);
+  const node_t *leader = &sim->nodes[stage];
+  for (int i = 0; i < sim->node_count; i++) {
+    const node_t *node = &sim->nodes[i];
+    if (i == stage || !node->powered) {
+      continue;
+    }
+    CHECK_MSG(
+        node->election.has_leader &&
+            !memcmp(node->election.leader_mac, leader->mac, ELECTION_MAC_LEN),
+        "node %d doesn't follow node %d",
+        i,
+        stage
+    );
+    CHECK_MSG(
+        fabs(cycle_difference(node->phase, leader->phase)) < PHASE_TOLERANCE,
+        "node %d is %f cycles off",
+        i,
+        cycle_difference(node->phase, leader->phase)
+    );
+  }
+}
+
+static void test_fresh_box_listens_first() {
+  sim_t sim;
+  sim_init(&sim, 1, 0, 1);
+  sim_boot(&sim, 0, true);
+  sim_run(&sim, ELECTION_LISTEN_US - TICK_US);
+  CHECK(!sim.nodes[0].election.is_leader);
+  sim_run(&sim, ELECTION_LISTEN_US + 2 * TICK_US);
+  CHECK(sim.nodes[0].election.is_leader);
+}
+
+// A box booting with its fader up, with a lower MAC than the leader, used to
+// claim the effect on its first tick and take it over from phase 0
+static void test_newcomer_follows_incumbent() {
+  sim_t sim;
+  sim_init(&sim, 3, 0, 1);
+  sim_boot(&sim, 1, true);
+  sim_run(&sim, 500000);
+  sim_boot(&sim, 2, true);
+  sim_run(&sim, 10000000);
+  CHECK(sim.nodes[1].election.is_leader);
+
+  sim_boot(&sim, 0, true);
+  sim_run(&sim, 30000000);
+
+  CHECK(sim.nodes[1].election.is_leader);
+  CHECK_MSG(!sim.nodes[1].yields, "%d yields", sim.nodes[1].yields);
+  CHECK(!sim.nodes[0].elections);
+  CHECK(!sim.split_us);
+  CHECK_MSG(sim.max_jump < PHASE_TOLERANCE, "jumped %f", sim.max_jump);
+  check_converged(&sim);
+}
+
+// Even when the newcomer misses every heartbeat while it listens and claims
+// the effect, the incumbent outranks it
+static void test_newcomer_under_loss() {
+  int claims = 0;
+  int64_t split_us = 0;
+  for (uint32_t seed = 1; seed <= 200; seed++) {
+    sim_t sim;
+    sim_init(&sim, 3, 0.3, seed);
+    sim_boot(&sim, 1, true);
+    sim_run(&sim, 500000);
+    sim_boot(&sim, 2, true);
+    sim_run(&sim, 10000000 + test_random(&sim.random) % 1000000);
+
+    sim_boot(&sim, 0, true);
+    sim_run(&sim, 40000000);
+
+    CHECK_MSG(sim.nodes[1].election.is_leader, "seed %u", seed);
+    CHECK_MSG(!sim.nodes[1].yields, "seed %u", seed);
+    CHECK_MSG(
+        sim.max_jump < PHASE_TOLERANCE,
+        "seed %u jumped %f",
+        seed,
+        sim.max_jump
+    );
+    check_converged(&sim);
+    claims += sim.nodes[0].elections > 0;
+    split_us += sim.split_us;
+  }
+  printf(
+      "  newcomer claimed the effect in %d of 200 runs, %lld ms split in all\n",
+      claims,
+      (long long)split_us / 1000
+  );
+}
+
+static void test_handover_on_fader_down() {
+  for (uint32_t seed = 1; seed <= 50; seed++) {
+    sim_t sim;
+    sim_init(&sim, 3, 0.1, seed);
+    sim_boot(&sim, 2, true);
+    sim_run(&sim, 5000000);
+    sim_boot(&sim, 0, true);
+    sim_boot(&sim, 1, true);
+    sim_run(&sim, 15000000);
+    CHECK_MSG(sim.nodes[2].election.is_leader, "seed %u", seed);
+
+    sim.nodes[2].fader_up = false;
+    sim_run(&sim, 25000000);
+
+    CHECK_MSG(!sim.nodes[2].election.is_leader, "seed %u", seed);
+    CHECK_MSG(
+        sim.max_jump < PHASE_TOLERANCE,
+        "seed %u jumped %f",
+        seed,
+        sim.max_jump
+    );
+    check_converged(&sim);
+  }
+}
+
+static void test_leader_powered_off() {
+  for (uint32_t seed = 1; seed <= 50; seed++) {
+    sim_t sim;
+    sim_init(&sim, 3, 0.2, seed);
+    sim_boot(&sim, 0, true);
+    sim_run(&sim, 5000000);
+    sim_boot(&sim, 1, true);
+    sim_boot(&sim, 2, true);
+    sim_run(&sim, 15000000);
+    CHECK_MSG(sim.nodes[0].election.is_leader, "seed %u", seed);
+
+    sim.leaderless_us = 0;
+    sim_power_off(&sim, 0);
+    sim_run(&sim, 30000000);
+
+    CHECK_MSG(
+        sim.leaderless_us <= ELECTION_TIMEOUT_US + 2 * ELECTION_HEARTBEAT_US,
+        "seed %u without a leader for %lld ms",
+        seed,
+        (long long)sim.leaderless_us / 1000
+    );
+    CHECK_MSG(
+        sim.max_jump < PHASE_TOLERANCE,
+        "seed %u jumped %f",
+        seed,
+        sim.max_jump
+    );
+    check_converged(&sim);
+  }
+}
+
+// Faders moving and boxes rebooting at random, then a quiet spell
+static void test_churn_converges() {
+  for (uint32_t seed = 1; seed <= 100; seed++) {
+    sim_t sim;
+    sim_init(&sim, 6, 0.3, seed);
+    for (int i = 0; i < sim.node_count; i++) {
+      sim_boot(&sim, i, test_random(&sim.random) & 1);
+    }
+    while (sim.time_us < 120000000) {
+      sim_run(&sim, sim.time_us + test_random(&sim.random) % 5000000);
+      int index = test_random(&sim.random) % sim.node_count;
+      switch (test_random(&sim.random) % 3) {
+      case 0:
+        sim.nodes[index].fader_up = !sim.nodes[index].fader_up;
+        break;
+      case 1:
+        sim_power_off(&sim, index);
+        break;
+      default:
+        sim_boot(&sim, index, test_random(&sim.random) & 1);
+        break;
+      }
+    }
+
+    if (!sim.nodes[0].powered) {
+      sim_boot(&sim, 0, true);
+    }
+    sim.nodes[0].fader_up = true;
+    sim_run(&sim, sim.time_us + 15000000);
+    check_converged(&sim);
+  }
+}
+
+int main() {
+  RUN(test_fresh_box_listens_first);
+  RUN(test_newcomer_follows_incumbent);
+  RUN(test_newcomer_under_loss);
+  RUN(test_handover_on_fader_down);
+  RUN(test_leader_powered_off);
+  RUN(test_churn_converges);
+  return 0;
+}
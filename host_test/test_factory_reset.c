@@ -0,0 +1,93 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "dmxbox_storage.h"
+#include "esp_partition.h"
+#include "host_test.h"
+#include "show_image_storage.h"
+
+// A factory reset runs at boot before storage is initialized, and has to
+// leave nothing behind. Every boot runs in a child process, with NVS starting
+// out empty like after the erase, so the show generation a stored image was
+// built from comes round again in the next boot.
+
+#define PARTITION_PATH "factory_reset_show.bin"
+#define SECTOR_SIZE 4096
+#define PARTITION_SIZE (8 * SECTOR_SIZE)
+#define FLUSH_MS 5000
+#define LAYOUT_VERSION 1
+
+static void boot(void (*run)()) {
+  fflush(stdout);
+  pid_t pid = fork();
+  CHECK(pid >= 0);
+  if (!pid) {
+    run();
+    fflush(stdout);
+    _exit(0);
+  }
+  int status;
+  CHECK(waitpid(pid, &status, 0) == pid);
+  CHECK_MSG(
+      WIFEXITED(status) && !WEXITSTATUS(status),
+      "boot failed with status %d",
+      status
+  );
+}
+
+static void store_image() {
+  dmxbox_storage_init();
+  dmxbox_show_image_t *image = dmxbox_show_image_alloc(64);
+  CHECK(image);
+  image->layout_version = LAYOUT_VERSION;
+  image->generation = dmxbox_show_generation();
+  memset(image->body, 0x5a, image->body_size);
+  CHECK(dmxbox_show_image_set(image) == ESP_OK);
+  CHECK(dmxbox_storage_flush(FLUSH_MS) == ESP_OK);
+
+  dmxbox_show_image_ref_t ref;
+  CHECK(dmxbox_show_image_open(LAYOUT_VERSION, &ref) == ESP_OK);
+  dmxbox_show_image_close(&ref);
+}
+
+static void expect_image(bool found) {
+  dmxbox_storage_init();
+  dmxbox_show_image_ref_t ref;
+  esp_err_t ret = dmxbox_show_image_open(LAYOUT_VERSION, &ref);
+  CHECK_MSG(
+      ret == (found ? ESP_OK : ESP_ERR_NOT_FOUND),
+      "opening the image: %s",
+      esp_err_to_name(ret)
+  );
+  if (ret == ESP_OK) {
+    dmxbox_show_image_close(&ref);
+  }
+}
+
+static void image_survives_a_reboot() { expect_image(true); }
+
+static void reset_then_boot() {
+  dmxbox_storage_factory_reset();
+  expect_image(false);
+}
+
+static void reset_erases_the_show_partition() {
+  fake_partition_create("show", PARTITION_PATH, PARTITION_SIZE, SECTOR_SIZE);
+  boot(store_image);
+  boot(image_survives_a_reboot);
+  boot(reset_then_boot);
+}
+
+// without a show partition the image lives in NVS, which goes anyway
+static void reset_without_a_show_partition() { boot(reset_then_boot); }
+
+int main() {
+  RUN(reset_without_a_show_partition);
+  RUN(reset_erases_the_show_partition);
+  unlink(PARTITION_PATH);
+  return 0;
+}
@@ -0,0 +1,268 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "esp_partition.h"
+#include "host_test.h"
+#include "show_partition.h"
+
+// The show partition on a file that stands in for flash. Every boot runs in
+// a child process, so a power cut is the child exiting part way through a
+// write and the next boot starts from what made it to the file, like after
+// a real reset.
+
+#define PARTITION_PATH "show_partition.bin"
+#define SECTOR_SIZE 4096
+#define PARTITION_SIZE (8 * SECTOR_SIZE)
+#define HALF_SIZE (PARTITION_SIZE / 2)
+#define HEADER_SIZE 16
+#define RECORD_PAYLOAD 1000 // a 1024-byte record, 16 to a half
+#define RECORDS_PER_HALF (HALF_SIZE / 1024)
+#define MAX_PAYLOAD (HALF_SIZE - HEADER_SIZE)
+
+static void create_partition() {
+  fake_partition_create("show", PARTITION_PATH, PARTITION_SIZE, SECTOR_SIZE);
+}
+
+// Runs one boot of the device: the partition is mounted and run is called.
+// Returns the exit status, which is FAKE_POWER_CUT_STATUS if the power was
+// cut and 0 if everything passed.
+static int boot(void (*run)(void *ctx), void *ctx) {
+  fflush(stdout);
+  pid_t pid = fork();
+  CHECK(pid >= 0);
+  if (!pid) {
+    CHECK(show_partition_init() == ESP_OK);
+    run(ctx);
+    fflush(stdout);
+    _exit(0);
+  }
+  int status;
+  CHECK(waitpid(pid, &status, 0) == pid);
+  return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+static void boot_ok(void (*run)(void *ctx), void *ctx) {
+  CHECK(boot(run, ctx) == 0);
+}
+
+// the payload of record n starts with n and is different for every n
+static void fill_payload(uint8_t *payload, uint32_t n, size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    payload[i] = (uint8_t)(n * 131 + i);
+  }
+  memcpy(payload, &n, size < sizeof(n) ? size : sizeof(n));
+}
+
+static esp_err_t append(uint32_t n, size_t size) {
+  static uint8_t payload[MAX_PAYLOAD];
+  fill_payload(payload, n, size);
+  return show_partition_append(payload, size);
+}
+
+static bool is_payload(const void *data, uint32_t n, size_t size) {
+  static uint8_t payload[MAX_PAYLOAD];
+  fill_payload(payload, n, size);
+  return !memcmp(data, payload, size);
+}
+
+static void expect_latest(uint32_t n, size_t size) {
+  const void *data;
+  size_t latest_size;
+  int pin;
+  CHECK(show_partition_get_latest(&data, &latest_size, &pin) == ESP_OK);
+  CHECK_MSG(
+      latest_size == size && is_payload(data, n, size),
+      "latest is %u bytes starting with %u, expected %u bytes of record %u",
+      (unsigned)latest_size,
+      latest_size >= 4 ? *(const uint32_t *)data : 0,
+      (unsigned)size,
+      n
+  );
+  show_partition_unpin(pin);
+}
+
+typedef struct records {
+  uint32_t first;
+  uint32_t last;
+  size_t size;
+} records_t;
+
+static void append_records(void *ctx) {
+  const records_t *records = ctx;
+  for (uint32_t n = records->first; n <= records->last; n++) {
+    CHECK(append(n, records->size) == ESP_OK);
+  }
+}
+
+static void expect_last_record(void *ctx) {
+  const records_t *records = ctx;
+  expect_latest(records->last, records->size);
+}
+
+static void expect_none(void *ctx) {
+  const void *data;
+  size_t size;
+  int pin;
+  CHECK(show_partition_get_latest(&data, &size, &pin) == ESP_ERR_NOT_FOUND);
+}
+
+static void clear(void *ctx) { CHECK(show_partition_clear() == ESP_OK); }
+
+static void latest_survives_a_reboot() {
+  create_partition();
+  boot_ok(expect_none, NULL);
+  boot_ok(append_records, &(records_t){1, 3, 100});
+  boot_ok(expect_last_record, &(records_t){1, 3, 100});
+  boot_ok(clear, NULL);
+  boot_ok(expect_none, NULL);
+  boot_ok(append_records, &(records_t){4, 4, 100});
+  boot_ok(expect_last_record, &(records_t){4, 4, 100});
+}
+
+typedef struct torn {
+  size_t cut_after;
+  records_t records;
+} torn_t;
+
+static void append_until_the_power_goes(void *ctx) {
+  const torn_t *torn = ctx;
+  fake_partition_cut_power_after(torn->cut_after);
+  append_records((void *)&torn->records);
+}
+
+// Cuts the power after every possible number of bytes of a record. The
+// record before has to be the latest after the reboot, and appending has to
+// carry on past whatever the cut left behind.
+static void torn_records_are_skipped() {
+  size_t payload = 40;
+  size_t written = HEADER_SIZE + payload;
+  for (size_t cut = 0; cut < written; cut++) {
+    create_partition();
+    boot_ok(append_records, &(records_t){1, 2, payload});
+    int status = boot(
+        append_until_the_power_goes,
+        &(torn_t){cut, {3, 3, payload}}
+    );
+    CHECK_MSG(status == FAKE_POWER_CUT_STATUS, "cut at %zu", cut);
+    boot_ok(expect_last_record, &(records_t){2, 2, payload});
+    boot_ok(append_records, &(records_t){4, 5, payload});
+    boot_ok(expect_last_record, &(records_t){5, 5, payload});
+  }
+  printf("  power cut at each of %zu bytes of a record\n", written);
+}
+
+// Cuts the power while the older half is being erased to make room. The
+// latest record is in the other half and has to survive, and the erase has
+// to be redone on the next append.
+static void torn_erases_are_redone() {
+  size_t cuts[] = {0, 1, SECTOR_SIZE - 1, SECTOR_SIZE, HALF_SIZE / 2,
+                   HALF_SIZE - 1};
+  uint32_t last = 2 * RECORDS_PER_HALF;
+  for (size_t i = 0; i < sizeof(cuts) / sizeof(cuts[0]); i++) {
+    create_partition();
+    boot_ok(append_records, &(records_t){1, last, RECORD_PAYLOAD});
+    int status = boot(
+        append_until_the_power_goes,
+        &(torn_t){cuts[i], {last + 1, last + 1, RECORD_PAYLOAD}}
+    );
+    CHECK_MSG(status == FAKE_POWER_CUT_STATUS, "cut at %zu", cuts[i]);
+    boot_ok(expect_last_record, &(records_t){last, last, RECORD_PAYLOAD});
+    boot_ok(append_records, &(records_t){last + 1, last + 2, RECORD_PAYLOAD});
+    boot_ok(
+        expect_last_record,
+        &(records_t){last + 2, last + 2, RECORD_PAYLOAD}
+    );
+  }
+}
+
+typedef struct sized_record {
+  uint32_t n;
+  size_t size;
+} sized_record_t;
+
+static void append_sized(void *ctx) {
+  const sized_record_t *record = ctx;
+  CHECK(append(record->n, record->size) == ESP_OK);
+}
+
+static void expect_sized(void *ctx) {
+  const sized_record_t *record = ctx;
+  expect_latest(record->n, record->size);
+}
+
+static void too_big_is_refused(void *ctx) {
+  CHECK(append(0, MAX_PAYLOAD + 1) == ESP_ERR_INVALID_SIZE);
+}
+
+// Records of random sizes, up to one that fills a half on its own, through
+// many rollovers and reboots
+static void latest_survives_half_rollovers() {
+  create_partition();
+  uint32_t random = 3;
+  size_t appended = 0;
+  uint32_t n;
+  for (n = 1; appended < 12 * HALF_SIZE; n++) {
+    size_t size = test_random(&random) % 4 ? test_random(&random) % 3000
+                                           : MAX_PAYLOAD;
+    sized_record_t record = {n, size};
+    boot_ok(append_sized, &record);
+    appended += HEADER_SIZE + size;
+    if (test_random(&random) % 3 == 0) {
+      boot_ok(expect_sized, &record);
+    }
+  }
+  boot_ok(too_big_is_refused, NULL);
+  printf("  %u records, about %zu halves\n", n - 1, appended / HALF_SIZE);
+}
+
+// Erasing a half while a record in it is pinned would pull the image out
+// from under whoever is reading it, so the append is refused until it's
+// unpinned.
+static void pinned_half_blocks_erase(void *ctx) {
+  append_records(&(records_t){1, RECORDS_PER_HALF, RECORD_PAYLOAD});
+
+  const void *data;
+  size_t size;
+  int pin;
+  CHECK(show_partition_get_latest(&data, &size, &pin) == ESP_OK);
+
+  // the other half isn't pinned, so filling it is fine
+  uint32_t last = 2 * RECORDS_PER_HALF;
+  append_records(&(records_t){RECORDS_PER_HALF + 1, last, RECORD_PAYLOAD});
+  expect_latest(last, RECORD_PAYLOAD);
+
+  CHECK(append(last + 1, RECORD_PAYLOAD) == ESP_ERR_INVALID_STATE);
+  CHECK(is_payload(data, RECORDS_PER_HALF, RECORD_PAYLOAD));
+  expect_latest(last, RECORD_PAYLOAD);
+
+  // a pin on the half being appended to doesn't get in the way
+  int latest_pin;
+  CHECK(show_partition_get_latest(&data, &size, &latest_pin) == ESP_OK);
+  show_partition_unpin(pin);
+  CHECK(append(last + 1, RECORD_PAYLOAD) == ESP_OK);
+  CHECK(is_payload(data, last, RECORD_PAYLOAD));
+  show_partition_unpin(latest_pin);
+  expect_latest(last + 1, RECORD_PAYLOAD);
+}
+
+static void pinned_half_is_not_erased() {
+  create_partition();
+  boot_ok(pinned_half_blocks_erase, NULL);
+  uint32_t last = 2 * RECORDS_PER_HALF + 1;
+  boot_ok(expect_last_record, &(records_t){last, last, RECORD_PAYLOAD});
+}
+
+int main() {
+  RUN(latest_survives_a_reboot);
+  RUN(torn_records_are_skipped);
+  RUN(torn_erases_are_redone);
+  RUN(latest_survives_half_rollovers);
+  RUN(pinned_half_is_not_erased);
+  unlink(PARTITION_PATH);
+  return 0;
+}
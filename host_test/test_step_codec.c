@@ -0,0 +1,481 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "blob_cache.h"
+#include "blob_index.h"
+#include "dmxbox_const.h"
+#include "dmxbox_storage.h"
+#include "effect_step_storage.h"
+#include "esp_log.h"
+#include "host_test.h"
+#include "nvs.h"
+#include "step_codec.h"
+
+// Steps through the compact encoding and back, steps in the legacy layout
+// read and rewritten, and blobs that end early or hold garbage. Every blob is
+// decoded from a heap copy of exactly its size, so that reading past its end
+// shows up under the address sanitizer this is built with where there is one.
+
+#define STEPS_NS "dmxbox/steps"
+#define FORMAT_VERSION 1
+#define PADDING 0
+#define FLUSH_MS 5000
+
+static size_t step_size(size_t channel_count) {
+  return sizeof(dmxbox_effect_step_t) +
+         (channel_count - 1) * sizeof(dmxbox_channel_level_t);
+}
+
+static void reset_storage() {
+  CHECK(dmxbox_storage_flush(FLUSH_MS) == ESP_OK);
+  fake_nvs_reset();
+  blob_index_init();
+  blob_cache_clear();
+}
+
+static dmxbox_effect_step_t *new_step(size_t channel_count) {
+  dmxbox_effect_step_t *step = dmxbox_effect_step_alloc(channel_count);
+  CHECK(step);
+  step->time = 1000;
+  step->in = 250;
+  step->dwell = 4000;
+  step->out = 500;
+  return step;
+}
+
+static void set_channel(
+    dmxbox_effect_step_t *step,
+    size_t i,
+    uint16_t universe,
+    uint16_t index,
+    uint8_t level
+) {
+  step->channels[i].channel.universe.address = universe;
+  step->channels[i].channel.index = index;
+  step->channels[i].level = level;
+}
+
+static void expect_step(
+    const dmxbox_effect_step_t *read,
+    const dmxbox_effect_step_t *written
+) {
+  CHECK_MSG(
+      read->time == written->time && read->in == written->in &&
+          read->dwell == written->dwell && read->out == written->out,
+      "timings %u/%u/%u/%u, expected %u/%u/%u/%u",
+      read->time,
+      read->in,
+      read->dwell,
+      read->out,
+      written->time,
+      written->in,
+      written->dwell,
+      written->out
+  );
+  CHECK_MSG(
+      read->channel_count == written->channel_count,
+      "%zu channels, expected %zu",
+      read->channel_count,
+      written->channel_count
+  );
+  for (size_t i = 0; i < written->channel_count; i++) {
+    const dmxbox_channel_level_t *got = &read->channels[i];
+    const dmxbox_channel_level_t *expected = &written->channels[i];
+    CHECK_MSG(
+        got->channel.universe.address == expected->channel.universe.address &&
+            got->channel.index == expected->channel.index &&
+            got->level == expected->level,
+        "channel %zu is %u/%u at %u, expected %u/%u at %u",
+        i,
+        got->channel.universe.address,
+        got->channel.index,
+        got->level,
+        expected->channel.universe.address,
+        expected->channel.index,
+        expected->level
+    );
+  }
+}
+
+static esp_err_t
+decode_copy(const void *data, size_t size, dmxbox_effect_step_t **result) {
+  void *copy = malloc(size ? size : 1);
+  CHECK(copy);
+  memcpy(copy, data, size);
+  esp_err_t ret = step_codec_decode(copy, size, result);
+  free(copy);
+  return ret;
+}
+
+static void expect_round_trip(const dmxbox_effect_step_t *written) {
+  void *encoded;
+  size_t size;
+  CHECK(step_codec_encode(written, &encoded, &size) == ESP_OK);
+  CHECK_MSG(!step_codec_is_legacy(size), "encoded to a legacy size %zu", size);
+  CHECK(((uint8_t *)encoded)[0] == FORMAT_VERSION);
+
+  dmxbox_effect_step_t *read;
+  CHECK(decode_copy(encoded, size, &read) == ESP_OK);
+  expect_step(read, written);
+  free(read);
+  free(encoded);
+}
+
+static void contiguous_channels() {
+  dmxbox_effect_step_t *step = new_step(DMX_CHANNEL_COUNT);
+  for (size_t i = 0; i < DMX_CHANNEL_COUNT; i++) {
+    set_channel(step, i, 3, i, i * 7);
+  }
+  expect_round_trip(step);
+  free(step);
+}
+
+// gaps, steps back and the same index twice, in runs of one and more
+static void sparse_channels() {
+  static const uint16_t indexes[] = {
+      0, 1, 2, 40, 41, 500, 10, 11, 12, 12, 511, 65534, 65535, 0, 300,
+  };
+  size_t count = sizeof(indexes) / sizeof(indexes[0]);
+  dmxbox_effect_step_t *step = new_step(count);
+  for (size_t i = 0; i < count; i++) {
+    set_channel(step, i, 0, indexes[i], 255 - i);
+  }
+  expect_round_trip(step);
+  free(step);
+}
+
+// a universe coming back after another one starts a group of its own
+static void multi_universe_channels() {
+  dmxbox_effect_step_t *step = new_step(9);
+  set_channel(step, 0, 0, 0, 10);
+  set_channel(step, 1, 0, 1, 20);
+  set_channel(step, 2, 1, 0, 30);
+  set_channel(step, 3, 0x7fff, 511, 40);
+  set_channel(step, 4, 0x7fff, 510, 50);
+  set_channel(step, 5, 0, 2, 60);
+  set_channel(step, 6, 0x100, 7, 70);
+  set_channel(step, 7, 0x100, 8, 80);
+  set_channel(step, 8, 1, 1, 90);
+  expect_round_trip(step);
+  free(step);
+}
+
+static void no_channels_and_long_timings() {
+  dmxbox_effect_step_t *step = new_step(0);
+  expect_round_trip(step);
+  step->time = UINT32_MAX;
+  step->in = 0x80;
+  step->dwell = 0x4000;
+  step->out = 0x200000;
+  expect_round_trip(step);
+  free(step);
+}
+
+static void random_steps() {
+  uint32_t random = 17;
+  for (int round = 0; round < 500; round++) {
+    size_t count = test_random(&random) % 64;
+    dmxbox_effect_step_t *step = new_step(count);
+    step->time = test_random(&random) >> (test_random(&random) % 32);
+    step->in = test_random(&random) % 10000;
+    for (size_t i = 0; i < count; i++) {
+      // mostly runs, some jumps, a few universes
+      uint16_t index = i && test_random(&random) % 4
+                           ? step->channels[i - 1].channel.index + 1
+                           : test_random(&random);
+      uint16_t universe = test_random(&random) % 3;
+      set_channel(step, i, universe, index, test_random(&random));
+    }
+    expect_round_trip(step);
+    free(step);
+  }
+}
+
+// Steps of every size up to a few hundred channels, with timings of every
+// varint length, pass through all the sizes a legacy blob can have
+static void legacy_sizes_are_padded() {
+  int padded = 0;
+  for (size_t count = 0; count < 300; count++) {
+    for (uint32_t time = 1; time; time <<= 7) {
+      dmxbox_effect_step_t *step = new_step(count);
+      step->time = time;
+      // levels from 1, so that a 0 at the end is the padding
+      for (size_t i = 0; i < count; i++) {
+        set_channel(step, i, 0, i, 1 + i % 255);
+      }
+
+      void *encoded;
+      size_t size;
+      CHECK(step_codec_encode(step, &encoded, &size) == ESP_OK);
+      CHECK_MSG(
+          !step_codec_is_legacy(size),
+          "%zu channels encoded to a legacy size %zu",
+          count,
+          size
+      );
+      if (count && ((uint8_t *)encoded)[size - 1] == PADDING) {
+        CHECK(step_codec_is_legacy(size - 1));
+        padded++;
+      }
+
+      dmxbox_effect_step_t *read;
+      CHECK(decode_copy(encoded, size, &read) == ESP_OK);
+      expect_step(read, step);
+      free(read);
+      free(encoded);
+      free(step);
+    }
+  }
+  CHECK_MSG(padded, "no step came out at a legacy size");
+}
+
+// the plain copy of the struct older versions stored
+static void *legacy_blob(const dmxbox_effect_step_t *step, size_t *size) {
+  *size = step_size(step->channel_count);
+  void *blob = malloc(*size);
+  CHECK(blob);
+  memcpy(blob, step, *size);
+  return blob;
+}
+
+static void legacy_blobs_decode() {
+  for (size_t count = 0; count < 20; count++) {
+    dmxbox_effect_step_t *step = new_step(count);
+    for (size_t i = 0; i < count; i++) {
+      set_channel(step, i, count % 5, 100 + 3 * i, i);
+    }
+    size_t size;
+    void *blob = legacy_blob(step, &size);
+    CHECK(step_codec_is_legacy(size));
+
+    dmxbox_effect_step_t *read;
+    CHECK(decode_copy(blob, size, &read) == ESP_OK);
+    expect_step(read, step);
+    free(read);
+
+    // a channel count that doesn't match the size drops the channels
+    if (count) {
+      ((dmxbox_effect_step_t *)blob)->channel_count = count + 1;
+      CHECK(decode_copy(blob, size, &read) == ESP_OK);
+      CHECK(read->channel_count == 0);
+      free(read);
+    }
+    free(blob);
+    free(step);
+  }
+}
+
+static void step_key(uint16_t effect_id, uint16_t step_id, char *key) {
+  CHECK(
+      snprintf(key, NVS_KEY_NAME_MAX_SIZE, "%x:%x", effect_id, step_id) <
+      NVS_KEY_NAME_MAX_SIZE
+  );
+}
+
+// writes straight to NVS, like a box that ran an older version did
+static void
+put_raw(uint16_t effect_id, uint16_t step_id, const void *blob, size_t size) {
+  nvs_handle_t storage;
+  char key[NVS_KEY_NAME_MAX_SIZE];
+  step_key(effect_id, step_id, key);
+  CHECK(nvs_open(STEPS_NS, NVS_READWRITE, &storage) == ESP_OK);
+  CHECK(nvs_set_blob(storage, key, blob, size) == ESP_OK);
+  nvs_close(storage);
+}
+
+static uint8_t *get_raw(uint16_t effect_id, uint16_t step_id, size_t *size) {
+  CHECK(dmxbox_storage_flush(FLUSH_MS) == ESP_OK);
+  nvs_handle_t storage;
+  char key[NVS_KEY_NAME_MAX_SIZE];
+  step_key(effect_id, step_id, key);
+  CHECK(nvs_open(STEPS_NS, NVS_READONLY, &storage) == ESP_OK);
+  CHECK(nvs_get_blob(storage, key, NULL, size) == ESP_OK);
+  uint8_t *blob = malloc(*size);
+  CHECK(blob);
+  CHECK(nvs_get_blob(storage, key, blob, size) == ESP_OK);
+  nvs_close(storage);
+  return blob;
+}
+
+static void legacy_steps_are_migrated_once() {
+  reset_storage();
+  dmxbox_effect_step_t *written = new_step(12);
+  for (size_t i = 0; i < 12; i++) {
+    set_channel(written, i, i / 6, 20 + i, 200 - i);
+  }
+  size_t size;
+  void *blob = legacy_blob(written, &size);
+  put_raw(4, 2, blob, size);
+  free(blob);
+  blob_index_init();
+
+  dmxbox_effect_step_t *read;
+  CHECK(dmxbox_effect_step_get(4, 2, &read) == ESP_OK);
+  expect_step(read, written);
+  free(read);
+
+  uint8_t *rewritten = get_raw(4, 2, &size);
+  CHECK_MSG(
+      rewritten[0] == FORMAT_VERSION && !step_codec_is_legacy(size),
+      "step is %zu bytes, version %u",
+      size,
+      rewritten[0]
+  );
+  free(rewritten);
+
+  // the rewrite holds the same, and reading it writes nothing more
+  fake_nvs_stats_t before = fake_nvs_get_stats();
+  CHECK(dmxbox_effect_step_get(4, 2, &read) == ESP_OK);
+  expect_step(read, written);
+  free(read);
+  CHECK(dmxbox_storage_flush(FLUSH_MS) == ESP_OK);
+  CHECK(fake_nvs_get_stats().sets == before.sets);
+  free(written);
+}
+
+static void expect_rejected(const uint8_t *data, size_t size, esp_err_t err) {
+  CHECK(!step_codec_is_legacy(size));
+  dmxbox_effect_step_t *read = NULL;
+  esp_err_t ret = decode_copy(data, size, &read);
+  CHECK_MSG(
+      ret == err,
+      "%zu-byte step decoded with %s, expected %s",
+      size,
+      esp_err_to_name(ret),
+      esp_err_to_name(err)
+  );
+  free(read);
+}
+
+// every prefix of a valid step short of the whole of it, but the ones that
+// have a legacy size and so are another step
+static void truncated_steps_are_rejected() {
+  dmxbox_effect_step_t *step = new_step(6);
+  step->time = 1 << 20;
+  set_channel(step, 0, 0, 5, 1);
+  set_channel(step, 1, 0, 6, 2);
+  set_channel(step, 2, 0, 300, 3);
+  set_channel(step, 3, 0x7fff, 0, 4);
+  set_channel(step, 4, 0x7fff, 1, 5);
+  set_channel(step, 5, 2, 65535, 6);
+  void *encoded;
+  size_t size;
+  CHECK(step_codec_encode(step, &encoded, &size) == ESP_OK);
+  for (size_t length = 0; length < size; length++) {
+    if (!step_codec_is_legacy(length)) {
+      expect_rejected(
+          encoded,
+          length,
+          length ? ESP_ERR_INVALID_SIZE : ESP_ERR_INVALID_VERSION
+      );
+    }
+  }
+
+  // and anything after it
+  uint8_t *longer = malloc(size + 2);
+  CHECK(longer);
+  memcpy(longer, encoded, size);
+  longer[size] = 0x2a;
+  longer[size + 1] = 0x2a;
+  for (size_t length = size + 1; length <= size + 2; length++) {
+    if (!step_codec_is_legacy(length)) {
+      expect_rejected(longer, length, ESP_ERR_INVALID_SIZE);
+    }
+  }
+  free(longer);
+  free(encoded);
+  free(step);
+}
+
+static void corrupted_steps_are_rejected() {
+  // version, time, in, dwell, out, channel count, then the groups
+  static const uint8_t unknown_version[] = {2, 0, 0, 0, 0, 0};
+  expect_rejected(
+      unknown_version,
+      sizeof(unknown_version),
+      ESP_ERR_INVALID_VERSION
+  );
+  static const uint8_t long_varint[] = {1, 0x80, 0x80, 0x80, 0x80, 0x80, 0};
+  expect_rejected(long_varint, sizeof(long_varint), ESP_ERR_INVALID_SIZE);
+  static const uint8_t more_channels_than_bytes[] = {1, 0, 0, 0, 0, 9, 0, 1};
+  expect_rejected(
+      more_channels_than_bytes,
+      sizeof(more_channels_than_bytes),
+      ESP_ERR_INVALID_SIZE
+  );
+  static const uint8_t empty_group[] = {1, 0, 0, 0, 0, 1, 0, 0, 0, 1, 9};
+  expect_rejected(empty_group, sizeof(empty_group), ESP_ERR_INVALID_SIZE);
+  static const uint8_t group_past_count[] = {1, 0, 0, 0, 0, 1, 0, 2, 0, 1, 9};
+  expect_rejected(
+      group_past_count,
+      sizeof(group_past_count),
+      ESP_ERR_INVALID_SIZE
+  );
+  static const uint8_t universe_too_high[] = {
+      1, 0, 0, 0, 0, 1, 0x80, 0x80, 0x02, 1, 0, 1, 9,
+  };
+  expect_rejected(
+      universe_too_high,
+      sizeof(universe_too_high),
+      ESP_ERR_INVALID_SIZE
+  );
+  static const uint8_t empty_run[] = {1, 0, 0, 0, 0, 1, 0, 1, 0, 0, 9};
+  expect_rejected(empty_run, sizeof(empty_run), ESP_ERR_INVALID_SIZE);
+  // zigzag -1 from index 0
+  static const uint8_t negative_index[] = {1, 0, 0, 0, 0, 1, 0, 1, 1, 1, 9};
+  expect_rejected(negative_index, sizeof(negative_index), ESP_ERR_INVALID_SIZE);
+  // a run of two from 65535
+  static const uint8_t index_too_high[] = {
+      1, 0, 0, 0, 0, 2, 0, 2, 0xfe, 0xff, 0x07, 2, 9, 9,
+  };
+  expect_rejected(index_too_high, sizeof(index_too_high), ESP_ERR_INVALID_SIZE);
+}
+
+// whatever garbage decodes has to encode to the same step again
+static void garbage_never_overreads() {
+  uint32_t random = 23;
+  uint8_t data[64];
+  for (int round = 0; round < 100000; round++) {
+    size_t size = 1 + test_random(&random) % sizeof(data);
+    if (step_codec_is_legacy(size)) {
+      continue;
+    }
+    data[0] = FORMAT_VERSION;
+    for (size_t i = 1; i < size; i++) {
+      // small values, so that counts and lengths are often in range
+      data[i] = test_random(&random) % 4 ? test_random(&random) % 8
+                                          : test_random(&random);
+    }
+    dmxbox_effect_step_t *read;
+    esp_err_t ret = decode_copy(data, size, &read);
+    CHECK_MSG(
+        ret == ESP_OK || ret == ESP_ERR_INVALID_SIZE,
+        "garbage decoded with %s",
+        esp_err_to_name(ret)
+    );
+    if (ret == ESP_OK) {
+      expect_round_trip(read);
+      free(read);
+    }
+  }
+}
+
+int main() {
+  esp_log_level_set("*", ESP_LOG_NONE);
+  dmxbox_storage_init();
+  RUN(contiguous_channels);
+  RUN(sparse_channels);
+  RUN(multi_universe_channels);
+  RUN(no_channels_and_long_timings);
+  RUN(random_steps);
+  RUN(legacy_sizes_are_padded);
+  RUN(legacy_blobs_decode);
+  RUN(legacy_steps_are_migrated_once);
+  RUN(truncated_steps_are_rejected);
+  RUN(corrupted_steps_are_rejected);
+  RUN(garbage_never_overreads);
+  return 0;
+}
@@ -0,0 +1,473 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "blob_cache.h"
+#include "blob_index.h"
+#include "dmxbox_storage.h"
+#include "effect_step_storage.h"
+#include "effect_storage.h"
+#include "esp_log.h"
+#include "host_test.h"
+#include "nvs.h"
+#include "private.h"
+
+// Replays a recorded editing session (a device log, see
+// workloads/editing_session.log) through the storage component, at the pace
+// it was recorded and with NVS taking as long as flash does. Reports how many
+// of the queued writes made it to flash and how long the callers waited, and
+// checks that reads saw every write straight away, that ids never reached
+// flash ahead of their counter and that flash ends up with the last value of
+// everything.
+
+#define MAX_EFFECTS 16
+#define MAX_STEPS 16
+#define UNIVERSES 4
+#define STEP_CHANNELS 12
+#define MAX_CALLS 1024
+#define WAIT_EVERY 10 // step writes between checks of dmxbox_storage_wait
+
+static const char *trace_path;
+
+// what everything should read as, -1 when it doesn't exist
+typedef struct model {
+  int effect_steps[MAX_EFFECTS + 1];
+  int step_levels[MAX_EFFECTS + 1][MAX_STEPS + 1];
+  int snapshot_levels[UNIVERSES];
+  uint16_t native_universe;
+  uint16_t created; // effects
+} model_t;
+
+typedef struct replay_result {
+  int calls;
+  uint32_t queued;
+  fake_nvs_stats_t flash;
+  double call_us[MAX_CALLS];
+  double drain_us;
+} replay_result_t;
+
+static model_t model;
+static replay_result_t result;
+static int next_level;
+
+static void reset_model() {
+  memset(&model, 0xff, sizeof(model));
+  model.native_universe = 0;
+  model.created = 0;
+}
+
+static int take_level() { return next_level++ % 256; }
+
+static double start_call() { return test_time_us(); }
+
+static void end_call(double start) {
+  CHECK(result.calls < MAX_CALLS);
+  result.call_us[result.calls++] = test_time_us() - start;
+}
+
+static void expect_step(uint16_t effect_id, uint16_t step_id) {
+  dmxbox_effect_step_t *step = NULL;
+  int level = model.step_levels[effect_id][step_id];
+  esp_log_level_set("*", level < 0 ? ESP_LOG_NONE : ESP_LOG_ERROR);
+  esp_err_t ret = dmxbox_effect_step_get(effect_id, step_id, &step);
+  esp_log_level_set("*", ESP_LOG_ERROR);
+  if (level < 0) {
+    CHECK_MSG(
+        ret == ESP_ERR_NOT_FOUND,
+        "effect %u step %u should be gone, got 0x%x",
+        effect_id,
+        step_id,
+        ret
+    );
+    return;
+  }
+  CHECK_MSG(
+      ret == ESP_OK && step->channel_count == STEP_CHANNELS &&
+          step->channels[0].level == level,
+      "effect %u step %u should be at %d",
+      effect_id,
+      step_id,
+      level
+  );
+  free(step);
+}
+
+static void expect_effect(uint16_t effect_id) {
+  dmxbox_effect_t *effect = NULL;
+  int step_count = model.effect_steps[effect_id];
+  esp_log_level_set("*", step_count < 0 ? ESP_LOG_NONE : ESP_LOG_ERROR);
+  esp_err_t ret = dmxbox_effect_get(effect_id, &effect);
+  esp_log_level_set("*", ESP_LOG_ERROR);
+  if (step_count < 0) {
+    CHECK_MSG(ret == ESP_ERR_NOT_FOUND, "effect %u should be gone", effect_id);
+    return;
+  }
+  CHECK_MSG(
+      ret == ESP_OK && effect->step_count == step_count,
+      "effect %u should have %d steps",
+      effect_id,
+      step_count
+  );
+  free(effect);
+}
+
+static void expect_snapshot(uint16_t universe) {
+  uint8_t data[DMX_CHANNEL_COUNT];
+  int level = model.snapshot_levels[universe];
+  esp_log_level_set("*", level < 0 ? ESP_LOG_NONE : ESP_LOG_ERROR);
+  bool found = dmxbox_get_artnet_snapshot(universe, data);
+  esp_log_level_set("*", ESP_LOG_ERROR);
+  CHECK_MSG(
+      found == (level >= 0) && (!found || data[0] == level),
+      "universe %u snapshot should be at %d",
+      universe,
+      level
+  );
+}
+
+// A step that was waited for has to be on flash, as it reads now
+static void expect_step_on_flash(uint16_t effect_id, uint16_t step_id) {
+  size_t size;
+  void *queued;
+  CHECK(
+      dmxbox_storage_get_blob(
+          "dmxbox/steps",
+          effect_id,
+          step_id,
+          &size,
+          &queued
+      ) == ESP_OK
+  );
+
+  nvs_handle_t storage;
+  CHECK(nvs_open("dmxbox/steps", NVS_READONLY, &storage) == ESP_OK);
+  char key[NVS_KEY_NAME_MAX_SIZE];
+  snprintf(key, sizeof(key), "%x:%x", effect_id, step_id);
+  uint8_t flash[256];
+  size_t flash_size = sizeof(flash);
+  CHECK_MSG(
+      nvs_get_blob(storage, key, flash, &flash_size) == ESP_OK &&
+          flash_size == size && !memcmp(flash, queued, size),
+      "step %s isn't on flash after waiting for it",
+      key
+  );
+  nvs_close(storage);
+  free(queued);
+}
+
+static void put_effect(uint16_t effect_id, bool create) {
+  int step_count = 0;
+  for (int step_id = 1; step_id <= MAX_STEPS; step_id++) {
+    if (model.step_levels[effect_id][step_id] >= 0) {
+      step_count = step_id;
+    }
+  }
+  dmxbox_effect_t *effect = dmxbox_effect_alloc(step_count);
+  CHECK(effect);
+  snprintf(effect->name, sizeof(effect->name), "effect %u", effect_id);
+  for (int i = 0; i < step_count; i++) {
+    effect->steps[i] = i + 1;
+  }
+
+  double start = start_call();
+  if (create) {
+    uint16_t id;
+    CHECK(dmxbox_effect_create(effect, &id) == ESP_OK);
+    CHECK_MSG(id == effect_id, "created effect %u, expected %u", id, effect_id);
+  } else {
+    CHECK(dmxbox_effect_set(effect_id, effect) == ESP_OK);
+  }
+  end_call(start);
+  free(effect);
+
+  model.effect_steps[effect_id] = step_count;
+  expect_effect(effect_id);
+}
+
+static void put_step(uint16_t effect_id, uint16_t step_id) {
+  dmxbox_effect_step_t *step = dmxbox_effect_step_alloc(STEP_CHANNELS);
+  CHECK(step);
+  int level = take_level();
+  step->time = 1000;
+  step->in = 200;
+  step->dwell = 600;
+  step->out = 200;
+  for (int i = 0; i < STEP_CHANNELS; i++) {
+    step->channels[i] = (dmxbox_channel_level_t){
+        .channel = {.universe = {.address = 0}, .index = effect_id * 16 + i},
+        .level = level,
+    };
+  }
+  CHECK(dmxbox_effect_step_set(effect_id, step_id, step) == ESP_OK);
+  free(step);
+  model.step_levels[effect_id][step_id] = level;
+}
+
+static void put_steps(uint16_t effect_id, unsigned count) {
+  double start = start_call();
+  dmxbox_storage_begin();
+  for (uint16_t step_id = 1; step_id <= count; step_id++) {
+    put_step(effect_id, step_id);
+  }
+  CHECK(dmxbox_storage_commit() == ESP_OK);
+  end_call(start);
+  for (uint16_t step_id = 1; step_id <= count; step_id++) {
+    expect_step(effect_id, step_id);
+  }
+}
+
+static void put_one_step(uint16_t effect_id, uint16_t step_id) {
+  static int step_writes;
+  double start = start_call();
+  put_step(effect_id, step_id);
+  end_call(start);
+  expect_step(effect_id, step_id);
+
+  if (++step_writes % WAIT_EVERY == 0) {
+    dmxbox_storage_mark_t mark = dmxbox_storage_mark();
+    CHECK(dmxbox_storage_wait(mark, 2000) == ESP_OK);
+    expect_step_on_flash(effect_id, step_id);
+  }
+}
+
+static void delete_step(uint16_t effect_id, uint16_t step_id) {
+  double start = start_call();
+  CHECK(dmxbox_effect_step_delete(effect_id, step_id) == ESP_OK);
+  end_call(start);
+  model.step_levels[effect_id][step_id] = -1;
+  expect_step(effect_id, step_id);
+}
+
+static void delete_effect(uint16_t effect_id) {
+  double start = start_call();
+  CHECK(dmxbox_effect_delete(effect_id) == ESP_OK);
+  end_call(start);
+  model.effect_steps[effect_id] = -1;
+  expect_effect(effect_id);
+}
+
+static void store_snapshot(uint16_t universe) {
+  uint8_t data[DMX_CHANNEL_COUNT];
+  int level = take_level();
+  memset(data, level, sizeof(data));
+  double start = start_call();
+  dmxbox_set_artnet_snapshot(universe, data);
+  end_call(start);
+  model.snapshot_levels[universe] = level;
+  expect_snapshot(universe);
+}
+
+static void put_artnet_settings() {
+  uint16_t universe = model.native_universe + 1;
+  double start = start_call();
+  dmxbox_set_native_universe(universe);
+  dmxbox_set_effect_control_universe(universe + 1);
+  dmxbox_set_cue_go_channel(1);
+  dmxbox_set_cue_back_channel(2);
+  dmxbox_set_tempo_tap_channel(3);
+  end_call(start);
+  model.native_universe = universe;
+  CHECK(dmxbox_get_native_universe() == universe);
+}
+
+static bool matches(const char *message, const char *format, unsigned *a) {
+  int end = -1;
+  return sscanf(message, format, a, &end) == 1 && end >= 0 && !message[end];
+}
+
+static bool
+matches2(const char *message, const char *format, unsigned *a, unsigned *b) {
+  int end = -1;
+  return sscanf(message, format, a, b, &end) == 2 && end >= 0 &&
+         !message[end];
+}
+
+// turns a log line back into the storage calls that logged it
+static void replay_line(const char *tag, const char *message) {
+  static unsigned batch_effect;
+  unsigned a;
+  unsigned b;
+
+  if (!strcmp(tag, "dmxbox_api_effect")) {
+    if (!strcmp(message, "POST effect")) {
+      put_effect(++model.created, true);
+    } else if (matches(message, "PUT effect=%u%n", &a)) {
+      put_effect(a, false);
+    } else if (matches(message, "DELETE effect=%u%n", &a)) {
+      delete_effect(a);
+    }
+  } else if (!strcmp(tag, "dmxbox_api_effect_step")) {
+    if (matches2(message, "PUT effect=%u step=%u%n", &a, &b)) {
+      put_one_step(a, b);
+    } else if (matches(message, "PUT effect=%u steps%n", &a)) {
+      batch_effect = a;
+    } else if (matches(message, "got %u steps%n", &a)) {
+      put_steps(batch_effect, a);
+    } else if (matches2(message, "DELETE effect=%u step=%u%n", &a, &b)) {
+      delete_step(a, b);
+    }
+  } else if (!strcmp(tag, "artnet")) {
+    if (matches(message, "Stored universe %u snapshot%n", &a)) {
+      store_snapshot(a);
+    }
+  } else if (!strcmp(tag, "dmxbox_api_settings_artnet")) {
+    if (!strcmp(message, "PUT request for /api/settings/artnet")) {
+      put_artnet_settings();
+    }
+  }
+}
+
+// The effect counter keeps its place in the queue, so by the time an effect
+// reaches flash the counter there is past its id
+static void check_counter_first(const char *ns, const char *key) {
+  unsigned id;
+  int end = -1;
+  if (strcmp(ns, "dmxbox/effect") || sscanf(key, "%x%n", &id, &end) != 1 ||
+      key[end]) {
+    return;
+  }
+  nvs_handle_t storage;
+  uint16_t next_id = 0;
+  CHECK(nvs_open(ns, NVS_READONLY, &storage) == ESP_OK);
+  CHECK_MSG(
+      nvs_get_u16(storage, "next_id", &next_id) == ESP_OK && next_id > id,
+      "effect %u reached flash before next_id (%u)",
+      id,
+      next_id
+  );
+  nvs_close(storage);
+}
+
+typedef struct flash_timing {
+  uint32_t write_us;
+  uint32_t commit_us;
+  uint32_t page_erase_us;
+} flash_timing_t;
+
+static void replay(const flash_timing_t *flash) {
+  CHECK(dmxbox_storage_flush(5000) == ESP_OK);
+  fake_nvs_reset();
+  blob_index_init();
+  blob_cache_clear();
+  reset_model();
+  memset(&result, 0, sizeof(result));
+  fake_nvs_set_latency(flash->write_us, flash->commit_us, flash->page_erase_us);
+  fake_nvs_set_observer(check_counter_first);
+
+  FILE *trace = fopen(trace_path, "r");
+  CHECK_MSG(trace, "can't open %s", trace_path);
+  dmxbox_storage_mark_t first = dmxbox_storage_mark();
+  double replay_start = test_time_us();
+  unsigned first_ms = 0;
+  bool started = false;
+  char line[256];
+  while (fgets(line, sizeof(line), trace)) {
+    char level;
+    unsigned ms;
+    char tag[32];
+    char message[128];
+    if (sscanf(line, "%c (%u) %31[^:]: %127[^\n]", &level, &ms, tag, message) !=
+        4) {
+      continue;
+    }
+    if (!started) {
+      first_ms = ms;
+      started = true;
+    }
+    double due_us = replay_start + (ms - first_ms) * 1000.0;
+    double now_us = test_time_us();
+    if (due_us > now_us) {
+      usleep((useconds_t)(due_us - now_us));
+    }
+    replay_line(tag, message);
+  }
+  fclose(trace);
+  result.queued = dmxbox_storage_mark() - first;
+
+  double drain_start = test_time_us();
+  CHECK(dmxbox_storage_flush(5000) == ESP_OK);
+  result.drain_us = test_time_us() - drain_start;
+  result.flash = fake_nvs_get_stats();
+  fake_nvs_set_observer(NULL);
+
+  // forget everything that isn't on flash, then read it all back
+  blob_cache_clear();
+  blob_index_init();
+  for (uint16_t effect_id = 1; effect_id <= MAX_EFFECTS; effect_id++) {
+    expect_effect(effect_id);
+    for (uint16_t step_id = 1; step_id <= MAX_STEPS; step_id++) {
+      expect_step(effect_id, step_id);
+    }
+  }
+  for (uint16_t universe = 0; universe < UNIVERSES; universe++) {
+    expect_snapshot(universe);
+  }
+  nvs_handle_t storage;
+  CHECK(nvs_open("storage", NVS_READONLY, &storage) == ESP_OK);
+  CHECK(dmxbox_storage_get_u16(storage, "native_uni") == model.native_universe);
+  nvs_close(storage);
+}
+
+static int compare_double(const void *a, const void *b) {
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+static void report(const flash_timing_t *flash) {
+  double total_us = 0;
+  for (int i = 0; i < result.calls; i++) {
+    total_us += result.call_us[i];
+  }
+  qsort(result.call_us, result.calls, sizeof(double), compare_double);
+  uint32_t flash_writes = result.flash.sets + result.flash.erases;
+  printf(
+      "  flash %4u us a write, %4u us a commit, %6u us a page erase:\n"
+      "    %d calls queued %u writes, %u reached flash (%.0f%% coalesced) in "
+      "%u commits, %llu bytes\n",
+      flash->write_us,
+      flash->commit_us,
+      flash->page_erase_us,
+      result.calls,
+      result.queued,
+      flash_writes,
+      100.0 * (result.queued - flash_writes) / result.queued,
+      result.flash.commits,
+      (unsigned long long)result.flash.bytes_written
+  );
+  printf(
+      "    callers waited %.0f us on average, p99 %.0f us, max %.0f us; "
+      "draining the rest took %.0f us\n",
+      total_us / result.calls,
+      result.call_us[result.calls * 99 / 100],
+      result.call_us[result.calls - 1],
+      result.drain_us
+  );
+}
+
+// From a fast chip to a worn one, where NVS page erases take long enough for
+// the fader drags to pile up behind the writer
+static void replay_editing_session() {
+  flash_timing_t timings[] = {
+      {.write_us = 200, .commit_us = 100, .page_erase_us = 20000},
+      {.write_us = 1500, .commit_us = 1000, .page_erase_us = 50000},
+      {.write_us = 5000, .commit_us = 3000, .page_erase_us = 300000},
+  };
+  for (size_t i = 0; i < sizeof(timings) / sizeof(timings[0]); i++) {
+    replay(&timings[i]);
+    report(&timings[i]);
+    CHECK(result.flash.sets + result.flash.erases <= result.queued);
+  }
+  CHECK(result.flash.sets + result.flash.erases < result.queued * 3 / 4);
+}
+
+int main(int argc, char **argv) {
+  CHECK_MSG(argc == 2, "usage: %s <trace>", argv[0]);
+  trace_path = argv[1];
+  dmxbox_storage_init();
+  RUN(replay_editing_session);
+  return 0;
+}
@@ -0,0 +1,233 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "dmxbox_artnet.h"
+#include "dmxbox_espnow.h"
+#include "dmxbox_storage.h"
+#include "dmxbox_tempo.h"
+#include "esp_timer.h"
+#include "host_test.h"
+
+// The tempo clock through taps and tempos received from other boxes. Its
+// position must never jump or run backwards, taps have to end up on the
+// beat, and a received position has to be the sender's at the time it was
+// sent on the shared clock, not whenever the packet turned up.
+
+#define SLEW_RATE 0.25 // as in dmxbox_tempo.c
+#define SAMPLE_US 1000
+#define EPSILON 1e-6
+
+// Stand-ins for the other boxes and the settings
+
+static dmxbox_espnow_tempo_callback_t received;
+static bool synced;
+static int64_t shared_offset_us; // shared minus local
+static int sent_count;
+static double sent_bpm;
+static double sent_beats;
+static int64_t sent_time_us;
+
+void dmxbox_espnow_register_tempo_callback(dmxbox_espnow_tempo_callback_t cb
+) {
+  received = cb;
+}
+
+void dmxbox_espnow_send_tempo(double bpm, double beats, int64_t time_us) {
+  sent_count++;
+  sent_bpm = bpm;
+  sent_beats = beats;
+  sent_time_us = time_us;
+}
+
+bool dmxbox_espnow_time_synced() { return synced; }
+
+int64_t dmxbox_espnow_to_local_time(int64_t shared_us) {
+  return shared_us - shared_offset_us;
+}
+
+uint16_t dmxbox_get_tempo_tap_channel() { return 0; }
+uint16_t dmxbox_get_effect_control_universe() { return 0; }
+
+esp_err_t dmxbox_artnet_subscribe(
+    uint16_t address,
+    const uint16_t *channels,
+    size_t count,
+    dmxbox_artnet_subscription_t **subscription
+) {
+  return ESP_ERR_NOT_SUPPORTED;
+}
+
+bool dmxbox_artnet_subscription_poll(
+    dmxbox_artnet_subscription_t *subscription,
+    uint8_t *values
+) {
+  return false;
+}
+
+static double beats_per_us(double bpm) { return bpm / 60e6; }
+
+// Samples the position from start_us to end_us and checks it only ever
+// moves forwards, at the tempo give or take the slew
+static void expect_smooth(int64_t start_us, int64_t end_us, double bpm) {
+  double min_step = beats_per_us(bpm) * (1 - SLEW_RATE) * SAMPLE_US;
+  double max_step = beats_per_us(bpm) * (1 + SLEW_RATE) * SAMPLE_US;
+  double last = dmxbox_tempo_get_beats(start_us);
+  for (int64_t time_us = start_us + SAMPLE_US; time_us <= end_us;
+       time_us += SAMPLE_US) {
+    double beats = dmxbox_tempo_get_beats(time_us);
+    double step = beats - last;
+    CHECK_MSG(
+        step > min_step - EPSILON && step < max_step + EPSILON,
+        "moved %f beats in %d us at %.1f bpm",
+        step,
+        SAMPLE_US,
+        bpm
+    );
+    last = beats;
+  }
+}
+
+static double distance_to_beat(double beats) {
+  return fabs(beats - round(beats));
+}
+
+// Taps are in the past, so that the position has settled by the time the
+// leader shares it
+static void single_tap_changes_nothing() {
+  int64_t start_us = esp_timer_get_time() - 30000000;
+  dmxbox_tempo_state_t before;
+  dmxbox_tempo_get_state(start_us, &before);
+
+  // a third of the way between beats, so a snap would show
+  int64_t tap_us = start_us + 60e6 / before.bpm * (1.0 / 3);
+  dmxbox_tempo_tap(tap_us);
+
+  dmxbox_tempo_state_t after;
+  dmxbox_tempo_get_state(start_us, &after);
+  CHECK(!after.leader && after.bpm == before.bpm);
+  CHECK(fabs(after.beats - before.beats) < EPSILON);
+  expect_smooth(start_us, tap_us + 2000000, before.bpm);
+
+  dmxbox_tempo_update();
+  CHECK(sent_count == 0);
+}
+
+// Tapping 150 bpm off the beat of the default 120. No tap moves the position
+// at the time of the tap, and once the slew is done the taps' times fall on
+// beats.
+static void taps_slew_onto_the_beat() {
+  int64_t period_us = 400000;
+  int64_t start_us = esp_timer_get_time() - 10000000;
+  double beats = dmxbox_tempo_get_beats(start_us);
+  start_us += (ceil(beats) + 0.4 - beats) / beats_per_us(120);
+
+  int64_t tap_us = start_us;
+  for (int tap = 0; tap < 4; tap++) {
+    tap_us = start_us + tap * period_us;
+    dmxbox_tempo_state_t before;
+    dmxbox_tempo_get_state(tap_us, &before);
+    expect_smooth(tap_us - period_us, tap_us, before.bpm);
+    dmxbox_tempo_tap(tap_us);
+    CHECK_MSG(
+        fabs(dmxbox_tempo_get_beats(tap_us) - before.beats) < EPSILON,
+        "tap %d jumped from %f to %f beats",
+        tap,
+        before.beats,
+        dmxbox_tempo_get_beats(tap_us)
+    );
+  }
+
+  dmxbox_tempo_state_t state;
+  dmxbox_tempo_get_state(tap_us, &state);
+  CHECK(state.leader);
+  CHECK_MSG(fabs(state.bpm - 150) < EPSILON, "%f bpm", state.bpm);
+  expect_smooth(tap_us, tap_us + 4000000, 150);
+
+  // half a beat at a quarter of the tempo is done within 2 beats
+  double error = 0;
+  for (int beat = 2; beat < 10; beat++) {
+    error = fmax(
+        error,
+        distance_to_beat(dmxbox_tempo_get_beats(tap_us + beat * period_us))
+    );
+  }
+  CHECK_MSG(error < EPSILON, "%f beats off the taps", error);
+
+  dmxbox_tempo_update();
+  CHECK(sent_count == 1 && fabs(sent_bpm - 150) < EPSILON);
+  CHECK(fabs(sent_beats - dmxbox_tempo_get_beats(sent_time_us)) < EPSILON);
+}
+
+static double received_beats(
+    double bpm,
+    double beats,
+    int64_t sent_us,
+    int64_t time_us
+) {
+  return beats + (time_us - sent_us) * beats_per_us(bpm);
+}
+
+// The packet spent 28 ms in queues and on the air, 0.06 beats at 128 bpm,
+// which the sender's shared time accounts for
+static void received_tempo_counts_from_the_send() {
+  synced = true;
+  shared_offset_us = 5000000000;
+  int64_t now_us = esp_timer_get_time();
+  int64_t sent_us = now_us - 30000;
+  received(128, 1000.25, sent_us + shared_offset_us, now_us - 2000);
+
+  dmxbox_tempo_state_t state;
+  int64_t later_us = now_us + 1000000;
+  dmxbox_tempo_get_state(later_us, &state);
+  CHECK(!state.leader && state.bpm == 128);
+  double expected = received_beats(128, 1000.25, sent_us, later_us);
+  CHECK_MSG(
+      fabs(state.beats - expected) < EPSILON,
+      "%f beats, expected %f",
+      state.beats,
+      expected
+  );
+
+  // without a shared clock the arrival is the best there is
+  synced = false;
+  now_us = esp_timer_get_time();
+  received(128, 2000, 12345, now_us - 2000);
+  expected = received_beats(128, 2000, now_us - 2000, later_us);
+  CHECK(fabs(dmxbox_tempo_get_beats(later_us) - expected) < EPSILON);
+
+  dmxbox_tempo_update();
+  CHECK(sent_count == 1);
+}
+
+// A leader that's a little ahead, like after its own taps or a better time
+// sync, is caught up with smoothly
+static void small_corrections_are_slewed() {
+  int64_t now_us = esp_timer_get_time();
+  double beats = dmxbox_tempo_get_beats(now_us);
+  received(128, beats + 0.1, 0, now_us);
+
+  int64_t after_us = esp_timer_get_time();
+  double expected = received_beats(128, beats, now_us, after_us);
+  CHECK_MSG(
+      fabs(dmxbox_tempo_get_beats(after_us) - expected) < 0.01,
+      "jumped %f beats",
+      dmxbox_tempo_get_beats(after_us) - expected
+  );
+  expect_smooth(after_us, after_us + 2000000, 128);
+
+  int64_t later_us = after_us + 2000000;
+  expected = received_beats(128, beats + 0.1, now_us, later_us);
+  CHECK(fabs(dmxbox_tempo_get_beats(later_us) - expected) < EPSILON);
+}
+
+int main() {
+  dmxbox_tempo_init();
+  CHECK(received);
+  RUN(single_tap_changes_nothing);
+  RUN(taps_slew_onto_the_beat);
+  RUN(received_tempo_counts_from_the_send);
+  RUN(small_corrections_are_slewed);
+  return 0;
+}
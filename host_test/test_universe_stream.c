@@ -0,0 +1,135 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "dmxbox_const.h"
+#include "dmxbox_espnow.h"
+#include "esp_timer.h"
+#include "host_test.h"
+#include "packets.h"
+#include "universe_stream.h"
+
+// The receiving end of the streamed universe, fed packets the way a DMX-in
+// box sends them. Late packets must not be applied over newer ones, but a
+// sender that rebooted starts its sequence and keyframe ids over, and has to
+// be followed again as soon as it sends a whole keyframe.
+
+#define STREAM_TIMEOUT_US 1000000 // as in universe_stream.c
+
+void send_packet(packet_type_t type, void *data, size_t length) {}
+
+static const uint8_t source[ESP_NOW_ETH_ALEN] = {2, 0, 0, 0, 0, 1};
+
+static struct {
+  universe_packet_t header;
+  uint8_t data[UNIVERSE_PACKET_DATA_SIZE];
+} __attribute__((packed)) packet;
+
+// the stream's clock, the receiver's and get_streamed_universe's
+static int64_t now_us;
+
+static void receive(size_t data_size) {
+  now_us += 1000;
+  universe_stream_handle_packet(
+      &packet.header,
+      sizeof(universe_packet_t) + data_size,
+      source,
+      now_us
+  );
+}
+
+static size_t chunk_size(uint8_t chunk) {
+  size_t start = chunk * UNIVERSE_CHUNK_SIZE;
+  return DMX_CHANNEL_COUNT - start < UNIVERSE_CHUNK_SIZE
+             ? DMX_CHANNEL_COUNT - start
+             : UNIVERSE_CHUNK_SIZE;
+}
+
+// a whole keyframe of level, one chunk per packet from sequence on; returns
+// the next sequence
+static uint16_t
+send_keyframe(uint16_t sequence, uint16_t keyframe, uint8_t level) {
+  for (uint8_t chunk = 0; chunk < UNIVERSE_CHUNK_COUNT; chunk++) {
+    packet.header.sequence = sequence++;
+    packet.header.keyframe = keyframe;
+    packet.header.kind = UNIVERSE_PACKET_KEYFRAME;
+    universe_chunk_t *header = (universe_chunk_t *)packet.data;
+    header->chunk = chunk;
+    memset(header->values, level, chunk_size(chunk));
+    receive(sizeof(universe_chunk_t) + chunk_size(chunk));
+  }
+  return sequence;
+}
+
+// the first slot at level, against the keyframe
+static void send_delta(uint16_t sequence, uint16_t keyframe, uint8_t level) {
+  packet.header.sequence = sequence;
+  packet.header.keyframe = keyframe;
+  packet.header.kind = UNIVERSE_PACKET_DELTA;
+  universe_run_t run = {.start = 0, .length = 1};
+  memcpy(packet.data, &run, sizeof(run));
+  packet.data[sizeof(run)] = level;
+  receive(sizeof(run) + 1);
+}
+
+// the first slot and the rest of the universe
+static void expect_universe(uint8_t first, uint8_t rest) {
+  uint8_t data[DMX_CHANNEL_COUNT];
+  CHECK(dmxbox_espnow_get_streamed_universe(data));
+  CHECK_MSG(
+      data[0] == first && data[DMX_CHANNEL_COUNT - 1] == rest,
+      "streamed %u ... %u, expected %u ... %u",
+      data[0],
+      data[DMX_CHANNEL_COUNT - 1],
+      first,
+      rest
+  );
+}
+
+static void late_packets_are_dropped() {
+  uint16_t sequence = send_keyframe(100, 7, 10);
+  expect_universe(10, 10);
+  send_delta(sequence + 1, 7, 50);
+  expect_universe(50, 10);
+
+  // overtaken by the one after it
+  send_delta(sequence, 7, 40);
+  expect_universe(50, 10);
+}
+
+// A warm reset is back well within the stream timeout, with the sequence
+// back at the start and the keyframe id it used before
+static void restart_is_followed() {
+  uint16_t sequence = send_keyframe(5000, 1, 20);
+  send_delta(sequence, 1, 60);
+  expect_universe(60, 20);
+
+  // deltas against a keyframe id of before the restart aren't applied to
+  // the old keyframe
+  send_delta(1, 1, 90);
+  expect_universe(60, 20);
+
+  sequence = send_keyframe(2, 1, 30);
+  expect_universe(30, 30);
+  send_delta(sequence, 1, 70);
+  expect_universe(70, 30);
+}
+
+// After a silence even a small step back is a new stream
+static void silence_resyncs() {
+  uint16_t sequence = send_keyframe(300, 4, 15);
+  expect_universe(15, 15);
+
+  now_us += STREAM_TIMEOUT_US;
+  send_keyframe(sequence - 10, 2, 25);
+  expect_universe(25, 25);
+}
+
+int main() {
+  now_us = esp_timer_get_time();
+  RUN(late_packets_are_dropped);
+  RUN(restart_is_followed);
+  RUN(silence_resyncs);
+  return 0;
+}
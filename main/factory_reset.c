@@ -4,6 +4,7 @@
 #include <freertos/task.h>
 
 #include "dmxbox_const.h"
+#include "dmxbox_dmx_rtc.h"
 #include "dmxbox_led.h"
 #include "dmxbox_storage.h"
 
@@ -37,6 +38,8 @@ bool blink_and_wait(int blink_interval, int wait_time) {
 
 void perform_factory_reset() {
   dmxbox_storage_factory_reset();
+  // the restart is a software reset, which would resume the old output
+  dmxbox_dmx_rtc_clear();
   ESP_LOGI(TAG, "performing factory reset");
   esp_restart();
 }
@@ -7,6 +7,8 @@
 #include <string.h>
 
 #include "dmxbox_artnet.h"
+#include "dmxbox_boot.h"
+#include "dmxbox_cues.h"
 #include "dmxbox_dmx_receive.h"
 #include "dmxbox_dmx_send.h"
 #include "dmxbox_dns.h"
@@ -16,6 +18,8 @@
 #include "dmxbox_led.h"
 #include "dmxbox_recalc.h"
 #include "dmxbox_storage.h"
+#include "dmxbox_tempo.h"
+#include "dmxbox_timecode.h"
 #include "factory_reset.h"
 #include "sdkconfig.h"
 #include "webserver.h"
@@ -57,41 +61,103 @@ esp_err_t init_fs() {
   return ESP_OK;
 }
 
-void app_main() {
-  ESP_LOGI(TAG, "App starting...");
-
-  dmxbox_led_start();
+static void start_dmx_send() {
+  // a warm reset carries on with the last frame, otherwise output is dark
+  // until the recalc task starts
+  if (!dmxbox_dmx_send_resume()) {
+    dmxbox_dmx_send_start();
+  }
+}
 
+static void check_factory_reset() {
   dmxbox_handle_factory_reset();
-
   ESP_ERROR_CHECK(dmxbox_led_set(dmxbox_led_power, 1));
+}
 
-  dmxbox_storage_init();
-  dmxbox_wifi_start();
-
+static void apply_first_run_defaults() {
   if (!dmxbox_get_first_run_completed()) {
     wifi_set_defaults();
     dmxbox_storage_set_defaults();
     dmxbox_set_first_run_completed(1);
   }
+}
 
-  dmxbox_artnet_init();
-
-  dmxbox_effects_init();
+static void mount_fs() { ESP_ERROR_CHECK(init_fs()); }
 
-  dmxbox_espnow_init();
+static void start_webserver() { ESP_ERROR_CHECK(dmxbox_webserver_start()); }
 
-  ESP_ERROR_CHECK(init_fs());
-  ESP_ERROR_CHECK(dmxbox_webserver_start());
-  dmxbox_start_dns_server();
+static void start_dmx_receive() {
+  xTaskCreate(dmxbox_dmx_receive_task, "DMX receive", 10000, NULL, 2, NULL);
+}
 
+static void start_tasks() {
   xTaskCreate(dmxbox_artnet_receive_task, "ArtNet", 10000, NULL, 2, NULL);
 
-  xTaskCreate(dmxbox_dmx_receive_task, "DMX receive", 10000, NULL, 2, NULL);
-
   xTaskCreate(dmxbox_effects_task, "Effect runner", 10000, NULL, 3, NULL);
 
   xTaskCreate(dmxbox_recalc_task, "Recalc", 10000, NULL, 4, NULL);
+}
+
+typedef enum boot_stage {
+  boot_dmx_send,
+  boot_fs,
+  boot_led,
+  boot_factory_reset,
+  boot_storage,
+  boot_wifi,
+  boot_first_run,
+  boot_dmx_receive,
+  boot_artnet,
+  boot_tempo,
+  boot_timecode,
+  boot_effects,
+  boot_cues,
+  boot_espnow,
+  boot_webserver,
+  boot_dns,
+  boot_tasks,
+  boot_stage_count,
+} boot_stage_t;
+
+#define AFTER(stage) DMXBOX_BOOT_STAGE(boot_##stage)
+
+static const dmxbox_boot_stage_t boot_stages[boot_stage_count] = {
+    [boot_dmx_send] = {"DMX send", start_dmx_send},
+    [boot_fs] = {"SPIFFS", mount_fs, .background = true},
+    [boot_led] = {"LED", dmxbox_led_start},
+    // holds the boot for as long as the button is pressed
+    [boot_factory_reset] = {"factory reset", check_factory_reset, AFTER(led)},
+    [boot_storage] = {"storage", dmxbox_storage_init, AFTER(factory_reset)},
+    [boot_wifi] = {"Wi-Fi", dmxbox_wifi_start, AFTER(storage)},
+    [boot_first_run] = {"defaults", apply_first_run_defaults, AFTER(wifi)},
+    [boot_dmx_receive] =
+        {"DMX receive", start_dmx_receive, AFTER(factory_reset)},
+    [boot_artnet] = {"Art-Net", dmxbox_artnet_init, AFTER(first_run)},
+    [boot_tempo] = {"tempo", dmxbox_tempo_init, AFTER(artnet)},
+    [boot_timecode] = {"timecode", dmxbox_timecode_init, AFTER(artnet)},
+    // loads the whole show
+    [boot_effects] =
+        {"effects",
+         dmxbox_effects_init,
+         AFTER(tempo) | AFTER(timecode),
+         .background = true},
+    // after the effects, whose button handler goes first
+    [boot_cues] =
+        {"cues", dmxbox_cues_init, AFTER(effects), .background = true},
+    [boot_espnow] = {"ESP-NOW", dmxbox_espnow_init, AFTER(tempo)},
+    // the API only queues cue requests, so it doesn't wait for the show
+    [boot_webserver] =
+        {"httpd",
+         start_webserver,
+         AFTER(fs) | AFTER(timecode) | AFTER(espnow),
+         .background = true},
+    [boot_dns] = {"DNS", dmxbox_start_dns_server, AFTER(first_run)},
+    // button handlers have to be added before the Art-Net task starts
+    [boot_tasks] =
+        {"tasks", start_tasks, AFTER(cues) | AFTER(espnow) | AFTER(artnet)},
+};
 
-  xTaskCreate(dmxbox_dmx_send_task, "DMX send", 10000, NULL, 5, NULL);
+void app_main() {
+  ESP_LOGI(TAG, "App starting...");
+  dmxbox_boot_run(boot_stages, boot_stage_count);
 }